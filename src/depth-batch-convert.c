@@ -0,0 +1,451 @@
+/* GFreenect Utils : depth-batch-convert.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "depth-file.h"
+#include "depth-image.h"
+#include "depth-points.h"
+#include "depth-colormap.h"
+#include "point-cloud.h"
+#include "worker-pool.h"
+
+/* Converts depth files to PGM images, or PPM images when points are
+   drawn on them, or to point clouds, without needing a display. Files
+   are converted in parallel by a pool with a thread per core */
+
+#define PROGRESS_INTERVAL G_USEC_PER_SEC
+
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  guint files_done;
+  guint files_failed;
+  guint64 frames;
+  guint64 bytes;
+} Progress;
+
+static gchar *output_dir = NULL;
+static gint n_jobs = 0;
+static gchar **point_strs = NULL;
+static gchar *points_file = NULL;
+static gchar *format_str = NULL;
+static gchar *intrinsics_str = NULL;
+
+static DepthPoints *points = NULL;
+static guint n_points = 0;
+static DepthColormap *colormap = NULL;
+static gboolean write_cloud = FALSE;
+static PointCloudFormat cloud_format;
+static PointCloudIntrinsics intrinsics;
+
+static GOptionEntry entries[] =
+{
+  { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir,
+    "Write images to DIR instead of next to each depth file", "DIR" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs,
+    "Number of files converted at once, one per core by default", "N" },
+  { "point", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &point_strs,
+    "Highlight a point, given in full resolution coordinates, in every "
+    "frame or only in the frame at FRAME", "[FRAME,]#RRGGBB,X,Y" },
+  { "points", 0, 0, G_OPTION_ARG_FILENAME, &points_file,
+    "Highlight the points in FILE, with a point per line like --point or "
+    "in the binary points format", "FILE" },
+  { "format", 'f', 0, G_OPTION_ARG_STRING, &format_str,
+    "Write images (pnm, the default) or point clouds as binary PLY (ply) "
+    "or packed x, y, z 32 bit floats (f32)", "FORMAT" },
+  { "intrinsics", 0, 0, G_OPTION_ARG_STRING, &intrinsics_str,
+    "Depth camera intrinsics used for point clouds, in full resolution "
+    "pixels", "FX,FY,CX,CY" },
+  { NULL }
+};
+
+static gboolean
+parse_points (GError **error)
+{
+  guint i;
+
+  points = depth_points_new ();
+
+  if (points_file != NULL &&
+      ! depth_points_load (points, points_file, error))
+    return FALSE;
+
+  for (i = 0; point_strs != NULL && point_strs[i] != NULL; i++)
+    {
+      if (! depth_points_parse (points, point_strs[i]))
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Invalid point \"%s\", expected [FRAME,]#RRGGBB,X,Y",
+                       point_strs[i]);
+          return FALSE;
+        }
+    }
+
+  n_points = depth_points_get_n_points (points);
+
+  return TRUE;
+}
+
+static gboolean
+parse_format (GError **error)
+{
+  point_cloud_intrinsics_init_default (&intrinsics);
+
+  if (format_str != NULL && g_ascii_strcasecmp (format_str, "pnm") != 0)
+    {
+      if (! point_cloud_format_from_string (format_str, &cloud_format))
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Unknown format \"%s\", expected pnm, ply or f32",
+                       format_str);
+          return FALSE;
+        }
+      write_cloud = TRUE;
+    }
+
+  if (write_cloud && n_points > 0)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Points can only be highlighted on images");
+      return FALSE;
+    }
+
+  if (intrinsics_str != NULL &&
+      ! point_cloud_intrinsics_parse (intrinsics_str, &intrinsics))
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Invalid intrinsics \"%s\", expected FX,FY,CX,CY",
+                   intrinsics_str);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static const gchar *
+get_output_extension (void)
+{
+  if (write_cloud)
+    return point_cloud_format_get_extension (cloud_format);
+
+  return n_points > 0 ? "ppm" : "pgm";
+}
+
+static gchar *
+build_output_path (const gchar *path, guint frame, guint n_frames)
+{
+  gchar *base_name, *dir, *name, *output_path;
+
+  base_name = g_path_get_basename (path);
+  dir = output_dir != NULL ? g_strdup (output_dir) : g_path_get_dirname (path);
+
+  if (n_frames > 1)
+    name = g_strdup_printf ("%s-%05u.%s", base_name, frame,
+                            get_output_extension ());
+  else
+    name = g_strdup_printf ("%s.%s", base_name, get_output_extension ());
+
+  output_path = g_build_filename (dir, name, NULL);
+
+  g_free (name);
+  g_free (dir);
+  g_free (base_name);
+
+  return output_path;
+}
+
+/* Converts every frame in a depth file, run by the pool threads */
+static void
+convert_file (gpointer data, gpointer user_data)
+{
+  gchar *path = data;
+  Progress *progress = user_data;
+  DepthFile *file;
+  GError *error = NULL;
+  guint16 *decoded = NULL;
+  guchar *image = NULL;
+  guchar *rgb_image = NULL;
+  gfloat *cloud = NULL;
+  gsize n_samples = 0;
+  guint64 bytes = 0;
+  guint n_frames, frame;
+
+  file = depth_file_open (path, &error);
+  if (file == NULL)
+    goto out;
+
+  n_frames = depth_file_get_n_frames (file);
+  for (frame = 0; frame < n_frames; frame++)
+    {
+      DepthFrameHeader header;
+      const guint16 *depth;
+      gchar *output_path;
+
+      if (! depth_file_get_frame_header (file, frame, &header, &error))
+        break;
+
+      if ((gsize) header.width * header.height > n_samples)
+        {
+          n_samples = (gsize) header.width * header.height;
+          g_free (decoded);
+          g_free (image);
+          g_free (rgb_image);
+          g_free (cloud);
+          decoded = g_new (guint16, n_samples);
+          image = write_cloud ? NULL : g_malloc (n_samples);
+          rgb_image = n_points > 0 ? g_malloc (n_samples * 3) : NULL;
+          cloud = write_cloud ? g_new (gfloat, n_samples * 3) : NULL;
+        }
+
+      depth = depth_file_get_depth (file, frame, &header,
+                                    decoded, n_samples, &error);
+      if (depth == NULL)
+        break;
+
+      output_path = build_output_path (path, frame, n_frames);
+
+      if (write_cloud)
+        {
+          PointCloudIntrinsics cropped_intrinsics = intrinsics;
+          PointCloudRays *rays;
+          guint n_cloud_points;
+
+          point_cloud_intrinsics_crop (&cropped_intrinsics,
+                                       header.x_offset, header.y_offset);
+          rays = point_cloud_rays_get (header.width, header.height,
+                                       header.dimension_factor,
+                                       &cropped_intrinsics);
+          n_cloud_points = point_cloud_rays_unproject (rays, depth,
+                                                       header.threshold_begin,
+                                                       header.threshold_end,
+                                                       cloud);
+          point_cloud_rays_unref (rays);
+          depth_file_release_frame (file, frame);
+
+          point_cloud_write (output_path, cloud_format, cloud, n_cloud_points,
+                             &error);
+        }
+      else
+        {
+          depth_colormap_apply (colormap, depth,
+                                (gsize) header.width * header.height, image);
+          depth_file_release_frame (file, frame);
+
+          if (n_points > 0)
+            {
+              depth_image_gray_to_rgb (image, header.width, header.height,
+                                       rgb_image);
+              depth_points_draw (points, frame, rgb_image,
+                                 header.width, header.height, 3,
+                                 header.dimension_factor,
+                                 header.x_offset, header.y_offset);
+
+              depth_image_write_pnm (output_path, rgb_image,
+                                     header.width, header.height, 3, &error);
+            }
+          else
+            {
+              depth_image_write_pnm (output_path, image,
+                                     header.width, header.height, 1, &error);
+            }
+        }
+      g_free (output_path);
+
+      if (error != NULL)
+        break;
+
+      bytes += header.payload_size;
+      g_mutex_lock (&progress->mutex);
+      progress->frames++;
+      g_mutex_unlock (&progress->mutex);
+    }
+
+  depth_file_close (file);
+
+ out:
+  if (error != NULL)
+    {
+      g_printerr ("%s: %s\n", path, error->message);
+      g_error_free (error);
+    }
+
+  g_mutex_lock (&progress->mutex);
+  progress->files_done++;
+  if (error != NULL)
+    progress->files_failed++;
+  progress->bytes += bytes;
+  g_cond_signal (&progress->cond);
+  g_mutex_unlock (&progress->mutex);
+
+  g_free (cloud);
+  g_free (rgb_image);
+  g_free (image);
+  g_free (decoded);
+  g_free (path);
+}
+
+/* Adds path to files, or the regular files in it if it is a directory */
+static void
+collect_files (const gchar *path, GPtrArray *files)
+{
+  GDir *dir;
+  const gchar *name;
+  GError *error = NULL;
+
+  if (! g_file_test (path, G_FILE_TEST_IS_DIR))
+    {
+      g_ptr_array_add (files, g_strdup (path));
+      return;
+    }
+
+  dir = g_dir_open (path, 0, &error);
+  if (dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *file_path = g_build_filename (path, name, NULL);
+
+      if (g_file_test (file_path, G_FILE_TEST_IS_REGULAR) &&
+          ! g_str_has_suffix (name, ".pgm") &&
+          ! g_str_has_suffix (name, ".ppm") &&
+          ! g_str_has_suffix (name, ".ply") &&
+          ! g_str_has_suffix (name, ".f32"))
+        g_ptr_array_add (files, file_path);
+      else
+        g_free (file_path);
+    }
+
+  g_dir_close (dir);
+}
+
+static void
+print_progress (Progress *progress, guint n_files, gint64 start_time,
+                gboolean done)
+{
+  gdouble seconds;
+
+  seconds = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+  seconds = MAX (seconds, 1e-6);
+
+  g_printerr ("\r%u/%u files, %" G_GUINT64_FORMAT " frames, "
+              "%.1f frames/s, %.1f MB/s%s",
+              progress->files_done, n_files, progress->frames,
+              progress->frames / seconds,
+              progress->bytes / seconds / (1024 * 1024),
+              done ? "\n" : "");
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GPtrArray *files;
+  GThreadPool *pool;
+  Progress progress;
+  gint64 start_time;
+  guint i, n_files;
+
+  context = g_option_context_new ("DEPTH_FILE_OR_DIR... - convert depth files "
+                                  "to PGM/PPM images or point clouds");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error) ||
+      ! parse_points (&error) ||
+      ! parse_format (&error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return -1;
+    }
+  g_option_context_free (context);
+
+  if (argc < 2)
+    {
+      g_print ("Usage: %s [OPTION...] DEPTH_FILE_OR_DIR...\n", argv[0]);
+      return 0;
+    }
+
+  if (n_jobs <= 0)
+    n_jobs = g_get_num_processors ();
+
+  /* With files converted side by side, each is converted in the thread
+     that took it, rather than have every file job spread its frames
+     over the cores again */
+  if (n_jobs > 1)
+    worker_pool_set_default_n_threads (1);
+
+  colormap = depth_colormap_new (DEPTH_COLORMAP_GRAY,
+                                 DEPTH_COLORMAP_DEFAULT_BEGIN,
+                                 DEPTH_COLORMAP_DEFAULT_END);
+
+  files = g_ptr_array_new ();
+  for (i = 1; i < argc; i++)
+    collect_files (argv[i], files);
+  n_files = files->len;
+
+  memset (&progress, 0, sizeof (progress));
+  g_mutex_init (&progress.mutex);
+  g_cond_init (&progress.cond);
+
+  start_time = g_get_monotonic_time ();
+  pool = g_thread_pool_new (convert_file, &progress, n_jobs, TRUE, NULL);
+  for (i = 0; i < n_files; i++)
+    g_thread_pool_push (pool, g_ptr_array_index (files, i), NULL);
+  g_ptr_array_free (files, TRUE);
+
+  g_mutex_lock (&progress.mutex);
+  while (progress.files_done < n_files)
+    {
+      gint64 end_time = g_get_monotonic_time () + PROGRESS_INTERVAL;
+
+      while (progress.files_done < n_files &&
+             g_cond_wait_until (&progress.cond, &progress.mutex, end_time))
+        ;
+      if (progress.files_done < n_files)
+        print_progress (&progress, n_files, start_time, FALSE);
+    }
+  print_progress (&progress, n_files, start_time, TRUE);
+  g_mutex_unlock (&progress.mutex);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_print ("Converted %" G_GUINT64_FORMAT " frames from %u files with %d "
+           "threads in %.2f s",
+           progress.frames, n_files - progress.files_failed, n_jobs,
+           (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC);
+  if (progress.files_failed > 0)
+    g_print (", %u files failed", progress.files_failed);
+  g_print ("\n");
+
+  g_mutex_clear (&progress.mutex);
+  g_cond_clear (&progress.cond);
+  depth_points_free (points);
+  depth_colormap_unref (colormap);
+
+  return progress.files_failed > 0 ? 1 : 0;
+}
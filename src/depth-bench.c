@@ -0,0 +1,829 @@
+/* GFreenect Utils : depth-bench.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "depth-processing.h"
+#include "depth-colormap.h"
+#include "depth-image.h"
+#include "depth-file.h"
+#include "depth-codec.h"
+#include "depth-recorder.h"
+#include "depth-sequence.h"
+#include "depth-filter.h"
+#include "depth-tiles.h"
+#include "point-cloud.h"
+#include "depth-registration.h"
+#include "depth-histogram.h"
+
+/* Measures the per-pixel kernels on synthetic frames and on frames
+   of recordings, without a Kinect or a display, and prints how long
+   they take and how much they allocate as JSON, for comparing
+   releases. Every kernel runs over the frames of a set in turn */
+
+#define DEFAULT_ITERATIONS 100
+#define DEFAULT_FRAMES     30
+
+/* The synthetic scene, like the virtual device's with noise on the
+   wall so it does not compress unrealistically well */
+#define SYNTHETIC_WIDTH  640
+#define SYNTHETIC_HEIGHT 480
+#define WALL_DEPTH       2500
+#define WALL_NOISE       3
+#define DISC_DEPTH       1000
+#define DISC_RADIUS      100
+#define DISC_SPEED       8
+#define SHADOW_WIDTH     8
+
+/* Points drawn on every frame by the draw_point benchmark, and by
+   the draw_points one, like an annotations file would have */
+#define N_POINTS 64
+#define N_ANNOTATIONS 10000
+
+typedef struct
+{
+  gchar *source;
+  guint width;
+  guint height;
+  guint dimension_factor;
+  guint n_frames;
+  guint16 **frames;
+} FrameSet;
+
+typedef struct
+{
+  const FrameSet *set;
+  guint threshold_begin;
+  guint threshold_end;
+  guint dimension_factor;
+
+  guint16 *depth;
+  guchar *mask;
+  guchar *image;
+  gfloat *points;
+  DepthImagePoint *annotations;
+  guchar *video;
+  guint8 **encoded;
+  gsize *encoded_sizes;
+
+  DepthColormap *colormap;
+  DepthFilter *filter;
+  DepthTiles *tiles;
+  PointCloudRays *rays;
+  DepthRegistration *registration;
+  DepthFile *file;
+  DepthHistogram histogram;
+  guint histogram_step;
+} Bench;
+
+typedef void (*BenchFunc) (Bench *bench, guint frame);
+
+static gint n_iterations = DEFAULT_ITERATIONS;
+static gint max_frames = DEFAULT_FRAMES;
+static gchar *output_path = NULL;
+
+static GString *results = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &n_iterations,
+    "Frames processed by every benchmark, 100 by default", "N" },
+  { "frames", 'f', 0, G_OPTION_ARG_INT, &max_frames,
+    "Frames taken from each recording, 30 by default", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path,
+    "Write the results to FILE instead of the standard output", "FILE" },
+  { NULL }
+};
+
+#ifdef __GLIBC__
+
+/* Every allocation, GLib's included, goes through these, which glibc
+   lets a program replace by exporting its own under other names.
+   Aligned allocations are not counted */
+
+#define COUNTS_ALLOCATIONS TRUE
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint n_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members, size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_realloc (ptr, size);
+}
+
+#else
+
+#define COUNTS_ALLOCATIONS FALSE
+
+static gint n_allocations = 0;
+
+#endif
+
+static FrameSet *
+frame_set_new (const gchar *source, guint width, guint height)
+{
+  FrameSet *set;
+
+  set = g_slice_new0 (FrameSet);
+  set->source = g_strdup (source);
+  set->width = width;
+  set->height = height;
+  set->dimension_factor = 1;
+  set->frames = g_new0 (guint16 *, max_frames);
+
+  return set;
+}
+
+static void
+frame_set_free (FrameSet *set)
+{
+  guint i;
+
+  for (i = 0; i < set->n_frames; i++)
+    g_free (set->frames[i]);
+  g_free (set->frames);
+  g_free (set->source);
+  g_slice_free (FrameSet, set);
+}
+
+static FrameSet *
+frame_set_new_synthetic (void)
+{
+  FrameSet *set;
+  GRand *rand;
+  gint range = SYNTHETIC_WIDTH + 2 * DISC_RADIUS;
+  gint i, j;
+  guint n;
+
+  set = frame_set_new ("synthetic", SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT);
+  rand = g_rand_new_with_seed (0);
+
+  for (n = 0; n < (guint) max_frames; n++)
+    {
+      guint16 *depth = g_new (guint16,
+                              SYNTHETIC_WIDTH * SYNTHETIC_HEIGHT);
+      gint center_x = (gint) ((n * DISC_SPEED) % range) - DISC_RADIUS;
+      gint center_y = SYNTHETIC_HEIGHT / 2;
+
+      for (j = 0; j < SYNTHETIC_HEIGHT; j++)
+        {
+          guint16 *row = depth + (gsize) j * SYNTHETIC_WIDTH;
+          gint dy = j - center_y;
+
+          for (i = 0; i < SYNTHETIC_WIDTH; i++)
+            {
+              gint dx = i - center_x;
+
+              if (i < SHADOW_WIDTH)
+                row[i] = 0;
+              else if (dx * dx + dy * dy < DISC_RADIUS * DISC_RADIUS)
+                row[i] = DISC_DEPTH + (dx * dx + dy * dy) / DISC_RADIUS;
+              else
+                row[i] = WALL_DEPTH + j +
+                  g_rand_int_range (rand, -WALL_NOISE, WALL_NOISE + 1);
+            }
+        }
+      set->frames[set->n_frames++] = depth;
+    }
+
+  g_rand_free (rand);
+
+  return set;
+}
+
+/* Loads the first frames of a recording or directory of shots, those
+   of a different size than the first being skipped */
+static FrameSet *
+frame_set_load (const gchar *path, GError **error)
+{
+  DepthSequence *sequence;
+  DepthFrameHeader header;
+  FrameSet *set = NULL;
+  GError *read_error = NULL;
+  guint i;
+
+  sequence = depth_sequence_open (path, error);
+  if (sequence == NULL)
+    return NULL;
+
+  for (i = 0; i < depth_sequence_get_n_frames (sequence) &&
+         (set == NULL || set->n_frames < (guint) max_frames); i++)
+    {
+      const guint16 *depth;
+      guint16 *frame;
+      gsize n_samples;
+
+      if (! depth_sequence_get_frame_header (sequence, i, &header,
+                                             &read_error))
+        break;
+
+      if (set == NULL)
+        {
+          set = frame_set_new (path, header.width, header.height);
+          set->dimension_factor = MAX (header.dimension_factor, 1);
+        }
+      else if (header.width != set->width || header.height != set->height)
+        {
+          continue;
+        }
+
+      n_samples = (gsize) header.width * header.height;
+      frame = g_new (guint16, n_samples);
+      depth = depth_sequence_get_depth (sequence, i, &header,
+                                        frame, n_samples, &read_error);
+      if (depth == NULL)
+        {
+          g_free (frame);
+          break;
+        }
+      if (depth != frame)
+        memcpy (frame, depth, n_samples * sizeof (guint16));
+      depth_sequence_release_frame (sequence, i);
+
+      set->frames[set->n_frames++] = frame;
+    }
+
+  depth_sequence_free (sequence);
+
+  if (set != NULL && set->n_frames == 0)
+    {
+      frame_set_free (set);
+      set = NULL;
+    }
+
+  /* The frames read before a bad one are still measured */
+  if (set != NULL && read_error != NULL)
+    {
+      g_printerr ("%s, measuring only the frames before it (%u)\n",
+                  read_error->message, set->n_frames);
+      g_clear_error (&read_error);
+    }
+  else if (read_error != NULL)
+    g_propagate_error (error, read_error);
+  else if (set == NULL)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "%s has no frames", path);
+
+  return set;
+}
+
+static void
+append_json_string (GString *string, const gchar *str)
+{
+  g_string_append_c (string, '"');
+  for (; *str != '\0'; str++)
+    {
+      if (*str == '"' || *str == '\\')
+        g_string_append_printf (string, "\\%c", *str);
+      else if ((guchar) *str < 0x20)
+        g_string_append_printf (string, "\\u%04x", (guchar) *str);
+      else
+        g_string_append_c (string, *str);
+    }
+  g_string_append_c (string, '"');
+}
+
+/* Runs func over n_iterations frames of the set, after a pass over
+   all of them to warm up, and appends the results. pixels is how
+   many pixels func processes for every frame, and params the
+   settings of the kernel, or what it makes of the set, as the
+   members of a JSON object */
+static void
+run_bench (Bench       *bench,
+           const gchar *kernel,
+           const gchar *params,
+           gsize        pixels,
+           BenchFunc    func)
+{
+  const FrameSet *set = bench->set;
+  gint64 start_time, duration;
+  gint allocations;
+  guint i;
+
+  for (i = 0; i < set->n_frames; i++)
+    func (bench, i);
+
+  allocations = g_atomic_int_get (&n_allocations);
+  start_time = g_get_monotonic_time ();
+  for (i = 0; i < (guint) n_iterations; i++)
+    func (bench, i % set->n_frames);
+  duration = MAX (g_get_monotonic_time () - start_time, 1);
+  allocations = g_atomic_int_get (&n_allocations) - allocations;
+
+  if (results->len > 0)
+    g_string_append (results, ",\n");
+  g_string_append (results, "    { \"source\": ");
+  append_json_string (results, set->source);
+  g_string_append_printf (results,
+                          ", \"kernel\": \"%s\", \"params\": { %s }, "
+                          "\"width\": %u, \"height\": %u, \"frames\": %d, "
+                          "\"ns_per_pixel\": %.3f, "
+                          "\"frames_per_second\": %.1f, "
+                          "\"allocations_per_frame\": ",
+                          kernel, params, set->width, set->height,
+                          n_iterations,
+                          duration * 1000. / ((gdouble) pixels * n_iterations),
+                          n_iterations * (gdouble) G_USEC_PER_SEC / duration);
+  if (COUNTS_ALLOCATIONS)
+    g_string_append_printf (results, "%.2f }",
+                            allocations / (gdouble) n_iterations);
+  else
+    g_string_append (results, "null }");
+}
+
+static void
+bench_threshold_mask (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  depth_processing_threshold_mask (set->frames[frame],
+                                   set->width, set->height,
+                                   bench->dimension_factor,
+                                   bench->threshold_begin,
+                                   bench->threshold_end,
+                                   bench->depth, bench->mask);
+}
+
+static void
+bench_threshold_reduce (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  depth_processing_threshold_reduce (set->frames[frame],
+                                     set->width, set->height,
+                                     bench->dimension_factor,
+                                     bench->threshold_begin,
+                                     bench->threshold_end,
+                                     bench->depth);
+}
+
+static void
+bench_colormap (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  depth_colormap_apply (bench->colormap, set->frames[frame],
+                        (gsize) set->width * set->height, bench->image);
+}
+
+static void
+bench_gray_to_rgb (Bench *bench, guint frame)
+{
+  depth_image_gray_to_rgb (bench->mask, bench->set->width,
+                           bench->set->height, bench->image);
+}
+
+static void
+bench_draw_point (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+  const guchar color[3] = { 0, 255, 0 };
+  guint i;
+
+  for (i = 0; i < N_POINTS; i++)
+    depth_image_draw_point (bench->image, set->width, set->height, color,
+                            (i * 97 + frame * 13) % set->width,
+                            (i * 61 + frame * 7) % set->height);
+}
+
+static void
+bench_draw_points (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  depth_image_draw_points (bench->image, set->width, set->height, 3,
+                           bench->annotations, N_ANNOTATIONS,
+                           set->dimension_factor, 0, 0);
+}
+
+static void
+bench_read_depth (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+  DepthFrameHeader header;
+
+  depth_file_read_depth (bench->file, frame, &header, bench->depth,
+                         (gsize) set->width * set->height, NULL);
+}
+
+static void
+bench_encode (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  bench->encoded_sizes[frame] = depth_codec_encode (set->frames[frame],
+                                                    set->width, set->height,
+                                                    bench->encoded[frame]);
+}
+
+static void
+bench_decode (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  depth_codec_decode (bench->encoded[frame], bench->encoded_sizes[frame],
+                      set->width, set->height, bench->depth);
+}
+
+/* The filter works in place, so this includes copying the frame */
+static void
+bench_denoise (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+
+  memcpy (bench->depth, set->frames[frame],
+          (gsize) set->width * set->height * sizeof (guint16));
+  depth_filter_apply (bench->filter, bench->depth);
+}
+
+static void
+bench_tiles (Bench *bench, guint frame)
+{
+  depth_tiles_update (bench->tiles, bench->set->frames[frame]);
+}
+
+/* Counts the histogram and finds the end of the threshold from it,
+   as automatic thresholding does for every frame */
+static void
+bench_histogram (Bench *bench, guint frame)
+{
+  const FrameSet *set = bench->set;
+  guint threshold_end;
+
+  depth_histogram_compute (&bench->histogram, set->frames[frame],
+                           set->width, set->height, bench->histogram_step);
+  depth_histogram_find_threshold (&bench->histogram, DEPTH_HISTOGRAM_OTSU,
+                                  bench->threshold_begin, &threshold_end);
+}
+
+static void
+bench_unproject (Bench *bench, guint frame)
+{
+  point_cloud_rays_unproject (bench->rays, bench->set->frames[frame],
+                              bench->threshold_begin, bench->threshold_end,
+                              bench->points);
+}
+
+static void
+bench_cutout (Bench *bench, guint frame)
+{
+  depth_registration_cutout (bench->registration,
+                             bench->set->frames[frame],
+                             bench->threshold_begin, bench->threshold_end,
+                             bench->video, 3, bench->image);
+}
+
+/* Writes the frames of the set to a recording at path */
+static gboolean
+write_recording (const FrameSet    *set,
+                 const gchar       *path,
+                 DepthFrameFormat   format,
+                 GError           **error)
+{
+  DepthRecorder *recorder;
+  DepthFrameHeader header;
+  guint i;
+
+  recorder = depth_recorder_new (path, format, set->n_frames, error);
+  if (recorder == NULL)
+    return FALSE;
+
+  memset (&header, 0, sizeof (header));
+  header.width = set->width;
+  header.height = set->height;
+  header.dimension_factor = set->dimension_factor;
+  for (i = 0; i < set->n_frames; i++)
+    {
+      header.timestamp = i;
+      depth_recorder_push (recorder, &header, set->frames[i]);
+    }
+
+  return depth_recorder_close (recorder, error);
+}
+
+static void
+bench_read_recording (Bench            *bench,
+                      const gchar      *tmp_dir,
+                      DepthFrameFormat  format,
+                      const gchar      *params)
+{
+  const FrameSet *set = bench->set;
+  GError *error = NULL;
+  gchar *path;
+
+  path = g_build_filename (tmp_dir, "frames", NULL);
+  if (write_recording (set, path, format, &error))
+    bench->file = depth_file_open (path, &error);
+
+  if (bench->file != NULL)
+    {
+      run_bench (bench, "read_depth", params,
+                 (gsize) set->width * set->height, bench_read_depth);
+      depth_file_close (bench->file);
+      bench->file = NULL;
+    }
+  else
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_unlink (path);
+  g_free (path);
+}
+
+static void
+bench_frame_set (const FrameSet *set, const gchar *tmp_dir)
+{
+  static const guint thresholds[][2] = { { 500, 1500 }, { 0, 4000 } };
+  static const guint factors[] = { 1, 2, 4 };
+  PointCloudIntrinsics intrinsics;
+  DepthRegistrationCalibration calibration;
+  gsize n_pixels = (gsize) set->width * set->height;
+  guint64 encoded_size;
+  Bench bench;
+  gchar *params;
+  guint i, j;
+
+  memset (&bench, 0, sizeof (bench));
+  bench.set = set;
+  bench.dimension_factor = 1;
+  bench.threshold_begin = thresholds[0][0];
+  bench.threshold_end = thresholds[0][1];
+  bench.depth = g_new (guint16, n_pixels);
+  bench.mask = g_new0 (guchar, n_pixels);
+  bench.image = g_new0 (guchar, n_pixels * 4);
+  bench.points = g_new (gfloat, n_pixels * 3);
+  bench.video = g_new (guchar, n_pixels * 3);
+  for (i = 0; i < n_pixels * 3; i++)
+    bench.video[i] = i * 7;
+
+  /* Annotations are in full resolution coordinates */
+  bench.annotations = g_new (DepthImagePoint, N_ANNOTATIONS);
+  for (i = 0; i < N_ANNOTATIONS; i++)
+    {
+      DepthImagePoint *point = &bench.annotations[i];
+
+      point->color[0] = i;
+      point->color[1] = 255;
+      point->color[2] = i * 3;
+      point->x = (i * 97) % (set->width * set->dimension_factor);
+      point->y = (i * 61) % (set->height * set->dimension_factor);
+    }
+
+  /* The original process_buffer() */
+  for (i = 0; i < G_N_ELEMENTS (factors); i++)
+    for (j = 0; j < G_N_ELEMENTS (thresholds); j++)
+      {
+        bench.dimension_factor = factors[i];
+        bench.threshold_begin = thresholds[j][0];
+        bench.threshold_end = thresholds[j][1];
+        params = g_strdup_printf ("\"dimension_factor\": %u, "
+                                  "\"threshold_begin\": %u, "
+                                  "\"threshold_end\": %u",
+                                  bench.dimension_factor,
+                                  bench.threshold_begin,
+                                  bench.threshold_end);
+        run_bench (&bench, "threshold_mask", params, n_pixels,
+                   bench_threshold_mask);
+        /* What is left of it when saving a shot */
+        run_bench (&bench, "threshold_reduce", params, n_pixels,
+                   bench_threshold_reduce);
+        g_free (params);
+      }
+
+  /* What create_grayscale_buffer() made in the record tool, an RGB
+     image of the mask, and in the viewer, now the gray palette */
+  run_bench (&bench, "gray_to_rgb", "", n_pixels, bench_gray_to_rgb);
+
+  for (i = 0; i < DEPTH_COLORMAP_LAST; i++)
+    {
+      bench.colormap = depth_colormap_new (i, DEPTH_COLORMAP_DEFAULT_BEGIN,
+                                           DEPTH_COLORMAP_DEFAULT_END);
+      params = g_strdup_printf ("\"palette\": \"%s\"",
+                                depth_colormap_palette_get_name (i));
+      run_bench (&bench, "colormap", params, n_pixels, bench_colormap);
+      g_free (params);
+      depth_colormap_unref (bench.colormap);
+    }
+
+  params = g_strdup_printf ("\"points\": %d", N_POINTS);
+  run_bench (&bench, "draw_point", params,
+             N_POINTS * 4 * DEPTH_IMAGE_POINT_SIZE * DEPTH_IMAGE_POINT_SIZE,
+             bench_draw_point);
+  g_free (params);
+
+  params = g_strdup_printf ("\"points\": %d", N_ANNOTATIONS);
+  run_bench (&bench, "draw_points", params,
+             N_ANNOTATIONS * 4 * DEPTH_IMAGE_POINT_SIZE *
+             DEPTH_IMAGE_POINT_SIZE, bench_draw_points);
+  g_free (params);
+
+  /* The original read_file_to_buffer() */
+  bench_read_recording (&bench, tmp_dir, DEPTH_FRAME_FORMAT_RAW_16,
+                        "\"format\": \"raw\"");
+  bench_read_recording (&bench, tmp_dir, DEPTH_FRAME_FORMAT_DELTA_RLE,
+                        "\"format\": \"delta-rle\"");
+
+  bench.encoded = g_new (guint8 *, set->n_frames);
+  bench.encoded_sizes = g_new0 (gsize, set->n_frames);
+  for (i = 0; i < set->n_frames; i++)
+    bench.encoded[i] = g_malloc (depth_codec_get_max_encoded_size (set->width,
+                                                                   set->height));
+
+  /* How small the frames of this set get, so that speed can be
+     weighed against size */
+  encoded_size = 0;
+  for (i = 0; i < set->n_frames; i++)
+    {
+      bench_encode (&bench, i);
+      encoded_size += bench.encoded_sizes[i];
+    }
+  params = g_strdup_printf ("\"encoded_bytes_per_frame\": %.0f, "
+                            "\"compression_ratio\": %.2f",
+                            encoded_size / (gdouble) set->n_frames,
+                            n_pixels * sizeof (guint16) *
+                            (gdouble) set->n_frames /
+                            MAX (encoded_size, 1));
+  run_bench (&bench, "encode", params, n_pixels, bench_encode);
+  run_bench (&bench, "decode", params, n_pixels, bench_decode);
+  g_free (params);
+
+  bench.filter = depth_filter_new (set->width, set->height, 2,
+                                   DEPTH_FILTER_DEFAULT_JUMP);
+  run_bench (&bench, "denoise", "\"strength\": 2", n_pixels, bench_denoise);
+
+  bench.tiles = depth_tiles_new (set->width, set->height,
+                                 DEPTH_TILES_DEFAULT_TOLERANCE);
+  params = g_strdup_printf ("\"tolerance\": %d",
+                            DEPTH_TILES_DEFAULT_TOLERANCE);
+  run_bench (&bench, "tiles", params, n_pixels, bench_tiles);
+  g_free (params);
+
+  bench.threshold_begin = thresholds[0][0];
+  bench.threshold_end = thresholds[0][1];
+
+  for (bench.histogram_step = 1; bench.histogram_step <= 2;
+       bench.histogram_step++)
+    {
+      params = g_strdup_printf ("\"step\": %u", bench.histogram_step);
+      run_bench (&bench, "histogram", params, n_pixels, bench_histogram);
+      g_free (params);
+    }
+
+  params = g_strdup_printf ("\"threshold_begin\": %u, "
+                            "\"threshold_end\": %u",
+                            bench.threshold_begin, bench.threshold_end);
+
+  point_cloud_intrinsics_init_default (&intrinsics);
+  bench.rays = point_cloud_rays_get (set->width, set->height,
+                                     set->dimension_factor, &intrinsics);
+  run_bench (&bench, "unproject", params, n_pixels, bench_unproject);
+
+  depth_registration_calibration_init_default (&calibration);
+  bench.registration = depth_registration_new (set->width, set->height,
+                                               set->width, set->height,
+                                               &calibration);
+  run_bench (&bench, "cutout", params, n_pixels, bench_cutout);
+  g_free (params);
+
+  depth_registration_free (bench.registration);
+  point_cloud_rays_unref (bench.rays);
+  depth_tiles_free (bench.tiles);
+  depth_filter_free (bench.filter);
+  for (i = 0; i < set->n_frames; i++)
+    g_free (bench.encoded[i]);
+  g_free (bench.encoded);
+  g_free (bench.encoded_sizes);
+  g_free (bench.video);
+  g_free (bench.annotations);
+  g_free (bench.points);
+  g_free (bench.image);
+  g_free (bench.mask);
+  g_free (bench.depth);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GString *json;
+  gchar *tmp_dir;
+  FrameSet *set;
+  gint i;
+
+  context = g_option_context_new ("[DEPTH_FILE_OR_DIR...] - measure the "
+                                  "depth processing kernels");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return -1;
+    }
+  g_option_context_free (context);
+
+  if (n_iterations <= 0 || max_frames <= 0)
+    {
+      g_printerr ("Iterations and frames must be more than 0\n");
+      return -1;
+    }
+
+  tmp_dir = g_dir_make_tmp ("depth-bench-XXXXXX", &error);
+  if (tmp_dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return -1;
+    }
+
+  results = g_string_new (NULL);
+
+  set = frame_set_new_synthetic ();
+  bench_frame_set (set, tmp_dir);
+  frame_set_free (set);
+
+  for (i = 1; i < argc; i++)
+    {
+      set = frame_set_load (argv[i], &error);
+      if (set == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          g_clear_error (&error);
+          continue;
+        }
+      bench_frame_set (set, tmp_dir);
+      frame_set_free (set);
+    }
+
+  g_rmdir (tmp_dir);
+  g_free (tmp_dir);
+
+  json = g_string_new ("{\n  \"implementations\": { ");
+  g_string_append_printf (json, "\"threshold_mask\": \"%s\", "
+                          "\"denoise\": \"%s\" },\n",
+                          depth_processing_get_implementation (),
+                          depth_filter_get_implementation ());
+  g_string_append_printf (json, "  \"iterations\": %d,\n"
+                          "  \"results\": [\n%s\n  ]\n}\n",
+                          n_iterations, results->str);
+  g_string_free (results, TRUE);
+
+  if (output_path != NULL)
+    {
+      if (! g_file_set_contents (output_path, json->str, json->len, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+          g_string_free (json, TRUE);
+          return -1;
+        }
+    }
+  else
+    {
+      g_print ("%s", json->str);
+    }
+  g_string_free (json, TRUE);
+
+  return 0;
+}
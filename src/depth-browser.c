@@ -0,0 +1,761 @@
+/* GFreenect Utils : depth-browser.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "depth-browser.h"
+
+/* A browser lists the depth files of a directory without opening
+   them, so even thousands of files show up at once, and decodes the
+   first frame of each in a few worker threads: thumbnails for the
+   files in view, and the full resolution frames around the selected
+   file. Thumbnails are sampled down from the decoded frame and
+   colored by the workers, then taken by the consumer from a queue.
+   Full frames are kept in a cache of least recently used frames up to
+   a memory size, where frames being shown are pinned and those near
+   the selection are evicted last, farthest first. Requests that
+   went out of view are dropped from the queues before being decoded,
+   and full frames are decoded before any thumbnail */
+
+#define MAX_THREADS 4
+
+/* Files decoded ahead on each side of the selected one */
+#define PREFETCH_FILES 4
+
+typedef struct
+{
+  guint index;
+  DepthFrameHeader header;
+  guint16 *depth;
+  gsize size;
+  guint pins;
+  GList link;
+} CacheEntry;
+
+typedef struct
+{
+  gchar *path;
+  gboolean thumbnail_queued;
+  gboolean frame_queued;
+  CacheEntry *frame;
+} BrowserFile;
+
+struct _DepthBrowser
+{
+  BrowserFile *files;
+  guint n_files;
+  guint thumbnail_size;
+  GThread **threads;
+  guint n_threads;
+
+  GMutex mutex;
+  GCond cond;
+  DepthColormap *colormap;
+  guint generation;
+  GQueue frame_queue;
+  GQueue thumbnail_queue;
+  GQueue thumbnails;
+  guint n_decoding;
+  gboolean stopping;
+
+  /* Most recently used first */
+  GQueue lru;
+  guint selected;
+  gsize frame_size;
+  gsize cache_size;
+  gsize max_cache_size;
+  guint64 hits;
+  guint64 misses;
+};
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->depth);
+  g_slice_free (CacheEntry, entry);
+}
+
+static void
+drop_frame (DepthBrowser *browser, CacheEntry *entry)
+{
+  g_queue_unlink (&browser->lru, &entry->link);
+  browser->files[entry->index].frame = NULL;
+  browser->cache_size -= entry->size;
+  cache_entry_free (entry);
+}
+
+static gboolean
+is_near_selection (DepthBrowser *browser, guint index)
+{
+  return index + PREFETCH_FILES >= browser->selected &&
+    index <= browser->selected + PREFETCH_FILES;
+}
+
+/* Drops frames that are not pinned until the cache fits: first the
+   least recently used of those away from the selection, then its
+   neighbors from the farthest. The selected frame is always kept */
+static void
+evict_frames (DepthBrowser *browser)
+{
+  GList *link = browser->lru.tail;
+  guint distance;
+
+  while (browser->cache_size > browser->max_cache_size && link != NULL)
+    {
+      CacheEntry *entry = link->data;
+
+      link = link->prev;
+      if (entry->pins == 0 && ! is_near_selection (browser, entry->index))
+        drop_frame (browser, entry);
+    }
+
+  for (distance = PREFETCH_FILES;
+       distance > 0 && browser->cache_size > browser->max_cache_size;
+       distance--)
+    {
+      guint sides[2] = { browser->selected + distance,
+                         browser->selected - distance };
+      guint side;
+
+      for (side = 0; side < 2; side++)
+        {
+          CacheEntry *entry;
+
+          /* Indices before the first file wrap around past the last */
+          if (sides[side] >= browser->n_files)
+            continue;
+
+          entry = browser->files[sides[side]].frame;
+          if (entry != NULL && entry->pins == 0 &&
+              browser->cache_size > browser->max_cache_size)
+            drop_frame (browser, entry);
+        }
+    }
+}
+
+static void
+touch_frame (DepthBrowser *browser, CacheEntry *entry)
+{
+  g_queue_unlink (&browser->lru, &entry->link);
+  g_queue_push_head_link (&browser->lru, &entry->link);
+}
+
+static CacheEntry *
+load_frame (const gchar *path, guint index)
+{
+  DepthFrameHeader header;
+  CacheEntry *entry = NULL;
+  GError *error = NULL;
+  DepthFile *file;
+  gsize n_samples;
+
+  file = depth_file_open (path, &error);
+  if (file == NULL)
+    goto out;
+
+  if (depth_file_get_frame_header (file, 0, &header, &error))
+    {
+      n_samples = (gsize) header.width * header.height;
+
+      entry = g_slice_new0 (CacheEntry);
+      entry->index = index;
+      entry->depth = g_new (guint16, n_samples);
+      entry->size = n_samples * sizeof (guint16);
+      entry->link.data = entry;
+
+      if (! depth_file_read_depth (file, 0, &entry->header,
+                                   entry->depth, n_samples, &error))
+        {
+          cache_entry_free (entry);
+          entry = NULL;
+        }
+    }
+
+  depth_file_close (file);
+
+ out:
+  if (error != NULL)
+    {
+      g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
+    }
+
+  return entry;
+}
+
+/* Samples the frame down to fit in size x size pixels and colors it */
+static DepthBrowserThumbnail *
+make_thumbnail (guint                   index,
+                const DepthFrameHeader *header,
+                const guint16          *depth,
+                guint                   size,
+                DepthColormap          *colormap)
+{
+  DepthBrowserThumbnail *thumbnail;
+  guint factor, x, y;
+  guint16 *sampled;
+  gsize n_samples;
+
+  factor = MAX ((header->width + size - 1) / size,
+                (header->height + size - 1) / size);
+  factor = MAX (factor, 1);
+
+  thumbnail = g_slice_new0 (DepthBrowserThumbnail);
+  thumbnail->index = index;
+  thumbnail->header = *header;
+  thumbnail->width = MAX (header->width / factor, 1);
+  thumbnail->height = MAX (header->height / factor, 1);
+  thumbnail->n_channels = depth_colormap_get_n_channels (colormap);
+
+  n_samples = (gsize) thumbnail->width * thumbnail->height;
+  sampled = g_new (guint16, n_samples);
+  for (y = 0; y < thumbnail->height; y++)
+    {
+      const guint16 *row = depth +
+        (gsize) MIN (y * factor + factor / 2, header->height - 1) *
+        header->width;
+
+      for (x = 0; x < thumbnail->width; x++)
+        sampled[y * thumbnail->width + x] =
+          row[MIN (x * factor + factor / 2, header->width - 1)];
+    }
+
+  thumbnail->image = g_malloc (n_samples * thumbnail->n_channels);
+  depth_colormap_apply (colormap, sampled, n_samples, thumbnail->image);
+  g_free (sampled);
+
+  return thumbnail;
+}
+
+/* Called with the mutex held, which is released while decoding */
+static void
+decode_frame (DepthBrowser *browser, guint index)
+{
+  BrowserFile *file = &browser->files[index];
+  CacheEntry *entry;
+
+  browser->n_decoding++;
+  g_mutex_unlock (&browser->mutex);
+
+  entry = load_frame (file->path, index);
+
+  g_mutex_lock (&browser->mutex);
+  browser->n_decoding--;
+  file->frame_queued = FALSE;
+
+  /* A failed file is not retried until it is selected again */
+  if (entry == NULL)
+    return;
+
+  file->frame = entry;
+  g_queue_push_head_link (&browser->lru, &entry->link);
+  browser->frame_size = entry->size;
+  browser->cache_size += entry->size;
+  evict_frames (browser);
+}
+
+/* Called with the mutex held, which is released while decoding. A
+   frame already in the cache is pinned and used instead of reading
+   the file again */
+static void
+decode_thumbnail (DepthBrowser *browser, guint index)
+{
+  BrowserFile *file = &browser->files[index];
+  DepthBrowserThumbnail *thumbnail = NULL;
+  DepthColormap *colormap;
+  CacheEntry *entry, *cached;
+  guint generation;
+
+  /* It can be queued again while decoding, with another colormap */
+  file->thumbnail_queued = FALSE;
+  generation = browser->generation;
+  colormap = depth_colormap_ref (browser->colormap);
+  cached = file->frame;
+  if (cached != NULL)
+    cached->pins++;
+  browser->n_decoding++;
+  g_mutex_unlock (&browser->mutex);
+
+  entry = cached != NULL ? cached : load_frame (file->path, index);
+  if (entry != NULL)
+    thumbnail = make_thumbnail (index, &entry->header, entry->depth,
+                                browser->thumbnail_size, colormap);
+  depth_colormap_unref (colormap);
+
+  g_mutex_lock (&browser->mutex);
+  browser->n_decoding--;
+
+  if (cached != NULL)
+    {
+      cached->pins--;
+      evict_frames (browser);
+    }
+  else if (entry != NULL)
+    {
+      cache_entry_free (entry);
+    }
+
+  if (generation != browser->generation)
+    {
+      if (thumbnail != NULL)
+        depth_browser_thumbnail_free (thumbnail);
+      return;
+    }
+
+  /* Files that cannot be read get a thumbnail without an image */
+  if (thumbnail == NULL)
+    {
+      thumbnail = g_slice_new0 (DepthBrowserThumbnail);
+      thumbnail->index = index;
+    }
+
+  g_queue_push_tail (&browser->thumbnails, thumbnail);
+}
+
+static gpointer
+decode_thread (gpointer data)
+{
+  DepthBrowser *browser = data;
+
+  g_mutex_lock (&browser->mutex);
+  while (TRUE)
+    {
+      gpointer index;
+
+      while (! browser->stopping &&
+             g_queue_is_empty (&browser->frame_queue) &&
+             g_queue_is_empty (&browser->thumbnail_queue))
+        g_cond_wait (&browser->cond, &browser->mutex);
+
+      if (browser->stopping)
+        break;
+
+      if (! g_queue_is_empty (&browser->frame_queue))
+        {
+          index = g_queue_pop_head (&browser->frame_queue);
+          decode_frame (browser, GPOINTER_TO_UINT (index));
+        }
+      else
+        {
+          index = g_queue_pop_head (&browser->thumbnail_queue);
+          decode_thumbnail (browser, GPOINTER_TO_UINT (index));
+        }
+    }
+  g_mutex_unlock (&browser->mutex);
+
+  return NULL;
+}
+
+/* Images, point clouds and video recordings written next to depth
+   files are left out */
+static gboolean
+is_depth_file_name (const gchar *name)
+{
+  static const gchar *other_suffixes[] =
+    { ".pgm", ".ppm", ".pam", ".ply", ".f32", ".csv", ".video" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (other_suffixes); i++)
+    if (g_str_has_suffix (name, other_suffixes[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Lists the depth files in the directory at path, in the order of
+   their names, which is the capture order for shots, and starts
+   the decoding threads. Thumbnails fit in thumbnail_size x
+   thumbnail_size pixels and at most cache_size bytes of full
+   resolution frames are kept */
+DepthBrowser *
+depth_browser_open (const gchar    *path,
+                    guint           thumbnail_size,
+                    gsize           cache_size,
+                    GError        **error)
+{
+  DepthBrowser *browser;
+  GPtrArray *names;
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (thumbnail_size > 0, NULL);
+
+  dir = g_dir_open (path, 0, error);
+  if (dir == NULL)
+    return NULL;
+
+  names = g_ptr_array_new ();
+  while ((name = g_dir_read_name (dir)) != NULL)
+    if (is_depth_file_name (name))
+      g_ptr_array_add (names, g_strdup (name));
+  g_dir_close (dir);
+
+  if (names->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "No depth files in %s", path);
+      g_ptr_array_free (names, TRUE);
+      return NULL;
+    }
+
+  g_ptr_array_sort (names, compare_names);
+
+  browser = g_slice_new0 (DepthBrowser);
+  browser->n_files = names->len;
+  browser->files = g_new0 (BrowserFile, browser->n_files);
+  for (i = 0; i < browser->n_files; i++)
+    {
+      browser->files[i].path = g_build_filename (path,
+                                                 g_ptr_array_index (names, i),
+                                                 NULL);
+      g_free (g_ptr_array_index (names, i));
+    }
+  g_ptr_array_free (names, TRUE);
+
+  browser->thumbnail_size = thumbnail_size;
+  browser->max_cache_size = cache_size;
+  g_mutex_init (&browser->mutex);
+  g_cond_init (&browser->cond);
+  g_queue_init (&browser->frame_queue);
+  g_queue_init (&browser->thumbnail_queue);
+  g_queue_init (&browser->thumbnails);
+  g_queue_init (&browser->lru);
+
+  browser->n_threads = CLAMP (g_get_num_processors (), 1, MAX_THREADS);
+  browser->threads = g_new (GThread *, browser->n_threads);
+  for (i = 0; i < browser->n_threads; i++)
+    browser->threads[i] = g_thread_new ("depth-browser", decode_thread,
+                                        browser);
+
+  return browser;
+}
+
+void
+depth_browser_free (DepthBrowser *browser)
+{
+  DepthBrowserThumbnail *thumbnail;
+  CacheEntry *entry;
+  guint i;
+
+  g_return_if_fail (browser != NULL);
+
+  g_mutex_lock (&browser->mutex);
+  browser->stopping = TRUE;
+  g_cond_broadcast (&browser->cond);
+  g_mutex_unlock (&browser->mutex);
+
+  for (i = 0; i < browser->n_threads; i++)
+    g_thread_join (browser->threads[i]);
+  g_free (browser->threads);
+
+  while ((thumbnail = g_queue_pop_head (&browser->thumbnails)) != NULL)
+    depth_browser_thumbnail_free (thumbnail);
+  while ((entry = g_queue_peek_head (&browser->lru)) != NULL)
+    {
+      g_queue_unlink (&browser->lru, &entry->link);
+      cache_entry_free (entry);
+    }
+  g_queue_clear (&browser->frame_queue);
+  g_queue_clear (&browser->thumbnail_queue);
+
+  for (i = 0; i < browser->n_files; i++)
+    g_free (browser->files[i].path);
+  g_free (browser->files);
+
+  if (browser->colormap != NULL)
+    depth_colormap_unref (browser->colormap);
+  g_mutex_clear (&browser->mutex);
+  g_cond_clear (&browser->cond);
+  g_slice_free (DepthBrowser, browser);
+}
+
+guint
+depth_browser_get_n_files (DepthBrowser *browser)
+{
+  g_return_val_if_fail (browser != NULL, 0);
+
+  return browser->n_files;
+}
+
+const gchar *
+depth_browser_get_path (DepthBrowser *browser, guint index)
+{
+  g_return_val_if_fail (browser != NULL, NULL);
+  g_return_val_if_fail (index < browser->n_files, NULL);
+
+  return browser->files[index].path;
+}
+
+/* Colors the thumbnails decoded from now on with colormap, which has
+   to be set before requesting any. Thumbnails in the old colors are
+   thrown away, so the ones in view have to be requested again */
+void
+depth_browser_set_colormap (DepthBrowser *browser, DepthColormap *colormap)
+{
+  DepthBrowserThumbnail *thumbnail;
+  guint i;
+
+  g_return_if_fail (browser != NULL);
+  g_return_if_fail (colormap != NULL);
+
+  g_mutex_lock (&browser->mutex);
+
+  depth_colormap_ref (colormap);
+  if (browser->colormap != NULL)
+    depth_colormap_unref (browser->colormap);
+  browser->colormap = colormap;
+  browser->generation++;
+
+  while (! g_queue_is_empty (&browser->thumbnail_queue))
+    {
+      i = GPOINTER_TO_UINT (g_queue_pop_head (&browser->thumbnail_queue));
+      browser->files[i].thumbnail_queued = FALSE;
+    }
+  while ((thumbnail = g_queue_pop_head (&browser->thumbnails)) != NULL)
+    depth_browser_thumbnail_free (thumbnail);
+
+  g_mutex_unlock (&browser->mutex);
+}
+
+/* Asks for the thumbnails of the files at indices, usually the ones
+   in view without one, in that order. Queued thumbnails of other
+   files are dropped */
+void
+depth_browser_request_thumbnails (DepthBrowser *browser,
+                                  const guint  *indices,
+                                  guint         n_indices)
+{
+  GQueue *queue;
+  guint i;
+
+  g_return_if_fail (browser != NULL);
+  g_return_if_fail (indices != NULL || n_indices == 0);
+  g_return_if_fail (browser->colormap != NULL);
+
+  g_mutex_lock (&browser->mutex);
+
+  queue = &browser->thumbnail_queue;
+  while (! g_queue_is_empty (queue))
+    {
+      i = GPOINTER_TO_UINT (g_queue_pop_head (queue));
+      browser->files[i].thumbnail_queued = FALSE;
+    }
+
+  for (i = 0; i < n_indices; i++)
+    {
+      BrowserFile *file;
+
+      if (indices[i] >= browser->n_files)
+        continue;
+
+      file = &browser->files[indices[i]];
+      if (! file->thumbnail_queued)
+        {
+          file->thumbnail_queued = TRUE;
+          g_queue_push_tail (queue, GUINT_TO_POINTER (indices[i]));
+        }
+    }
+
+  if (! g_queue_is_empty (queue))
+    g_cond_broadcast (&browser->cond);
+
+  g_mutex_unlock (&browser->mutex);
+}
+
+/* Takes the next decoded thumbnail, or returns NULL if there is none.
+   Its image is NULL if the file could not be read */
+DepthBrowserThumbnail *
+depth_browser_pop_thumbnail (DepthBrowser *browser)
+{
+  DepthBrowserThumbnail *thumbnail;
+
+  g_return_val_if_fail (browser != NULL, NULL);
+
+  g_mutex_lock (&browser->mutex);
+  thumbnail = g_queue_pop_head (&browser->thumbnails);
+  g_mutex_unlock (&browser->mutex);
+
+  return thumbnail;
+}
+
+void
+depth_browser_thumbnail_free (DepthBrowserThumbnail *thumbnail)
+{
+  g_return_if_fail (thumbnail != NULL);
+
+  g_free (thumbnail->image);
+  g_slice_free (DepthBrowserThumbnail, thumbnail);
+}
+
+/* Decodes the full resolution frame of the file at index, unless it
+   is cached, followed by those of its nearest neighbors that fit in
+   the cache. Neighbors queued for an earlier selection are dropped */
+void
+depth_browser_select (DepthBrowser *browser, guint index)
+{
+  guint distance, n_fit, n_files;
+  BrowserFile *file;
+  guint i;
+
+  g_return_if_fail (browser != NULL);
+  g_return_if_fail (index < browser->n_files);
+
+  g_mutex_lock (&browser->mutex);
+
+  while (! g_queue_is_empty (&browser->frame_queue))
+    {
+      i = GPOINTER_TO_UINT (g_queue_pop_head (&browser->frame_queue));
+      browser->files[i].frame_queued = FALSE;
+    }
+
+  browser->selected = index;
+  file = &browser->files[index];
+  if (file->frame != NULL)
+    {
+      browser->hits++;
+      touch_frame (browser, file->frame);
+    }
+  else
+    {
+      browser->misses++;
+    }
+
+  /* Until a frame is decoded its size is unknown */
+  n_fit = browser->frame_size > 0 ?
+    MAX (browser->max_cache_size / browser->frame_size, 1) : G_MAXUINT;
+
+  n_files = 0;
+  for (distance = 0; distance <= PREFETCH_FILES; distance++)
+    {
+      guint sides[2] = { index + distance, index - distance };
+      guint side;
+
+      for (side = 0; side < (distance > 0 ? 2 : 1); side++)
+        {
+          if (sides[side] >= browser->n_files || n_files++ >= n_fit)
+            continue;
+
+          file = &browser->files[sides[side]];
+          if (file->frame == NULL && ! file->frame_queued)
+            {
+              file->frame_queued = TRUE;
+              g_queue_push_tail (&browser->frame_queue,
+                                 GUINT_TO_POINTER (sides[side]));
+            }
+        }
+    }
+
+  if (! g_queue_is_empty (&browser->frame_queue))
+    g_cond_broadcast (&browser->cond);
+
+  g_mutex_unlock (&browser->mutex);
+}
+
+/* Returns the full resolution depth of the file at index if it has
+   been decoded, or NULL. The frame stays in the cache until
+   depth_browser_release_frame() */
+const guint16 *
+depth_browser_get_frame (DepthBrowser     *browser,
+                         guint             index,
+                         DepthFrameHeader *header)
+{
+  CacheEntry *entry;
+
+  g_return_val_if_fail (browser != NULL, NULL);
+  g_return_val_if_fail (index < browser->n_files, NULL);
+  g_return_val_if_fail (header != NULL, NULL);
+
+  g_mutex_lock (&browser->mutex);
+  entry = browser->files[index].frame;
+  if (entry != NULL)
+    {
+      entry->pins++;
+      touch_frame (browser, entry);
+      *header = entry->header;
+    }
+  g_mutex_unlock (&browser->mutex);
+
+  return entry != NULL ? entry->depth : NULL;
+}
+
+void
+depth_browser_release_frame (DepthBrowser *browser, guint index)
+{
+  CacheEntry *entry;
+
+  g_return_if_fail (browser != NULL);
+  g_return_if_fail (index < browser->n_files);
+
+  g_mutex_lock (&browser->mutex);
+  entry = browser->files[index].frame;
+  if (entry != NULL && entry->pins > 0)
+    {
+      entry->pins--;
+      evict_frames (browser);
+    }
+  else
+    {
+      g_warning ("Frame %u released without being taken", index);
+    }
+  g_mutex_unlock (&browser->mutex);
+}
+
+/* Returns TRUE while files are being decoded or thumbnails wait to be
+   taken */
+gboolean
+depth_browser_is_busy (DepthBrowser *browser)
+{
+  gboolean busy;
+
+  g_return_val_if_fail (browser != NULL, FALSE);
+
+  g_mutex_lock (&browser->mutex);
+  busy = browser->n_decoding > 0 ||
+    ! g_queue_is_empty (&browser->frame_queue) ||
+    ! g_queue_is_empty (&browser->thumbnail_queue) ||
+    ! g_queue_is_empty (&browser->thumbnails);
+  g_mutex_unlock (&browser->mutex);
+
+  return busy;
+}
+
+void
+depth_browser_get_stats (DepthBrowser *browser, DepthBrowserStats *stats)
+{
+  g_return_if_fail (browser != NULL);
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&browser->mutex);
+  stats->n_cached = g_queue_get_length (&browser->lru);
+  stats->cache_size = browser->cache_size;
+  stats->max_cache_size = browser->max_cache_size;
+  stats->hits = browser->hits;
+  stats->misses = browser->misses;
+  stats->n_queued = g_queue_get_length (&browser->frame_queue) +
+    g_queue_get_length (&browser->thumbnail_queue);
+  g_mutex_unlock (&browser->mutex);
+}
@@ -0,0 +1,83 @@
+/* GFreenect Utils : depth-browser.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_BROWSER_H__
+#define __DEPTH_BROWSER_H__
+
+#include <glib.h>
+
+#include "depth-file.h"
+#include "depth-colormap.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthBrowser DepthBrowser;
+
+typedef struct
+{
+  guint index;
+  DepthFrameHeader header;
+  guint width;
+  guint height;
+  guint n_channels;
+  guchar *image;
+} DepthBrowserThumbnail;
+
+typedef struct
+{
+  guint n_cached;
+  gsize cache_size;
+  gsize max_cache_size;
+  guint64 hits;
+  guint64 misses;
+  guint n_queued;
+} DepthBrowserStats;
+
+DepthBrowser          *depth_browser_open               (const gchar    *path,
+                                                         guint           thumbnail_size,
+                                                         gsize           cache_size,
+                                                         GError        **error);
+void                   depth_browser_free               (DepthBrowser *browser);
+
+guint                  depth_browser_get_n_files        (DepthBrowser *browser);
+const gchar           *depth_browser_get_path           (DepthBrowser *browser,
+                                                         guint         index);
+void                   depth_browser_set_colormap       (DepthBrowser  *browser,
+                                                         DepthColormap *colormap);
+
+void                   depth_browser_request_thumbnails (DepthBrowser *browser,
+                                                         const guint  *indices,
+                                                         guint         n_indices);
+DepthBrowserThumbnail *depth_browser_pop_thumbnail      (DepthBrowser *browser);
+void                   depth_browser_thumbnail_free     (DepthBrowserThumbnail *thumbnail);
+
+void                   depth_browser_select             (DepthBrowser *browser,
+                                                         guint         index);
+const guint16         *depth_browser_get_frame          (DepthBrowser     *browser,
+                                                         guint             index,
+                                                         DepthFrameHeader *header);
+void                   depth_browser_release_frame      (DepthBrowser *browser,
+                                                         guint         index);
+gboolean               depth_browser_is_busy            (DepthBrowser *browser);
+
+void                   depth_browser_get_stats          (DepthBrowser      *browser,
+                                                         DepthBrowserStats *stats);
+
+G_END_DECLS
+
+#endif /* __DEPTH_BROWSER_H__ */
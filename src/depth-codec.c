@@ -0,0 +1,203 @@
+/* GFreenect Utils : depth-codec.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "depth-codec.h"
+
+/* Lossless depth frame codec.
+ *
+ * Every sample is predicted from its left neighbour, or from the
+ * first sample of the row above for the first sample of a row. The
+ * stream is a sequence of varints (7 bits per byte, least significant
+ * group first):
+ *
+ *   zigzag (sample - prediction)   a literal, never 0
+ *   0, run - 1                     run samples equal to their prediction
+ *
+ * Runs may span several rows. Thresholded frames are mostly long
+ * zero runs and smooth surfaces need a single byte per sample. */
+
+#define MAX_VARINT_BYTES 5
+
+static inline guint32
+zigzag_encode (gint32 value)
+{
+  return ((guint32) value << 1) ^ (guint32) (value >> 31);
+}
+
+static inline gint32
+zigzag_decode (guint32 value)
+{
+  return (gint32) (value >> 1) ^ - (gint32) (value & 1);
+}
+
+static inline guint8 *
+put_varint (guint8 *out, guint32 value)
+{
+  while (value >= 0x80)
+    {
+      *out++ = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+  *out++ = value;
+
+  return out;
+}
+
+static inline gboolean
+get_varint (const guint8 **in, const guint8 *end, guint32 *value)
+{
+  const guint8 *p = *in;
+  guint32 result = 0;
+  guint shift;
+
+  for (shift = 0; shift < MAX_VARINT_BYTES * 7; shift += 7)
+    {
+      if (p == end)
+        return FALSE;
+
+      result |= (guint32) (*p & 0x7f) << shift;
+      if ((*p++ & 0x80) == 0)
+        {
+          *in = p;
+          *value = result;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* A literal takes at most 3 bytes and a run at least covers one
+   sample in at most 2 bytes, plus one trailing run marker */
+gsize
+depth_codec_get_max_encoded_size (guint width, guint height)
+{
+  return (gsize) width * height * 3 + 1 + MAX_VARINT_BYTES;
+}
+
+/* Encodes a width x height frame into encoded, which must hold
+   depth_codec_get_max_encoded_size() bytes. Returns the encoded size */
+gsize
+depth_codec_encode (const guint16 *depth,
+                    guint          width,
+                    guint          height,
+                    guint8        *encoded)
+{
+  guint8 *out = encoded;
+  guint32 run = 0;
+  guint i, j;
+
+  g_return_val_if_fail (depth != NULL, 0);
+  g_return_val_if_fail (encoded != NULL, 0);
+
+  for (j = 0; j < height; j++)
+    {
+      const guint16 *row = depth + (gsize) j * width;
+      guint16 prediction = j > 0 ? row[- (gssize) width] : 0;
+
+      for (i = 0; i < width; i++)
+        {
+          guint16 value = row[i];
+
+          if (value == prediction)
+            {
+              run++;
+              continue;
+            }
+
+          if (run > 0)
+            {
+              *out++ = 0;
+              out = put_varint (out, run - 1);
+              run = 0;
+            }
+
+          out = put_varint (out, zigzag_encode ((gint32) value - prediction));
+          prediction = value;
+        }
+    }
+
+  if (run > 0)
+    {
+      *out++ = 0;
+      out = put_varint (out, run - 1);
+    }
+
+  return out - encoded;
+}
+
+/* Decodes a frame produced by depth_codec_encode(). Returns FALSE if
+   the data is corrupt or does not describe a width x height frame */
+gboolean
+depth_codec_decode (const guint8 *encoded,
+                    gsize         size,
+                    guint         width,
+                    guint         height,
+                    guint16      *depth)
+{
+  const guint8 *in = encoded;
+  const guint8 *end = encoded + size;
+  guint32 run = 0;
+  guint i, j;
+
+  g_return_val_if_fail (encoded != NULL || size == 0, FALSE);
+  g_return_val_if_fail (depth != NULL, FALSE);
+
+  for (j = 0; j < height; j++)
+    {
+      guint16 *row = depth + (gsize) j * width;
+      guint16 prediction = j > 0 ? row[- (gssize) width] : 0;
+
+      i = 0;
+      while (i < width)
+        {
+          guint32 token, n;
+
+          if (run == 0)
+            {
+              gint32 value;
+
+              if (! get_varint (&in, end, &token))
+                return FALSE;
+
+              if (token == 0)
+                {
+                  if (! get_varint (&in, end, &run) || run == G_MAXUINT32)
+                    return FALSE;
+                  run++;
+                  continue;
+                }
+
+              value = (gint32) prediction + zigzag_decode (token);
+              if (value < 0 || value > G_MAXUINT16)
+                return FALSE;
+
+              prediction = value;
+              row[i++] = prediction;
+              continue;
+            }
+
+          n = MIN (run, width - i);
+          run -= n;
+          while (n-- > 0)
+            row[i++] = prediction;
+        }
+    }
+
+  return run == 0 && in == end;
+}
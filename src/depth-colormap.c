@@ -0,0 +1,519 @@
+/* GFreenect Utils : depth-colormap.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "depth-colormap.h"
+#include "depth-processing.h"
+#include "worker-pool.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define N_ENTRIES (G_MAXUINT16 + 1)
+
+/* The AVX2 path reads the gray table 32 bits at a time */
+#define GRAY_TABLE_PADDING 3
+
+/* Samples with no depth are painted white in every palette */
+#define WHITE 255
+
+/* Frames are mapped in bands of this many samples, about 64 KiB of
+   depth and image, spread over the default worker pool */
+#define BAND_SAMPLES (16 * 1024)
+
+/* Every palette is precomputed for all the 65536 possible depth
+   values, so mapping a frame is one table lookup per sample. Gray
+   tables have a byte per entry, color tables a 32 bit word per entry
+   holding R, G and B in its first three bytes in memory */
+struct _DepthColormap
+{
+  volatile gint ref_count;
+  DepthColormapPalette palette;
+  guint range_begin;
+  guint range_end;
+  guint8 *gray;
+  guint32 *rgb;
+};
+
+typedef void (*ColormapRunFunc) (const DepthColormap *colormap,
+                                 const guint16       *depth,
+                                 gsize                n_samples,
+                                 guchar              *image);
+
+typedef struct
+{
+  DepthProcessingSimd simd;
+  ColormapRunFunc run;
+} ColormapImpl;
+
+typedef struct
+{
+  const ColormapImpl *impl;
+  const DepthColormap *colormap;
+  const guint16 *depth;
+  gsize n_samples;
+  guchar *image;
+  guint n_channels;
+} ColormapBands;
+
+static const gchar *palette_names[] = {
+  "gray",
+  "turbo",
+  "jet",
+  "near-far"
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (palette_names) == DEPTH_COLORMAP_LAST);
+
+static guint8
+to_byte (gdouble value)
+{
+  return (guint8) (CLAMP (value, 0., 1.) * 255. + .5);
+}
+
+/* round ((depth - begin) * 256 / (end - begin)), saturated to 8 bits.
+   The default range gives the levels the viewer always used, without
+   wrapping past 2999 mm */
+static guint8
+gray_level (guint depth, guint begin, guint end)
+{
+  guint value;
+
+  if (depth <= begin)
+    return 0;
+
+  value = ((depth - begin) * 256 + (end - begin) / 2) / (end - begin);
+  return MIN (value, 255);
+}
+
+/* Polynomial approximation of the Turbo colormap by Google, x in
+   [0, 1] from near to far */
+static void
+turbo_color (gdouble x, guint8 rgb[3])
+{
+  gdouble x2 = x * x;
+  gdouble x3 = x2 * x;
+  gdouble x4 = x2 * x2;
+  gdouble x5 = x4 * x;
+
+  rgb[0] = to_byte (0.13572138 + 4.61539260 * x - 42.66032258 * x2 +
+                    132.13108234 * x3 - 152.94239396 * x4 +
+                    59.28637943 * x5);
+  rgb[1] = to_byte (0.09140261 + 2.19418839 * x + 4.84296658 * x2 -
+                    14.18503333 * x3 + 4.27729857 * x4 +
+                    2.82956604 * x5);
+  rgb[2] = to_byte (0.10667330 + 12.64194608 * x - 60.58204836 * x2 +
+                    110.36276771 * x3 - 89.90310912 * x4 +
+                    27.34824973 * x5);
+}
+
+static void
+jet_color (gdouble x, guint8 rgb[3])
+{
+  rgb[0] = to_byte (1.5 - fabs (4. * x - 3.));
+  rgb[1] = to_byte (1.5 - fabs (4. * x - 2.));
+  rgb[2] = to_byte (1.5 - fabs (4. * x - 1.));
+}
+
+static void
+fill_rgb_table (DepthColormap *colormap)
+{
+  guint begin = colormap->range_begin;
+  guint end = colormap->range_end;
+  guint depth;
+
+  colormap->rgb = g_new (guint32, N_ENTRIES);
+
+  for (depth = 0; depth < N_ENTRIES; depth++)
+    {
+      guint8 rgb[3];
+      gdouble x;
+
+      x = depth <= begin ? 0. :
+        MIN ((depth - begin) / (gdouble) (end - begin), 1.);
+
+      if (depth == 0)
+        {
+          memset (rgb, WHITE, 3);
+        }
+      else if (colormap->palette == DEPTH_COLORMAP_TURBO)
+        {
+          turbo_color (x, rgb);
+        }
+      else if (colormap->palette == DEPTH_COLORMAP_JET)
+        {
+          jet_color (x, rgb);
+        }
+      else
+        {
+          /* Near/far: gray inside the range, red nearer and blue
+             farther */
+          if (depth < begin)
+            {
+              rgb[0] = 255;
+              rgb[1] = rgb[2] = 0;
+            }
+          else if (depth > end)
+            {
+              rgb[0] = rgb[1] = 0;
+              rgb[2] = 255;
+            }
+          else
+            {
+              memset (rgb, gray_level (depth, begin, end), 3);
+            }
+        }
+
+      colormap->rgb[depth] = GUINT32_TO_LE (rgb[0] | rgb[1] << 8 |
+                                            rgb[2] << 16);
+    }
+}
+
+static void
+fill_gray_table (DepthColormap *colormap)
+{
+  guint depth;
+
+  colormap->gray = g_malloc0 (N_ENTRIES + GRAY_TABLE_PADDING);
+
+  colormap->gray[0] = WHITE;
+  for (depth = 1; depth < N_ENTRIES; depth++)
+    colormap->gray[depth] = gray_level (depth, colormap->range_begin,
+                                        colormap->range_end);
+}
+
+static void
+colormap_run_scalar (const DepthColormap *colormap,
+                     const guint16       *depth,
+                     gsize                n_samples,
+                     guchar              *image)
+{
+  gsize i;
+
+  if (colormap->gray != NULL)
+    {
+      for (i = 0; i < n_samples; i++)
+        image[i] = colormap->gray[depth[i]];
+    }
+  else
+    {
+      for (i = 0; i < n_samples; i++)
+        {
+          guint32 entry = colormap->rgb[depth[i]];
+          memcpy (image + i * 3, &entry, 3);
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* Looks 8 samples up at a time with gathers, then packs the lowest
+   byte (gray) or the lowest three bytes (color) of every entry */
+
+__attribute__ ((target ("avx2")))
+static void
+colormap_run_avx2 (const DepthColormap *colormap,
+                   const guint16       *depth,
+                   gsize                n_samples,
+                   guchar              *image)
+{
+  gsize i = 0;
+
+  if (colormap->gray != NULL)
+    {
+      const __m256i pack = _mm256_setr_epi8 (0, 4, 8, 12, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 8, 12, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1);
+      const __m256i order = _mm256_setr_epi32 (0, 4, 1, 1, 1, 1, 1, 1);
+
+      for (; i + 8 <= n_samples; i += 8)
+        {
+          __m256i index, entries;
+
+          index = _mm256_cvtepu16_epi32 (
+            _mm_loadu_si128 ((const __m128i *) (depth + i)));
+          entries = _mm256_i32gather_epi32 ((const int *) colormap->gray,
+                                            index, 1);
+          entries = _mm256_permutevar8x32_epi32 (
+            _mm256_shuffle_epi8 (entries, pack), order);
+          _mm_storel_epi64 ((__m128i *) (image + i),
+                            _mm256_castsi256_si128 (entries));
+        }
+    }
+  else
+    {
+      const __m256i pack = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9,
+                                             10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9,
+                                             10, 12, 13, 14, -1, -1, -1, -1);
+      const __m256i order = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7);
+
+      /* Every store writes 32 bytes for 24 bytes of pixels, so the
+         last samples are left to the scalar loop */
+      for (; i + 16 <= n_samples; i += 8)
+        {
+          __m256i index, entries;
+
+          index = _mm256_cvtepu16_epi32 (
+            _mm_loadu_si128 ((const __m128i *) (depth + i)));
+          entries = _mm256_i32gather_epi32 ((const int *) colormap->rgb,
+                                            index, 4);
+          entries = _mm256_permutevar8x32_epi32 (
+            _mm256_shuffle_epi8 (entries, pack), order);
+          _mm256_storeu_si256 ((__m256i *) (image + i * 3), entries);
+        }
+    }
+
+  colormap_run_scalar (colormap, depth + i, n_samples - i,
+                       image + i * (colormap->gray != NULL ? 1 : 3));
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const ColormapImpl implementations[] = {
+#ifdef HAVE_X86_SIMD
+  { DEPTH_PROCESSING_SIMD_AVX2, colormap_run_avx2 },
+#endif
+  { DEPTH_PROCESSING_SIMD_SCALAR, colormap_run_scalar }
+};
+
+static const ColormapImpl *
+get_implementation (void)
+{
+  DepthProcessingSimd simd = depth_processing_get_simd ();
+  guint i;
+
+  /* The most capable first, down to the scalar one */
+  for (i = 0; implementations[i].simd > simd; i++)
+    ;
+
+  return &implementations[i];
+}
+
+/* Creates the lookup table mapping depths in [range_begin, range_end]
+   millimeters to the palette. Gray colormaps produce one byte per
+   sample, the others RGB */
+DepthColormap *
+depth_colormap_new (DepthColormapPalette palette,
+                    guint                range_begin,
+                    guint                range_end)
+{
+  DepthColormap *colormap;
+
+  g_return_val_if_fail (palette < DEPTH_COLORMAP_LAST, NULL);
+  g_return_val_if_fail (range_begin < range_end, NULL);
+  g_return_val_if_fail (range_end <= G_MAXUINT16, NULL);
+
+  colormap = g_slice_new0 (DepthColormap);
+  colormap->ref_count = 1;
+  colormap->palette = palette;
+  colormap->range_begin = range_begin;
+  colormap->range_end = range_end;
+
+  if (palette == DEPTH_COLORMAP_GRAY)
+    fill_gray_table (colormap);
+  else
+    fill_rgb_table (colormap);
+
+  return colormap;
+}
+
+DepthColormap *
+depth_colormap_ref (DepthColormap *colormap)
+{
+  g_return_val_if_fail (colormap != NULL, NULL);
+
+  g_atomic_int_inc (&colormap->ref_count);
+  return colormap;
+}
+
+void
+depth_colormap_unref (DepthColormap *colormap)
+{
+  g_return_if_fail (colormap != NULL);
+
+  if (! g_atomic_int_dec_and_test (&colormap->ref_count))
+    return;
+
+  g_free (colormap->gray);
+  g_free (colormap->rgb);
+  g_slice_free (DepthColormap, colormap);
+}
+
+DepthColormapPalette
+depth_colormap_get_palette (DepthColormap *colormap)
+{
+  g_return_val_if_fail (colormap != NULL, DEPTH_COLORMAP_GRAY);
+
+  return colormap->palette;
+}
+
+void
+depth_colormap_get_range (DepthColormap *colormap,
+                          guint         *range_begin,
+                          guint         *range_end)
+{
+  g_return_if_fail (colormap != NULL);
+
+  if (range_begin != NULL)
+    *range_begin = colormap->range_begin;
+  if (range_end != NULL)
+    *range_end = colormap->range_end;
+}
+
+/* Bytes per pixel of the images written by depth_colormap_apply() */
+guint
+depth_colormap_get_n_channels (DepthColormap *colormap)
+{
+  g_return_val_if_fail (colormap != NULL, 0);
+
+  return colormap->gray != NULL ? 1 : 3;
+}
+
+static void
+colormap_band (guint band, gpointer user_data)
+{
+  const ColormapBands *bands = user_data;
+  gsize begin = (gsize) band * BAND_SAMPLES;
+
+  bands->impl->run (bands->colormap, bands->depth + begin,
+                    MIN (BAND_SAMPLES, bands->n_samples - begin),
+                    bands->image + begin * bands->n_channels);
+}
+
+/* Maps n_samples depth values to image, which must hold n_samples
+   times the number of channels bytes */
+void
+depth_colormap_apply (DepthColormap *colormap,
+                      const guint16 *depth,
+                      gsize          n_samples,
+                      guchar        *image)
+{
+  ColormapBands bands;
+
+  g_return_if_fail (colormap != NULL);
+  g_return_if_fail (depth != NULL || n_samples == 0);
+  g_return_if_fail (image != NULL || n_samples == 0);
+
+  bands.impl = get_implementation ();
+  bands.colormap = colormap;
+  bands.depth = depth;
+  bands.n_samples = n_samples;
+  bands.image = image;
+  bands.n_channels = depth_colormap_get_n_channels (colormap);
+
+  worker_pool_run (worker_pool_get_default (),
+                   (n_samples + BAND_SAMPLES - 1) / BAND_SAMPLES,
+                   colormap_band, &bands);
+}
+
+/* Histogram bins are 16 mm wide */
+#define RANGE_BIN_SHIFT 4
+#define RANGE_N_BINS (N_ENTRIES >> RANGE_BIN_SHIFT)
+
+/* Share of the samples ignored at each end of the range */
+#define RANGE_OUTLIERS 0.02
+
+/* Finds the range holding most of the samples with depth, ignoring the
+   nearest and farthest outliers. Returns FALSE if no sample has
+   depth */
+gboolean
+depth_colormap_find_range (const guint16 *depth,
+                           gsize          n_samples,
+                           guint         *range_begin,
+                           guint         *range_end)
+{
+  guint32 *histogram;
+  gsize i, total = 0, low, high, count;
+  guint begin_bin = 0, end_bin = 0;
+
+  g_return_val_if_fail (depth != NULL || n_samples == 0, FALSE);
+  g_return_val_if_fail (range_begin != NULL && range_end != NULL, FALSE);
+
+  histogram = g_new0 (guint32, RANGE_N_BINS);
+  for (i = 0; i < n_samples; i++)
+    {
+      if (depth[i] != 0)
+        {
+          histogram[depth[i] >> RANGE_BIN_SHIFT]++;
+          total++;
+        }
+    }
+
+  if (total == 0)
+    {
+      g_free (histogram);
+      return FALSE;
+    }
+
+  low = total * RANGE_OUTLIERS;
+  high = total - low;
+
+  count = 0;
+  for (i = 0; i < RANGE_N_BINS; i++)
+    {
+      if (count <= low)
+        begin_bin = i;
+      count += histogram[i];
+      if (count >= high)
+        {
+          end_bin = i;
+          break;
+        }
+    }
+  g_free (histogram);
+
+  *range_begin = begin_bin << RANGE_BIN_SHIFT;
+  *range_end = MIN ((end_bin + 1) << RANGE_BIN_SHIFT, G_MAXUINT16);
+
+  return TRUE;
+}
+
+const gchar *
+depth_colormap_palette_get_name (DepthColormapPalette palette)
+{
+  g_return_val_if_fail (palette < DEPTH_COLORMAP_LAST, NULL);
+
+  return palette_names[palette];
+}
+
+gboolean
+depth_colormap_palette_from_string (const gchar          *name,
+                                    DepthColormapPalette *palette)
+{
+  guint i;
+
+  g_return_val_if_fail (name != NULL, FALSE);
+
+  for (i = 0; i < DEPTH_COLORMAP_LAST; i++)
+    {
+      if (g_ascii_strcasecmp (name, palette_names[i]) == 0)
+        {
+          if (palette != NULL)
+            *palette = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,69 @@
+/* GFreenect Utils : depth-colormap.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_COLORMAP_H__
+#define __DEPTH_COLORMAP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Depth in millimeters that the gray palette has always covered */
+#define DEPTH_COLORMAP_DEFAULT_BEGIN 0
+#define DEPTH_COLORMAP_DEFAULT_END   3000
+
+typedef enum
+{
+  DEPTH_COLORMAP_GRAY,
+  DEPTH_COLORMAP_TURBO,
+  DEPTH_COLORMAP_JET,
+  DEPTH_COLORMAP_NEAR_FAR,
+  DEPTH_COLORMAP_LAST
+} DepthColormapPalette;
+
+typedef struct _DepthColormap DepthColormap;
+
+DepthColormap *depth_colormap_new            (DepthColormapPalette palette,
+                                              guint                range_begin,
+                                              guint                range_end);
+DepthColormap *depth_colormap_ref            (DepthColormap *colormap);
+void           depth_colormap_unref          (DepthColormap *colormap);
+
+DepthColormapPalette depth_colormap_get_palette (DepthColormap *colormap);
+void           depth_colormap_get_range      (DepthColormap *colormap,
+                                              guint         *range_begin,
+                                              guint         *range_end);
+guint          depth_colormap_get_n_channels (DepthColormap *colormap);
+
+void           depth_colormap_apply          (DepthColormap *colormap,
+                                              const guint16 *depth,
+                                              gsize          n_samples,
+                                              guchar        *image);
+
+gboolean       depth_colormap_find_range     (const guint16 *depth,
+                                              gsize          n_samples,
+                                              guint         *range_begin,
+                                              guint         *range_end);
+
+const gchar   *depth_colormap_palette_get_name    (DepthColormapPalette palette);
+gboolean       depth_colormap_palette_from_string (const gchar          *name,
+                                                   DepthColormapPalette *palette);
+
+G_END_DECLS
+
+#endif /* __DEPTH_COLORMAP_H__ */
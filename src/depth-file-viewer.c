@@ -19,171 +19,821 @@
  */
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <glib-object.h>
 #include <clutter/clutter.h>
+#include <clutter/clutter-keysyms.h>
+
+#include "depth-sequence.h"
+#include "depth-player.h"
+#include "depth-image.h"
+#include "depth-texture.h"
+#include "depth-colormap.h"
+#include "depth-points.h"
+#include "depth-browser.h"
 
 static ClutterActor *info_text;
+static ClutterActor *depth_group;
 static ClutterActor *depth_tex;
+static ClutterActor *points_tex;
+
+/* Frames decoded ahead of the one being shown */
+#define PREFETCH_FRAMES 4
+
+#define SEEK_STEP (5 * G_USEC_PER_SEC)
+
+/* How often the playback rate is measured */
+#define FPS_INTERVAL G_USEC_PER_SEC
+
+/* How long to wait for a frame the prefetch thread is still decoding */
+#define RETRY_INTERVAL 2
+
+/* Browse mode shows the files of a directory as a grid of thumbnails
+   next to the selected file, only making actors for the cells in view
+   so directories of any size open at once */
+#define THUMBNAIL_SIZE 80
+#define GRID_COLUMNS 5
+#define GRID_ROWS 5
+#define GRID_SPACING 8
+#define GRID_PITCH (THUMBNAIL_SIZE + GRID_SPACING)
+#define DEFAULT_CACHE_MEMORY 256
+
+typedef struct
+{
+  ClutterActor *background;
+  ClutterActor *thumbnail;
+  gint index;
+  gboolean loaded;
+} GridCell;
+
+static const gchar *file_name;
+static DepthSequence *sequence = NULL;
+static DepthPlayer *player = NULL;
+static gchar *points_file = NULL;
+static DepthPoints *points = NULL;
+
+/* Points are drawn on a transparent overlay over the depth texture,
+   so frames can still be uploaded as grayscale, and it is only drawn
+   again when the frame size changes or some points are for a single
+   frame */
+static guchar *points_image = NULL;
+static DepthFrameHeader points_header;
+static gint points_frame = -1;
 
-#define POINT_SIZE 6
+/* Playback clock: when playing, the frame captured at
+   start_position + (now - start_time) is the one to show */
+static gboolean playing = FALSE;
+static gint64 start_time = 0;
+static gint64 start_position = 0;
+
+static guint target_frame = 0;
+static gint shown_frame = -1;
+static DepthFrameHeader shown_header;
+static guint tick_id = 0;
+
+static guint64 late_frames = 0;
+static guint presented_frames = 0;
+static gint64 fps_start_time = 0;
+static gdouble achieved_fps = 0.;
+static gdouble target_fps = 0.;
+
+static gchar *palette_name = NULL;
+static gchar *range_str = NULL;
+static DepthColormap *colormap = NULL;
+
+static gboolean browse = FALSE;
+static gint cache_memory = DEFAULT_CACHE_MEMORY;
+static DepthBrowser *browser = NULL;
+static GridCell grid_cells[GRID_COLUMNS * GRID_ROWS];
+static ClutterActor *grid_selection;
+static guint first_row = 0;
+static guint selected_file = 0;
+static gboolean selected_failed = FALSE;
+static guchar *browse_image = NULL;
+static gsize browse_image_size = 0;
+
+static GOptionEntry entries[] =
+{
+  { "palette", 0, 0, G_OPTION_ARG_STRING, &palette_name,
+    "Color depth with PALETTE: gray (the default), turbo, jet or near-far, "
+    "which shows depths before and after the range in red and blue",
+    "PALETTE" },
+  { "range", 0, 0, G_OPTION_ARG_STRING, &range_str,
+    "Depth range in millimeters covered by the palette, or auto to find it "
+    "from the first frame, 0,3000 by default", "BEGIN,END|auto" },
+  { "points", 0, 0, G_OPTION_ARG_FILENAME, &points_file,
+    "Draw the points in FILE, with a [FRAME,]#RRGGBB,X,Y point per line or "
+    "in the binary points format", "FILE" },
+  { "browse", 'b', 0, G_OPTION_ARG_NONE, &browse,
+    "Browse the depth files of a directory as a grid of thumbnails", NULL },
+  { "cache-memory", 0, 0, G_OPTION_ARG_INT, &cache_memory,
+    "Memory in MB for the full resolution frames of browsed files, 256 by "
+    "default", "MB" },
+  { NULL }
+};
+
+static gboolean tick (gpointer data);
+static void schedule_tick (guint interval);
+
+static GSourceFunc tick_func = tick;
 
 static void
-grayscale_buffer_set_value (guchar *buffer, gint index, guchar value)
+paint_points (const DepthFrameHeader *header, gint frame)
 {
-  buffer[index * 3] = value;
-  buffer[index * 3 + 1] = value;
-  buffer[index * 3 + 2] = value;
+  GError *error = NULL;
+  gsize size;
+
+  if (depth_points_get_n_points (points) == 0)
+    return;
+
+  if (header->width == points_header.width &&
+      header->height == points_header.height &&
+      header->dimension_factor == points_header.dimension_factor &&
+      header->x_offset == points_header.x_offset &&
+      header->y_offset == points_header.y_offset &&
+      (frame == points_frame || ! depth_points_has_frames (points)))
+    return;
+
+  size = (gsize) header->width * header->height * 4;
+  if (header->width != points_header.width ||
+      header->height != points_header.height)
+    {
+      g_free (points_image);
+      points_image = g_malloc (size);
+    }
+  memset (points_image, 0, size);
+
+  depth_points_draw (points, frame, points_image,
+                     header->width, header->height, 4,
+                     header->dimension_factor,
+                     header->x_offset, header->y_offset);
+
+  if (! depth_texture_upload (CLUTTER_TEXTURE (points_tex), points_image,
+                              header->width, header->height, 4, &error))
+    {
+      g_debug ("Error setting points texture: %s", error->message);
+      g_error_free (error);
+    }
+
+  points_header = *header;
+  points_frame = frame;
 }
 
+/* Frames cropped to a region of interest are shown where the region
+   was in the whole frame */
 static void
-draw_point (guchar *buffer,
-            guint width,
-            guint height,
-            gchar *color_str,
-            guint x,
-            guint y)
-{
-  ClutterColor *color = clutter_color_new (0, 0, 0, 255);
-  clutter_color_from_string (color, color_str);
-  gint i, j;
-  for (i = -POINT_SIZE; i < POINT_SIZE; i++)
-    {
-      for (j = -POINT_SIZE; j < POINT_SIZE; j++)
-        {
-          if (x + i < 0 || x + i >= width ||
-              y + j < 0 || y + j >= height)
-            continue;
+place_depth_group (const DepthFrameHeader *header)
+{
+  clutter_actor_set_position (depth_group,
+                              header->x_offset / header->dimension_factor,
+                              header->y_offset / header->dimension_factor);
+}
 
-          buffer[(width * (y + j) + x + i) * 3] = color->red;
-          buffer[(width * (y + j) + x + i) * 3 + 1] = color->green;
-          buffer[(width * (y + j) + x + i) * 3 + 2] = color->blue;
-        }
+static gboolean
+paint_texture (guchar *buffer, guint width, guint height, guint n_channels)
+{
+  GError *error = NULL;
+  if (! depth_texture_upload (CLUTTER_TEXTURE (depth_tex),
+                              buffer, width, height, n_channels, &error))
+    {
+      g_debug ("Error setting texture area: %s", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static void
+set_info_text (void)
+{
+  const DepthFrameHeader *header = &shown_header;
+  guint n_frames, range_begin, range_end;
+  GString *title;
+
+  title = g_string_new (NULL);
+  g_string_append_printf (title, "<b>File:</b> %s (%ux%u", file_name,
+                          header->width, header->height);
+  if (header->dimension_factor > 1)
+    g_string_append_printf (title, ", reduced 1/%u", header->dimension_factor);
+  if (header->x_offset > 0 || header->y_offset > 0)
+    g_string_append_printf (title, ", cropped at %u,%u",
+                            header->x_offset, header->y_offset);
+  g_string_append (title, ")");
+
+  if (header->threshold_end > 0)
+    g_string_append_printf (title, "\n<b>Threshold:</b> %u - %u mm",
+                            header->threshold_begin, header->threshold_end);
+
+  depth_colormap_get_range (colormap, &range_begin, &range_end);
+  g_string_append_printf (title, "\n<b>Palette:</b> %s, %u - %u mm",
+                          depth_colormap_palette_get_name (
+                            depth_colormap_get_palette (colormap)),
+                          range_begin, range_end);
+
+  if (header->timestamp > 0)
+    {
+      GDateTime *date;
+      gchar *date_str;
+
+      date = g_date_time_new_from_unix_local (header->timestamp /
+                                              G_USEC_PER_SEC);
+      date_str = g_date_time_format (date, "%Y-%m-%d %H:%M:%S");
+      g_string_append_printf (title, "\n<b>Captured:</b> %s", date_str);
+      g_free (date_str);
+      g_date_time_unref (date);
+    }
+
+  if (browser != NULL)
+    {
+      DepthBrowserStats stats;
+
+      depth_browser_get_stats (browser, &stats);
+      g_string_append_printf (title, "\n<b>Browsing:</b> file %u/%u%s",
+                              selected_file + 1,
+                              depth_browser_get_n_files (browser),
+                              selected_failed ? ", cannot be read" : "");
+      g_string_append_printf (title, "\n<b>Cache:</b> %u frames, "
+                              "%.1f/%.1f MB, %" G_GUINT64_FORMAT " hits, "
+                              "%" G_GUINT64_FORMAT " misses",
+                              stats.n_cached,
+                              stats.cache_size / (1024. * 1024.),
+                              stats.max_cache_size / (1024. * 1024.),
+                              stats.hits, stats.misses);
+    }
+
+  n_frames = sequence != NULL ? depth_sequence_get_n_frames (sequence) : 0;
+  if (n_frames > 1)
+    {
+      g_string_append_printf (title, "\n<b>Frame:</b> %d/%u, %.2f s%s",
+                              shown_frame + 1, n_frames,
+                              depth_sequence_get_time (sequence,
+                                                       MAX (shown_frame, 0)) /
+                              (gdouble) G_USEC_PER_SEC,
+                              playing ? "" : " (paused)");
+      g_string_append_printf (title, "\n<b>Playback:</b> %.1f/%.1f fps, "
+                              "%" G_GUINT64_FORMAT " frames dropped",
+                              playing ? achieved_fps : 0., target_fps,
+                              late_frames + depth_player_get_skipped (player));
     }
 
-  clutter_color_free (color);
+  clutter_text_set_markup (CLUTTER_TEXT (info_text), title->str);
+  g_string_free (title, TRUE);
 }
 
-static guchar *
-create_grayscale_buffer (guint16 *buffer, guint width, guint height)
+static gint64
+get_position (void)
 {
-  gint i,j;
-  gint size;
-  guchar *grayscale_buffer;
+  if (! playing)
+    return depth_sequence_get_time (sequence, target_frame);
 
-  size = width * height * sizeof (guchar) * 3;
-  grayscale_buffer = g_slice_alloc (size);
-  /*Paint it white*/
-  memset (grayscale_buffer, 255, size);
+  return start_position + g_get_monotonic_time () - start_time;
+}
+
+static void
+update_fps (void)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (now - fps_start_time < FPS_INTERVAL)
+    return;
+
+  achieved_fps = presented_frames * (gdouble) G_USEC_PER_SEC /
+    (now - fps_start_time);
+  presented_frames = 0;
+  fps_start_time = now;
+}
+
+/* Shows the frame due at the current position, throwing away the
+   prefetched frames that are already late, and sleeps until the next
+   one is due */
+static gboolean
+tick (gpointer data)
+{
+  DepthPlayerFrame *frame;
+  guint n_frames = depth_sequence_get_n_frames (sequence);
+  gint64 position;
 
-  for (i = 0; i < width; i++)
+  tick_id = 0;
+
+  position = get_position ();
+  if (playing)
+    {
+      target_frame = depth_sequence_find_frame (sequence, position);
+      depth_player_skip_to (player, target_frame);
+    }
+
+  while ((frame = depth_player_peek (player)) != NULL &&
+         frame->frame < target_frame)
+    {
+      depth_player_pop (player);
+      if (playing)
+        late_frames++;
+    }
+
+  /* A frame after the target means the target could not be read */
+  if (frame != NULL && (gint) target_frame != shown_frame)
     {
-      for (j = 0; j < height; j++)
+      target_frame = frame->frame;
+      place_depth_group (&frame->header);
+      paint_texture (frame->image, frame->header.width, frame->header.height,
+                     frame->n_channels);
+      paint_points (&frame->header, frame->frame);
+      shown_frame = frame->frame;
+      shown_header = frame->header;
+      presented_frames++;
+      depth_player_pop (player);
+
+      if (playing && target_frame == n_frames - 1)
+        playing = FALSE;
+
+      update_fps ();
+      set_info_text ();
+    }
+
+  if ((gint) target_frame != shown_frame)
+    schedule_tick (RETRY_INTERVAL);
+  else if (playing)
+    schedule_tick ((depth_sequence_get_time (sequence, target_frame + 1) -
+                    position) / 1000 + 1);
+
+  return FALSE;
+}
+
+static void
+schedule_tick (guint interval)
+{
+  if (tick_id != 0)
+    g_source_remove (tick_id);
+  tick_id = g_timeout_add (interval, tick_func, NULL);
+}
+
+static void
+set_playing (gboolean play)
+{
+  guint n_frames = depth_sequence_get_n_frames (sequence);
+
+  if (play && target_frame == n_frames - 1)
+    {
+      target_frame = 0;
+      depth_player_seek (player, 0);
+    }
+
+  start_position = depth_sequence_get_time (sequence, target_frame);
+  start_time = g_get_monotonic_time ();
+  fps_start_time = start_time;
+  presented_frames = 0;
+  playing = play && n_frames > 1;
+
+  schedule_tick (0);
+  set_info_text ();
+}
+
+/* Pauses on the given frame */
+static void
+go_to_frame (gint frame)
+{
+  guint n_frames = depth_sequence_get_n_frames (sequence);
+
+  frame = CLAMP (frame, 0, (gint) n_frames - 1);
+
+  /* Going forwards the frame is likely prefetched already */
+  if (frame < shown_frame || frame > shown_frame + PREFETCH_FRAMES)
+    depth_player_seek (player, frame);
+  else
+    depth_player_skip_to (player, frame);
+
+  target_frame = frame;
+  set_playing (FALSE);
+}
+
+static void
+seek (gint64 offset)
+{
+  gboolean was_playing = playing;
+
+  go_to_frame (depth_sequence_find_frame (sequence,
+                                          MAX (get_position () + offset, 0)));
+  if (was_playing)
+    set_playing (TRUE);
+}
+
+/* The cell showing the file at index, or NULL if it is not in view */
+static GridCell *
+get_grid_cell (guint index)
+{
+  guint first = first_row * GRID_COLUMNS;
+
+  if (index < first || index >= first + G_N_ELEMENTS (grid_cells))
+    return NULL;
+
+  return &grid_cells[index - first];
+}
+
+/* Assigns the files in view to the cells and asks for the thumbnails
+   they lack */
+static void
+update_grid (void)
+{
+  guint indices[G_N_ELEMENTS (grid_cells)];
+  guint n_files = depth_browser_get_n_files (browser);
+  guint i, n_indices = 0;
+  GridCell *cell;
+
+  for (i = 0; i < G_N_ELEMENTS (grid_cells); i++)
+    {
+      guint index = first_row * GRID_COLUMNS + i;
+
+      cell = &grid_cells[i];
+      if (index >= n_files)
         {
-          guint16 value = round (buffer[j * width + i]  * 256. / 3000.);
-          if (value != 0)
-            {
-              gint index = j * width + i;
-              grayscale_buffer_set_value (grayscale_buffer,
-                                          index,
-                                          value);
-            }
+          cell->index = -1;
+          clutter_actor_hide (cell->background);
+          clutter_actor_hide (cell->thumbnail);
+          continue;
         }
+
+      clutter_actor_show (cell->background);
+      if (cell->index != (gint) index)
+        {
+          cell->index = index;
+          cell->loaded = FALSE;
+          clutter_actor_hide (cell->thumbnail);
+        }
+
+      if (! cell->loaded)
+        indices[n_indices++] = index;
+    }
+
+  depth_browser_request_thumbnails (browser, indices, n_indices);
+
+  cell = get_grid_cell (selected_file);
+  if (cell != NULL)
+    {
+      gfloat x, y;
+
+      clutter_actor_get_position (cell->background, &x, &y);
+      clutter_actor_set_position (grid_selection,
+                                  x - GRID_SPACING / 2, y - GRID_SPACING / 2);
+      clutter_actor_show (grid_selection);
+    }
+  else
+    {
+      clutter_actor_hide (grid_selection);
     }
 
-  return grayscale_buffer;
+  schedule_tick (0);
+}
+
+static void
+scroll_grid (gint n_rows)
+{
+  guint n_files = depth_browser_get_n_files (browser);
+  gint last_row;
+
+  last_row = (n_files + GRID_COLUMNS - 1) / GRID_COLUMNS - GRID_ROWS;
+  first_row = CLAMP ((gint) first_row + n_rows, 0, MAX (last_row, 0));
+  update_grid ();
 }
 
-static guint16 *
-read_file_to_buffer (const gchar *name, gsize count, GError *e)
+/* Selects the file at index, scrolling the grid to it */
+static void
+select_file (gint index)
+{
+  guint n_files = depth_browser_get_n_files (browser);
+  guint row;
+
+  selected_file = CLAMP (index, 0, (gint) n_files - 1);
+
+  row = selected_file / GRID_COLUMNS;
+  if (row < first_row)
+    first_row = row;
+  else if (row >= first_row + GRID_ROWS)
+    first_row = row - GRID_ROWS + 1;
+
+  depth_browser_select (browser, selected_file);
+  update_grid ();
+}
+
+static void
+show_browsed_frame (const guint16 *depth, const DepthFrameHeader *header)
+{
+  gsize n_samples = (gsize) header->width * header->height;
+  guint n_channels = depth_colormap_get_n_channels (colormap);
+
+  if (n_samples * n_channels > browse_image_size)
+    {
+      g_free (browse_image);
+      browse_image_size = n_samples * n_channels;
+      browse_image = g_malloc (browse_image_size);
+    }
+
+  depth_colormap_apply (colormap, depth, n_samples, browse_image);
+  place_depth_group (header);
+  paint_texture (browse_image, header->width, header->height, n_channels);
+  paint_points (header, 0);
+  clutter_actor_show (depth_group);
+}
+
+static void
+paint_thumbnail (GridCell *cell, DepthBrowserThumbnail *thumbnail)
 {
   GError *error = NULL;
-  guint16 *depth = NULL;
-  GFile *new_file = g_file_new_for_path (name);
-  GFileInputStream *input_stream = g_file_read (new_file,
-                                                NULL,
-                                                &error);
-  if (error != NULL)
+
+  if (! depth_texture_upload (CLUTTER_TEXTURE (cell->thumbnail),
+                              thumbnail->image,
+                              thumbnail->width, thumbnail->height,
+                              thumbnail->n_channels, &error))
     {
-      g_debug ("ERROR: %s", error->message);
+      g_debug ("Error setting thumbnail: %s", error->message);
+      g_error_free (error);
+      return;
     }
-  else
+
+  clutter_actor_show (cell->thumbnail);
+}
+
+/* Puts the decoded thumbnails in their cells and shows the selected
+   file once its frame is decoded, polling while the browser is busy */
+static gboolean
+browse_tick (gpointer data)
+{
+  DepthBrowserThumbnail *thumbnail;
+  DepthFrameHeader header;
+  const guint16 *depth;
+
+  tick_id = 0;
+
+  while ((thumbnail = depth_browser_pop_thumbnail (browser)) != NULL)
     {
-      gsize bread = 0;
-      depth = g_slice_alloc (count);
-      g_input_stream_read_all ((GInputStream *) input_stream,
-                               depth,
-                               count,
-                               &bread,
-                               NULL,
-                               &error);
+      GridCell *cell = get_grid_cell (thumbnail->index);
 
-      if (error != NULL)
+      /* Files that cannot be read are left as empty cells */
+      if (cell != NULL && ! cell->loaded)
+        {
+          cell->loaded = TRUE;
+          if (thumbnail->image != NULL)
+            paint_thumbnail (cell, thumbnail);
+        }
+      depth_browser_thumbnail_free (thumbnail);
+    }
+
+  if (shown_frame != (gint) selected_file)
+    {
+      depth = depth_browser_get_frame (browser, selected_file, &header);
+      if (depth != NULL)
         {
-          g_debug ("ERROR: %s", error->message);
+          show_browsed_frame (depth, &header);
+          depth_browser_release_frame (browser, selected_file);
+
+          shown_frame = selected_file;
+          shown_header = header;
+          file_name = depth_browser_get_path (browser, selected_file);
+          selected_failed = FALSE;
+          set_info_text ();
         }
     }
-  return depth;
+
+  if (depth_browser_is_busy (browser))
+    {
+      schedule_tick (RETRY_INTERVAL);
+    }
+  else if (shown_frame != (gint) selected_file)
+    {
+      /* Nothing left to decode, so the file could not be read */
+      clutter_actor_hide (depth_group);
+      shown_frame = selected_file;
+      file_name = depth_browser_get_path (browser, selected_file);
+      selected_failed = TRUE;
+      set_info_text ();
+    }
+
+  return FALSE;
 }
 
 static gboolean
-paint_texture (guchar *buffer, guint width, guint height)
+on_cell_clicked (ClutterActor *actor,
+                 ClutterEvent *event,
+                 gpointer data)
 {
-  GError *error = NULL;
-  if (! clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (depth_tex),
-                                           buffer,
-                                           FALSE,
-                                           width, height,
-                                           0,
-                                           3,
-                                           CLUTTER_TEXTURE_NONE,
-                                           &error))
+  GridCell *cell = data;
+
+  if (cell->index >= 0)
+    select_file (cell->index);
+  return TRUE;
+}
+
+static gboolean
+on_scroll (ClutterActor *actor,
+           ClutterEvent *event,
+           gpointer data)
+{
+  switch (clutter_event_get_scroll_direction (event))
     {
-      g_debug ("Error setting texture area: %s", error->message);
-      g_error_free (error);
-      return FALSE;
+    case CLUTTER_SCROLL_UP:
+      scroll_grid (-1);
+      break;
+    case CLUTTER_SCROLL_DOWN:
+      scroll_grid (1);
+      break;
+    default:
+      break;
     }
-  g_slice_free1 (width * height * sizeof (guchar) * 3, buffer);
   return TRUE;
 }
 
-static guchar *
-load_image (const gchar *name, guint width, guint height)
+static void
+create_grid (ClutterActor *stage, gfloat x)
 {
-  guchar *grayscale_buffer;
-  guint16 *depth;
-  gchar *contents;
-  gsize len;
-  GError *error = NULL;
+  ClutterColor background_color = { 0x40, 0x40, 0x40, 0xff };
+  ClutterColor selection_color = { 0xff, 0xcc, 0x00, 0xff };
+  ClutterColor transparent = { 0, 0, 0, 0 };
+  ClutterActor *grid;
+  guint i;
+
+  grid = clutter_group_new ();
+  clutter_actor_set_position (grid, x, 0);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), grid);
 
-  gsize count = width * height * sizeof (guint16);
-  depth = read_file_to_buffer (name, count, error);
+  grid_selection = clutter_rectangle_new_with_color (&transparent);
+  clutter_rectangle_set_border_color (CLUTTER_RECTANGLE (grid_selection),
+                                      &selection_color);
+  clutter_rectangle_set_border_width (CLUTTER_RECTANGLE (grid_selection),
+                                      GRID_SPACING / 2);
+  clutter_actor_set_size (grid_selection, GRID_PITCH, GRID_PITCH);
+  clutter_container_add_actor (CLUTTER_CONTAINER (grid), grid_selection);
 
-  if (error != NULL)
+  for (i = 0; i < G_N_ELEMENTS (grid_cells); i++)
     {
-      g_debug ("Error Opening: %s", error->message);
-      return NULL;
+      GridCell *cell = &grid_cells[i];
+      gfloat cell_x = (i % GRID_COLUMNS) * GRID_PITCH + GRID_SPACING / 2;
+      gfloat cell_y = (i / GRID_COLUMNS) * GRID_PITCH + GRID_SPACING / 2;
+
+      cell->index = -1;
+
+      cell->background = clutter_rectangle_new_with_color (&background_color);
+      clutter_actor_set_size (cell->background,
+                              THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+      clutter_actor_set_position (cell->background, cell_x, cell_y);
+      clutter_actor_set_reactive (cell->background, TRUE);
+      g_signal_connect (cell->background, "button-release-event",
+                        G_CALLBACK (on_cell_clicked), cell);
+      clutter_container_add_actor (CLUTTER_CONTAINER (grid),
+                                   cell->background);
+
+      /* Clicks go through the thumbnail to the cell */
+      cell->thumbnail = clutter_texture_new ();
+      clutter_actor_set_position (cell->thumbnail, cell_x, cell_y);
+      clutter_container_add_actor (CLUTTER_CONTAINER (grid),
+                                   cell->thumbnail);
     }
 
-  if (depth == NULL)
+  g_signal_connect (stage, "scroll-event", G_CALLBACK (on_scroll), NULL);
+}
+
+/* Colors the frames with the next palette, over the same range */
+static void
+next_palette (void)
+{
+  DepthColormapPalette palette;
+  guint range_begin, range_end;
+
+  palette = (depth_colormap_get_palette (colormap) + 1) % DEPTH_COLORMAP_LAST;
+  depth_colormap_get_range (colormap, &range_begin, &range_end);
+  depth_colormap_unref (colormap);
+  colormap = depth_colormap_new (palette, range_begin, range_end);
+
+  if (browser != NULL)
     {
-      return NULL;
+      guint i;
+
+      /* Thumbnails stay in the old colors until the new ones come */
+      depth_browser_set_colormap (browser, colormap);
+      for (i = 0; i < G_N_ELEMENTS (grid_cells); i++)
+        grid_cells[i].loaded = FALSE;
+      shown_frame = -1;
+      update_grid ();
+      return;
     }
 
-  grayscale_buffer = create_grayscale_buffer (depth, width, height);
+  depth_player_set_colormap (player, colormap);
 
-  g_slice_free1 (width * height * sizeof (guint16), depth);
-  return grayscale_buffer;
+  /* The shown frame is decoded again in the new colors */
+  target_frame = MAX (shown_frame, 0);
+  shown_frame = -1;
+  depth_player_seek (player, target_frame);
+  set_playing (playing);
 }
 
 static void
-set_info_text (const gchar *name)
+on_browse_key (guint key)
+{
+  switch (key)
+    {
+    case CLUTTER_KEY_Left:
+      select_file ((gint) selected_file - 1);
+      break;
+    case CLUTTER_KEY_Right:
+      select_file (selected_file + 1);
+      break;
+    case CLUTTER_KEY_Up:
+      select_file ((gint) selected_file - GRID_COLUMNS);
+      break;
+    case CLUTTER_KEY_Down:
+      select_file (selected_file + GRID_COLUMNS);
+      break;
+    case CLUTTER_KEY_Page_Up:
+      select_file ((gint) selected_file - GRID_COLUMNS * GRID_ROWS);
+      break;
+    case CLUTTER_KEY_Page_Down:
+      select_file (selected_file + GRID_COLUMNS * GRID_ROWS);
+      break;
+    case CLUTTER_KEY_Home:
+      select_file (0);
+      break;
+    case CLUTTER_KEY_End:
+      select_file (depth_browser_get_n_files (browser) - 1);
+      break;
+    case CLUTTER_KEY_c:
+      next_palette ();
+      break;
+    }
+}
+
+static gboolean
+on_key_release (ClutterActor *actor,
+                ClutterEvent *event,
+                gpointer data)
+{
+  guint key;
+  g_return_val_if_fail (event != NULL, FALSE);
+
+  key = clutter_event_get_key_symbol (event);
+
+  if (browser != NULL)
+    {
+      on_browse_key (key);
+      return TRUE;
+    }
+
+  switch (key)
+    {
+    case CLUTTER_KEY_space:
+      set_playing (! playing);
+      break;
+    case CLUTTER_KEY_Left:
+      go_to_frame (shown_frame - 1);
+      break;
+    case CLUTTER_KEY_Right:
+      go_to_frame (shown_frame + 1);
+      break;
+    case CLUTTER_KEY_Page_Up:
+      seek (- SEEK_STEP);
+      break;
+    case CLUTTER_KEY_Page_Down:
+      seek (SEEK_STEP);
+      break;
+    case CLUTTER_KEY_Home:
+      go_to_frame (0);
+      break;
+    case CLUTTER_KEY_End:
+      go_to_frame (depth_sequence_get_n_frames (sequence) - 1);
+      break;
+    case CLUTTER_KEY_c:
+      next_palette ();
+      break;
+    }
+  return TRUE;
+}
+
+static ClutterActor *
+create_instructions (gboolean sequence)
 {
-  gchar *title;
-  title = g_strdup_printf ("<b>File:</b> %s", name);
-  clutter_text_set_markup (CLUTTER_TEXT (info_text), title);
-  g_free (title);
+  ClutterActor *text;
+
+  text = clutter_text_new ();
+  if (browser != NULL)
+    clutter_text_set_markup (CLUTTER_TEXT (text),
+                           "<b>Instructions:</b>\n"
+                           "\tSelect a file:  \t\tArrows, Mouse click\n"
+                           "\tPrevious/next page:  \tPage Up/Page Down\n"
+                           "\tScroll:  \t\t\tMouse wheel\n"
+                           "\tFirst/last file:  \t\tHome/End\n"
+                           "\tChange palette:  \t\tC");
+  else if (sequence)
+    clutter_text_set_markup (CLUTTER_TEXT (text),
+                           "<b>Instructions:</b>\n"
+                           "\tPlay/pause:  \t\t\tSpace bar\n"
+                           "\tStep one frame:  \t\tLeft/Right Arrows\n"
+                           "\tSeek 5 seconds:  \t\tPage Up/Page Down\n"
+                           "\tFirst/last frame:  \t\tHome/End\n"
+                           "\tChange palette:  \t\tC");
+  else
+    clutter_text_set_markup (CLUTTER_TEXT (text),
+                           "<b>Instructions:</b>\n"
+                           "\tChange palette:  \t\tC");
+  return text;
 }
 
 static void
@@ -193,25 +843,48 @@ on_destroy (ClutterActor *actor, gpointer data)
 }
 
 static void
-create_stage (guint width, guint height)
+create_stage (guint width, guint height, gboolean sequence)
 {
   ClutterActor *stage, *instructions;
-  GError *error = NULL;
+  guint grid_width = 0;
+
+  /* The grid goes to the right of the frame */
+  if (browser != NULL)
+    grid_width = 20 + GRID_COLUMNS * GRID_PITCH;
 
   stage = clutter_stage_get_default ();
   clutter_stage_set_title (CLUTTER_STAGE (stage), "Depth File Viewer");
-  clutter_actor_set_size (stage, width, height + 100);
+  clutter_actor_set_size (stage, width + grid_width,
+                          height + (sequence ? 290 : 160));
   clutter_stage_set_user_resizable (CLUTTER_STAGE (stage), TRUE);
 
   g_signal_connect (stage, "destroy", G_CALLBACK (on_destroy), NULL);
+  g_signal_connect (stage,
+                    "key-release-event",
+                    G_CALLBACK (on_key_release),
+                    NULL);
+
+  depth_group = clutter_group_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), depth_group);
+
+  depth_tex = clutter_texture_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (depth_group), depth_tex);
+
+  points_tex = clutter_texture_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (depth_group), points_tex);
 
-  depth_tex = clutter_cairo_texture_new (width, height);
-  clutter_container_add_actor (CLUTTER_CONTAINER (stage), depth_tex);
+  if (browser != NULL)
+    create_grid (stage, width + 20);
 
   info_text = clutter_text_new ();
   clutter_actor_set_position (info_text, 50, height + 20);
   clutter_container_add_actor (CLUTTER_CONTAINER (stage), info_text);
 
+  instructions = create_instructions (sequence);
+  clutter_actor_set_position (instructions, 50,
+                              height + (sequence ? 160 : 110));
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), instructions);
+
   clutter_actor_show_all (stage);
 }
 
@@ -223,65 +896,286 @@ quit (gint signale)
   clutter_main_quit ();
 }
 
+static gboolean
+parse_points (gint argc, gchar *argv[], GError **error)
+{
+  gint i;
+
+  points = depth_points_new ();
+
+  if (points_file != NULL &&
+      ! depth_points_load (points, points_file, error))
+    return FALSE;
+
+  if ((argc - 2) % 3 != 0)
+    {
+      g_print ("Wrong number of arguments...\n");
+      return TRUE;
+    }
+
+  for (i = 2; i < argc; i += 3)
+    {
+      ClutterColor color = { 0, 0, 0, 255 };
+      guchar rgb[3];
+      gint x, y;
+
+      /* Points are drawn opaque whatever the color says */
+      clutter_color_from_string (&color, argv[i]);
+      rgb[0] = color.red;
+      rgb[1] = color.green;
+      rgb[2] = color.blue;
+
+      errno = 0;
+      x = g_ascii_strtod (argv[i + 1], NULL);
+      y = g_ascii_strtod (argv[i + 2], NULL);
+      if (errno == 0)
+        depth_points_add (points, DEPTH_POINTS_ALL_FRAMES, rgb, x, y);
+    }
+
+  return TRUE;
+}
+
+/* Waits for the browser to decode the first file, which is shown
+   first anyway, and finds the range of its depths */
+static gboolean
+find_browsed_range (guint *range_begin, guint *range_end, GError **error)
+{
+  DepthFrameHeader header;
+  const guint16 *depth;
+  gboolean found;
+
+  depth_browser_select (browser, 0);
+  while ((depth = depth_browser_get_frame (browser, 0, &header)) == NULL &&
+         depth_browser_is_busy (browser))
+    g_usleep (RETRY_INTERVAL * 1000);
+
+  if (depth == NULL)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The first file cannot be read to find the range from");
+      return FALSE;
+    }
+
+  found = depth_colormap_find_range (depth,
+                                     (gsize) header.width * header.height,
+                                     range_begin, range_end);
+  depth_browser_release_frame (browser, 0);
+
+  if (! found)
+    g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                 "The first file has no depth to find the range from");
+  return found;
+}
+
+/* Finds the range of the first frame's depths */
+static gboolean
+find_range (guint *range_begin, guint *range_end, GError **error)
+{
+  DepthFrameHeader header;
+  const guint16 *depth;
+  guint16 *buffer;
+  gsize n_samples;
+  gboolean found;
+
+  if (browser != NULL)
+    return find_browsed_range (range_begin, range_end, error);
+
+  n_samples = (gsize) shown_header.width * shown_header.height;
+  buffer = g_new (guint16, n_samples);
+  depth = depth_sequence_get_depth (sequence, 0, &header,
+                                    buffer, n_samples, error);
+  if (depth == NULL)
+    {
+      g_free (buffer);
+      return FALSE;
+    }
+
+  found = depth_colormap_find_range (depth, n_samples,
+                                     range_begin, range_end);
+  depth_sequence_release_frame (sequence, 0);
+  g_free (buffer);
+
+  if (! found)
+    g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                 "The first frame has no depth to find the range from");
+  return found;
+}
+
+static gboolean
+create_colormap (GError **error)
+{
+  DepthColormapPalette palette = DEPTH_COLORMAP_GRAY;
+  guint range_begin = DEPTH_COLORMAP_DEFAULT_BEGIN;
+  guint range_end = DEPTH_COLORMAP_DEFAULT_END;
+
+  if (palette_name != NULL &&
+      ! depth_colormap_palette_from_string (palette_name, &palette))
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Unknown palette \"%s\"", palette_name);
+      return FALSE;
+    }
+
+  if (g_strcmp0 (range_str, "auto") == 0)
+    {
+      if (! find_range (&range_begin, &range_end, error))
+        return FALSE;
+    }
+  else if (range_str != NULL)
+    {
+      gchar **fields = g_strsplit (range_str, ",", 2);
+      gchar *end_begin = NULL, *end_end = NULL;
+      gboolean valid;
+
+      valid = g_strv_length (fields) == 2;
+      if (valid)
+        {
+          range_begin = strtoul (fields[0], &end_begin, 10);
+          range_end = strtoul (fields[1], &end_end, 10);
+          valid = *fields[0] != '\0' && *end_begin == '\0' &&
+            *fields[1] != '\0' && *end_end == '\0' &&
+            range_begin < range_end && range_end <= G_MAXUINT16;
+        }
+      g_strfreev (fields);
+
+      if (! valid)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Invalid range \"%s\", expected BEGIN,END in "
+                       "millimeters or auto", range_str);
+          return FALSE;
+        }
+    }
+
+  colormap = depth_colormap_new (palette, range_begin, range_end);
+  return TRUE;
+}
+
 int
 main (int argc, char *argv[])
 {
-  guchar *buffer;
-  gchar *file_name;
-  guint width, height;
+  GError *error = NULL;
+  guint n_frames;
 
-  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
-    return -1;
+  if (clutter_init_with_args (&argc, &argv,
+                              "DEPTH_FILE_OR_DIR [COLOR_STRING POINT_X "
+                              "POINT_Y]... - show depth files",
+                              entries, NULL, &error) != CLUTTER_INIT_SUCCESS)
+    {
+      if (error != NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+        }
+      return -1;
+    }
 
   signal (SIGINT, quit);
 
   if (argc < 2)
     {
-      g_print ("Usage: %s DEPTH_FILE [COLOR_STRING POINT_X POINT_Y]\n",
+      g_print ("Usage: %s [OPTION...] DEPTH_FILE_OR_DIR "
+               "[COLOR_STRING POINT_X POINT_Y]...\n",
                argv[0]);
       return 0;
     }
 
-  width = 640;
-  height = 480;
+  if (cache_memory <= 0)
+    {
+      g_printerr ("Invalid cache memory %d, it must be at least 1 MB\n",
+                  cache_memory);
+      return -1;
+    }
 
   file_name = argv[1];
-  create_stage (width, height);
-  set_info_text (file_name);
-
-  buffer = load_image (file_name, width, height);
-  if (buffer == NULL)
-    return -1;
-
-  if (argc > 2)
+  if (browse)
     {
-      if ((argc - 2) % 3 == 0)
+      browser = depth_browser_open (file_name, THUMBNAIL_SIZE,
+                                    (gsize) cache_memory * 1024 * 1024,
+                                    &error);
+      if (browser == NULL)
         {
-          guint i;
-          for (i = 2; i < argc; i+=3)
-            {
-              gchar *color;
-              guint x, y;
-              color = argv[i];
-              x = g_ascii_strtod (argv[i + 1], NULL);
-              y = g_ascii_strtod (argv[i + 2], NULL);
-              if (errno == 0)
-                {
-                  draw_point (buffer, width, height, color, x, y);
-                }
-            }
+          g_debug ("Error Opening: %s", error->message);
+          g_error_free (error);
+          return -1;
         }
-      else
+
+      /* The window is laid out for Kinect frames until one is shown */
+      shown_header.width = DEPTH_FILE_LEGACY_WIDTH;
+      shown_header.height = DEPTH_FILE_LEGACY_HEIGHT;
+      shown_header.dimension_factor = 1;
+      n_frames = depth_browser_get_n_files (browser);
+    }
+  else
+    {
+      sequence = depth_sequence_open (file_name, &error);
+      if (sequence == NULL ||
+          ! depth_sequence_get_frame_header (sequence, 0, &shown_header,
+                                             &error))
         {
-          g_print ("Wrong number of arguments...\n");
+          g_debug ("Error Opening: %s", error->message);
+          g_error_free (error);
+          return -1;
         }
+
+      n_frames = depth_sequence_get_n_frames (sequence);
+      if (n_frames > 1)
+        target_fps = (n_frames - 1) * (gdouble) G_USEC_PER_SEC /
+          MAX (depth_sequence_get_time (sequence, n_frames - 1), 1);
     }
 
-  if (!paint_texture (buffer, width, height))
+  if (! create_colormap (&error) ||
+      ! parse_points (argc, argv, &error))
     {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      if (points != NULL)
+        depth_points_free (points);
+      if (colormap != NULL)
+        depth_colormap_unref (colormap);
+      if (browser != NULL)
+        depth_browser_free (browser);
+      if (sequence != NULL)
+        depth_sequence_free (sequence);
       return -1;
     }
+
+  create_stage (shown_header.width +
+                shown_header.x_offset / shown_header.dimension_factor,
+                shown_header.height +
+                shown_header.y_offset / shown_header.dimension_factor,
+                n_frames > 1);
+
+  if (browser != NULL)
+    {
+      depth_browser_set_colormap (browser, colormap);
+      tick_func = browse_tick;
+      select_file (0);
+    }
+  else
+    {
+      player = depth_player_new (sequence, colormap, PREFETCH_FRAMES,
+                                 NULL, NULL);
+      set_playing (TRUE);
+    }
+
   clutter_main ();
 
+  if (tick_id != 0)
+    g_source_remove (tick_id);
+  if (browser != NULL)
+    {
+      depth_browser_free (browser);
+      g_free (browse_image);
+    }
+  else
+    {
+      depth_player_free (player);
+      depth_sequence_free (sequence);
+    }
+  depth_colormap_unref (colormap);
+  depth_points_free (points);
+  g_free (points_image);
+
   return 0;
 }
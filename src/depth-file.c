@@ -0,0 +1,559 @@
+/* GFreenect Utils : depth-file.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "depth-file.h"
+#include "depth-codec.h"
+
+/* Depth files are memory mapped rather than read, so opening one only
+   costs reading its seek index, however large it is, and the pages of
+   a frame are only faulted in when the frame is used */
+
+struct _DepthFile
+{
+  gchar *path;
+  GMappedFile *mapped_file;
+  const guint8 *data;
+  gsize length;
+
+  gboolean legacy;
+  guint32 header_size;
+  guint n_frames;
+  guint64 *index;
+};
+
+void
+depth_frame_header_to_le (DepthFrameHeader *header)
+{
+  header->header_size = GUINT32_TO_LE (header->header_size);
+  header->format = GUINT32_TO_LE (header->format);
+  header->width = GUINT32_TO_LE (header->width);
+  header->height = GUINT32_TO_LE (header->height);
+  header->timestamp = GINT64_TO_LE (header->timestamp);
+  header->payload_size = GUINT32_TO_LE (header->payload_size);
+  header->reserved = GUINT32_TO_LE (header->reserved);
+  header->dimension_factor = GUINT32_TO_LE (header->dimension_factor);
+  header->threshold_begin = GUINT32_TO_LE (header->threshold_begin);
+  header->threshold_end = GUINT32_TO_LE (header->threshold_end);
+  header->reserved2 = GUINT32_TO_LE (header->reserved2);
+  header->x_offset = GUINT32_TO_LE (header->x_offset);
+  header->y_offset = GUINT32_TO_LE (header->y_offset);
+}
+
+void
+depth_frame_header_from_le (DepthFrameHeader *header)
+{
+  header->header_size = GUINT32_FROM_LE (header->header_size);
+  header->format = GUINT32_FROM_LE (header->format);
+  header->width = GUINT32_FROM_LE (header->width);
+  header->height = GUINT32_FROM_LE (header->height);
+  header->timestamp = GINT64_FROM_LE (header->timestamp);
+  header->payload_size = GUINT32_FROM_LE (header->payload_size);
+  header->reserved = GUINT32_FROM_LE (header->reserved);
+  header->dimension_factor = GUINT32_FROM_LE (header->dimension_factor);
+  header->threshold_begin = GUINT32_FROM_LE (header->threshold_begin);
+  header->threshold_end = GUINT32_FROM_LE (header->threshold_end);
+  header->reserved2 = GUINT32_FROM_LE (header->reserved2);
+  header->x_offset = GUINT32_FROM_LE (header->x_offset);
+  header->y_offset = GUINT32_FROM_LE (header->y_offset);
+}
+
+#if defined (G_OS_UNIX) && defined (MADV_WILLNEED)
+#define HAVE_MADVISE 1
+#else
+#define MADV_RANDOM 0
+#define MADV_SEQUENTIAL 0
+#define MADV_WILLNEED 0
+#define MADV_DONTNEED 0
+#endif
+
+static void
+advise (DepthFile *file, guint64 offset, guint64 length, gint advice)
+{
+#ifdef HAVE_MADVISE
+  static gsize page_size = 0;
+  guintptr start, end;
+
+  if (page_size == 0)
+    page_size = sysconf (_SC_PAGESIZE);
+
+  if (length == 0)
+    return;
+
+  start = (guintptr) file->data + offset;
+  end = start + length;
+  start -= start % page_size;
+
+  madvise ((gpointer) start, end - start, advice);
+#endif
+}
+
+/* Reads a frame header, tolerating headers written by versions with
+   more or fewer fields than this one */
+static gboolean
+read_frame_header (DepthFile         *file,
+                   guint64            offset,
+                   DepthFrameHeader  *header,
+                   GError           **error)
+{
+  guint32 header_size;
+
+  if (file->legacy)
+    {
+      memset (header, 0, sizeof (DepthFrameHeader));
+      header->format = DEPTH_FRAME_FORMAT_RAW_16;
+      header->width = DEPTH_FILE_LEGACY_WIDTH;
+      header->height = DEPTH_FILE_LEGACY_HEIGHT;
+      header->payload_size = file->length;
+      header->dimension_factor = 1;
+      return TRUE;
+    }
+
+  /* Offsets come from the file, so the sizes are compared with what
+     is left of it rather than added to them, which could wrap */
+  if (offset > file->length ||
+      file->length - offset < sizeof (header_size))
+    goto corrupt;
+
+  memcpy (&header_size, file->data + offset, sizeof (header_size));
+  header_size = GUINT32_FROM_LE (header_size);
+  if (header_size < G_STRUCT_OFFSET (DepthFrameHeader, payload_size) +
+      sizeof (header->payload_size) ||
+      file->length - offset < header_size)
+    goto corrupt;
+
+  memset (header, 0, sizeof (DepthFrameHeader));
+  memcpy (header, file->data + offset,
+          MIN (header_size, sizeof (DepthFrameHeader)));
+  depth_frame_header_from_le (header);
+  header->header_size = header_size;
+
+  /* Version 1 frames were never reduced */
+  if (header->dimension_factor == 0)
+    header->dimension_factor = 1;
+
+  if (file->length - offset - header_size < header->payload_size)
+    goto corrupt;
+
+  return TRUE;
+
+ corrupt:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Corrupt frame at offset %" G_GUINT64_FORMAT " in %s",
+               offset, file->path);
+  return FALSE;
+}
+
+/* Rebuilds the seek index of a recording whose trailer was never
+   written, e.g. because the recorder did not exit cleanly */
+static void
+scan_frames (DepthFile *file)
+{
+  GArray *index;
+  guint64 offset;
+
+  index = g_array_new (FALSE, FALSE, sizeof (guint64));
+  offset = file->header_size;
+
+  while (offset < file->length)
+    {
+      DepthFrameHeader header;
+
+      if (! read_frame_header (file, offset, &header, NULL))
+        break;
+
+      g_array_append_val (index, offset);
+      offset += header.header_size + header.payload_size;
+    }
+
+  g_debug ("No index in %s, recovered %u frames", file->path, index->len);
+
+  file->n_frames = index->len;
+  file->index = (guint64 *) g_array_free (index, FALSE);
+}
+
+static void
+read_index (DepthFile *file)
+{
+  DepthFileTrailer trailer;
+  guint64 index_offset;
+  gsize index_end;
+  guint i;
+
+  if (file->length - file->header_size < sizeof (trailer))
+    {
+      scan_frames (file);
+      return;
+    }
+
+  memcpy (&trailer, file->data + file->length - sizeof (trailer),
+          sizeof (trailer));
+  file->n_frames = GUINT32_FROM_LE (trailer.n_frames);
+  index_offset = GUINT64_FROM_LE (trailer.index_offset);
+
+  /* The index has to end where the trailer starts. n_frames is
+     bounded before it is multiplied, so the size cannot wrap */
+  index_end = file->length - sizeof (trailer);
+  if (memcmp (trailer.magic, DEPTH_FILE_TRAILER_MAGIC,
+              DEPTH_FILE_MAGIC_LEN) != 0 ||
+      file->n_frames > index_end / sizeof (guint64) ||
+      index_offset > index_end ||
+      index_end - index_offset < file->n_frames * sizeof (guint64))
+    {
+      scan_frames (file);
+      return;
+    }
+
+  file->index = g_new (guint64, MAX (file->n_frames, 1));
+  memcpy (file->index, file->data + index_offset,
+          file->n_frames * sizeof (guint64));
+
+  for (i = 0; i < file->n_frames; i++)
+    file->index[i] = GUINT64_FROM_LE (file->index[i]);
+}
+
+/* Opens a depth recording or a legacy raw depth file */
+DepthFile *
+depth_file_open (const gchar *path, GError **error)
+{
+  DepthFile *file;
+  DepthFileHeader header;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  file = g_slice_new0 (DepthFile);
+  file->path = g_strdup (path);
+
+  file->mapped_file = g_mapped_file_new (path, FALSE, error);
+  if (file->mapped_file == NULL)
+    goto error;
+
+  file->data = (const guint8 *) g_mapped_file_get_contents (file->mapped_file);
+  file->length = g_mapped_file_get_length (file->mapped_file);
+
+  if (file->length >= sizeof (header))
+    memcpy (&header, file->data, sizeof (header));
+
+  if (file->length >= sizeof (header) &&
+      memcmp (header.magic, DEPTH_FILE_MAGIC, DEPTH_FILE_MAGIC_LEN) == 0)
+    {
+      file->header_size = GUINT32_FROM_LE (header.header_size);
+      if (file->header_size < sizeof (header) ||
+          file->header_size > file->length)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Corrupt header in %s", path);
+          goto error;
+        }
+
+      /* Frames are prefetched one by one as they are mapped, don't
+         let the kernel read ahead the rest of the file */
+      advise (file, 0, file->length, MADV_RANDOM);
+      read_index (file);
+    }
+  else if (file->length == (gsize) DEPTH_FILE_LEGACY_WIDTH *
+           DEPTH_FILE_LEGACY_HEIGHT * sizeof (guint16))
+    {
+      file->legacy = TRUE;
+      file->n_frames = 1;
+      file->index = g_new0 (guint64, 1);
+    }
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is not a depth file", path);
+      goto error;
+    }
+
+  return file;
+
+ error:
+  depth_file_close (file);
+  return NULL;
+}
+
+void
+depth_file_close (DepthFile *file)
+{
+  g_return_if_fail (file != NULL);
+
+  if (file->mapped_file != NULL)
+    g_mapped_file_unref (file->mapped_file);
+
+  g_free (file->index);
+  g_free (file->path);
+  g_slice_free (DepthFile, file);
+}
+
+guint
+depth_file_get_n_frames (DepthFile *file)
+{
+  g_return_val_if_fail (file != NULL, 0);
+
+  return file->n_frames;
+}
+
+gboolean
+depth_file_get_frame_header (DepthFile         *file,
+                             guint              frame,
+                             DepthFrameHeader  *header,
+                             GError           **error)
+{
+  g_return_val_if_fail (file != NULL, FALSE);
+  g_return_val_if_fail (header != NULL, FALSE);
+
+  if (frame >= file->n_frames)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Frame %u out of range, %s has %u frames",
+                   frame, file->path, file->n_frames);
+      return FALSE;
+    }
+
+  return read_frame_header (file, file->index[frame], header, error);
+}
+
+/* Returns the payload of the given frame inside the mapping, asking
+   the kernel to start paging it in. It stays valid until the file is
+   closed */
+const guint8 *
+depth_file_map_frame (DepthFile         *file,
+                      guint              frame,
+                      DepthFrameHeader  *header,
+                      GError           **error)
+{
+  guint64 offset;
+
+  if (! depth_file_get_frame_header (file, frame, header, error))
+    return NULL;
+
+  offset = file->index[frame] + header->header_size;
+  advise (file, offset, header->payload_size, MADV_SEQUENTIAL);
+  advise (file, offset, header->payload_size, MADV_WILLNEED);
+
+  return file->data + offset;
+}
+
+/* Lets the kernel drop the pages of a frame that will not be used
+   again soon, to bound memory use when going through long files */
+void
+depth_file_release_frame (DepthFile *file, guint frame)
+{
+  DepthFrameHeader header;
+
+  g_return_if_fail (file != NULL);
+
+  if (! depth_file_get_frame_header (file, frame, &header, NULL))
+    return;
+
+  advise (file, file->index[frame] + header.header_size,
+          header.payload_size, MADV_DONTNEED);
+}
+
+/* Copies the payload of the given frame into data, which must be able
+   to hold at least header->payload_size bytes */
+gboolean
+depth_file_read_frame (DepthFile         *file,
+                       guint              frame,
+                       DepthFrameHeader  *header,
+                       gpointer           data,
+                       gsize              size,
+                       GError           **error)
+{
+  const guint8 *payload;
+
+  g_return_val_if_fail (data != NULL, FALSE);
+
+  payload = depth_file_map_frame (file, frame, header, error);
+  if (payload == NULL)
+    return FALSE;
+
+  if (header->payload_size > size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Frame %u of %s needs %u bytes, got %" G_GSIZE_FORMAT,
+                   frame, file->path, header->payload_size, size);
+      return FALSE;
+    }
+
+  memcpy (data, payload, header->payload_size);
+  return TRUE;
+}
+
+/* Returns the depth samples of the given frame. Uncompressed frames
+   are returned straight from the mapping; others are decoded into
+   buffer, which must be able to hold n_samples samples */
+const guint16 *
+depth_file_get_depth (DepthFile         *file,
+                      guint              frame,
+                      DepthFrameHeader  *header,
+                      guint16           *buffer,
+                      gsize              n_samples,
+                      GError           **error)
+{
+  const guint8 *payload;
+  gsize frame_samples;
+
+  payload = depth_file_map_frame (file, frame, header, error);
+  if (payload == NULL)
+    return NULL;
+
+  frame_samples = (gsize) header->width * header->height;
+
+  switch (header->format)
+    {
+    case DEPTH_FRAME_FORMAT_RAW_16:
+      if (header->payload_size < frame_samples * sizeof (guint16))
+        break;
+
+      if (((guintptr) payload % sizeof (guint16)) == 0)
+        return (const guint16 *) payload;
+
+      if (buffer == NULL || frame_samples > n_samples)
+        goto too_large;
+
+      memcpy (buffer, payload, frame_samples * sizeof (guint16));
+      return buffer;
+
+    case DEPTH_FRAME_FORMAT_DELTA_RLE:
+      if (buffer == NULL || frame_samples > n_samples)
+        goto too_large;
+
+      if (! depth_codec_decode (payload, header->payload_size,
+                                header->width, header->height, buffer))
+        break;
+
+      return buffer;
+
+    default:
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Frame %u of %s has unknown format %u",
+                   frame, file->path, header->format);
+      return NULL;
+    }
+
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Frame %u of %s is corrupt", frame, file->path);
+  return NULL;
+
+ too_large:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Frame %u of %s is %ux%u, larger than expected",
+               frame, file->path, header->width, header->height);
+  return NULL;
+}
+
+/* Like depth_file_get_depth() but always leaves the samples in depth */
+gboolean
+depth_file_read_depth (DepthFile         *file,
+                       guint              frame,
+                       DepthFrameHeader  *header,
+                       guint16           *depth,
+                       gsize              n_samples,
+                       GError           **error)
+{
+  const guint16 *samples;
+
+  g_return_val_if_fail (depth != NULL, FALSE);
+
+  samples = depth_file_get_depth (file, frame, header,
+                                  depth, n_samples, error);
+  if (samples == NULL)
+    return FALSE;
+
+  if (samples != depth)
+    {
+      if ((gsize) header->width * header->height > n_samples)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Frame %u is %ux%u, larger than expected",
+                       frame, header->width, header->height);
+          return FALSE;
+        }
+
+      memcpy (depth, samples,
+              (gsize) header->width * header->height * sizeof (guint16));
+    }
+
+  return TRUE;
+}
+
+/* Writes a depth file holding a single uncompressed frame. The
+   payload size is taken from header->width and header->height, the
+   remaining fields are stored as given */
+gboolean
+depth_file_save_frame (const gchar             *path,
+                       const DepthFrameHeader  *header,
+                       gconstpointer            data,
+                       GError                 **error)
+{
+  DepthFileHeader file_header;
+  DepthFrameHeader frame_header;
+  DepthFileTrailer trailer;
+  guint64 frame_offset;
+  gsize payload_size;
+  GString *contents;
+  gboolean success;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (header != NULL, FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+
+  payload_size = (gsize) header->width * header->height * sizeof (guint16);
+  contents = g_string_sized_new (sizeof (file_header) +
+                                 sizeof (frame_header) + payload_size +
+                                 sizeof (frame_offset) + sizeof (trailer));
+
+  memset (&file_header, 0, sizeof (file_header));
+  memcpy (file_header.magic, DEPTH_FILE_MAGIC, DEPTH_FILE_MAGIC_LEN);
+  file_header.version = GUINT32_TO_LE (DEPTH_FILE_VERSION);
+  file_header.header_size = GUINT32_TO_LE (sizeof (file_header));
+  g_string_append_len (contents, (const gchar *) &file_header,
+                       sizeof (file_header));
+
+  frame_header = *header;
+  frame_header.header_size = sizeof (frame_header);
+  frame_header.format = DEPTH_FRAME_FORMAT_RAW_16;
+  frame_header.payload_size = payload_size;
+  depth_frame_header_to_le (&frame_header);
+  g_string_append_len (contents, (const gchar *) &frame_header,
+                       sizeof (frame_header));
+  g_string_append_len (contents, data, payload_size);
+
+  frame_offset = GUINT64_TO_LE (sizeof (file_header));
+  g_string_append_len (contents, (const gchar *) &frame_offset,
+                       sizeof (frame_offset));
+
+  memset (&trailer, 0, sizeof (trailer));
+  trailer.index_offset = GUINT64_TO_LE (contents->len - sizeof (frame_offset));
+  trailer.n_frames = GUINT32_TO_LE (1);
+  memcpy (trailer.magic, DEPTH_FILE_TRAILER_MAGIC, DEPTH_FILE_MAGIC_LEN);
+  g_string_append_len (contents, (const gchar *) &trailer, sizeof (trailer));
+
+  success = g_file_set_contents (path, contents->str, contents->len, error);
+  g_string_free (contents, TRUE);
+
+  return success;
+}
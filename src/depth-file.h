@@ -0,0 +1,142 @@
+/* GFreenect Utils : depth-file.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_FILE_H__
+#define __DEPTH_FILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A depth recording is laid out as:
+ *
+ *   DepthFileHeader
+ *   DepthFrameHeader, payload    (once per frame)
+ *   ...
+ *   guint64 offset               (once per frame, the seek index)
+ *   DepthFileTrailer
+ *
+ * All integers are little endian. Readers must honour header_size so
+ * fields can be appended to the headers in later versions */
+
+#define DEPTH_FILE_MAGIC         "GFDEPTH\0"
+#define DEPTH_FILE_TRAILER_MAGIC "GFINDEX\0"
+#define DEPTH_FILE_MAGIC_LEN     8
+#define DEPTH_FILE_VERSION       3
+
+typedef enum
+{
+  DEPTH_FRAME_FORMAT_RAW_16 = 0,
+  DEPTH_FRAME_FORMAT_DELTA_RLE = 1,
+
+  /* Video frames matched to a depth recording, 8 bit RGB */
+  DEPTH_FRAME_FORMAT_RGB_24 = 2
+} DepthFrameFormat;
+
+typedef struct
+{
+  gchar   magic[DEPTH_FILE_MAGIC_LEN];
+  guint32 version;
+  guint32 header_size;
+} DepthFileHeader;
+
+typedef struct
+{
+  guint32 header_size;
+  guint32 format;
+  guint32 width;
+  guint32 height;
+  gint64  timestamp;
+  guint32 payload_size;
+  guint32 reserved;
+
+  /* Since version 2. Frames are width x height samples taken every
+     dimension_factor pixels, out of the threshold band set to 0 */
+  guint32 dimension_factor;
+  guint32 threshold_begin;
+  guint32 threshold_end;
+  guint32 reserved2;
+
+  /* Since version 3. Frames cropped to a region of interest start at
+     x_offset, y_offset of the whole frame, in full resolution pixels */
+  guint32 x_offset;
+  guint32 y_offset;
+} DepthFrameHeader;
+
+typedef struct
+{
+  guint64 index_offset;
+  guint32 n_frames;
+  guint32 reserved;
+  gchar   magic[DEPTH_FILE_MAGIC_LEN];
+} DepthFileTrailer;
+
+/* Files without a DepthFileHeader are raw dumps of a single frame of
+   this size, as written by older versions of record-depth-file */
+#define DEPTH_FILE_LEGACY_WIDTH  640
+#define DEPTH_FILE_LEGACY_HEIGHT 480
+
+typedef struct _DepthFile DepthFile;
+
+DepthFile      *depth_file_open             (const gchar  *path,
+                                             GError      **error);
+void            depth_file_close            (DepthFile *file);
+
+guint           depth_file_get_n_frames     (DepthFile *file);
+gboolean        depth_file_get_frame_header (DepthFile         *file,
+                                             guint              frame,
+                                             DepthFrameHeader  *header,
+                                             GError           **error);
+
+const guint8   *depth_file_map_frame        (DepthFile         *file,
+                                             guint              frame,
+                                             DepthFrameHeader  *header,
+                                             GError           **error);
+void            depth_file_release_frame    (DepthFile *file,
+                                             guint      frame);
+
+gboolean        depth_file_read_frame       (DepthFile         *file,
+                                             guint              frame,
+                                             DepthFrameHeader  *header,
+                                             gpointer           data,
+                                             gsize              size,
+                                             GError           **error);
+const guint16  *depth_file_get_depth        (DepthFile         *file,
+                                             guint              frame,
+                                             DepthFrameHeader  *header,
+                                             guint16           *buffer,
+                                             gsize              n_samples,
+                                             GError           **error);
+gboolean        depth_file_read_depth       (DepthFile         *file,
+                                             guint              frame,
+                                             DepthFrameHeader  *header,
+                                             guint16           *depth,
+                                             gsize              n_samples,
+                                             GError           **error);
+
+gboolean        depth_file_save_frame       (const gchar             *path,
+                                             const DepthFrameHeader  *header,
+                                             gconstpointer            data,
+                                             GError                 **error);
+
+void            depth_frame_header_to_le    (DepthFrameHeader *header);
+void            depth_frame_header_from_le  (DepthFrameHeader *header);
+
+G_END_DECLS
+
+#endif /* __DEPTH_FILE_H__ */
@@ -0,0 +1,236 @@
+/* GFreenect Utils : depth-filter.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "depth-filter.h"
+#include "depth-processing.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* A per-sample exponential moving average of the depth, kept in a
+   buffer of the frame size and updated in place. Each averaging step
+   is a rounded 16 bit mean, which cannot overflow, and strength steps
+   give the new sample a weight of 1 / 2^strength. Rounding up means
+   the average can settle one millimeter above a falling depth.
+
+   Samples with no depth, samples whose average has just been reset
+   and samples that jump by more than jump millimeters are taken
+   as they are, so real motion and holes are never smeared */
+
+struct _DepthFilter
+{
+  guint width;
+  guint height;
+  guint strength;
+  guint16 jump;
+  guint16 *average;
+};
+
+typedef void (*FilterRunFunc) (guint16 *average,
+                               guint16 *depth,
+                               gsize    n_samples,
+                               guint    strength,
+                               guint16  jump);
+
+typedef struct
+{
+  DepthProcessingSimd simd;
+  FilterRunFunc run;
+} FilterImpl;
+
+static void
+filter_run_scalar (guint16 *average,
+                   guint16 *depth,
+                   gsize    n_samples,
+                   guint    strength,
+                   guint16  jump)
+{
+  gsize i;
+
+  for (i = 0; i < n_samples; i++)
+    {
+      guint value = depth[i];
+      guint mean = average[i];
+
+      if (value == 0 || mean == 0 ||
+          (value > mean ? value - mean : mean - value) > jump)
+        {
+          mean = value;
+        }
+      else
+        {
+          guint step, smoothed = value;
+
+          for (step = 0; step < strength; step++)
+            smoothed = (mean + smoothed + 1) >> 1;
+          mean = smoothed;
+        }
+
+      average[i] = mean;
+      depth[i] = mean;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__ ((target ("sse2")))
+static void
+filter_run_sse2 (guint16 *average,
+                 guint16 *depth,
+                 gsize    n_samples,
+                 guint    strength,
+                 guint16  jump)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i max_jump = _mm_set1_epi16 ((gshort) jump);
+  gsize i;
+
+  for (i = 0; i + 8 <= n_samples; i += 8)
+    {
+      __m128i value, mean, smoothed, distance, reset;
+      guint step;
+
+      value = _mm_loadu_si128 ((const __m128i *) (depth + i));
+      mean = _mm_loadu_si128 ((const __m128i *) (average + i));
+
+      /* |value - mean| with saturated unsigned subtractions, which is
+         above jump iff subtracting jump does not saturate to 0 */
+      distance = _mm_or_si128 (_mm_subs_epu16 (value, mean),
+                               _mm_subs_epu16 (mean, value));
+      reset = _mm_or_si128 (
+        _mm_or_si128 (_mm_cmpeq_epi16 (value, zero),
+                      _mm_cmpeq_epi16 (mean, zero)),
+        _mm_xor_si128 (_mm_cmpeq_epi16 (_mm_subs_epu16 (distance, max_jump),
+                                        zero),
+                       _mm_cmpeq_epi16 (zero, zero)));
+
+      smoothed = value;
+      for (step = 0; step < strength; step++)
+        smoothed = _mm_avg_epu16 (mean, smoothed);
+
+      mean = _mm_or_si128 (_mm_and_si128 (reset, value),
+                           _mm_andnot_si128 (reset, smoothed));
+
+      _mm_storeu_si128 ((__m128i *) (average + i), mean);
+      _mm_storeu_si128 ((__m128i *) (depth + i), mean);
+    }
+
+  filter_run_scalar (average + i, depth + i, n_samples - i, strength, jump);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const FilterImpl implementations[] = {
+#ifdef HAVE_X86_SIMD
+  { DEPTH_PROCESSING_SIMD_SSE2, filter_run_sse2 },
+#endif
+  { DEPTH_PROCESSING_SIMD_SCALAR, filter_run_scalar }
+};
+
+static const FilterImpl *
+get_implementation (void)
+{
+  DepthProcessingSimd simd = depth_processing_get_simd ();
+  guint i;
+
+  /* The most capable first, down to the scalar one */
+  for (i = 0; implementations[i].simd > simd; i++)
+    ;
+
+  return &implementations[i];
+}
+
+const gchar *
+depth_filter_get_implementation (void)
+{
+  return depth_processing_simd_get_name (get_implementation ()->simd);
+}
+
+/* Creates a filter for frames of width x height samples. strength,
+   from 1 to DEPTH_FILTER_MAX_STRENGTH, sets how much the past frames
+   weigh and jump the largest change, in millimeters, that is taken
+   as noise */
+DepthFilter *
+depth_filter_new (guint width, guint height, guint strength, guint jump)
+{
+  DepthFilter *filter;
+
+  g_return_val_if_fail (strength > 0 &&
+                        strength <= DEPTH_FILTER_MAX_STRENGTH, NULL);
+
+  filter = g_slice_new0 (DepthFilter);
+  filter->width = width;
+  filter->height = height;
+  filter->strength = strength;
+  filter->jump = MIN (jump, G_MAXUINT16);
+  filter->average = g_new0 (guint16, (gsize) width * height);
+
+  return filter;
+}
+
+void
+depth_filter_free (DepthFilter *filter)
+{
+  g_return_if_fail (filter != NULL);
+
+  g_free (filter->average);
+  g_slice_free (DepthFilter, filter);
+}
+
+/* Forgets the past frames, e.g. after a jump in the stream */
+void
+depth_filter_reset (DepthFilter *filter)
+{
+  g_return_if_fail (filter != NULL);
+
+  memset (filter->average, 0,
+          (gsize) filter->width * filter->height * sizeof (guint16));
+}
+
+/* Adds a frame of the filter's size to the average and replaces it
+   with the filtered depth */
+void
+depth_filter_apply (DepthFilter *filter, guint16 *depth)
+{
+  g_return_if_fail (filter != NULL);
+  g_return_if_fail (depth != NULL);
+
+  get_implementation ()->run (filter->average, depth,
+                              (gsize) filter->width * filter->height,
+                              filter->strength, filter->jump);
+}
+
+guint
+depth_filter_get_width (DepthFilter *filter)
+{
+  g_return_val_if_fail (filter != NULL, 0);
+
+  return filter->width;
+}
+
+guint
+depth_filter_get_height (DepthFilter *filter)
+{
+  g_return_val_if_fail (filter != NULL, 0);
+
+  return filter->height;
+}
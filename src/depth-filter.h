@@ -0,0 +1,51 @@
+/* GFreenect Utils : depth-filter.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_FILTER_H__
+#define __DEPTH_FILTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Samples that change by more than this many millimeters from one
+   frame to the next are taken as they are instead of smoothed */
+#define DEPTH_FILTER_DEFAULT_JUMP 60
+
+#define DEPTH_FILTER_MAX_STRENGTH 3
+
+typedef struct _DepthFilter DepthFilter;
+
+DepthFilter *depth_filter_new                (guint width,
+                                              guint height,
+                                              guint strength,
+                                              guint jump);
+void         depth_filter_free               (DepthFilter *filter);
+
+void         depth_filter_reset              (DepthFilter *filter);
+void         depth_filter_apply              (DepthFilter *filter,
+                                              guint16     *depth);
+
+guint        depth_filter_get_width          (DepthFilter *filter);
+guint        depth_filter_get_height         (DepthFilter *filter);
+
+const gchar *depth_filter_get_implementation (void);
+
+G_END_DECLS
+
+#endif /* __DEPTH_FILTER_H__ */
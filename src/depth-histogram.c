@@ -0,0 +1,346 @@
+/* GFreenect Utils : depth-histogram.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "depth-histogram.h"
+#include "worker-pool.h"
+
+/* Frames are counted in bands of rows of about this many bytes of
+   depth, spread over the default worker pool. Each band counts into
+   a histogram of its own on the stack, added to the shared one once
+   the band is done, so threads never contend for a bin */
+#define BAND_BYTES (64 * 1024)
+
+/* Neighbouring samples mostly fall in the same bin, so each band
+   counts them in turn in this many copies of its histogram, which
+   keeps every increment from waiting for the one before it */
+#define N_COPIES 4
+
+#define MAX_DEPTH (DEPTH_HISTOGRAM_N_BINS * DEPTH_HISTOGRAM_BIN_SIZE)
+
+/* Fewer samples than this past the start of the band are not enough
+   to place its end */
+#define MIN_SAMPLES 100
+
+/* The nearest peak must hold at least 1 / PEAK_MIN_SHARE of the
+   samples past the start of the band, so noise is not taken for an
+   object */
+#define PEAK_MIN_SHARE 50
+
+static const gchar *method_names[] = {
+  "otsu",
+  "peak"
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (method_names) == DEPTH_HISTOGRAM_LAST);
+
+typedef struct
+{
+  DepthHistogram *histogram;
+  const guint16 *depth;
+  guint width;
+  guint height;
+  guint step;
+  guint band_rows;
+} HistogramBands;
+
+static void
+histogram_band (guint band, gpointer user_data)
+{
+  const HistogramBands *bands = user_data;
+  guint32 bins[N_COPIES][DEPTH_HISTOGRAM_N_BINS];
+  guint32 n_samples = 0;
+  guint row_begin, row_end, row, i, n;
+
+  memset (bins, 0, sizeof (bins));
+
+  row_begin = band * bands->band_rows;
+  row_end = MIN (row_begin + bands->band_rows, bands->height);
+  for (row = row_begin; row < row_end; row += bands->step)
+    {
+      const guint16 *src = bands->depth + (gsize) row * bands->width;
+
+      for (i = 0, n = 0; i < bands->width; i += bands->step, n++)
+        {
+          /* Samples with no depth wrap around and are left out too */
+          guint value = src[i];
+
+          if (value - 1 < MAX_DEPTH - 1)
+            bins[n % N_COPIES][value / DEPTH_HISTOGRAM_BIN_SIZE]++;
+        }
+    }
+
+  for (i = 0; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    {
+      guint32 count = 0;
+
+      for (n = 0; n < N_COPIES; n++)
+        count += bins[n][i];
+      if (count == 0)
+        continue;
+
+      g_atomic_int_add ((gint *) &bands->histogram->bins[i], count);
+      n_samples += count;
+    }
+  g_atomic_int_add ((gint *) &bands->histogram->n_samples, n_samples);
+}
+
+/* Counts one out of every step samples of depth in each direction */
+void
+depth_histogram_compute (DepthHistogram *histogram,
+                         const guint16  *depth,
+                         guint           width,
+                         guint           height,
+                         guint           step)
+{
+  HistogramBands bands;
+  guint band_rows;
+
+  g_return_if_fail (histogram != NULL);
+  g_return_if_fail (depth != NULL);
+  g_return_if_fail (step > 0);
+
+  memset (histogram, 0, sizeof (DepthHistogram));
+  if (width == 0 || height == 0)
+    return;
+
+  bands.histogram = histogram;
+  bands.depth = depth;
+  bands.width = width;
+  bands.height = height;
+  bands.step = step;
+
+  band_rows = BAND_BYTES / ((gsize) width * sizeof (guint16));
+  band_rows -= band_rows % step;
+  bands.band_rows = MAX (band_rows, step);
+
+  worker_pool_run (worker_pool_get_default (),
+                   (height + bands.band_rows - 1) / bands.band_rows,
+                   histogram_band, &bands);
+}
+
+/* Otsu's method: the bin that splits the samples into the two
+   classes with the largest variance between them */
+static gboolean
+find_otsu_threshold (const DepthHistogram *histogram,
+                     guint                 first_bin,
+                     guint                *threshold_end)
+{
+  const guint32 *bins = histogram->bins;
+  guint64 total = 0, near = 0;
+  gdouble sum = 0., near_sum = 0., best_variance = 0.;
+  gint best = -1;
+  guint i;
+
+  for (i = first_bin; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    {
+      total += bins[i];
+      sum += (gdouble) i * bins[i];
+    }
+  if (total < MIN_SAMPLES)
+    return FALSE;
+
+  for (i = first_bin; i + 1 < DEPTH_HISTOGRAM_N_BINS; i++)
+    {
+      gdouble near_mean, far_mean, variance;
+      guint64 far;
+
+      near += bins[i];
+      near_sum += (gdouble) i * bins[i];
+      far = total - near;
+      if (near == 0)
+        continue;
+      if (far == 0)
+        break;
+
+      near_mean = near_sum / near;
+      far_mean = (sum - near_sum) / far;
+      variance = (gdouble) near * far * (near_mean - far_mean) *
+        (near_mean - far_mean);
+      if (variance > best_variance)
+        {
+          best_variance = variance;
+          best = i;
+        }
+    }
+
+  if (best < 0)
+    return FALSE;
+
+  *threshold_end = (best + 1) * DEPTH_HISTOGRAM_BIN_SIZE;
+  return TRUE;
+}
+
+/* The end of the nearest peak of the smoothed histogram: where it
+   falls to an eighth of its height, or the valley before the next
+   peak rises */
+static gboolean
+find_peak_threshold (const DepthHistogram *histogram,
+                     guint                 first_bin,
+                     guint                *threshold_end)
+{
+  const guint32 *bins = histogram->bins;
+  guint32 smoothed[DEPTH_HISTOGRAM_N_BINS];
+  guint64 total = 0, min_count;
+  guint i, peak, valley;
+
+  for (i = first_bin; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    total += bins[i];
+  if (total < MIN_SAMPLES)
+    return FALSE;
+
+  /* A [1 2 1] kernel, so smoothed counts are four times the bins' */
+  for (i = 0; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    smoothed[i] = 2 * bins[i] +
+      (i > 0 ? bins[i - 1] : bins[i]) +
+      (i + 1 < DEPTH_HISTOGRAM_N_BINS ? bins[i + 1] : bins[i]);
+  min_count = MAX (total / PEAK_MIN_SHARE, 1) * 4;
+
+  for (peak = first_bin; peak < DEPTH_HISTOGRAM_N_BINS; peak++)
+    if (smoothed[peak] >= min_count &&
+        (peak == first_bin || smoothed[peak] >= smoothed[peak - 1]) &&
+        (peak + 1 == DEPTH_HISTOGRAM_N_BINS ||
+         smoothed[peak] >= smoothed[peak + 1]))
+      break;
+  if (peak == DEPTH_HISTOGRAM_N_BINS)
+    return FALSE;
+
+  valley = peak;
+  for (i = peak + 1; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    {
+      if (smoothed[i] < smoothed[valley])
+        {
+          valley = i;
+          if (smoothed[valley] <= smoothed[peak] / 8)
+            break;
+        }
+      else if (smoothed[i] > smoothed[valley] * 2 + min_count)
+        {
+          break;
+        }
+    }
+
+  *threshold_end = (valley + 1) * DEPTH_HISTOGRAM_BIN_SIZE;
+  return TRUE;
+}
+
+/* Finds the end of a threshold band starting at threshold_begin that
+   holds the nearest object, with method. Returns FALSE, leaving
+   threshold_end alone, if too few samples are past threshold_begin */
+gboolean
+depth_histogram_find_threshold (const DepthHistogram *histogram,
+                                DepthHistogramMethod  method,
+                                guint                 threshold_begin,
+                                guint                *threshold_end)
+{
+  guint first_bin;
+
+  g_return_val_if_fail (histogram != NULL, FALSE);
+  g_return_val_if_fail (method < DEPTH_HISTOGRAM_LAST, FALSE);
+  g_return_val_if_fail (threshold_end != NULL, FALSE);
+
+  first_bin = threshold_begin / DEPTH_HISTOGRAM_BIN_SIZE;
+  if (first_bin >= DEPTH_HISTOGRAM_N_BINS)
+    return FALSE;
+
+  if (method == DEPTH_HISTOGRAM_OTSU)
+    return find_otsu_threshold (histogram, first_bin, threshold_end);
+
+  return find_peak_threshold (histogram, first_bin, threshold_end);
+}
+
+/* Draws the histogram as bars on a translucent RGBA image, the bins
+   within the threshold band highlighted. Bars grow with the square
+   root of the counts, so a near object still shows next to a wall */
+void
+depth_histogram_draw (const DepthHistogram *histogram,
+                      guchar               *image,
+                      guint                 width,
+                      guint                 height,
+                      guint                 threshold_begin,
+                      guint                 threshold_end)
+{
+  static const guchar background[4] = { 0, 0, 0, 160 };
+  static const guchar band_color[4] = { 255, 200, 0, 255 };
+  static const guchar bar_color[4] = { 180, 180, 180, 255 };
+  guint32 max_count = 0;
+  guint x, y, i;
+
+  g_return_if_fail (histogram != NULL);
+  g_return_if_fail (image != NULL);
+
+  for (i = 0; i < (gsize) width * height; i++)
+    memcpy (image + i * 4, background, 4);
+
+  for (i = 0; i < DEPTH_HISTOGRAM_N_BINS; i++)
+    max_count = MAX (max_count, histogram->bins[i]);
+  if (max_count == 0)
+    return;
+
+  for (x = 0; x < width; x++)
+    {
+      guint bin_begin = (gsize) x * DEPTH_HISTOGRAM_N_BINS / width;
+      guint bin_end = (gsize) (x + 1) * DEPTH_HISTOGRAM_N_BINS / width;
+      guint32 count = 0;
+      const guchar *color;
+      guint bar;
+
+      bin_end = MAX (bin_end, bin_begin + 1);
+      for (i = bin_begin; i < bin_end; i++)
+        count = MAX (count, histogram->bins[i]);
+
+      bar = sqrt ((gdouble) count / max_count) * height + .5;
+      color = bin_end * DEPTH_HISTOGRAM_BIN_SIZE > threshold_begin &&
+        bin_begin * DEPTH_HISTOGRAM_BIN_SIZE <= threshold_end ?
+        band_color : bar_color;
+
+      for (y = height - MIN (bar, height); y < height; y++)
+        memcpy (image + ((gsize) y * width + x) * 4, color, 4);
+    }
+}
+
+const gchar *
+depth_histogram_method_get_name (DepthHistogramMethod method)
+{
+  g_return_val_if_fail (method < DEPTH_HISTOGRAM_LAST, NULL);
+
+  return method_names[method];
+}
+
+gboolean
+depth_histogram_method_from_string (const gchar          *name,
+                                    DepthHistogramMethod *method)
+{
+  guint i;
+
+  g_return_val_if_fail (name != NULL, FALSE);
+
+  for (i = 0; i < DEPTH_HISTOGRAM_LAST; i++)
+    {
+      if (g_ascii_strcasecmp (name, method_names[i]) == 0)
+        {
+          if (method != NULL)
+            *method = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,69 @@
+/* GFreenect Utils : depth-histogram.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_HISTOGRAM_H__
+#define __DEPTH_HISTOGRAM_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Bins of 16 mm from 0 to 4096 mm, deeper samples are not counted */
+#define DEPTH_HISTOGRAM_BIN_SIZE 16
+#define DEPTH_HISTOGRAM_N_BINS   256
+
+typedef enum
+{
+  DEPTH_HISTOGRAM_OTSU,
+  DEPTH_HISTOGRAM_PEAK,
+  DEPTH_HISTOGRAM_LAST
+} DepthHistogramMethod;
+
+/* Number of samples with depth in each bin, samples with no depth
+   are left out */
+typedef struct
+{
+  guint32 bins[DEPTH_HISTOGRAM_N_BINS];
+  guint32 n_samples;
+} DepthHistogram;
+
+void         depth_histogram_compute             (DepthHistogram *histogram,
+                                                  const guint16  *depth,
+                                                  guint           width,
+                                                  guint           height,
+                                                  guint           step);
+
+gboolean     depth_histogram_find_threshold      (const DepthHistogram *histogram,
+                                                  DepthHistogramMethod  method,
+                                                  guint                 threshold_begin,
+                                                  guint                *threshold_end);
+
+void         depth_histogram_draw                (const DepthHistogram *histogram,
+                                                  guchar               *image,
+                                                  guint                 width,
+                                                  guint                 height,
+                                                  guint                 threshold_begin,
+                                                  guint                 threshold_end);
+
+const gchar *depth_histogram_method_get_name     (DepthHistogramMethod  method);
+gboolean     depth_histogram_method_from_string  (const gchar          *name,
+                                                  DepthHistogramMethod *method);
+
+G_END_DECLS
+
+#endif /* __DEPTH_HISTOGRAM_H__ */
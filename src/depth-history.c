@@ -0,0 +1,382 @@
+/* GFreenect Utils : depth-history.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "depth-history.h"
+#include "depth-codec.h"
+
+/* Keeps the last frames of a depth stream compressed in a byte arena
+   of a fixed size, allocated up front with the index of the frames,
+   so the memory used never changes. Frames are written one after the
+   other and the arena wraps around, the oldest frames being dropped
+   to make room for new ones. Each frame is given room for its
+   largest encoding but only keeps what it took.
+
+   Saving a window of frames pins them while a thread of its own
+   writes them out, and new frames keep coming. A new frame that
+   would need the room of a pinned one is dropped instead */
+
+typedef struct
+{
+  DepthFrameHeader header;
+  gint64 time;
+  gsize offset;
+} HistoryFrame;
+
+struct _DepthHistory
+{
+  guint8 *data;
+  gsize size;
+  gsize write_offset;
+
+  HistoryFrame *frames;
+  guint max_frames;
+
+  /* Frames are numbered in the order they were pushed */
+  guint64 first;
+  guint n_frames;
+
+  GMutex mutex;
+  guint64 frames_dropped;
+  gboolean saving;
+  guint64 save_first;
+  guint save_n_frames;
+
+  /* Only used by the saving thread while saving */
+  GThread *thread;
+  gchar *path;
+  guint64 *index;
+  DepthHistorySavedFunc func;
+  gpointer user_data;
+};
+
+static HistoryFrame *
+get_frame (DepthHistory *history, guint64 n)
+{
+  return &history->frames[n % history->max_frames];
+}
+
+static gboolean
+drop_oldest (DepthHistory *history)
+{
+  if (history->saving && history->first >= history->save_first)
+    return FALSE;
+
+  history->first++;
+  history->n_frames--;
+
+  return TRUE;
+}
+
+/* Drops the oldest frames until there is room for size bytes at the
+   write offset, wrapping it around if it is too close to the end.
+   Frames past the write offset are left from the previous time
+   around, and are the oldest */
+static gboolean
+make_room (DepthHistory *history, gsize size)
+{
+  if (history->n_frames == history->max_frames && ! drop_oldest (history))
+    return FALSE;
+
+  if (history->write_offset + size > history->size)
+    {
+      while (history->n_frames > 0 &&
+             get_frame (history, history->first)->offset >=
+             history->write_offset)
+        {
+          if (! drop_oldest (history))
+            return FALSE;
+        }
+      history->write_offset = 0;
+    }
+
+  while (history->n_frames > 0)
+    {
+      gsize offset = get_frame (history, history->first)->offset;
+
+      if (offset < history->write_offset ||
+          offset >= history->write_offset + size)
+        break;
+
+      if (! drop_oldest (history))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Makes a history of up to max_frames frames in size bytes */
+DepthHistory *
+depth_history_new (guint max_frames, gsize size)
+{
+  DepthHistory *history;
+
+  g_return_val_if_fail (max_frames > 0, NULL);
+  g_return_val_if_fail (size > 0, NULL);
+
+  history = g_slice_new0 (DepthHistory);
+  history->data = g_malloc (size);
+  history->size = size;
+  history->frames = g_new0 (HistoryFrame, max_frames);
+  history->index = g_new (guint64, max_frames);
+  history->max_frames = max_frames;
+  g_mutex_init (&history->mutex);
+
+  return history;
+}
+
+/* Waits for a save in progress and frees the history */
+void
+depth_history_free (DepthHistory *history)
+{
+  g_return_if_fail (history != NULL);
+
+  if (history->thread != NULL)
+    g_thread_join (history->thread);
+
+  g_mutex_clear (&history->mutex);
+  g_free (history->path);
+  g_free (history->index);
+  g_free (history->frames);
+  g_free (history->data);
+  g_slice_free (DepthHistory, history);
+}
+
+/* Returns the memory taken by the history, which never changes */
+gsize
+depth_history_get_memory_size (DepthHistory *history)
+{
+  g_return_val_if_fail (history != NULL, 0);
+
+  return history->size +
+    history->max_frames * (sizeof (HistoryFrame) + sizeof (guint64));
+}
+
+/* Compresses a depth frame of header->width by header->height samples
+   into the history, dropping the oldest frames if there is no room.
+   time is when the frame was captured, in monotonic time. Returns
+   FALSE if the frame was dropped because the frames it would replace
+   are being saved. Must always be called from the thread that calls
+   depth_history_save() */
+gboolean
+depth_history_push (DepthHistory           *history,
+                    const DepthFrameHeader *header,
+                    const guint16          *depth,
+                    gint64                  time)
+{
+  HistoryFrame *frame;
+  gsize size, offset, encoded_size;
+
+  g_return_val_if_fail (history != NULL, FALSE);
+  g_return_val_if_fail (header != NULL, FALSE);
+  g_return_val_if_fail (depth != NULL, FALSE);
+
+  size = depth_codec_get_max_encoded_size (header->width, header->height);
+
+  g_mutex_lock (&history->mutex);
+  if (size > history->size || ! make_room (history, size))
+    {
+      history->frames_dropped++;
+      g_mutex_unlock (&history->mutex);
+      return FALSE;
+    }
+  offset = history->write_offset;
+  g_mutex_unlock (&history->mutex);
+
+  /* The room is not used by any frame until this one is added */
+  encoded_size = depth_codec_encode (depth, header->width, header->height,
+                                     history->data + offset);
+
+  g_mutex_lock (&history->mutex);
+  frame = get_frame (history, history->first + history->n_frames);
+  frame->header = *header;
+  frame->header.header_size = sizeof (DepthFrameHeader);
+  frame->header.format = DEPTH_FRAME_FORMAT_DELTA_RLE;
+  frame->header.payload_size = encoded_size;
+  frame->time = time;
+  frame->offset = offset;
+  history->n_frames++;
+  history->write_offset = offset + encoded_size;
+  g_mutex_unlock (&history->mutex);
+
+  return TRUE;
+}
+
+static gboolean
+write_frames (DepthHistory *history, GOutputStream *stream, GError **error)
+{
+  DepthFileHeader file_header;
+  DepthFileTrailer trailer;
+  guint64 offset;
+  guint i;
+
+  memset (&file_header, 0, sizeof (file_header));
+  memcpy (file_header.magic, DEPTH_FILE_MAGIC, DEPTH_FILE_MAGIC_LEN);
+  file_header.version = GUINT32_TO_LE (DEPTH_FILE_VERSION);
+  file_header.header_size = GUINT32_TO_LE (sizeof (file_header));
+
+  if (! g_output_stream_write_all (stream, &file_header, sizeof (file_header),
+                                   NULL, NULL, error))
+    return FALSE;
+  offset = sizeof (file_header);
+
+  /* The pinned frames are not touched by the pushing thread */
+  for (i = 0; i < history->save_n_frames; i++)
+    {
+      HistoryFrame *frame = get_frame (history, history->save_first + i);
+      DepthFrameHeader header = frame->header;
+
+      history->index[i] = GUINT64_TO_LE (offset);
+      offset += sizeof (header) + header.payload_size;
+      depth_frame_header_to_le (&header);
+
+      if (! g_output_stream_write_all (stream, &header, sizeof (header),
+                                       NULL, NULL, error) ||
+          ! g_output_stream_write_all (stream,
+                                       history->data + frame->offset,
+                                       frame->header.payload_size,
+                                       NULL, NULL, error))
+        return FALSE;
+    }
+
+  memset (&trailer, 0, sizeof (trailer));
+  trailer.index_offset = GUINT64_TO_LE (offset);
+  trailer.n_frames = GUINT32_TO_LE (history->save_n_frames);
+  memcpy (trailer.magic, DEPTH_FILE_TRAILER_MAGIC, DEPTH_FILE_MAGIC_LEN);
+
+  return g_output_stream_write_all (stream, history->index,
+                                    history->save_n_frames * sizeof (guint64),
+                                    NULL, NULL, error) &&
+    g_output_stream_write_all (stream, &trailer, sizeof (trailer),
+                               NULL, NULL, error);
+}
+
+static gpointer
+save_thread (gpointer data)
+{
+  DepthHistory *history = data;
+  GOutputStream *stream;
+  GError *error = NULL;
+  GFile *file;
+
+  file = g_file_new_for_path (history->path);
+  stream = (GOutputStream *) g_file_replace (file, NULL, FALSE,
+                                             G_FILE_CREATE_NONE,
+                                             NULL, &error);
+  g_object_unref (file);
+
+  if (stream != NULL)
+    {
+      if (write_frames (history, stream, &error))
+        g_output_stream_close (stream, NULL, &error);
+      else
+        g_output_stream_close (stream, NULL, NULL);
+      g_object_unref (stream);
+    }
+
+  if (history->func != NULL)
+    history->func (history->path, history->save_n_frames, error,
+                   history->user_data);
+  g_clear_error (&error);
+
+  g_mutex_lock (&history->mutex);
+  history->saving = FALSE;
+  g_mutex_unlock (&history->mutex);
+
+  return NULL;
+}
+
+/* Writes the frames captured from begin to end, in monotonic time, as
+   a recording at path, in a thread of its own. func is called from
+   that thread when it is done. Fails if there are no such frames or
+   if a save is still in progress */
+gboolean
+depth_history_save (DepthHistory           *history,
+                    const gchar            *path,
+                    gint64                  begin,
+                    gint64                  end,
+                    DepthHistorySavedFunc   func,
+                    gpointer                user_data,
+                    GError                **error)
+{
+  guint64 first, last;
+
+  g_return_val_if_fail (history != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  g_mutex_lock (&history->mutex);
+  if (history->saving)
+    {
+      g_mutex_unlock (&history->mutex);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                   "Still saving %s", history->path);
+      return FALSE;
+    }
+
+  last = history->first + history->n_frames;
+  for (first = history->first; first < last; first++)
+    if (get_frame (history, first)->time >= begin)
+      break;
+  for (last = first; last < history->first + history->n_frames; last++)
+    if (get_frame (history, last)->time > end)
+      break;
+
+  if (first == last)
+    {
+      g_mutex_unlock (&history->mutex);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "No frames to save in %s", path);
+      return FALSE;
+    }
+
+  history->saving = TRUE;
+  history->save_first = first;
+  history->save_n_frames = last - first;
+  g_mutex_unlock (&history->mutex);
+
+  /* The last save is over, but its thread may not have returned yet */
+  if (history->thread != NULL)
+    g_thread_join (history->thread);
+
+  g_free (history->path);
+  history->path = g_strdup (path);
+  history->func = func;
+  history->user_data = user_data;
+  history->thread = g_thread_new ("depth-history", save_thread, history);
+
+  return TRUE;
+}
+
+void
+depth_history_get_stats (DepthHistory      *history,
+                         DepthHistoryStats *stats)
+{
+  g_return_if_fail (history != NULL);
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&history->mutex);
+  stats->n_frames = history->n_frames;
+  stats->duration = history->n_frames > 0 ?
+    get_frame (history, history->first + history->n_frames - 1)->time -
+    get_frame (history, history->first)->time : 0;
+  stats->frames_dropped = history->frames_dropped;
+  stats->saving = history->saving;
+  g_mutex_unlock (&history->mutex);
+}
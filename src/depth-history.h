@@ -0,0 +1,68 @@
+/* GFreenect Utils : depth-history.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_HISTORY_H__
+#define __DEPTH_HISTORY_H__
+
+#include <glib.h>
+
+#include "depth-file.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthHistory DepthHistory;
+
+typedef struct
+{
+  guint    n_frames;
+  gint64   duration;
+  guint64  frames_dropped;
+  gboolean saving;
+} DepthHistoryStats;
+
+/* Called from the saving thread once a save is done, with error set
+   if it failed */
+typedef void (*DepthHistorySavedFunc) (const gchar  *path,
+                                       guint         n_frames,
+                                       const GError *error,
+                                       gpointer      user_data);
+
+DepthHistory *depth_history_new             (guint  max_frames,
+                                             gsize  size);
+void          depth_history_free            (DepthHistory *history);
+
+gsize         depth_history_get_memory_size (DepthHistory *history);
+
+gboolean      depth_history_push            (DepthHistory           *history,
+                                             const DepthFrameHeader *header,
+                                             const guint16          *depth,
+                                             gint64                  time);
+gboolean      depth_history_save            (DepthHistory           *history,
+                                             const gchar            *path,
+                                             gint64                  begin,
+                                             gint64                  end,
+                                             DepthHistorySavedFunc   func,
+                                             gpointer                user_data,
+                                             GError                **error);
+
+void          depth_history_get_stats       (DepthHistory      *history,
+                                             DepthHistoryStats *stats);
+
+G_END_DECLS
+
+#endif /* __DEPTH_HISTORY_H__ */
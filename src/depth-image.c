@@ -0,0 +1,203 @@
+/* GFreenect Utils : depth-image.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "depth-image.h"
+
+/* Expands an 8 bit grayscale image to RGB, e.g. to draw colored
+   points on it. rgb_buffer must hold width * height * 3 bytes */
+void
+depth_image_gray_to_rgb (const guchar *gray_buffer,
+                         guint         width,
+                         guint         height,
+                         guchar       *rgb_buffer)
+{
+  gsize i, n_pixels;
+
+  g_return_if_fail (gray_buffer != NULL);
+  g_return_if_fail (rgb_buffer != NULL);
+
+  n_pixels = (gsize) width * height;
+  for (i = 0; i < n_pixels; i++)
+    memset (rgb_buffer + i * 3, gray_buffer[i], 3);
+}
+
+static gint
+hex_value (gchar c)
+{
+  return g_ascii_xdigit_value (c);
+}
+
+/* Parses "#rgb" or "#rrggbb" colors. Returns FALSE if color_str is
+   not one of those */
+gboolean
+depth_image_parse_color (const gchar *color_str, guchar color[3])
+{
+  gsize len, digits, i;
+
+  g_return_val_if_fail (color_str != NULL, FALSE);
+
+  if (color_str[0] != '#')
+    return FALSE;
+
+  color_str++;
+  len = strlen (color_str);
+  if (len != 3 && len != 6)
+    return FALSE;
+
+  digits = len / 3;
+  for (i = 0; i < 3; i++)
+    {
+      gint high = hex_value (color_str[i * digits]);
+      gint low = hex_value (color_str[i * digits + digits - 1]);
+
+      if (high < 0 || low < 0)
+        return FALSE;
+
+      color[i] = (high << 4) | low;
+    }
+
+  return TRUE;
+}
+
+/* Draws a square of DEPTH_IMAGE_POINT_SIZE around x, y, clipped to the
+   image */
+void
+depth_image_draw_point (guchar       *rgb_buffer,
+                        guint         width,
+                        guint         height,
+                        const guchar  color[3],
+                        gint          x,
+                        gint          y)
+{
+  DepthImagePoint point;
+
+  g_return_if_fail (rgb_buffer != NULL);
+
+  memcpy (point.color, color, 3);
+  point.x = x;
+  point.y = y;
+  depth_image_draw_points (rgb_buffer, width, height, 3, &point, 1, 1, 0, 0);
+}
+
+/* Draws squares of DEPTH_IMAGE_POINT_SIZE around points given in full
+   resolution coordinates, on an image of n_channels, 3 for RGB or 4
+   for RGBA, reduced by dimension_factor. Images of frames cropped to
+   a region of interest start at x_offset, y_offset of the whole frame.
+   Squares are clipped to the image once, and their rows copied from a
+   span of their color */
+void
+depth_image_draw_points (guchar                *image,
+                         guint                  width,
+                         guint                  height,
+                         guint                  n_channels,
+                         const DepthImagePoint *points,
+                         guint                  n_points,
+                         guint                  dimension_factor,
+                         guint                  x_offset,
+                         guint                  y_offset)
+{
+  guchar span[DEPTH_IMAGE_POINT_SIZE * 2 * 4];
+  gsize stride = (gsize) width * n_channels;
+  guint i;
+
+  g_return_if_fail (image != NULL);
+  g_return_if_fail (n_channels == 3 || n_channels == 4);
+  g_return_if_fail (dimension_factor > 0);
+
+  for (i = 0; i < n_points; i++)
+    {
+      gint x = (points[i].x - (gint) x_offset) / (gint) dimension_factor;
+      gint y = (points[i].y - (gint) y_offset) / (gint) dimension_factor;
+      gint x_begin, x_end, y_begin, y_end, k;
+      gsize span_size;
+      guchar *row;
+
+      x_begin = MAX (x - DEPTH_IMAGE_POINT_SIZE, 0);
+      x_end = MIN (x + DEPTH_IMAGE_POINT_SIZE, (gint) width);
+      y_begin = MAX (y - DEPTH_IMAGE_POINT_SIZE, 0);
+      y_end = MIN (y + DEPTH_IMAGE_POINT_SIZE, (gint) height);
+      if (x_begin >= x_end || y_begin >= y_end)
+        continue;
+
+      span_size = (gsize) (x_end - x_begin) * n_channels;
+      for (k = 0; k < x_end - x_begin; k++)
+        {
+          memcpy (span + k * n_channels, points[i].color, 3);
+          if (n_channels == 4)
+            span[k * 4 + 3] = 255;
+        }
+
+      row = image + y_begin * stride + (gsize) x_begin * n_channels;
+      for (k = y_begin; k < y_end; k++, row += stride)
+        memcpy (row, span, span_size);
+    }
+}
+
+/* Writes an image of n_channels bytes per pixel, which must be 1, 3
+   or 4, as a binary PGM, PPM or RGBA PAM respectively */
+gboolean
+depth_image_write_pnm (const gchar   *path,
+                       const guchar  *buffer,
+                       guint          width,
+                       guint          height,
+                       guint          n_channels,
+                       GError       **error)
+{
+  FILE *file;
+  gsize size;
+  gboolean success;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (n_channels == 1 || n_channels == 3 ||
+                        n_channels == 4, FALSE);
+
+  file = g_fopen (path, "wb");
+  if (file == NULL)
+    goto error;
+
+  if (n_channels == 4)
+    fprintf (file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\n"
+             "TUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+  else
+    fprintf (file, "P%c\n%u %u\n255\n", n_channels == 1 ? '5' : '6',
+             width, height);
+
+  size = (gsize) width * height * n_channels;
+  success = fwrite (buffer, 1, size, file) == size;
+
+  if (fclose (file) != 0)
+    success = FALSE;
+
+  if (success)
+    return TRUE;
+
+ error:
+  {
+    gint saved_errno = errno;
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Could not write %s: %s", path, g_strerror (saved_errno));
+  }
+  return FALSE;
+}
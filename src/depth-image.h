@@ -0,0 +1,67 @@
+/* GFreenect Utils : depth-image.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_IMAGE_H__
+#define __DEPTH_IMAGE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define DEPTH_IMAGE_POINT_SIZE 6
+
+typedef struct
+{
+  guchar color[3];
+  gint x;
+  gint y;
+} DepthImagePoint;
+
+void     depth_image_gray_to_rgb    (const guchar  *gray_buffer,
+                                     guint          width,
+                                     guint          height,
+                                     guchar        *rgb_buffer);
+
+gboolean depth_image_parse_color    (const gchar *color_str,
+                                     guchar       color[3]);
+void     depth_image_draw_point     (guchar       *rgb_buffer,
+                                     guint         width,
+                                     guint         height,
+                                     const guchar  color[3],
+                                     gint          x,
+                                     gint          y);
+void     depth_image_draw_points    (guchar                *image,
+                                     guint                  width,
+                                     guint                  height,
+                                     guint                  n_channels,
+                                     const DepthImagePoint *points,
+                                     guint                  n_points,
+                                     guint                  dimension_factor,
+                                     guint                  x_offset,
+                                     guint                  y_offset);
+
+gboolean depth_image_write_pnm      (const gchar   *path,
+                                     const guchar  *buffer,
+                                     guint          width,
+                                     guint          height,
+                                     guint          n_channels,
+                                     GError       **error);
+
+G_END_DECLS
+
+#endif /* __DEPTH_IMAGE_H__ */
@@ -0,0 +1,309 @@
+/* GFreenect Utils : depth-player.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "depth-player.h"
+
+/* A prefetch thread decodes the frames of a sequence in order and
+   maps them through a colormap into a small ring of images, which the
+   consumer takes from the head. When the consumer falls behind it
+   moves the decoder forward with depth_player_skip_to() so late
+   frames are never decoded, and a seek discards everything
+   prefetched. Frames decoded for an older seek
+   are recognised by their generation and thrown away */
+
+struct _DepthPlayer
+{
+  DepthSequence *sequence;
+  DepthColormap *colormap;
+  DepthPlayerDrawFunc draw_func;
+  gpointer user_data;
+  GThread *thread;
+
+  GMutex mutex;
+  GCond cond;
+  DepthPlayerFrame *frames;
+  gsize *capacities;
+  guint n_frames;
+  guint head;
+  guint queued;
+  guint next_frame;
+  guint generation;
+  gboolean stopping;
+  guint64 skipped;
+
+  /* Only touched by the prefetch thread */
+  guint16 *decoded;
+  gsize decoded_samples;
+};
+
+static gboolean
+decode_frame (DepthPlayer      *player,
+              DepthColormap    *colormap,
+              guint             index,
+              DepthPlayerFrame *frame)
+{
+  GError *error = NULL;
+  const guint16 *depth;
+  gsize n_samples, size;
+
+  if (! depth_sequence_get_frame_header (player->sequence, index,
+                                         &frame->header, &error))
+    goto error;
+
+  n_samples = (gsize) frame->header.width * frame->header.height;
+  if (n_samples > player->decoded_samples)
+    {
+      g_free (player->decoded);
+      player->decoded = g_new (guint16, n_samples);
+      player->decoded_samples = n_samples;
+    }
+
+  frame->n_channels = depth_colormap_get_n_channels (colormap);
+  size = n_samples * frame->n_channels;
+  if (size > player->capacities[frame - player->frames])
+    {
+      g_free (frame->image);
+      frame->image = g_malloc (size);
+      player->capacities[frame - player->frames] = size;
+    }
+
+  depth = depth_sequence_get_depth (player->sequence, index, &frame->header,
+                                    player->decoded, n_samples, &error);
+  if (depth == NULL)
+    goto error;
+
+  depth_colormap_apply (colormap, depth, n_samples, frame->image);
+  depth_sequence_release_frame (player->sequence, index);
+
+  frame->frame = index;
+  if (player->draw_func != NULL)
+    player->draw_func (frame, player->user_data);
+
+  return TRUE;
+
+ error:
+  g_debug ("ERROR: %s", error->message);
+  g_error_free (error);
+  return FALSE;
+}
+
+static gpointer
+prefetch_thread (gpointer data)
+{
+  DepthPlayer *player = data;
+  guint n_frames = depth_sequence_get_n_frames (player->sequence);
+
+  g_mutex_lock (&player->mutex);
+  while (TRUE)
+    {
+      DepthPlayerFrame *frame;
+      DepthColormap *colormap;
+      guint index, generation;
+      gboolean decoded;
+
+      while (! player->stopping &&
+             (player->queued == player->n_frames ||
+              player->next_frame >= n_frames))
+        g_cond_wait (&player->cond, &player->mutex);
+
+      if (player->stopping)
+        break;
+
+      /* The slot after the queued ones is only ever written here */
+      index = player->next_frame;
+      generation = player->generation;
+      colormap = depth_colormap_ref (player->colormap);
+      frame = &player->frames[(player->head + player->queued) %
+                              player->n_frames];
+      g_mutex_unlock (&player->mutex);
+
+      decoded = decode_frame (player, colormap, index, frame);
+      depth_colormap_unref (colormap);
+
+      g_mutex_lock (&player->mutex);
+      if (generation != player->generation)
+        continue;
+
+      player->next_frame = MAX (player->next_frame, index + 1);
+      if (decoded)
+        player->queued++;
+      else
+        player->skipped++;
+    }
+  g_mutex_unlock (&player->mutex);
+
+  return NULL;
+}
+
+/* Starts prefetching the sequence from its first frame into n_buffers
+   buffers, colored with colormap. The sequence must not be used by
+   anyone else until the player is freed */
+DepthPlayer *
+depth_player_new (DepthSequence       *sequence,
+                  DepthColormap       *colormap,
+                  guint                n_buffers,
+                  DepthPlayerDrawFunc  draw_func,
+                  gpointer             user_data)
+{
+  DepthPlayer *player;
+
+  g_return_val_if_fail (sequence != NULL, NULL);
+  g_return_val_if_fail (colormap != NULL, NULL);
+  g_return_val_if_fail (n_buffers > 0, NULL);
+
+  player = g_slice_new0 (DepthPlayer);
+  player->sequence = sequence;
+  player->colormap = depth_colormap_ref (colormap);
+  player->draw_func = draw_func;
+  player->user_data = user_data;
+  player->n_frames = n_buffers;
+  player->frames = g_new0 (DepthPlayerFrame, n_buffers);
+  player->capacities = g_new0 (gsize, n_buffers);
+  g_mutex_init (&player->mutex);
+  g_cond_init (&player->cond);
+
+  player->thread = g_thread_new ("depth-player", prefetch_thread, player);
+
+  return player;
+}
+
+void
+depth_player_free (DepthPlayer *player)
+{
+  guint i;
+
+  g_return_if_fail (player != NULL);
+
+  g_mutex_lock (&player->mutex);
+  player->stopping = TRUE;
+  g_cond_signal (&player->cond);
+  g_mutex_unlock (&player->mutex);
+
+  g_thread_join (player->thread);
+
+  for (i = 0; i < player->n_frames; i++)
+    g_free (player->frames[i].image);
+  g_free (player->frames);
+  depth_colormap_unref (player->colormap);
+  g_free (player->capacities);
+  g_free (player->decoded);
+
+  g_mutex_clear (&player->mutex);
+  g_cond_clear (&player->cond);
+  g_slice_free (DepthPlayer, player);
+}
+
+/* Colors the frames decoded from now on with colormap. Frames already
+   prefetched keep their colors, depth_player_seek() drops them */
+void
+depth_player_set_colormap (DepthPlayer *player, DepthColormap *colormap)
+{
+  DepthColormap *old;
+
+  g_return_if_fail (player != NULL);
+  g_return_if_fail (colormap != NULL);
+
+  g_mutex_lock (&player->mutex);
+  old = player->colormap;
+  player->colormap = depth_colormap_ref (colormap);
+  g_mutex_unlock (&player->mutex);
+
+  depth_colormap_unref (old);
+}
+
+/* Drops every prefetched frame and restarts decoding at frame. Frames
+   returned by depth_player_peek() must not be used afterwards */
+void
+depth_player_seek (DepthPlayer *player, guint frame)
+{
+  g_return_if_fail (player != NULL);
+
+  g_mutex_lock (&player->mutex);
+  player->queued = 0;
+  player->next_frame = frame;
+  player->generation++;
+  g_cond_signal (&player->cond);
+  g_mutex_unlock (&player->mutex);
+}
+
+/* Makes the prefetch thread skip the frames before frame it has not
+   started decoding yet. Frames already prefetched are kept */
+void
+depth_player_skip_to (DepthPlayer *player, guint frame)
+{
+  g_return_if_fail (player != NULL);
+
+  g_mutex_lock (&player->mutex);
+  if (player->next_frame < frame)
+    {
+      player->skipped += frame - player->next_frame;
+      player->next_frame = frame;
+      g_cond_signal (&player->cond);
+    }
+  g_mutex_unlock (&player->mutex);
+}
+
+/* Returns the oldest prefetched frame, or NULL if none is ready. It
+   stays valid until depth_player_pop() or depth_player_seek() */
+DepthPlayerFrame *
+depth_player_peek (DepthPlayer *player)
+{
+  DepthPlayerFrame *frame = NULL;
+
+  g_return_val_if_fail (player != NULL, NULL);
+
+  g_mutex_lock (&player->mutex);
+  if (player->queued > 0)
+    frame = &player->frames[player->head];
+  g_mutex_unlock (&player->mutex);
+
+  return frame;
+}
+
+/* Gives the frame returned by depth_player_peek() back to the
+   prefetch thread */
+void
+depth_player_pop (DepthPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  g_mutex_lock (&player->mutex);
+  if (player->queued > 0)
+    {
+      player->head = (player->head + 1) % player->n_frames;
+      player->queued--;
+      g_cond_signal (&player->cond);
+    }
+  g_mutex_unlock (&player->mutex);
+}
+
+/* Returns how many frames were never decoded because they were late
+   or could not be read */
+guint64
+depth_player_get_skipped (DepthPlayer *player)
+{
+  guint64 skipped;
+
+  g_return_val_if_fail (player != NULL, 0);
+
+  g_mutex_lock (&player->mutex);
+  skipped = player->skipped;
+  g_mutex_unlock (&player->mutex);
+
+  return skipped;
+}
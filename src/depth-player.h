@@ -0,0 +1,66 @@
+/* GFreenect Utils : depth-player.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_PLAYER_H__
+#define __DEPTH_PLAYER_H__
+
+#include <glib.h>
+
+#include "depth-sequence.h"
+#include "depth-colormap.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthPlayer DepthPlayer;
+
+typedef struct
+{
+  guint frame;
+  DepthFrameHeader header;
+  guchar *image;
+  guint n_channels;
+} DepthPlayerFrame;
+
+/* Called from the prefetch thread on every decoded frame, e.g. to
+   draw on it */
+typedef void (*DepthPlayerDrawFunc) (DepthPlayerFrame *frame,
+                                     gpointer          user_data);
+
+DepthPlayer      *depth_player_new         (DepthSequence       *sequence,
+                                            DepthColormap       *colormap,
+                                            guint                n_buffers,
+                                            DepthPlayerDrawFunc  draw_func,
+                                            gpointer             user_data);
+void              depth_player_free        (DepthPlayer *player);
+
+void              depth_player_set_colormap (DepthPlayer   *player,
+                                             DepthColormap *colormap);
+
+void              depth_player_seek        (DepthPlayer *player,
+                                            guint        frame);
+void              depth_player_skip_to     (DepthPlayer *player,
+                                            guint        frame);
+
+DepthPlayerFrame *depth_player_peek        (DepthPlayer *player);
+void              depth_player_pop         (DepthPlayer *player);
+
+guint64           depth_player_get_skipped (DepthPlayer *player);
+
+G_END_DECLS
+
+#endif /* __DEPTH_PLAYER_H__ */
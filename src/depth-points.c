@@ -0,0 +1,329 @@
+/* GFreenect Utils : depth-points.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "depth-points.h"
+
+/* Points are kept in an array per frame, so those of a frame are
+   drawn without looking each one up, and colors are only parsed when
+   the points are added. Once added, points are only read, so they
+   can be drawn from several threads at once */
+
+/* Longest line of a points file */
+#define MAX_LINE_LENGTH 256
+
+struct _DepthPoints
+{
+  GArray *all_frames;
+  GHashTable *frames;
+  guint n_points;
+};
+
+DepthPoints *
+depth_points_new (void)
+{
+  DepthPoints *points;
+
+  points = g_slice_new0 (DepthPoints);
+  points->all_frames = g_array_new (FALSE, FALSE, sizeof (DepthImagePoint));
+  points->frames = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                          NULL,
+                                          (GDestroyNotify) g_array_unref);
+
+  return points;
+}
+
+void
+depth_points_free (DepthPoints *points)
+{
+  g_return_if_fail (points != NULL);
+
+  g_array_free (points->all_frames, TRUE);
+  g_hash_table_destroy (points->frames);
+  g_slice_free (DepthPoints, points);
+}
+
+static GArray *
+get_frame_points (DepthPoints *points, gint frame)
+{
+  if (frame == DEPTH_POINTS_ALL_FRAMES)
+    return points->all_frames;
+
+  return g_hash_table_lookup (points->frames, GINT_TO_POINTER (frame));
+}
+
+/* Adds a point, in full resolution coordinates, for the frame at
+   index frame or for every frame if it is DEPTH_POINTS_ALL_FRAMES.
+   Points added later are drawn over earlier ones */
+void
+depth_points_add (DepthPoints  *points,
+                  gint          frame,
+                  const guchar  color[3],
+                  gint          x,
+                  gint          y)
+{
+  DepthImagePoint point;
+  GArray *array;
+
+  g_return_if_fail (points != NULL);
+  g_return_if_fail (frame >= DEPTH_POINTS_ALL_FRAMES);
+
+  array = get_frame_points (points, frame);
+  if (array == NULL)
+    {
+      array = g_array_new (FALSE, FALSE, sizeof (DepthImagePoint));
+      g_hash_table_insert (points->frames, GINT_TO_POINTER (frame), array);
+    }
+
+  memcpy (point.color, color, 3);
+  point.x = x;
+  point.y = y;
+  g_array_append_val (array, point);
+  points->n_points++;
+}
+
+static gboolean
+parse_int (const gchar **str, gint *value)
+{
+  gchar *end;
+  gint64 parsed;
+
+  parsed = g_ascii_strtoll (*str, &end, 10);
+  if (end == *str || parsed < G_MININT32 || parsed > G_MAXINT32)
+    return FALSE;
+
+  *value = parsed;
+  *str = end;
+
+  return TRUE;
+}
+
+/* Adds a point given as "[FRAME,]#RRGGBB,X,Y". Returns FALSE if str
+   is not one */
+gboolean
+depth_points_parse (DepthPoints *points, const gchar *str)
+{
+  gint frame = DEPTH_POINTS_ALL_FRAMES;
+  gchar color_str[8];
+  const gchar *comma;
+  guchar color[3];
+  gint x, y;
+
+  g_return_val_if_fail (points != NULL, FALSE);
+  g_return_val_if_fail (str != NULL, FALSE);
+
+  if (*str != '#' &&
+      (! parse_int (&str, &frame) || frame < 0 || *str++ != ','))
+    return FALSE;
+
+  comma = strchr (str, ',');
+  if (comma == NULL || comma - str >= (gssize) sizeof (color_str))
+    return FALSE;
+  memcpy (color_str, str, comma - str);
+  color_str[comma - str] = '\0';
+  if (! depth_image_parse_color (color_str, color))
+    return FALSE;
+  str = comma + 1;
+
+  if (! parse_int (&str, &x) || *str++ != ',' || ! parse_int (&str, &y))
+    return FALSE;
+  while (g_ascii_isspace (*str))
+    str++;
+  if (*str != '\0')
+    return FALSE;
+
+  depth_points_add (points, frame, color, x, y);
+
+  return TRUE;
+}
+
+static gboolean
+load_text (DepthPoints  *points,
+           const gchar  *path,
+           const gchar  *data,
+           gsize         length,
+           GError      **error)
+{
+  gchar line[MAX_LINE_LENGTH + 1];
+  const gchar *end = data + length;
+  guint line_number;
+
+  for (line_number = 1; data < end; line_number++)
+    {
+      const gchar *line_end = memchr (data, '\n', end - data);
+      gsize line_length;
+
+      if (line_end == NULL)
+        line_end = end;
+      line_length = line_end - data;
+
+      if (line_length > MAX_LINE_LENGTH)
+        goto invalid;
+      memcpy (line, data, line_length);
+      line[line_length] = '\0';
+      data = line_end + 1;
+
+      /* Blank lines are skipped */
+      if (line[strspn (line, " \t\r")] == '\0')
+        continue;
+
+      if (! depth_points_parse (points, line))
+        goto invalid;
+    }
+
+  return TRUE;
+
+ invalid:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Invalid point at line %u of %s, expected "
+               "[FRAME,]#RRGGBB,X,Y", line_number, path);
+  return FALSE;
+}
+
+static gboolean
+load_binary (DepthPoints  *points,
+             const gchar  *path,
+             const gchar  *data,
+             gsize         length,
+             GError      **error)
+{
+  DepthPointsFileHeader header;
+  guint i;
+
+  memcpy (&header, data, sizeof (header));
+  header.version = GUINT32_FROM_LE (header.version);
+  header.n_points = GUINT32_FROM_LE (header.n_points);
+
+  if (header.version != DEPTH_POINTS_FILE_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Unsupported version %u of points file %s",
+                   header.version, path);
+      return FALSE;
+    }
+
+  if ((length - sizeof (header)) / sizeof (DepthPointsFileRecord) <
+      header.n_points)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Points file %s is truncated", path);
+      return FALSE;
+    }
+
+  data += sizeof (header);
+  for (i = 0; i < header.n_points; i++)
+    {
+      DepthPointsFileRecord record;
+
+      memcpy (&record, data + i * sizeof (record), sizeof (record));
+      record.frame = GINT32_FROM_LE (record.frame);
+      if (record.frame < DEPTH_POINTS_ALL_FRAMES)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid frame %d of point %u in %s",
+                       record.frame, i, path);
+          return FALSE;
+        }
+
+      depth_points_add (points, record.frame, record.color,
+                        GINT32_FROM_LE (record.x), GINT32_FROM_LE (record.y));
+    }
+
+  return TRUE;
+}
+
+/* Adds the points of a text or binary points file, telling them
+   apart by the magic of binary files */
+gboolean
+depth_points_load (DepthPoints *points, const gchar *path, GError **error)
+{
+  GMappedFile *mapped_file;
+  const gchar *data;
+  gsize length;
+  gboolean success;
+
+  g_return_val_if_fail (points != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  mapped_file = g_mapped_file_new (path, FALSE, error);
+  if (mapped_file == NULL)
+    return FALSE;
+
+  data = g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
+
+  if (length >= sizeof (DepthPointsFileHeader) &&
+      memcmp (data, DEPTH_POINTS_FILE_MAGIC, DEPTH_POINTS_FILE_MAGIC_LEN) == 0)
+    success = load_binary (points, path, data, length, error);
+  else
+    success = load_text (points, path, data, length, error);
+
+  g_mapped_file_unref (mapped_file);
+
+  return success;
+}
+
+guint
+depth_points_get_n_points (DepthPoints *points)
+{
+  g_return_val_if_fail (points != NULL, 0);
+
+  return points->n_points;
+}
+
+/* Returns TRUE if some points are only for some frames */
+gboolean
+depth_points_has_frames (DepthPoints *points)
+{
+  g_return_val_if_fail (points != NULL, FALSE);
+
+  return g_hash_table_size (points->frames) > 0;
+}
+
+/* Draws the points for every frame and those for the frame at index
+   frame, see depth_image_draw_points() */
+void
+depth_points_draw (DepthPoints *points,
+                   gint         frame,
+                   guchar      *image,
+                   guint        width,
+                   guint        height,
+                   guint        n_channels,
+                   guint        dimension_factor,
+                   guint        x_offset,
+                   guint        y_offset)
+{
+  GArray *array;
+
+  g_return_if_fail (points != NULL);
+  g_return_if_fail (image != NULL);
+
+  depth_image_draw_points (image, width, height, n_channels,
+                           (const DepthImagePoint *) points->all_frames->data,
+                           points->all_frames->len, dimension_factor,
+                           x_offset, y_offset);
+
+  array = get_frame_points (points, frame);
+  if (array != NULL && frame != DEPTH_POINTS_ALL_FRAMES)
+    depth_image_draw_points (image, width, height, n_channels,
+                             (const DepthImagePoint *) array->data,
+                             array->len, dimension_factor,
+                             x_offset, y_offset);
+}
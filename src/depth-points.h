@@ -0,0 +1,96 @@
+/* GFreenect Utils : depth-points.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_POINTS_H__
+#define __DEPTH_POINTS_H__
+
+#include <glib.h>
+
+#include "depth-image.h"
+
+G_BEGIN_DECLS
+
+/* Points are either for every frame or for the frame at an index of
+   a recording or directory of shots.
+ *
+ * A points file is either text, with a point per line as
+ *
+ *   [FRAME,]#RRGGBB,X,Y
+ *
+ * or binary, laid out as:
+ *
+ *   DepthPointsFileHeader
+ *   DepthPointsFileRecord        (once per point)
+ *
+ * with all integers little endian and frame -1 for every frame.
+ * Coordinates are in full resolution pixels */
+
+#define DEPTH_POINTS_ALL_FRAMES       -1
+
+#define DEPTH_POINTS_FILE_MAGIC       "GFPOINTS"
+#define DEPTH_POINTS_FILE_MAGIC_LEN   8
+#define DEPTH_POINTS_FILE_VERSION     1
+
+typedef struct
+{
+  gchar   magic[DEPTH_POINTS_FILE_MAGIC_LEN];
+  guint32 version;
+  guint32 n_points;
+} DepthPointsFileHeader;
+
+typedef struct
+{
+  gint32 frame;
+  gint32 x;
+  gint32 y;
+  guint8 color[3];
+  guint8 reserved;
+} DepthPointsFileRecord;
+
+typedef struct _DepthPoints DepthPoints;
+
+DepthPoints *depth_points_new          (void);
+void         depth_points_free         (DepthPoints *points);
+
+void         depth_points_add          (DepthPoints  *points,
+                                        gint          frame,
+                                        const guchar  color[3],
+                                        gint          x,
+                                        gint          y);
+gboolean     depth_points_parse        (DepthPoints *points,
+                                        const gchar *str);
+gboolean     depth_points_load         (DepthPoints  *points,
+                                        const gchar  *path,
+                                        GError      **error);
+
+guint        depth_points_get_n_points (DepthPoints *points);
+gboolean     depth_points_has_frames   (DepthPoints *points);
+
+void         depth_points_draw         (DepthPoints *points,
+                                        gint         frame,
+                                        guchar      *image,
+                                        guint        width,
+                                        guint        height,
+                                        guint        n_channels,
+                                        guint        dimension_factor,
+                                        guint        x_offset,
+                                        guint        y_offset);
+
+G_END_DECLS
+
+#endif /* __DEPTH_POINTS_H__ */
@@ -0,0 +1,642 @@
+/* GFreenect Utils : depth-processing.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "depth-processing.h"
+#include "worker-pool.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Name of the environment variable that limits the instruction set
+   of the kernels of every module, e.g. to compare their output. It
+   takes scalar, sse2 or avx2 */
+#define IMPLEMENTATION_ENV "GFREENECT_UTILS_SIMD"
+
+#define WHITE 255
+#define BLACK 0
+
+/* Frames are processed in bands of rows that take about this much
+   memory, counting the depth, reduced and mask buffers */
+#define BAND_BYTES (64 * 1024)
+#define BAND_BYTES_PER_PIXEL (2 * sizeof (guint16) + sizeof (guchar))
+
+/* Rectangles are thresholded in pieces of this many samples of a row,
+   with the reduced output going to a buffer on the stack */
+#define RECT_CHUNK 256
+
+typedef void (*ThresholdRunFunc) (const guint16 *depth,
+                                  guint16       *reduced,
+                                  guchar        *mask,
+                                  gsize          n_pixels,
+                                  guint16        threshold_begin,
+                                  guint16        threshold_end);
+
+/* Like ThresholdRunFunc, without the mask */
+typedef void (*ThresholdReduceFunc) (const guint16 *depth,
+                                     guint16       *reduced,
+                                     gsize          n_pixels,
+                                     guint16        threshold_begin,
+                                     guint16        threshold_end);
+
+typedef struct
+{
+  DepthProcessingSimd simd;
+  ThresholdRunFunc run;
+  ThresholdReduceFunc reduce;
+} ThresholdImpl;
+
+static void
+threshold_run_scalar (const guint16 *depth,
+                      guint16       *reduced,
+                      guchar        *mask,
+                      gsize          n_pixels,
+                      guint16        threshold_begin,
+                      guint16        threshold_end)
+{
+  gsize i;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      guint16 value = depth[i];
+
+      if (value < threshold_begin || value > threshold_end)
+        value = 0;
+
+      reduced[i] = value;
+      mask[i] = value != 0 ? BLACK : WHITE;
+    }
+}
+
+static void
+threshold_reduce_scalar (const guint16 *depth,
+                         guint16       *reduced,
+                         gsize          n_pixels,
+                         guint16        threshold_begin,
+                         guint16        threshold_end)
+{
+  gsize i;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      guint16 value = depth[i];
+
+      reduced[i] = value < threshold_begin || value > threshold_end ?
+        0 : value;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 has no unsigned 16 bit comparison, so the range check is
+   done with saturated subtractions: a - b saturates to 0 iff a <= b.
+   Background samples compare equal to zero as all ones, so packing
+   the comparison to bytes gives the mask directly */
+
+__attribute__ ((target ("sse2")))
+static void
+threshold_run_sse2 (const guint16 *depth,
+                    guint16       *reduced,
+                    guchar        *mask,
+                    gsize          n_pixels,
+                    guint16        threshold_begin,
+                    guint16        threshold_end)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i begin = _mm_set1_epi16 ((gshort) threshold_begin);
+  const __m128i end = _mm_set1_epi16 ((gshort) threshold_end);
+  gsize i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      __m128i value, keep, background;
+
+      value = _mm_loadu_si128 ((const __m128i *) (depth + i));
+      keep = _mm_and_si128 (
+        _mm_cmpeq_epi16 (_mm_subs_epu16 (begin, value), zero),
+        _mm_cmpeq_epi16 (_mm_subs_epu16 (value, end), zero));
+      value = _mm_and_si128 (value, keep);
+      _mm_storeu_si128 ((__m128i *) (reduced + i), value);
+
+      background = _mm_cmpeq_epi16 (value, zero);
+      _mm_storel_epi64 ((__m128i *) (mask + i),
+                        _mm_packs_epi16 (background, background));
+    }
+
+  threshold_run_scalar (depth + i, reduced + i, mask + i,
+                        n_pixels - i, threshold_begin, threshold_end);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+threshold_run_avx2 (const guint16 *depth,
+                    guint16       *reduced,
+                    guchar        *mask,
+                    gsize          n_pixels,
+                    guint16        threshold_begin,
+                    guint16        threshold_end)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i begin = _mm256_set1_epi16 ((gshort) threshold_begin);
+  const __m256i end = _mm256_set1_epi16 ((gshort) threshold_end);
+  gsize i;
+
+  for (i = 0; i + 32 <= n_pixels; i += 32)
+    {
+      __m256i first, second, keep, background;
+
+      first = _mm256_loadu_si256 ((const __m256i *) (depth + i));
+      keep = _mm256_and_si256 (
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (begin, first), zero),
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (first, end), zero));
+      first = _mm256_and_si256 (first, keep);
+      _mm256_storeu_si256 ((__m256i *) (reduced + i), first);
+
+      second = _mm256_loadu_si256 ((const __m256i *) (depth + i + 16));
+      keep = _mm256_and_si256 (
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (begin, second), zero),
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (second, end), zero));
+      second = _mm256_and_si256 (second, keep);
+      _mm256_storeu_si256 ((__m256i *) (reduced + i + 16), second);
+
+      /* packs works per 128 bit lane, so the qwords come out as
+         first[0-7], second[0-7], first[8-15], second[8-15] and
+         have to be put back in pixel order */
+      background = _mm256_packs_epi16 (_mm256_cmpeq_epi16 (first, zero),
+                                       _mm256_cmpeq_epi16 (second, zero));
+      background = _mm256_permute4x64_epi64 (background, 0xd8);
+      _mm256_storeu_si256 ((__m256i *) (mask + i), background);
+    }
+
+  threshold_run_sse2 (depth + i, reduced + i, mask + i,
+                      n_pixels - i, threshold_begin, threshold_end);
+}
+
+__attribute__ ((target ("sse2")))
+static void
+threshold_reduce_sse2 (const guint16 *depth,
+                       guint16       *reduced,
+                       gsize          n_pixels,
+                       guint16        threshold_begin,
+                       guint16        threshold_end)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i begin = _mm_set1_epi16 ((gshort) threshold_begin);
+  const __m128i end = _mm_set1_epi16 ((gshort) threshold_end);
+  gsize i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      __m128i value, keep;
+
+      value = _mm_loadu_si128 ((const __m128i *) (depth + i));
+      keep = _mm_and_si128 (
+        _mm_cmpeq_epi16 (_mm_subs_epu16 (begin, value), zero),
+        _mm_cmpeq_epi16 (_mm_subs_epu16 (value, end), zero));
+      _mm_storeu_si128 ((__m128i *) (reduced + i),
+                        _mm_and_si128 (value, keep));
+    }
+
+  threshold_reduce_scalar (depth + i, reduced + i, n_pixels - i,
+                           threshold_begin, threshold_end);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+threshold_reduce_avx2 (const guint16 *depth,
+                       guint16       *reduced,
+                       gsize          n_pixels,
+                       guint16        threshold_begin,
+                       guint16        threshold_end)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i begin = _mm256_set1_epi16 ((gshort) threshold_begin);
+  const __m256i end = _mm256_set1_epi16 ((gshort) threshold_end);
+  gsize i;
+
+  for (i = 0; i + 16 <= n_pixels; i += 16)
+    {
+      __m256i value, keep;
+
+      value = _mm256_loadu_si256 ((const __m256i *) (depth + i));
+      keep = _mm256_and_si256 (
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (begin, value), zero),
+        _mm256_cmpeq_epi16 (_mm256_subs_epu16 (value, end), zero));
+      _mm256_storeu_si256 ((__m256i *) (reduced + i),
+                           _mm256_and_si256 (value, keep));
+    }
+
+  threshold_reduce_sse2 (depth + i, reduced + i, n_pixels - i,
+                         threshold_begin, threshold_end);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const ThresholdImpl implementations[] = {
+#ifdef HAVE_X86_SIMD
+  { DEPTH_PROCESSING_SIMD_AVX2, threshold_run_avx2, threshold_reduce_avx2 },
+  { DEPTH_PROCESSING_SIMD_SSE2, threshold_run_sse2, threshold_reduce_sse2 },
+#endif
+  { DEPTH_PROCESSING_SIMD_SCALAR, threshold_run_scalar,
+    threshold_reduce_scalar }
+};
+
+static const gchar *simd_names[] = {
+  "scalar",
+  "sse2",
+  "avx2"
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (simd_names) == DEPTH_PROCESSING_SIMD_LAST);
+
+static DepthProcessingSimd
+get_cpu_simd (void)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return DEPTH_PROCESSING_SIMD_AVX2;
+  if (__builtin_cpu_supports ("sse2"))
+    return DEPTH_PROCESSING_SIMD_SSE2;
+#endif
+  return DEPTH_PROCESSING_SIMD_SCALAR;
+}
+
+/* Returns the most capable instruction set that the kernels of every
+   module may use: the best the CPU has, but no better than the one
+   named by IMPLEMENTATION_ENV if it is set. Each module then takes
+   its most capable kernel that needs no more than that */
+DepthProcessingSimd
+depth_processing_get_simd (void)
+{
+  static gsize selected = 0;
+
+  if (g_once_init_enter (&selected))
+    {
+      DepthProcessingSimd simd = get_cpu_simd ();
+      const gchar *forced = g_getenv (IMPLEMENTATION_ENV);
+      guint i;
+
+      if (forced != NULL)
+        {
+          for (i = 0; i < DEPTH_PROCESSING_SIMD_LAST; i++)
+            if (g_strcmp0 (forced, simd_names[i]) == 0)
+              break;
+
+          if (i == DEPTH_PROCESSING_SIMD_LAST)
+            {
+              g_warning ("Unknown %s value '%s', using the scalar "
+                         "implementations", IMPLEMENTATION_ENV, forced);
+              simd = DEPTH_PROCESSING_SIMD_SCALAR;
+            }
+          else
+            {
+              simd = MIN (simd, (DepthProcessingSimd) i);
+            }
+        }
+
+      g_debug ("Using up to the %s depth processing implementations",
+               simd_names[simd]);
+      /* 0 means not set yet */
+      g_once_init_leave (&selected, simd + 1);
+    }
+
+  return selected - 1;
+}
+
+const gchar *
+depth_processing_simd_get_name (DepthProcessingSimd simd)
+{
+  g_return_val_if_fail (simd < DEPTH_PROCESSING_SIMD_LAST, NULL);
+
+  return simd_names[simd];
+}
+
+static const ThresholdImpl *
+get_implementation (void)
+{
+  DepthProcessingSimd simd = depth_processing_get_simd ();
+  guint i;
+
+  /* The most capable first, down to the scalar one */
+  for (i = 0; implementations[i].simd > simd; i++)
+    ;
+
+  return &implementations[i];
+}
+
+const gchar *
+depth_processing_get_implementation (void)
+{
+  return depth_processing_simd_get_name (get_implementation ()->simd);
+}
+
+guint
+depth_processing_reduce_dimension (guint dimension, guint dimension_factor)
+{
+  g_return_val_if_fail (dimension_factor > 0, 0);
+
+  return (dimension - dimension % dimension_factor) / dimension_factor;
+}
+
+/* Copies the crop_width x crop_height rectangle at x, y of a frame
+   width samples wide into the packed cropped buffer */
+void
+depth_processing_crop (const guint16 *depth,
+                       guint          width,
+                       guint          x,
+                       guint          y,
+                       guint          crop_width,
+                       guint          crop_height,
+                       guint16       *cropped)
+{
+  guint row;
+
+  g_return_if_fail (x + crop_width <= width);
+
+  depth += (gsize) y * width + x;
+  if (crop_width == width)
+    {
+      memcpy (cropped, depth,
+              (gsize) crop_width * crop_height * sizeof (guint16));
+      return;
+    }
+
+  for (row = 0; row < crop_height; row++)
+    {
+      memcpy (cropped, depth, crop_width * sizeof (guint16));
+      depth += width;
+      cropped += crop_width;
+    }
+}
+
+/* Clamps the thresholds to the range of the samples */
+static void
+get_threshold_range (guint    threshold_begin,
+                     guint    threshold_end,
+                     guint16 *begin,
+                     guint16 *end)
+{
+  *begin = MIN (threshold_begin, G_MAXUINT16);
+  *end = MIN (threshold_end, G_MAXUINT16);
+  if (threshold_begin > G_MAXUINT16)
+    {
+      /* Nothing can be in range */
+      *begin = 1;
+      *end = 0;
+    }
+}
+
+typedef struct
+{
+  const ThresholdImpl *impl;
+  const guint16 *depth;
+  guint width;
+  guint height;
+  guint dimension_factor;
+  guint16 begin;
+  guint16 end;
+  guint16 *reduced_buffer;
+  guchar *mask_buffer;
+  guint reduced_width;
+  guint reduced_height;
+  guint band_rows;
+} ThresholdBands;
+
+/* Thresholds the rows of one band, which always starts at a row
+   multiple of dimension_factor. There is no mask to fill if
+   mask_buffer is NULL */
+static void
+threshold_band (guint band, gpointer user_data)
+{
+  const ThresholdBands *bands = user_data;
+  guint factor = bands->dimension_factor;
+  guint width = bands->width;
+  guint row_begin, row_end, i, j, reduced_end;
+
+  row_begin = band * bands->band_rows;
+  row_end = MIN (row_begin + bands->band_rows, bands->height);
+
+  if (factor == 1)
+    {
+      gsize offset = (gsize) row_begin * width;
+      gsize n_pixels = (gsize) (row_end - row_begin) * width;
+
+      if (bands->mask_buffer == NULL)
+        bands->impl->reduce (bands->depth + offset,
+                             bands->reduced_buffer + offset,
+                             n_pixels, bands->begin, bands->end);
+      else
+        bands->impl->run (bands->depth + offset,
+                          bands->reduced_buffer + offset,
+                          bands->mask_buffer + offset,
+                          n_pixels, bands->begin, bands->end);
+      return;
+    }
+
+  /* Only the first row and column of each dimension_factor block is
+     sampled, everything else in the mask stays white */
+  if (bands->mask_buffer != NULL)
+    memset (bands->mask_buffer + (gsize) row_begin * width, WHITE,
+            (gsize) (row_end - row_begin) * width);
+
+  reduced_end = MIN (row_end / factor, bands->reduced_height);
+  for (j = row_begin / factor; j < reduced_end; j++)
+    {
+      const guint16 *src = bands->depth + (gsize) j * factor * width;
+      guint16 *dst = bands->reduced_buffer + (gsize) j * bands->reduced_width;
+
+      for (i = 0; i < bands->reduced_width; i++)
+        {
+          guint16 value = src[i * factor];
+
+          if (value < bands->begin || value > bands->end)
+            value = 0;
+
+          dst[i] = value;
+        }
+
+      if (bands->mask_buffer != NULL)
+        {
+          guchar *mask = bands->mask_buffer + (gsize) j * factor * width;
+
+          for (i = 0; i < bands->reduced_width; i++)
+            if (dst[i] != 0)
+              mask[i * factor] = BLACK;
+        }
+    }
+}
+
+static void
+threshold_bands (const guint16 *depth,
+                 guint          width,
+                 guint          height,
+                 guint          dimension_factor,
+                 guint          threshold_begin,
+                 guint          threshold_end,
+                 guint16       *reduced_buffer,
+                 guchar        *mask_buffer)
+{
+  ThresholdBands bands;
+  guint band_rows;
+
+  if (width == 0 || height == 0)
+    return;
+
+  bands.impl = get_implementation ();
+  bands.depth = depth;
+  bands.width = width;
+  bands.height = height;
+  bands.dimension_factor = dimension_factor;
+  bands.reduced_buffer = reduced_buffer;
+  bands.mask_buffer = mask_buffer;
+  bands.reduced_width = depth_processing_reduce_dimension (width,
+                                                           dimension_factor);
+  bands.reduced_height = depth_processing_reduce_dimension (height,
+                                                            dimension_factor);
+
+  get_threshold_range (threshold_begin, threshold_end,
+                       &bands.begin, &bands.end);
+
+  band_rows = BAND_BYTES / ((gsize) width * BAND_BYTES_PER_PIXEL);
+  band_rows -= band_rows % dimension_factor;
+  bands.band_rows = MAX (band_rows, dimension_factor);
+
+  worker_pool_run (worker_pool_get_default (),
+                   (height + bands.band_rows - 1) / bands.band_rows,
+                   threshold_band, &bands);
+}
+
+/* Thresholds the depth buffer, keeping one out of every
+   dimension_factor samples in each direction, and paints the
+   kept samples black in an 8 bit mask of the full frame size.
+   reduced_buffer must hold reduced_width * reduced_height samples
+   and mask_buffer width * height bytes. Both are filled in bands of
+   rows small enough to stay in cache, spread over the default worker
+   pool */
+void
+depth_processing_threshold_mask (const guint16 *depth,
+                                 guint          width,
+                                 guint          height,
+                                 guint          dimension_factor,
+                                 guint          threshold_begin,
+                                 guint          threshold_end,
+                                 guint16       *reduced_buffer,
+                                 guchar        *mask_buffer)
+{
+  g_return_if_fail (depth != NULL);
+  g_return_if_fail (reduced_buffer != NULL);
+  g_return_if_fail (mask_buffer != NULL);
+  g_return_if_fail (dimension_factor > 0);
+
+  threshold_bands (depth, width, height, dimension_factor,
+                   threshold_begin, threshold_end,
+                   reduced_buffer, mask_buffer);
+}
+
+/* Same as depth_processing_threshold_mask() for callers that only
+   need the reduced buffer, such as the recorder, so no mask is
+   written at all */
+void
+depth_processing_threshold_reduce (const guint16 *depth,
+                                   guint          width,
+                                   guint          height,
+                                   guint          dimension_factor,
+                                   guint          threshold_begin,
+                                   guint          threshold_end,
+                                   guint16       *reduced_buffer)
+{
+  g_return_if_fail (depth != NULL);
+  g_return_if_fail (reduced_buffer != NULL);
+  g_return_if_fail (dimension_factor > 0);
+
+  threshold_bands (depth, width, height, dimension_factor,
+                   threshold_begin, threshold_end,
+                   reduced_buffer, NULL);
+}
+
+/* Fills the rect_width x rect_height rectangle at x, y of mask_buffer
+   as depth_processing_threshold_mask() would, without the reduced
+   buffer. Used to update only the parts of a mask that changed, so it
+   runs in the caller. x and y must be multiples of dimension_factor */
+void
+depth_processing_threshold_mask_rect (const guint16 *depth,
+                                      guint          width,
+                                      guint          height,
+                                      guint          dimension_factor,
+                                      guint          threshold_begin,
+                                      guint          threshold_end,
+                                      guint          x,
+                                      guint          y,
+                                      guint          rect_width,
+                                      guint          rect_height,
+                                      guchar        *mask_buffer)
+{
+  const ThresholdImpl *impl;
+  guint16 begin, end;
+  guint factor = dimension_factor;
+  guint i, j, i_end, j_end;
+
+  g_return_if_fail (depth != NULL);
+  g_return_if_fail (mask_buffer != NULL);
+  g_return_if_fail (dimension_factor > 0);
+  g_return_if_fail (x % factor == 0 && y % factor == 0);
+  g_return_if_fail (x + rect_width <= width && y + rect_height <= height);
+
+  impl = get_implementation ();
+  get_threshold_range (threshold_begin, threshold_end, &begin, &end);
+
+  if (factor == 1)
+    {
+      guint16 reduced[RECT_CHUNK];
+
+      for (j = y; j < y + rect_height; j++)
+        {
+          gsize offset = (gsize) j * width + x;
+
+          for (i = 0; i < rect_width; i += RECT_CHUNK)
+            impl->run (depth + offset + i, reduced, mask_buffer + offset + i,
+                       MIN (RECT_CHUNK, rect_width - i), begin, end);
+        }
+      return;
+    }
+
+  for (j = y; j < y + rect_height; j++)
+    memset (mask_buffer + (gsize) j * width + x, WHITE, rect_width);
+
+  i_end = MIN ((x + rect_width + factor - 1) / factor,
+               depth_processing_reduce_dimension (width, factor));
+  j_end = MIN ((y + rect_height + factor - 1) / factor,
+               depth_processing_reduce_dimension (height, factor));
+  for (j = y / factor; j < j_end; j++)
+    {
+      const guint16 *src = depth + (gsize) j * factor * width;
+      guchar *mask = mask_buffer + (gsize) j * factor * width;
+
+      for (i = x / factor; i < i_end; i++)
+        {
+          guint16 value = src[i * factor];
+
+          if (value >= begin && value <= end && value != 0)
+            mask[i * factor] = BLACK;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+/* GFreenect Utils : depth-processing.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_PROCESSING_H__
+#define __DEPTH_PROCESSING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Instruction sets the depth kernels are written for, from the least
+   to the most capable */
+typedef enum
+{
+  DEPTH_PROCESSING_SIMD_SCALAR,
+  DEPTH_PROCESSING_SIMD_SSE2,
+  DEPTH_PROCESSING_SIMD_AVX2,
+  DEPTH_PROCESSING_SIMD_LAST
+} DepthProcessingSimd;
+
+guint        depth_processing_reduce_dimension  (guint dimension,
+                                                 guint dimension_factor);
+
+void         depth_processing_crop              (const guint16 *depth,
+                                                 guint          width,
+                                                 guint          x,
+                                                 guint          y,
+                                                 guint          crop_width,
+                                                 guint          crop_height,
+                                                 guint16       *cropped);
+
+void         depth_processing_threshold_mask    (const guint16 *depth,
+                                                 guint          width,
+                                                 guint          height,
+                                                 guint          dimension_factor,
+                                                 guint          threshold_begin,
+                                                 guint          threshold_end,
+                                                 guint16       *reduced_buffer,
+                                                 guchar        *mask_buffer);
+
+void         depth_processing_threshold_reduce  (const guint16 *depth,
+                                                 guint          width,
+                                                 guint          height,
+                                                 guint          dimension_factor,
+                                                 guint          threshold_begin,
+                                                 guint          threshold_end,
+                                                 guint16       *reduced_buffer);
+
+void         depth_processing_threshold_mask_rect (const guint16 *depth,
+                                                   guint          width,
+                                                   guint          height,
+                                                   guint          dimension_factor,
+                                                   guint          threshold_begin,
+                                                   guint          threshold_end,
+                                                   guint          x,
+                                                   guint          y,
+                                                   guint          rect_width,
+                                                   guint          rect_height,
+                                                   guchar        *mask_buffer);
+
+DepthProcessingSimd  depth_processing_get_simd           (void);
+const gchar         *depth_processing_simd_get_name      (DepthProcessingSimd simd);
+const gchar         *depth_processing_get_implementation (void);
+
+G_END_DECLS
+
+#endif /* __DEPTH_PROCESSING_H__ */
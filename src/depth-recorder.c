@@ -0,0 +1,354 @@
+/* GFreenect Utils : depth-recorder.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "depth-recorder.h"
+#include "depth-codec.h"
+
+/* Frames are copied into a fixed ring of slots by the capture thread
+   and written to disk by a dedicated writer thread. When the writer
+   falls behind and the ring is full, new frames are dropped instead
+   of blocking the producer. Compression also happens in the writer
+   thread, frames are always queued as DEPTH_FRAME_FORMAT_RAW_16, or
+   as DEPTH_FRAME_FORMAT_RGB_24 for video recordings */
+
+typedef struct
+{
+  DepthFrameHeader header;
+  guchar *data;
+  gsize capacity;
+} RecorderSlot;
+
+struct _DepthRecorder
+{
+  gchar *path;
+  DepthFrameFormat format;
+  GOutputStream *stream;
+  GThread *thread;
+
+  GMutex mutex;
+  GCond cond;
+  RecorderSlot *slots;
+  guint n_slots;
+  guint head;
+  guint queued;
+  gboolean stopping;
+
+  /* Only touched by the writer thread until it is joined */
+  GArray *index;
+  guint64 offset;
+  GError *error;
+  guint8 *encoded;
+  gsize encoded_size;
+
+  guint64 frames_written;
+  guint64 frames_dropped;
+  guint64 bytes_written;
+};
+
+static gboolean
+write_slot (DepthRecorder *recorder, RecorderSlot *slot, gsize *written)
+{
+  DepthFrameHeader header = slot->header;
+  guint64 offset = recorder->offset;
+  gconstpointer payload = slot->data;
+
+  if (recorder->format == DEPTH_FRAME_FORMAT_DELTA_RLE)
+    {
+      gsize size = depth_codec_get_max_encoded_size (header.width,
+                                                     header.height);
+      if (recorder->encoded_size < size)
+        {
+          g_free (recorder->encoded);
+          recorder->encoded = g_malloc (size);
+          recorder->encoded_size = size;
+        }
+
+      header.format = DEPTH_FRAME_FORMAT_DELTA_RLE;
+      header.payload_size = depth_codec_encode ((const guint16 *) slot->data,
+                                                header.width, header.height,
+                                                recorder->encoded);
+      payload = recorder->encoded;
+    }
+
+  *written = sizeof (header) + header.payload_size;
+  depth_frame_header_to_le (&header);
+
+  if (! g_output_stream_write_all (recorder->stream,
+                                   &header, sizeof (header),
+                                   NULL, NULL, &recorder->error) ||
+      ! g_output_stream_write_all (recorder->stream,
+                                   payload, *written - sizeof (header),
+                                   NULL, NULL, &recorder->error))
+    {
+      g_debug ("ERROR: %s", recorder->error->message);
+      return FALSE;
+    }
+
+  recorder->offset += *written;
+  offset = GUINT64_TO_LE (offset);
+  g_array_append_val (recorder->index, offset);
+
+  return TRUE;
+}
+
+static gpointer
+writer_thread (gpointer data)
+{
+  DepthRecorder *recorder = data;
+
+  g_mutex_lock (&recorder->mutex);
+  while (TRUE)
+    {
+      RecorderSlot *slot;
+      gboolean written = FALSE;
+      gsize size = 0;
+
+      while (recorder->queued == 0 && ! recorder->stopping)
+        g_cond_wait (&recorder->cond, &recorder->mutex);
+
+      if (recorder->queued == 0)
+        break;
+
+      /* The producer never touches a queued slot, so it can be
+         written without holding the lock */
+      slot = &recorder->slots[recorder->head];
+      g_mutex_unlock (&recorder->mutex);
+
+      if (recorder->error == NULL)
+        written = write_slot (recorder, slot, &size);
+
+      g_mutex_lock (&recorder->mutex);
+      recorder->head = (recorder->head + 1) % recorder->n_slots;
+      recorder->queued--;
+      if (written)
+        {
+          recorder->frames_written++;
+          recorder->bytes_written += size;
+        }
+      else
+        {
+          recorder->frames_dropped++;
+        }
+    }
+  g_mutex_unlock (&recorder->mutex);
+
+  return NULL;
+}
+
+/* Creates the recording at path. Frames are stored in the given
+   format, which for now must be DEPTH_FRAME_FORMAT_RAW_16 or
+   DEPTH_FRAME_FORMAT_DELTA_RLE for depth, or DEPTH_FRAME_FORMAT_RGB_24
+   for a recording of the matching video frames */
+DepthRecorder *
+depth_recorder_new (const gchar       *path,
+                    DepthFrameFormat   format,
+                    guint              queue_length,
+                    GError           **error)
+{
+  DepthRecorder *recorder;
+  DepthFileHeader header;
+  GFile *file;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (queue_length > 0, NULL);
+
+  file = g_file_new_for_path (path);
+  recorder = g_slice_new0 (DepthRecorder);
+  recorder->stream = (GOutputStream *) g_file_replace (file, NULL, FALSE,
+                                                       G_FILE_CREATE_NONE,
+                                                       NULL, error);
+  g_object_unref (file);
+
+  if (recorder->stream == NULL)
+    {
+      g_slice_free (DepthRecorder, recorder);
+      return NULL;
+    }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, DEPTH_FILE_MAGIC, DEPTH_FILE_MAGIC_LEN);
+  header.version = GUINT32_TO_LE (DEPTH_FILE_VERSION);
+  header.header_size = GUINT32_TO_LE (sizeof (header));
+
+  if (! g_output_stream_write_all (recorder->stream, &header, sizeof (header),
+                                   NULL, NULL, error))
+    {
+      g_object_unref (recorder->stream);
+      g_slice_free (DepthRecorder, recorder);
+      return NULL;
+    }
+
+  recorder->path = g_strdup (path);
+  recorder->format = format;
+  recorder->offset = sizeof (header);
+  recorder->index = g_array_new (FALSE, FALSE, sizeof (guint64));
+  recorder->n_slots = queue_length;
+  recorder->slots = g_new0 (RecorderSlot, queue_length);
+  g_mutex_init (&recorder->mutex);
+  g_cond_init (&recorder->cond);
+
+  recorder->thread = g_thread_new ("depth-recorder", writer_thread, recorder);
+
+  return recorder;
+}
+
+static gboolean
+write_trailer (DepthRecorder *recorder, GError **error)
+{
+  DepthFileTrailer trailer;
+
+  memset (&trailer, 0, sizeof (trailer));
+  trailer.index_offset = GUINT64_TO_LE (recorder->offset);
+  trailer.n_frames = GUINT32_TO_LE (recorder->index->len);
+  memcpy (trailer.magic, DEPTH_FILE_TRAILER_MAGIC, DEPTH_FILE_MAGIC_LEN);
+
+  return g_output_stream_write_all (recorder->stream,
+                                    recorder->index->data,
+                                    recorder->index->len * sizeof (guint64),
+                                    NULL, NULL, error) &&
+    g_output_stream_write_all (recorder->stream, &trailer, sizeof (trailer),
+                               NULL, NULL, error);
+}
+
+/* Waits for the queued frames to be written, appends the seek index
+   and frees the recorder */
+gboolean
+depth_recorder_close (DepthRecorder *recorder, GError **error)
+{
+  gboolean success;
+  guint i;
+
+  g_return_val_if_fail (recorder != NULL, FALSE);
+
+  g_mutex_lock (&recorder->mutex);
+  recorder->stopping = TRUE;
+  g_cond_signal (&recorder->cond);
+  g_mutex_unlock (&recorder->mutex);
+
+  g_thread_join (recorder->thread);
+
+  if (recorder->error != NULL)
+    {
+      g_propagate_error (error, recorder->error);
+      recorder->error = NULL;
+      g_output_stream_close (recorder->stream, NULL, NULL);
+      success = FALSE;
+    }
+  else
+    {
+      success = write_trailer (recorder, error) &&
+        g_output_stream_close (recorder->stream, NULL, error);
+    }
+
+  g_object_unref (recorder->stream);
+  g_array_free (recorder->index, TRUE);
+  g_free (recorder->encoded);
+
+  for (i = 0; i < recorder->n_slots; i++)
+    g_free (recorder->slots[i].data);
+  g_free (recorder->slots);
+
+  g_mutex_clear (&recorder->mutex);
+  g_cond_clear (&recorder->cond);
+  g_free (recorder->path);
+  g_slice_free (DepthRecorder, recorder);
+
+  return success;
+}
+
+/* Queues a copy of a 16 bit depth frame, or of a RGB frame for video
+   recordings, of header->width by header->height samples to be
+   appended to the recording. The format
+   and sizes in header are filled in by the recorder. Must always be
+   called from the same thread. Returns FALSE if the frame was dropped
+   because the writer thread is behind */
+gboolean
+depth_recorder_push (DepthRecorder          *recorder,
+                     const DepthFrameHeader *header,
+                     gconstpointer           data)
+{
+  RecorderSlot *slot;
+  gsize size;
+
+  g_return_val_if_fail (recorder != NULL, FALSE);
+  g_return_val_if_fail (header != NULL, FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+
+  size = (gsize) header->width * header->height *
+    (recorder->format == DEPTH_FRAME_FORMAT_RGB_24 ? 3 : sizeof (guint16));
+  g_return_val_if_fail (size <= G_MAXUINT32, FALSE);
+
+  g_mutex_lock (&recorder->mutex);
+  if (recorder->queued == recorder->n_slots)
+    {
+      recorder->frames_dropped++;
+      g_mutex_unlock (&recorder->mutex);
+      return FALSE;
+    }
+  slot = &recorder->slots[(recorder->head + recorder->queued) %
+                          recorder->n_slots];
+  g_mutex_unlock (&recorder->mutex);
+
+  /* The slot is not visible to the writer until it is queued below */
+  if (slot->capacity < size)
+    {
+      g_free (slot->data);
+      slot->data = g_malloc (size);
+      slot->capacity = size;
+    }
+  memcpy (slot->data, data, size);
+
+  slot->header = *header;
+  slot->header.header_size = sizeof (DepthFrameHeader);
+  slot->header.format = recorder->format == DEPTH_FRAME_FORMAT_RGB_24 ?
+    DEPTH_FRAME_FORMAT_RGB_24 : DEPTH_FRAME_FORMAT_RAW_16;
+  slot->header.payload_size = size;
+
+  g_mutex_lock (&recorder->mutex);
+  recorder->queued++;
+  g_cond_signal (&recorder->cond);
+  g_mutex_unlock (&recorder->mutex);
+
+  return TRUE;
+}
+
+void
+depth_recorder_get_stats (DepthRecorder      *recorder,
+                          DepthRecorderStats *stats)
+{
+  g_return_if_fail (recorder != NULL);
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&recorder->mutex);
+  stats->frames_written = recorder->frames_written;
+  stats->frames_dropped = recorder->frames_dropped;
+  stats->bytes_written = recorder->bytes_written;
+  stats->queued = recorder->queued;
+  g_mutex_unlock (&recorder->mutex);
+}
+
+const gchar *
+depth_recorder_get_path (DepthRecorder *recorder)
+{
+  g_return_val_if_fail (recorder != NULL, NULL);
+
+  return recorder->path;
+}
@@ -0,0 +1,55 @@
+/* GFreenect Utils : depth-recorder.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_RECORDER_H__
+#define __DEPTH_RECORDER_H__
+
+#include <glib.h>
+
+#include "depth-file.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthRecorder DepthRecorder;
+
+typedef struct
+{
+  guint64 frames_written;
+  guint64 frames_dropped;
+  guint64 bytes_written;
+  guint   queued;
+} DepthRecorderStats;
+
+DepthRecorder *depth_recorder_new       (const gchar       *path,
+                                         DepthFrameFormat   format,
+                                         guint              queue_length,
+                                         GError           **error);
+gboolean       depth_recorder_close     (DepthRecorder  *recorder,
+                                         GError        **error);
+
+gboolean       depth_recorder_push      (DepthRecorder          *recorder,
+                                         const DepthFrameHeader *header,
+                                         gconstpointer           data);
+
+void           depth_recorder_get_stats (DepthRecorder      *recorder,
+                                         DepthRecorderStats *stats);
+const gchar   *depth_recorder_get_path  (DepthRecorder *recorder);
+
+G_END_DECLS
+
+#endif /* __DEPTH_RECORDER_H__ */
@@ -0,0 +1,206 @@
+/* GFreenect Utils : depth-registration.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "depth-registration.h"
+
+/* A depth sample at pixel u, v lands in the video image at
+   fx * (u - cx) / fx_depth + cx + fx * baseline / depth, and the
+   same without the baseline in y, taking both cameras as parallel.
+   The part that only depends on the pixel, and the shift that only
+   depends on the depth, are kept in tables made once per frame size,
+   so each sample is registered with two lookups and an add. The
+   tables hold 1/SUBPIXEL pixels, so the sum rounds once */
+
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL      (1 << SUBPIXEL_BITS)
+
+/* Calibration of a typical Kinect video camera */
+#define DEFAULT_VIDEO_FX 529.22
+#define DEFAULT_VIDEO_FY 525.56
+#define DEFAULT_VIDEO_CX 328.94
+#define DEFAULT_VIDEO_CY 267.48
+#define DEFAULT_BASELINE 20.
+
+struct _DepthRegistration
+{
+  guint depth_width;
+  guint depth_height;
+  guint video_width;
+  guint video_height;
+
+  /* Video column of each depth pixel at infinite depth, in subpixels
+     and offset half a pixel so truncating rounds it */
+  gint32 *columns;
+
+  /* Index of the first pixel of the video row of each depth pixel,
+     or -1 if it falls outside the video image */
+  gint32 *rows;
+
+  /* Column shift of each depth, in subpixels */
+  gint32 shifts[DEPTH_REGISTRATION_MAX_DEPTH + 1];
+};
+
+void
+depth_registration_calibration_init_default (DepthRegistrationCalibration *calibration)
+{
+  g_return_if_fail (calibration != NULL);
+
+  point_cloud_intrinsics_init_default (&calibration->depth);
+  calibration->video.fx = DEFAULT_VIDEO_FX;
+  calibration->video.fy = DEFAULT_VIDEO_FY;
+  calibration->video.cx = DEFAULT_VIDEO_CX;
+  calibration->video.cy = DEFAULT_VIDEO_CY;
+  calibration->baseline = DEFAULT_BASELINE;
+}
+
+/* Makes the tables registering depth frames of depth_width x
+   depth_height to video frames of video_width x video_height */
+DepthRegistration *
+depth_registration_new (guint                               depth_width,
+                        guint                               depth_height,
+                        guint                               video_width,
+                        guint                               video_height,
+                        const DepthRegistrationCalibration *calibration)
+{
+  DepthRegistration *registration;
+  const PointCloudIntrinsics *depth, *video;
+  guint i, j, d;
+
+  g_return_val_if_fail (calibration != NULL, NULL);
+
+  depth = &calibration->depth;
+  video = &calibration->video;
+
+  registration = g_slice_new0 (DepthRegistration);
+  registration->depth_width = depth_width;
+  registration->depth_height = depth_height;
+  registration->video_width = video_width;
+  registration->video_height = video_height;
+  registration->columns = g_new (gint32, (gsize) depth_width * depth_height);
+  registration->rows = g_new (gint32, (gsize) depth_width * depth_height);
+
+  for (j = 0; j < depth_height; j++)
+    {
+      gdouble y = video->fy * (j - depth->cy) / depth->fy + video->cy;
+      gint row = (gint) floor (y + 0.5);
+
+      for (i = 0; i < depth_width; i++)
+        {
+          gsize index = (gsize) j * depth_width + i;
+          gdouble x = video->fx * (i - depth->cx) / depth->fx + video->cx;
+
+          registration->columns[index] =
+            (gint32) floor ((x + 0.5) * SUBPIXEL + 0.5);
+          registration->rows[index] =
+            row >= 0 && row < (gint) video_height ? row * video_width : -1;
+        }
+    }
+
+  registration->shifts[0] = 0;
+  for (d = 1; d <= DEPTH_REGISTRATION_MAX_DEPTH; d++)
+    registration->shifts[d] =
+      (gint32) floor (video->fx * calibration->baseline / d * SUBPIXEL + 0.5);
+
+  return registration;
+}
+
+void
+depth_registration_free (DepthRegistration *registration)
+{
+  g_return_if_fail (registration != NULL);
+
+  g_free (registration->columns);
+  g_free (registration->rows);
+  g_slice_free (DepthRegistration, registration);
+}
+
+gboolean
+depth_registration_has_size (DepthRegistration *registration,
+                             guint              depth_width,
+                             guint              depth_height,
+                             guint              video_width,
+                             guint              video_height)
+{
+  g_return_val_if_fail (registration != NULL, FALSE);
+
+  return registration->depth_width == depth_width &&
+    registration->depth_height == depth_height &&
+    registration->video_width == video_width &&
+    registration->video_height == video_height;
+}
+
+/* Fills rgba, of the depth frame size, with the color of the video
+   behind every depth sample between threshold_begin and
+   threshold_end, and makes the rest transparent */
+void
+depth_registration_cutout (DepthRegistration *registration,
+                           const guint16     *depth,
+                           guint              threshold_begin,
+                           guint              threshold_end,
+                           const guchar      *video,
+                           guint              video_bytes_per_pixel,
+                           guchar            *rgba)
+{
+  const gint32 *columns, *rows, *shifts;
+  gsize i, n_samples;
+  guint begin, end;
+  gint video_width;
+
+  g_return_if_fail (registration != NULL);
+  g_return_if_fail (depth != NULL);
+  g_return_if_fail (video != NULL);
+  g_return_if_fail (video_bytes_per_pixel >= 3);
+  g_return_if_fail (rgba != NULL);
+
+  begin = MAX (threshold_begin, 1);
+  end = MIN (threshold_end, DEPTH_REGISTRATION_MAX_DEPTH);
+
+  columns = registration->columns;
+  rows = registration->rows;
+  shifts = registration->shifts;
+  video_width = registration->video_width;
+  n_samples = (gsize) registration->depth_width * registration->depth_height;
+
+  for (i = 0; i < n_samples; i++, rgba += 4)
+    {
+      guint value = depth[i];
+
+      if (value >= begin && value <= end && rows[i] >= 0)
+        {
+          gint32 x = columns[i] + shifts[value];
+
+          if (x >= 0 && (x >> SUBPIXEL_BITS) < video_width)
+            {
+              const guchar *color;
+
+              color = video + (gsize) (rows[i] + (x >> SUBPIXEL_BITS)) *
+                video_bytes_per_pixel;
+              rgba[0] = color[0];
+              rgba[1] = color[1];
+              rgba[2] = color[2];
+              rgba[3] = 255;
+              continue;
+            }
+        }
+
+      memset (rgba, 0, 4);
+    }
+}
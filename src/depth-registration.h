@@ -0,0 +1,67 @@
+/* GFreenect Utils : depth-registration.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_REGISTRATION_H__
+#define __DEPTH_REGISTRATION_H__
+
+#include <glib.h>
+
+#include "point-cloud.h"
+
+G_BEGIN_DECLS
+
+/* Depths beyond this many millimeters are never registered */
+#define DEPTH_REGISTRATION_MAX_DEPTH 10000
+
+typedef struct
+{
+  PointCloudIntrinsics depth;
+  PointCloudIntrinsics video;
+
+  /* Distance from the depth to the video camera along x, in mm */
+  gdouble baseline;
+} DepthRegistrationCalibration;
+
+typedef struct _DepthRegistration DepthRegistration;
+
+void               depth_registration_calibration_init_default (DepthRegistrationCalibration *calibration);
+
+DepthRegistration *depth_registration_new      (guint                               depth_width,
+                                                guint                               depth_height,
+                                                guint                               video_width,
+                                                guint                               video_height,
+                                                const DepthRegistrationCalibration *calibration);
+void               depth_registration_free     (DepthRegistration *registration);
+
+gboolean           depth_registration_has_size (DepthRegistration *registration,
+                                                guint              depth_width,
+                                                guint              depth_height,
+                                                guint              video_width,
+                                                guint              video_height);
+
+void               depth_registration_cutout   (DepthRegistration *registration,
+                                                const guint16     *depth,
+                                                guint              threshold_begin,
+                                                guint              threshold_end,
+                                                const guchar      *video,
+                                                guint              video_bytes_per_pixel,
+                                                guchar            *rgba);
+
+G_END_DECLS
+
+#endif /* __DEPTH_REGISTRATION_H__ */
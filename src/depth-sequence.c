@@ -0,0 +1,307 @@
+/* GFreenect Utils : depth-sequence.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+
+#include "depth-sequence.h"
+
+/* A sequence is either a recording or a directory of single shots,
+   ordered by the capture time in their names. Only one file of a
+   directory is kept open at a time, so a sequence must only be read
+   from one thread */
+
+typedef struct
+{
+  gchar *path;
+  gint64 time;
+} Shot;
+
+struct _DepthSequence
+{
+  GArray *shots;
+
+  DepthFile *file;
+  guint file_shot;
+
+  guint n_frames;
+  gint64 *times;
+};
+
+static gint
+compare_shots (gconstpointer a, gconstpointer b)
+{
+  const Shot *shot_a = a;
+  const Shot *shot_b = b;
+
+  if (shot_a->time != shot_b->time)
+    return shot_a->time < shot_b->time ? -1 : 1;
+
+  return strcmp (shot_a->path, shot_b->path);
+}
+
+static GArray *
+collect_shots (const gchar *path, GError **error)
+{
+  GArray *shots;
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, error);
+  if (dir == NULL)
+    return NULL;
+
+  shots = g_array_new (FALSE, FALSE, sizeof (Shot));
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      Shot shot;
+
+      if (! g_str_has_prefix (name, DEPTH_SEQUENCE_SHOT_PREFIX))
+        continue;
+
+      shot.time = g_ascii_strtoll (name + strlen (DEPTH_SEQUENCE_SHOT_PREFIX),
+                                   NULL, 10);
+      shot.path = g_build_filename (path, name, NULL);
+      g_array_append_val (shots, shot);
+    }
+  g_dir_close (dir);
+
+  if (shots->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "No %s* files in %s", DEPTH_SEQUENCE_SHOT_PREFIX, path);
+      g_array_free (shots, TRUE);
+      return NULL;
+    }
+
+  g_array_sort (shots, compare_shots);
+  return shots;
+}
+
+/* Makes the times relative to the first frame, falling back to a
+   fixed rate if they do not grow, e.g. for frames without a capture
+   time */
+static void
+normalize_times (DepthSequence *sequence)
+{
+  gint64 first = sequence->times[0];
+  gboolean growing = first > 0;
+  guint i;
+
+  for (i = 1; i < sequence->n_frames && growing; i++)
+    growing = sequence->times[i] > sequence->times[i - 1];
+
+  for (i = 0; i < sequence->n_frames; i++)
+    {
+      if (growing)
+        sequence->times[i] -= first;
+      else
+        sequence->times[i] = i * DEPTH_SEQUENCE_DEFAULT_INTERVAL;
+    }
+}
+
+/* Opens a recording, a single shot or a directory of shots */
+DepthSequence *
+depth_sequence_open (const gchar *path, GError **error)
+{
+  DepthSequence *sequence;
+  guint i;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  sequence = g_slice_new0 (DepthSequence);
+
+  if (g_file_test (path, G_FILE_TEST_IS_DIR))
+    {
+      sequence->shots = collect_shots (path, error);
+      if (sequence->shots == NULL)
+        goto error;
+
+      sequence->n_frames = sequence->shots->len;
+      sequence->times = g_new (gint64, sequence->n_frames);
+      for (i = 0; i < sequence->n_frames; i++)
+        sequence->times[i] = g_array_index (sequence->shots, Shot, i).time;
+    }
+  else
+    {
+      sequence->file = depth_file_open (path, error);
+      if (sequence->file == NULL)
+        goto error;
+
+      sequence->n_frames = depth_file_get_n_frames (sequence->file);
+      if (sequence->n_frames == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "%s has no frames", path);
+          goto error;
+        }
+
+      sequence->times = g_new (gint64, sequence->n_frames);
+      for (i = 0; i < sequence->n_frames; i++)
+        {
+          DepthFrameHeader header;
+
+          if (! depth_file_get_frame_header (sequence->file, i,
+                                             &header, error))
+            goto error;
+          sequence->times[i] = header.timestamp;
+        }
+    }
+
+  normalize_times (sequence);
+  return sequence;
+
+ error:
+  depth_sequence_free (sequence);
+  return NULL;
+}
+
+void
+depth_sequence_free (DepthSequence *sequence)
+{
+  guint i;
+
+  g_return_if_fail (sequence != NULL);
+
+  if (sequence->file != NULL)
+    depth_file_close (sequence->file);
+
+  if (sequence->shots != NULL)
+    {
+      for (i = 0; i < sequence->shots->len; i++)
+        g_free (g_array_index (sequence->shots, Shot, i).path);
+      g_array_free (sequence->shots, TRUE);
+    }
+
+  g_free (sequence->times);
+  g_slice_free (DepthSequence, sequence);
+}
+
+guint
+depth_sequence_get_n_frames (DepthSequence *sequence)
+{
+  g_return_val_if_fail (sequence != NULL, 0);
+
+  return sequence->n_frames;
+}
+
+/* Returns the capture time of a frame in microseconds since the
+   first frame */
+gint64
+depth_sequence_get_time (DepthSequence *sequence, guint frame)
+{
+  g_return_val_if_fail (sequence != NULL, 0);
+  g_return_val_if_fail (frame < sequence->n_frames, 0);
+
+  return sequence->times[frame];
+}
+
+/* Returns the last frame captured at or before time */
+guint
+depth_sequence_find_frame (DepthSequence *sequence, gint64 time)
+{
+  guint low, high;
+
+  g_return_val_if_fail (sequence != NULL, 0);
+
+  low = 0;
+  high = sequence->n_frames;
+  while (high - low > 1)
+    {
+      guint middle = low + (high - low) / 2;
+
+      if (sequence->times[middle] <= time)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  return low;
+}
+
+/* Makes sure the file holding frame is open and returns the index of
+   frame inside it */
+static gboolean
+open_frame (DepthSequence *sequence, guint *frame, GError **error)
+{
+  if (sequence->shots == NULL)
+    return TRUE;
+
+  if (sequence->file == NULL || sequence->file_shot != *frame)
+    {
+      const Shot *shot = &g_array_index (sequence->shots, Shot, *frame);
+
+      if (sequence->file != NULL)
+        depth_file_close (sequence->file);
+
+      sequence->file = depth_file_open (shot->path, error);
+      if (sequence->file == NULL)
+        return FALSE;
+      sequence->file_shot = *frame;
+    }
+
+  *frame = 0;
+  return TRUE;
+}
+
+gboolean
+depth_sequence_get_frame_header (DepthSequence     *sequence,
+                                 guint              frame,
+                                 DepthFrameHeader  *header,
+                                 GError           **error)
+{
+  g_return_val_if_fail (sequence != NULL, FALSE);
+  g_return_val_if_fail (frame < sequence->n_frames, FALSE);
+
+  if (! open_frame (sequence, &frame, error))
+    return FALSE;
+
+  return depth_file_get_frame_header (sequence->file, frame, header, error);
+}
+
+/* Like depth_file_get_depth(). The returned samples stay valid until
+   another frame is read */
+const guint16 *
+depth_sequence_get_depth (DepthSequence     *sequence,
+                          guint              frame,
+                          DepthFrameHeader  *header,
+                          guint16           *buffer,
+                          gsize              n_samples,
+                          GError           **error)
+{
+  g_return_val_if_fail (sequence != NULL, NULL);
+  g_return_val_if_fail (frame < sequence->n_frames, NULL);
+
+  if (! open_frame (sequence, &frame, error))
+    return NULL;
+
+  return depth_file_get_depth (sequence->file, frame, header,
+                               buffer, n_samples, error);
+}
+
+/* Lets the pages of a frame of a recording be dropped once it has
+   been played */
+void
+depth_sequence_release_frame (DepthSequence *sequence, guint frame)
+{
+  g_return_if_fail (sequence != NULL);
+
+  if (sequence->shots == NULL)
+    depth_file_release_frame (sequence->file, frame);
+}
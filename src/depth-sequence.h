@@ -0,0 +1,61 @@
+/* GFreenect Utils : depth-sequence.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_SEQUENCE_H__
+#define __DEPTH_SEQUENCE_H__
+
+#include <glib.h>
+
+#include "depth-file.h"
+
+G_BEGIN_DECLS
+
+/* Prefix of the single shot files written by record-depth-file */
+#define DEPTH_SEQUENCE_SHOT_PREFIX "depth-data-"
+
+/* Frame interval assumed when a sequence has no usable timestamps */
+#define DEPTH_SEQUENCE_DEFAULT_INTERVAL (G_USEC_PER_SEC / 30)
+
+typedef struct _DepthSequence DepthSequence;
+
+DepthSequence *depth_sequence_open             (const gchar  *path,
+                                                GError      **error);
+void           depth_sequence_free             (DepthSequence *sequence);
+
+guint          depth_sequence_get_n_frames     (DepthSequence *sequence);
+gint64         depth_sequence_get_time         (DepthSequence *sequence,
+                                                guint          frame);
+guint          depth_sequence_find_frame       (DepthSequence *sequence,
+                                                gint64         time);
+
+gboolean       depth_sequence_get_frame_header (DepthSequence     *sequence,
+                                                guint              frame,
+                                                DepthFrameHeader  *header,
+                                                GError           **error);
+const guint16 *depth_sequence_get_depth        (DepthSequence     *sequence,
+                                                guint              frame,
+                                                DepthFrameHeader  *header,
+                                                guint16           *buffer,
+                                                gsize              n_samples,
+                                                GError           **error);
+void           depth_sequence_release_frame    (DepthSequence     *sequence,
+                                                guint              frame);
+
+G_END_DECLS
+
+#endif /* __DEPTH_SEQUENCE_H__ */
@@ -0,0 +1,146 @@
+/* GFreenect Utils : depth-texture.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+
+#include "depth-texture.h"
+
+/* Grayscale depth images only have one channel, so they are uploaded
+   as 8 bit luminance textures, a third of the size of the RGB data
+   clutter_texture_set_from_rgb_data takes, and expanded to gray by
+   the GPU when drawn. OpenGL has no 1 bit texture format, so masks
+   are uploaded the same way */
+
+static CoglPixelFormat
+get_format (guint n_channels)
+{
+  switch (n_channels)
+    {
+    case 1:
+      return COGL_PIXEL_FORMAT_G_8;
+    case 3:
+      return COGL_PIXEL_FORMAT_RGB_888;
+    default:
+      return COGL_PIXEL_FORMAT_RGBA_8888_PRE;
+    }
+}
+
+/* Uploads an image of width x height pixels, either 8 bit grayscale
+   if n_channels is 1, RGB if it is 3 or RGBA with premultiplied
+   alpha if it is 4. The texture's storage is reused while the size
+   and format do not change */
+gboolean
+depth_texture_upload (ClutterTexture  *texture,
+                      const guchar    *buffer,
+                      guint            width,
+                      guint            height,
+                      guint            n_channels,
+                      GError         **error)
+{
+  CoglHandle cogl_tex;
+  CoglPixelFormat format;
+
+  g_return_val_if_fail (texture != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (n_channels == 1 || n_channels == 3 ||
+                        n_channels == 4, FALSE);
+
+  format = get_format (n_channels);
+
+  cogl_tex = clutter_texture_get_cogl_texture (texture);
+  if (cogl_tex != COGL_INVALID_HANDLE &&
+      cogl_texture_get_width (cogl_tex) == width &&
+      cogl_texture_get_height (cogl_tex) == height &&
+      cogl_texture_get_format (cogl_tex) == format)
+    {
+      if (cogl_texture_set_region (cogl_tex, 0, 0, 0, 0, width, height,
+                                   width, height, format,
+                                   width * n_channels, buffer))
+        return TRUE;
+    }
+  else
+    {
+      cogl_tex = cogl_texture_new_from_data (width, height,
+                                             COGL_TEXTURE_NO_SLICING,
+                                             format, format,
+                                             width * n_channels, buffer);
+      if (cogl_tex != COGL_INVALID_HANDLE)
+        {
+          clutter_texture_set_cogl_texture (texture, cogl_tex);
+          cogl_handle_unref (cogl_tex);
+          return TRUE;
+        }
+    }
+
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "Failed to upload a %ux%u depth texture", width, height);
+  return FALSE;
+}
+
+/* Uploads the rect_width x rect_height rectangle at x, y of an image
+   of width x height pixels, as taken by depth_texture_upload(), into
+   the same place of the texture. The texture must have been uploaded
+   an image of that size and format before */
+gboolean
+depth_texture_upload_rect (ClutterTexture  *texture,
+                           const guchar    *buffer,
+                           guint            width,
+                           guint            height,
+                           guint            n_channels,
+                           guint            x,
+                           guint            y,
+                           guint            rect_width,
+                           guint            rect_height,
+                           GError         **error)
+{
+  CoglHandle cogl_tex;
+  CoglPixelFormat format;
+
+  g_return_val_if_fail (texture != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (n_channels == 1 || n_channels == 3 ||
+                        n_channels == 4, FALSE);
+  g_return_val_if_fail (x + rect_width <= width &&
+                        y + rect_height <= height, FALSE);
+
+  format = get_format (n_channels);
+
+  cogl_tex = clutter_texture_get_cogl_texture (texture);
+  if (cogl_tex == COGL_INVALID_HANDLE ||
+      cogl_texture_get_width (cogl_tex) != width ||
+      cogl_texture_get_height (cogl_tex) != height ||
+      cogl_texture_get_format (cogl_tex) != format)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "The depth texture does not hold a %ux%u image", width,
+                   height);
+      return FALSE;
+    }
+
+  if (! cogl_texture_set_region (cogl_tex, x, y, x, y,
+                                 rect_width, rect_height, width, height,
+                                 format, width * n_channels, buffer))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to upload a %ux%u region of the depth texture",
+                   rect_width, rect_height);
+      return FALSE;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,45 @@
+/* GFreenect Utils : depth-texture.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_TEXTURE_H__
+#define __DEPTH_TEXTURE_H__
+
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+gboolean depth_texture_upload      (ClutterTexture  *texture,
+                                    const guchar    *buffer,
+                                    guint            width,
+                                    guint            height,
+                                    guint            n_channels,
+                                    GError         **error);
+gboolean depth_texture_upload_rect (ClutterTexture  *texture,
+                                    const guchar    *buffer,
+                                    guint            width,
+                                    guint            height,
+                                    guint            n_channels,
+                                    guint            x,
+                                    guint            y,
+                                    guint            rect_width,
+                                    guint            rect_height,
+                                    GError         **error);
+
+G_END_DECLS
+
+#endif /* __DEPTH_TEXTURE_H__ */
@@ -0,0 +1,331 @@
+/* GFreenect Utils : depth-tiles.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "depth-tiles.h"
+#include "depth-processing.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Frames are split in tiles, and a tile is dirty when any of its
+   samples differs by more than tolerance millimeters from the
+   reference frame. The reference only takes the samples of dirty
+   tiles, so a slow drift is not lost below the tolerance but ends
+   up marking the tile dirty once it adds up */
+
+struct _DepthTiles
+{
+  guint width;
+  guint height;
+  guint16 tolerance;
+  guint n_columns;
+  guint n_rows;
+  gboolean invalid;
+  guint16 *reference;
+  guint8 *dirty;
+};
+
+/* Returns whether any of the n_samples of a and b differ by more
+   than tolerance */
+typedef gboolean (*TilesCompareFunc) (const guint16 *a,
+                                      const guint16 *b,
+                                      guint          n_samples,
+                                      guint16        tolerance);
+
+typedef struct
+{
+  DepthProcessingSimd simd;
+  TilesCompareFunc compare;
+} TilesImpl;
+
+static gboolean
+tiles_compare_scalar (const guint16 *a,
+                      const guint16 *b,
+                      guint          n_samples,
+                      guint16        tolerance)
+{
+  guint i;
+
+  for (i = 0; i < n_samples; i++)
+    if ((a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]) > tolerance)
+      return TRUE;
+
+  return FALSE;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__ ((target ("sse2")))
+static gboolean
+tiles_compare_sse2 (const guint16 *a,
+                    const guint16 *b,
+                    guint          n_samples,
+                    guint16        tolerance)
+{
+  const __m128i max_distance = _mm_set1_epi16 ((gshort) tolerance);
+  __m128i over = _mm_setzero_si128 ();
+  guint i;
+
+  /* The distances above the tolerance are ORed together, which stays
+     zero while every sample is within it */
+  for (i = 0; i + 8 <= n_samples; i += 8)
+    {
+      __m128i va, vb, distance;
+
+      va = _mm_loadu_si128 ((const __m128i *) (a + i));
+      vb = _mm_loadu_si128 ((const __m128i *) (b + i));
+      distance = _mm_or_si128 (_mm_subs_epu16 (va, vb),
+                               _mm_subs_epu16 (vb, va));
+      over = _mm_or_si128 (over, _mm_subs_epu16 (distance, max_distance));
+    }
+
+  if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (over, _mm_setzero_si128 ())) !=
+      0xffff)
+    return TRUE;
+
+  return tiles_compare_scalar (a + i, b + i, n_samples - i, tolerance);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const TilesImpl implementations[] = {
+#ifdef HAVE_X86_SIMD
+  { DEPTH_PROCESSING_SIMD_SSE2, tiles_compare_sse2 },
+#endif
+  { DEPTH_PROCESSING_SIMD_SCALAR, tiles_compare_scalar }
+};
+
+static const TilesImpl *
+get_implementation (void)
+{
+  DepthProcessingSimd simd = depth_processing_get_simd ();
+  guint i;
+
+  /* The most capable first, down to the scalar one */
+  for (i = 0; implementations[i].simd > simd; i++)
+    ;
+
+  return &implementations[i];
+}
+
+guint
+depth_tiles_get_n_columns (guint width)
+{
+  return (width + DEPTH_TILES_SIZE - 1) / DEPTH_TILES_SIZE;
+}
+
+guint
+depth_tiles_get_n_rows (guint height)
+{
+  return (height + DEPTH_TILES_SIZE - 1) / DEPTH_TILES_SIZE;
+}
+
+/* Tracks the changes of frames of width x height samples. Every tile
+   is dirty in the first update */
+DepthTiles *
+depth_tiles_new (guint width, guint height, guint tolerance)
+{
+  DepthTiles *tiles;
+
+  tiles = g_slice_new0 (DepthTiles);
+  tiles->width = width;
+  tiles->height = height;
+  tiles->tolerance = MIN (tolerance, G_MAXUINT16);
+  tiles->n_columns = depth_tiles_get_n_columns (width);
+  tiles->n_rows = depth_tiles_get_n_rows (height);
+  tiles->invalid = TRUE;
+  tiles->reference = g_new (guint16, (gsize) width * height);
+  tiles->dirty = g_new0 (guint8, tiles->n_columns * tiles->n_rows);
+
+  return tiles;
+}
+
+void
+depth_tiles_free (DepthTiles *tiles)
+{
+  g_return_if_fail (tiles != NULL);
+
+  g_free (tiles->reference);
+  g_free (tiles->dirty);
+  g_slice_free (DepthTiles, tiles);
+}
+
+/* Makes every tile dirty in the next update, e.g. when what is made
+   from the depth changes */
+void
+depth_tiles_invalidate (DepthTiles *tiles)
+{
+  g_return_if_fail (tiles != NULL);
+
+  tiles->invalid = TRUE;
+}
+
+/* Compares depth to the reference and marks the tiles that changed
+   as dirty, replacing their reference samples. Returns the number of
+   dirty tiles */
+guint
+depth_tiles_update (DepthTiles *tiles, const guint16 *depth)
+{
+  const TilesImpl *impl;
+  guint n_dirty = 0;
+  guint row, column, y;
+
+  g_return_val_if_fail (tiles != NULL, 0);
+  g_return_val_if_fail (depth != NULL, 0);
+
+  if (tiles->invalid)
+    {
+      memcpy (tiles->reference, depth,
+              (gsize) tiles->width * tiles->height * sizeof (guint16));
+      memset (tiles->dirty, 1, tiles->n_columns * tiles->n_rows);
+      tiles->invalid = FALSE;
+      return tiles->n_columns * tiles->n_rows;
+    }
+
+  impl = get_implementation ();
+
+  for (row = 0; row < tiles->n_rows; row++)
+    {
+      guint8 *dirty = tiles->dirty + row * tiles->n_columns;
+      guint y_begin = row * DEPTH_TILES_SIZE;
+      guint y_end = MIN (y_begin + DEPTH_TILES_SIZE, tiles->height);
+
+      memset (dirty, 0, tiles->n_columns);
+
+      /* Row by row so the comparison walks memory in order, skipping
+         the tiles already known to be dirty */
+      for (y = y_begin; y < y_end; y++)
+        {
+          gsize offset = (gsize) y * tiles->width;
+
+          for (column = 0; column < tiles->n_columns; column++)
+            {
+              guint x = column * DEPTH_TILES_SIZE;
+
+              if (dirty[column])
+                continue;
+
+              dirty[column] =
+                impl->compare (depth + offset + x, tiles->reference + offset + x,
+                               MIN (DEPTH_TILES_SIZE, tiles->width - x),
+                               tiles->tolerance);
+            }
+        }
+
+      for (column = 0; column < tiles->n_columns; column++)
+        {
+          guint x = column * DEPTH_TILES_SIZE;
+          guint tile_width = MIN (DEPTH_TILES_SIZE, tiles->width - x);
+
+          if (! dirty[column])
+            continue;
+
+          n_dirty++;
+          for (y = y_begin; y < y_end; y++)
+            memcpy (tiles->reference + (gsize) y * tiles->width + x,
+                    depth + (gsize) y * tiles->width + x,
+                    tile_width * sizeof (guint16));
+        }
+    }
+
+  return n_dirty;
+}
+
+/* Returns a byte per tile, row by row, that is not 0 for the tiles
+   found dirty in the last update */
+const guint8 *
+depth_tiles_get_dirty (DepthTiles *tiles)
+{
+  g_return_val_if_fail (tiles != NULL, NULL);
+
+  return tiles->dirty;
+}
+
+guint
+depth_tiles_get_width (DepthTiles *tiles)
+{
+  g_return_val_if_fail (tiles != NULL, 0);
+
+  return tiles->width;
+}
+
+guint
+depth_tiles_get_height (DepthTiles *tiles)
+{
+  g_return_val_if_fail (tiles != NULL, 0);
+
+  return tiles->height;
+}
+
+guint
+depth_tiles_get_n_tiles (DepthTiles *tiles)
+{
+  g_return_val_if_fail (tiles != NULL, 0);
+
+  return tiles->n_columns * tiles->n_rows;
+}
+
+/* Calls func with the rectangles covered by the dirty tiles of a
+   width x height frame, joining the dirty tiles next to each other in
+   a row of tiles into one rectangle */
+void
+depth_tiles_foreach_rect (const guint8       *dirty,
+                          guint               width,
+                          guint               height,
+                          DepthTilesRectFunc  func,
+                          gpointer            user_data)
+{
+  guint n_columns, n_rows, row, column;
+
+  g_return_if_fail (dirty != NULL);
+  g_return_if_fail (func != NULL);
+
+  n_columns = depth_tiles_get_n_columns (width);
+  n_rows = depth_tiles_get_n_rows (height);
+
+  for (row = 0; row < n_rows; row++)
+    {
+      guint y = row * DEPTH_TILES_SIZE;
+      guint rect_height = MIN (DEPTH_TILES_SIZE, height - y);
+
+      column = 0;
+      while (column < n_columns)
+        {
+          guint first;
+
+          if (! dirty[row * n_columns + column])
+            {
+              column++;
+              continue;
+            }
+
+          first = column;
+          while (column < n_columns && dirty[row * n_columns + column])
+            column++;
+
+          func (first * DEPTH_TILES_SIZE, y,
+                MIN (column * DEPTH_TILES_SIZE, width) -
+                first * DEPTH_TILES_SIZE,
+                rect_height, user_data);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/* GFreenect Utils : depth-tiles.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPTH_TILES_H__
+#define __DEPTH_TILES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Tiles are squares of this many pixels, except at the right and
+   bottom edges of frames whose size is not a multiple of it */
+#define DEPTH_TILES_SIZE 32
+
+#define DEPTH_TILES_DEFAULT_TOLERANCE 10
+
+typedef struct _DepthTiles DepthTiles;
+
+typedef void (*DepthTilesRectFunc) (guint    x,
+                                    guint    y,
+                                    guint    width,
+                                    guint    height,
+                                    gpointer user_data);
+
+DepthTiles   *depth_tiles_new           (guint          width,
+                                         guint          height,
+                                         guint          tolerance);
+void          depth_tiles_free          (DepthTiles    *tiles);
+
+void          depth_tiles_invalidate    (DepthTiles    *tiles);
+guint         depth_tiles_update        (DepthTiles    *tiles,
+                                         const guint16 *depth);
+
+const guint8 *depth_tiles_get_dirty     (DepthTiles    *tiles);
+guint         depth_tiles_get_width     (DepthTiles    *tiles);
+guint         depth_tiles_get_height    (DepthTiles    *tiles);
+guint         depth_tiles_get_n_tiles   (DepthTiles    *tiles);
+
+guint         depth_tiles_get_n_columns (guint          width);
+guint         depth_tiles_get_n_rows    (guint          height);
+void          depth_tiles_foreach_rect  (const guint8  *dirty,
+                                         guint          width,
+                                         guint          height,
+                                         DepthTilesRectFunc func,
+                                         gpointer       user_data);
+
+G_END_DECLS
+
+#endif /* __DEPTH_TILES_H__ */
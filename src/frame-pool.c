@@ -0,0 +1,238 @@
+/* GFreenect Utils : frame-pool.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame-pool.h"
+
+/* Every buffer is preceded by a header pointing back to its bucket
+   and linking it in the bucket's free list while it is not in use,
+   padded so the frame data keeps the alignment of g_malloc */
+#define HEADER_SIZE 32
+
+typedef struct
+{
+  guint width;
+  guint height;
+  guint bytes_per_pixel;
+} FrameKey;
+
+typedef struct _FrameHeader FrameHeader;
+typedef struct _FrameBucket FrameBucket;
+
+struct _FrameHeader
+{
+  FrameBucket *bucket;
+  FrameHeader *next_free;
+};
+
+struct _FrameBucket
+{
+  FrameKey key;
+  gsize size;
+  FrameHeader *free_buffers;
+  guint64 allocations;
+  guint64 acquisitions;
+  guint64 in_use;
+};
+
+struct _FramePool
+{
+  GMutex mutex;
+  GHashTable *buckets;
+};
+
+G_STATIC_ASSERT (sizeof (FrameHeader) <= HEADER_SIZE);
+
+static guint
+frame_key_hash (gconstpointer data)
+{
+  const FrameKey *key = data;
+
+  return (key->width * 31 + key->height) * 31 + key->bytes_per_pixel;
+}
+
+static gboolean
+frame_key_equal (gconstpointer a, gconstpointer b)
+{
+  const FrameKey *key_a = a;
+  const FrameKey *key_b = b;
+
+  return key_a->width == key_b->width &&
+    key_a->height == key_b->height &&
+    key_a->bytes_per_pixel == key_b->bytes_per_pixel;
+}
+
+static void
+frame_bucket_free (gpointer data)
+{
+  FrameBucket *bucket = data;
+  FrameHeader *header;
+
+  if (bucket->in_use > 0)
+    g_warning ("Freeing frame pool with %" G_GUINT64_FORMAT " buffers of "
+               "%ux%ux%u still in use", bucket->in_use,
+               bucket->key.width, bucket->key.height,
+               bucket->key.bytes_per_pixel);
+
+  while (bucket->free_buffers != NULL)
+    {
+      header = bucket->free_buffers;
+      bucket->free_buffers = header->next_free;
+      g_free (header);
+    }
+
+  g_slice_free (FrameBucket, bucket);
+}
+
+FramePool *
+frame_pool_new (void)
+{
+  FramePool *pool;
+
+  pool = g_slice_new0 (FramePool);
+  g_mutex_init (&pool->mutex);
+  pool->buckets = g_hash_table_new_full (frame_key_hash,
+                                         frame_key_equal,
+                                         NULL,
+                                         frame_bucket_free);
+  return pool;
+}
+
+void
+frame_pool_free (FramePool *pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  g_hash_table_destroy (pool->buckets);
+  g_mutex_clear (&pool->mutex);
+  g_slice_free (FramePool, pool);
+}
+
+/* Returns a buffer of width * height * bytes_per_pixel bytes, reusing
+   one released earlier for the same frame mode when possible. Its
+   contents are undefined */
+gpointer
+frame_pool_acquire (FramePool *pool,
+                    guint      width,
+                    guint      height,
+                    guint      bytes_per_pixel)
+{
+  FrameKey key = { width, height, bytes_per_pixel };
+  FrameBucket *bucket;
+  FrameHeader *header;
+
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_mutex_lock (&pool->mutex);
+
+  bucket = g_hash_table_lookup (pool->buckets, &key);
+  if (bucket == NULL)
+    {
+      bucket = g_slice_new0 (FrameBucket);
+      bucket->key = key;
+      bucket->size = (gsize) width * height * bytes_per_pixel;
+      g_hash_table_insert (pool->buckets, &bucket->key, bucket);
+    }
+
+  if (bucket->free_buffers != NULL)
+    {
+      header = bucket->free_buffers;
+      bucket->free_buffers = header->next_free;
+    }
+  else
+    {
+      header = g_malloc (HEADER_SIZE + bucket->size);
+      header->bucket = bucket;
+      bucket->allocations++;
+    }
+
+  bucket->acquisitions++;
+  bucket->in_use++;
+
+  g_mutex_unlock (&pool->mutex);
+
+  return (guchar *) header + HEADER_SIZE;
+}
+
+void
+frame_pool_release (FramePool *pool, gpointer buffer)
+{
+  FrameBucket *bucket;
+  FrameHeader *header;
+
+  g_return_if_fail (pool != NULL);
+
+  if (buffer == NULL)
+    return;
+
+  header = (FrameHeader *) ((guchar *) buffer - HEADER_SIZE);
+  bucket = header->bucket;
+
+  g_mutex_lock (&pool->mutex);
+  header->next_free = bucket->free_buffers;
+  bucket->free_buffers = header;
+  bucket->in_use--;
+  g_mutex_unlock (&pool->mutex);
+}
+
+void
+frame_pool_get_stats (FramePool *pool, FramePoolStats *stats)
+{
+  GHashTableIter iter;
+  FrameBucket *bucket;
+
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (stats != NULL);
+
+  stats->allocations = 0;
+  stats->acquisitions = 0;
+  stats->in_use = 0;
+  stats->bytes = 0;
+
+  g_mutex_lock (&pool->mutex);
+  g_hash_table_iter_init (&iter, pool->buckets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &bucket))
+    {
+      stats->allocations += bucket->allocations;
+      stats->acquisitions += bucket->acquisitions;
+      stats->in_use += bucket->in_use;
+      stats->bytes += bucket->allocations * bucket->size;
+    }
+  g_mutex_unlock (&pool->mutex);
+}
+
+void
+frame_pool_dump (FramePool *pool)
+{
+  GHashTableIter iter;
+  FrameBucket *bucket;
+
+  g_return_if_fail (pool != NULL);
+
+  g_mutex_lock (&pool->mutex);
+  g_hash_table_iter_init (&iter, pool->buckets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &bucket))
+    {
+      g_debug ("Frame pool %ux%ux%u: %" G_GUINT64_FORMAT " allocations, "
+               "%" G_GUINT64_FORMAT " acquisitions, "
+               "%" G_GUINT64_FORMAT " in use",
+               bucket->key.width, bucket->key.height,
+               bucket->key.bytes_per_pixel, bucket->allocations,
+               bucket->acquisitions, bucket->in_use);
+    }
+  g_mutex_unlock (&pool->mutex);
+}
@@ -0,0 +1,52 @@
+/* GFreenect Utils : frame-pool.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FramePool FramePool;
+
+typedef struct
+{
+  guint64 allocations;
+  guint64 acquisitions;
+  guint64 in_use;
+  gsize   bytes;
+} FramePoolStats;
+
+FramePool *frame_pool_new       (void);
+void       frame_pool_free      (FramePool *pool);
+
+gpointer   frame_pool_acquire   (FramePool *pool,
+                                 guint      width,
+                                 guint      height,
+                                 guint      bytes_per_pixel);
+void       frame_pool_release   (FramePool *pool,
+                                 gpointer   buffer);
+
+void       frame_pool_get_stats (FramePool      *pool,
+                                 FramePoolStats *stats);
+void       frame_pool_dump      (FramePool *pool);
+
+G_END_DECLS
+
+#endif /* __FRAME_POOL_H__ */
@@ -0,0 +1,162 @@
+/* GFreenect Utils : frame-ring.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame-ring.h"
+
+/* A ring of frames with a single producer and a single consumer,
+   which never lock. The producer owns the slots from tail onwards
+   and the consumer those from head to tail, and each only moves its
+   own index, after it is done with the slot. The indices run freely
+   and wrap at 2^32, which the capacity, a power of two, divides.
+   Slot buffers are kept, and only grow when a frame is larger than
+   any that used the slot before */
+
+struct _FrameRing
+{
+  FrameRingSlot *slots;
+  guint capacity;
+  gint head;
+  gint tail;
+  gint overflows;
+};
+
+/* Makes a ring of capacity frames, which must be a power of two,
+   each with info_size bytes of info */
+FrameRing *
+frame_ring_new (guint capacity, gsize info_size)
+{
+  FrameRing *ring;
+  guint i;
+
+  g_return_val_if_fail (capacity > 0 && (capacity & (capacity - 1)) == 0,
+                        NULL);
+
+  ring = g_slice_new0 (FrameRing);
+  ring->capacity = capacity;
+  ring->slots = g_new0 (FrameRingSlot, capacity);
+  for (i = 0; i < capacity; i++)
+    ring->slots[i].info = info_size > 0 ? g_malloc0 (info_size) : NULL;
+
+  return ring;
+}
+
+void
+frame_ring_free (FrameRing *ring)
+{
+  guint i;
+
+  g_return_if_fail (ring != NULL);
+
+  for (i = 0; i < ring->capacity; i++)
+    {
+      g_free (ring->slots[i].data);
+      g_free (ring->slots[i].info);
+    }
+  g_free (ring->slots);
+  g_slice_free (FrameRing, ring);
+}
+
+/* Returns the slot for the next frame, with room for its data, to be
+   filled and then queued with frame_ring_commit(). Returns NULL, and
+   counts an overflow, if the ring is full. Producer only */
+FrameRingSlot *
+frame_ring_reserve (FrameRing *ring,
+                    guint      width,
+                    guint      height,
+                    guint      bytes_per_pixel,
+                    gint64     timestamp)
+{
+  FrameRingSlot *slot;
+  guint tail, head;
+  gsize size;
+
+  g_return_val_if_fail (ring != NULL, NULL);
+
+  tail = ring->tail;
+  head = g_atomic_int_get (&ring->head);
+  if (tail - head == ring->capacity)
+    {
+      g_atomic_int_inc (&ring->overflows);
+      return NULL;
+    }
+
+  slot = &ring->slots[tail & (ring->capacity - 1)];
+  size = (gsize) width * height * bytes_per_pixel;
+  if (slot->capacity < size)
+    {
+      g_free (slot->data);
+      slot->data = g_malloc (size);
+      slot->capacity = size;
+    }
+
+  slot->timestamp = timestamp;
+  slot->width = width;
+  slot->height = height;
+  slot->bytes_per_pixel = bytes_per_pixel;
+
+  return slot;
+}
+
+/* Queues the slot returned by frame_ring_reserve(). Producer only */
+void
+frame_ring_commit (FrameRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_atomic_int_set (&ring->tail, ring->tail + 1);
+}
+
+/* Returns how many frames are queued. Consumer only */
+guint
+frame_ring_get_n_queued (FrameRing *ring)
+{
+  g_return_val_if_fail (ring != NULL, 0);
+
+  return (guint) g_atomic_int_get (&ring->tail) - (guint) ring->head;
+}
+
+/* Returns the nth oldest queued frame, which stays valid until it is
+   popped. Consumer only */
+FrameRingSlot *
+frame_ring_peek (FrameRing *ring, guint n)
+{
+  g_return_val_if_fail (ring != NULL, NULL);
+  g_return_val_if_fail (n < frame_ring_get_n_queued (ring), NULL);
+
+  return &ring->slots[((guint) ring->head + n) & (ring->capacity - 1)];
+}
+
+/* Gives the n oldest queued frames back to the producer. Consumer
+   only */
+void
+frame_ring_pop (FrameRing *ring, guint n)
+{
+  g_return_if_fail (ring != NULL);
+  g_return_if_fail (n <= frame_ring_get_n_queued (ring));
+
+  g_atomic_int_set (&ring->head, (guint) ring->head + n);
+}
+
+/* Returns how many frames were not queued because the ring was full */
+guint64
+frame_ring_get_overflows (FrameRing *ring)
+{
+  g_return_val_if_fail (ring != NULL, 0);
+
+  return (guint) g_atomic_int_get (&ring->overflows);
+}
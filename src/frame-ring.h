@@ -0,0 +1,64 @@
+/* GFreenect Utils : frame-ring.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FrameRing FrameRing;
+
+typedef struct
+{
+  /* Capture time, in monotonic time */
+  gint64 timestamp;
+  guint width;
+  guint height;
+  guint bytes_per_pixel;
+  gpointer data;
+
+  /* info_size bytes for the producer to describe the frame */
+  gpointer info;
+
+  gsize capacity;
+} FrameRingSlot;
+
+FrameRing     *frame_ring_new           (guint      capacity,
+                                         gsize      info_size);
+void           frame_ring_free          (FrameRing *ring);
+
+FrameRingSlot *frame_ring_reserve       (FrameRing *ring,
+                                         guint      width,
+                                         guint      height,
+                                         guint      bytes_per_pixel,
+                                         gint64     timestamp);
+void           frame_ring_commit        (FrameRing *ring);
+
+guint          frame_ring_get_n_queued  (FrameRing *ring);
+FrameRingSlot *frame_ring_peek          (FrameRing *ring,
+                                         guint      n);
+void           frame_ring_pop           (FrameRing *ring,
+                                         guint      n);
+
+guint64        frame_ring_get_overflows (FrameRing *ring);
+
+G_END_DECLS
+
+#endif /* __FRAME_RING_H__ */
@@ -0,0 +1,477 @@
+/* GFreenect Utils : frame-stats.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "frame-stats.h"
+
+/* Latencies are kept in log-linear histograms: every power of two of
+   microseconds is split in SUB_BUCKETS buckets, so percentiles are
+   within about 6% of the real value whatever the scale, in constant
+   memory and time per sample */
+
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS     (1 << SUB_BUCKET_BITS)
+
+/* Up to 2^MAX_BITS microseconds, about 67 seconds */
+#define MAX_BITS        26
+#define N_BUCKETS       ((MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct
+{
+  guint64 buckets[N_BUCKETS];
+  guint64 count;
+  gint64 sum;
+  gint64 max;
+} Histogram;
+
+struct _FrameStats
+{
+  GMutex mutex;
+  Histogram histograms[FRAME_STAGE_LAST];
+
+  /* Time between matched depth and video frames */
+  Histogram skew;
+
+  gint64 frame_interval;
+  gint64 last_frame_time;
+  guint64 dropped;
+  guint64 stale;
+  guint64 unchanged;
+  guint64 skipped_tiles;
+  guint64 n_tiles;
+  guint64 unmatched_depth;
+  guint64 unmatched_video;
+};
+
+static const gchar *stage_names[FRAME_STAGE_LAST] =
+{
+  "fetch",
+  "denoise",
+  "threshold",
+  "save",
+  "register",
+  "upload",
+  "total"
+};
+
+/* Values below SUB_BUCKETS get a bucket each, larger ones a bucket
+   per SUB_BUCKETS-th of their power of two */
+static guint
+get_bucket (gint64 value)
+{
+  guint bits, bucket;
+
+  if (value < SUB_BUCKETS)
+    return MAX (value, 0);
+
+  value = MIN (value, ((gint64) 1 << MAX_BITS) - 1);
+  bits = g_bit_storage (value);
+  bucket = (bits - SUB_BUCKET_BITS) * SUB_BUCKETS +
+    ((value >> (bits - SUB_BUCKET_BITS - 1)) & (SUB_BUCKETS - 1));
+
+  return bucket;
+}
+
+/* The largest value falling in bucket */
+static gint64
+get_bucket_value (guint bucket)
+{
+  guint bits;
+  gint64 base;
+
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+
+  bits = bucket / SUB_BUCKETS + SUB_BUCKET_BITS;
+  base = (gint64) (SUB_BUCKETS + bucket % SUB_BUCKETS) <<
+    (bits - SUB_BUCKET_BITS - 1);
+
+  return base + ((gint64) 1 << (bits - SUB_BUCKET_BITS - 1)) - 1;
+}
+
+static gint64
+get_percentile (const Histogram *histogram, gdouble percentile)
+{
+  guint64 rank, seen = 0;
+  guint i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  rank = MAX ((guint64) (histogram->count * percentile + 0.5), 1);
+  for (i = 0; i < N_BUCKETS; i++)
+    {
+      seen += histogram->buckets[i];
+      if (seen >= rank)
+        return i < N_BUCKETS - 1 ?
+          MIN (get_bucket_value (i), histogram->max) : histogram->max;
+    }
+
+  return histogram->max;
+}
+
+/* frame_interval is the expected time between frames in microseconds,
+   used to tell dropped frames */
+FrameStats *
+frame_stats_new (gint64 frame_interval)
+{
+  FrameStats *stats;
+
+  stats = g_slice_new0 (FrameStats);
+  stats->frame_interval = frame_interval;
+  g_mutex_init (&stats->mutex);
+
+  return stats;
+}
+
+void
+frame_stats_free (FrameStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_clear (&stats->mutex);
+  g_slice_free (FrameStats, stats);
+}
+
+/* Records the arrival of a frame at time, counting the frames that
+   should have arrived since the previous one as dropped */
+void
+frame_stats_add_frame (FrameStats *stats, gint64 time)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&stats->mutex);
+  if (stats->last_frame_time > 0 && stats->frame_interval > 0)
+    {
+      gint64 missed;
+
+      missed = (time - stats->last_frame_time + stats->frame_interval / 2) /
+        stats->frame_interval - 1;
+      if (missed > 0)
+        stats->dropped += missed;
+    }
+  stats->last_frame_time = time;
+  g_mutex_unlock (&stats->mutex);
+}
+
+static void
+histogram_add (FrameStats *stats, Histogram *histogram, gint64 duration)
+{
+  g_mutex_lock (&stats->mutex);
+  histogram->buckets[get_bucket (duration)]++;
+  histogram->count++;
+  histogram->sum += duration;
+  histogram->max = MAX (histogram->max, duration);
+  g_mutex_unlock (&stats->mutex);
+}
+
+static void
+histogram_get (FrameStats      *stats,
+               const Histogram *histogram,
+               FrameStageStats *stage_stats)
+{
+  g_mutex_lock (&stats->mutex);
+  stage_stats->count = histogram->count;
+  stage_stats->mean = histogram->count > 0 ?
+    histogram->sum / (gint64) histogram->count : 0;
+  stage_stats->p50 = get_percentile (histogram, 0.5);
+  stage_stats->p99 = get_percentile (histogram, 0.99);
+  stage_stats->max = histogram->max;
+  g_mutex_unlock (&stats->mutex);
+}
+
+/* Adds a duration in microseconds to the histogram of stage */
+void
+frame_stats_add (FrameStats *stats, FrameStage stage, gint64 duration)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (stage < FRAME_STAGE_LAST);
+
+  histogram_add (stats, &stats->histograms[stage], duration);
+}
+
+/* Records a depth frame matched with a video frame skew microseconds
+   apart, either way */
+void
+frame_stats_add_match (FrameStats *stats, gint64 skew)
+{
+  g_return_if_fail (stats != NULL);
+
+  histogram_add (stats, &stats->skew, ABS (skew));
+}
+
+/* Records depth and video frames that were never matched */
+void
+frame_stats_add_unmatched (FrameStats *stats, guint n_depth, guint n_video)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&stats->mutex);
+  stats->unmatched_depth += n_depth;
+  stats->unmatched_video += n_video;
+  g_mutex_unlock (&stats->mutex);
+}
+
+/* Records a frame that was replaced by a newer one before it could be
+   processed or shown */
+void
+frame_stats_add_stale (FrameStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&stats->mutex);
+  stats->stale++;
+  g_mutex_unlock (&stats->mutex);
+}
+
+/* Records a processed frame of which only n_dirty out of n_tiles
+   tiles changed, and so had to be processed and uploaded again */
+void
+frame_stats_add_tiles (FrameStats *stats, guint n_dirty, guint n_tiles)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (n_dirty <= n_tiles);
+
+  g_mutex_lock (&stats->mutex);
+  if (n_dirty == 0)
+    stats->unchanged++;
+  stats->skipped_tiles += n_tiles - n_dirty;
+  stats->n_tiles += n_tiles;
+  g_mutex_unlock (&stats->mutex);
+}
+
+void
+frame_stats_get (FrameStats      *stats,
+                 FrameStage       stage,
+                 FrameStageStats *stage_stats)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (stage < FRAME_STAGE_LAST);
+  g_return_if_fail (stage_stats != NULL);
+
+  histogram_get (stats, &stats->histograms[stage], stage_stats);
+}
+
+/* Gets the skew between matched depth and video frames, in
+   microseconds */
+void
+frame_stats_get_skew (FrameStats *stats, FrameStageStats *skew_stats)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (skew_stats != NULL);
+
+  histogram_get (stats, &stats->skew, skew_stats);
+}
+
+void
+frame_stats_get_unmatched (FrameStats *stats,
+                           guint64    *n_depth,
+                           guint64    *n_video)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&stats->mutex);
+  if (n_depth != NULL)
+    *n_depth = stats->unmatched_depth;
+  if (n_video != NULL)
+    *n_video = stats->unmatched_video;
+  g_mutex_unlock (&stats->mutex);
+}
+
+guint64
+frame_stats_get_dropped (FrameStats *stats)
+{
+  guint64 dropped;
+
+  g_return_val_if_fail (stats != NULL, 0);
+
+  g_mutex_lock (&stats->mutex);
+  dropped = stats->dropped;
+  g_mutex_unlock (&stats->mutex);
+
+  return dropped;
+}
+
+guint64
+frame_stats_get_stale (FrameStats *stats)
+{
+  guint64 stale;
+
+  g_return_val_if_fail (stats != NULL, 0);
+
+  g_mutex_lock (&stats->mutex);
+  stale = stats->stale;
+  g_mutex_unlock (&stats->mutex);
+
+  return stale;
+}
+
+/* Returns how many frames did not change at all */
+guint64
+frame_stats_get_unchanged (FrameStats *stats)
+{
+  guint64 unchanged;
+
+  g_return_val_if_fail (stats != NULL, 0);
+
+  g_mutex_lock (&stats->mutex);
+  unchanged = stats->unchanged;
+  g_mutex_unlock (&stats->mutex);
+
+  return unchanged;
+}
+
+/* Returns how many tiles were skipped because they did not change,
+   out of how many were compared */
+void
+frame_stats_get_tiles (FrameStats *stats,
+                       guint64    *skipped_tiles,
+                       guint64    *n_tiles)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&stats->mutex);
+  if (skipped_tiles != NULL)
+    *skipped_tiles = stats->skipped_tiles;
+  if (n_tiles != NULL)
+    *n_tiles = stats->n_tiles;
+  g_mutex_unlock (&stats->mutex);
+}
+
+const gchar *
+frame_stats_get_stage_name (FrameStage stage)
+{
+  g_return_val_if_fail (stage < FRAME_STAGE_LAST, NULL);
+
+  return stage_names[stage];
+}
+
+/* Returns the p50/p99/max latencies of the stages with samples, in
+   milliseconds, for an info text */
+gchar *
+frame_stats_to_markup (FrameStats *stats)
+{
+  GString *markup;
+  FrameStage stage;
+  FrameStageStats skew_stats;
+  guint64 skipped_tiles, n_tiles, unmatched_depth, unmatched_video;
+
+  g_return_val_if_fail (stats != NULL, NULL);
+
+  markup = g_string_new ("<b>Latency p50/p99/max (ms):</b>");
+  for (stage = 0; stage < FRAME_STAGE_LAST; stage++)
+    {
+      FrameStageStats stage_stats;
+
+      frame_stats_get (stats, stage, &stage_stats);
+      if (stage_stats.count == 0)
+        continue;
+
+      g_string_append_printf (markup, " %s %.1f/%.1f/%.1f",
+                              stage_names[stage],
+                              stage_stats.p50 / 1000.,
+                              stage_stats.p99 / 1000.,
+                              stage_stats.max / 1000.);
+    }
+  g_string_append_printf (markup, " <b>Dropped:</b> %" G_GUINT64_FORMAT
+                          " <b>Stale:</b> %" G_GUINT64_FORMAT,
+                          frame_stats_get_dropped (stats),
+                          frame_stats_get_stale (stats));
+
+  frame_stats_get_tiles (stats, &skipped_tiles, &n_tiles);
+  if (n_tiles > 0)
+    g_string_append_printf (markup, " <b>Unchanged:</b> %" G_GUINT64_FORMAT
+                            " <b>Tiles skipped:</b> %.0f%%",
+                            frame_stats_get_unchanged (stats),
+                            100. * skipped_tiles / n_tiles);
+
+  frame_stats_get_skew (stats, &skew_stats);
+  frame_stats_get_unmatched (stats, &unmatched_depth, &unmatched_video);
+  if (skew_stats.count > 0 || unmatched_depth > 0 || unmatched_video > 0)
+    g_string_append_printf (markup, "\n<b>Sync skew p50/p99/max (ms):</b> "
+                            "%.1f/%.1f/%.1f <b>Unmatched:</b> %"
+                            G_GUINT64_FORMAT " depth, %" G_GUINT64_FORMAT
+                            " video",
+                            skew_stats.p50 / 1000.,
+                            skew_stats.p99 / 1000.,
+                            skew_stats.max / 1000.,
+                            unmatched_depth, unmatched_video);
+
+  return g_string_free (markup, FALSE);
+}
+
+/* Writes a line per stage with its latencies in microseconds, the
+   number of dropped, stale and unchanged frames, of the tiles skipped
+   out of all, and the depth to video sync skew and misses */
+gboolean
+frame_stats_write_csv (FrameStats   *stats,
+                       const gchar  *path,
+                       GError      **error)
+{
+  GString *csv;
+  FrameStage stage;
+  gboolean success;
+  FrameStageStats skew_stats;
+  guint64 skipped_tiles, n_tiles, unmatched_depth, unmatched_video;
+
+  g_return_val_if_fail (stats != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  csv = g_string_new ("stage,count,mean_us,p50_us,p99_us,max_us\n");
+  for (stage = 0; stage < FRAME_STAGE_LAST; stage++)
+    {
+      FrameStageStats stage_stats;
+
+      frame_stats_get (stats, stage, &stage_stats);
+      g_string_append_printf (csv, "%s,%" G_GUINT64_FORMAT ",%" G_GINT64_FORMAT
+                              ",%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT
+                              ",%" G_GINT64_FORMAT "\n",
+                              stage_names[stage], stage_stats.count,
+                              stage_stats.mean, stage_stats.p50,
+                              stage_stats.p99, stage_stats.max);
+    }
+  g_string_append_printf (csv, "dropped,%" G_GUINT64_FORMAT ",,,,\n",
+                          frame_stats_get_dropped (stats));
+  g_string_append_printf (csv, "stale,%" G_GUINT64_FORMAT ",,,,\n",
+                          frame_stats_get_stale (stats));
+
+  frame_stats_get_tiles (stats, &skipped_tiles, &n_tiles);
+  g_string_append_printf (csv, "unchanged,%" G_GUINT64_FORMAT ",,,,\n",
+                          frame_stats_get_unchanged (stats));
+  g_string_append_printf (csv, "tiles_skipped,%" G_GUINT64_FORMAT ",,,,\n",
+                          skipped_tiles);
+  g_string_append_printf (csv, "tiles,%" G_GUINT64_FORMAT ",,,,\n", n_tiles);
+
+  frame_stats_get_skew (stats, &skew_stats);
+  g_string_append_printf (csv, "sync_skew,%" G_GUINT64_FORMAT ",%"
+                          G_GINT64_FORMAT ",%" G_GINT64_FORMAT ",%"
+                          G_GINT64_FORMAT ",%" G_GINT64_FORMAT "\n",
+                          skew_stats.count, skew_stats.mean, skew_stats.p50,
+                          skew_stats.p99, skew_stats.max);
+  frame_stats_get_unmatched (stats, &unmatched_depth, &unmatched_video);
+  g_string_append_printf (csv, "unmatched_depth,%" G_GUINT64_FORMAT ",,,,\n",
+                          unmatched_depth);
+  g_string_append_printf (csv, "unmatched_video,%" G_GUINT64_FORMAT ",,,,\n",
+                          unmatched_video);
+
+  success = g_file_set_contents (path, csv->str, csv->len, error);
+  g_string_free (csv, TRUE);
+
+  return success;
+}
@@ -0,0 +1,90 @@
+/* GFreenect Utils : frame-stats.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FRAME_STATS_H__
+#define __FRAME_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  FRAME_STAGE_FETCH,
+  FRAME_STAGE_DENOISE,
+  FRAME_STAGE_THRESHOLD,
+  FRAME_STAGE_SAVE,
+  FRAME_STAGE_REGISTER,
+  FRAME_STAGE_UPLOAD,
+  FRAME_STAGE_TOTAL,
+  FRAME_STAGE_LAST
+} FrameStage;
+
+typedef struct _FrameStats FrameStats;
+
+typedef struct
+{
+  guint64 count;
+  gint64  mean;
+  gint64  p50;
+  gint64  p99;
+  gint64  max;
+} FrameStageStats;
+
+FrameStats  *frame_stats_new            (gint64 frame_interval);
+void         frame_stats_free           (FrameStats *stats);
+
+void         frame_stats_add_frame      (FrameStats *stats,
+                                         gint64      time);
+void         frame_stats_add            (FrameStats *stats,
+                                         FrameStage  stage,
+                                         gint64      duration);
+void         frame_stats_add_stale      (FrameStats *stats);
+void         frame_stats_add_tiles      (FrameStats *stats,
+                                         guint       n_dirty,
+                                         guint       n_tiles);
+void         frame_stats_add_match      (FrameStats *stats,
+                                         gint64      skew);
+void         frame_stats_add_unmatched  (FrameStats *stats,
+                                         guint       n_depth,
+                                         guint       n_video);
+
+void         frame_stats_get            (FrameStats      *stats,
+                                         FrameStage       stage,
+                                         FrameStageStats *stage_stats);
+guint64      frame_stats_get_dropped    (FrameStats *stats);
+guint64      frame_stats_get_stale      (FrameStats *stats);
+guint64      frame_stats_get_unchanged  (FrameStats *stats);
+void         frame_stats_get_tiles      (FrameStats *stats,
+                                         guint64    *skipped_tiles,
+                                         guint64    *n_tiles);
+void         frame_stats_get_skew       (FrameStats      *stats,
+                                         FrameStageStats *skew_stats);
+void         frame_stats_get_unmatched  (FrameStats *stats,
+                                         guint64    *n_depth,
+                                         guint64    *n_video);
+const gchar *frame_stats_get_stage_name (FrameStage stage);
+
+gchar       *frame_stats_to_markup      (FrameStats *stats);
+gboolean     frame_stats_write_csv      (FrameStats   *stats,
+                                         const gchar  *path,
+                                         GError      **error);
+
+G_END_DECLS
+
+#endif /* __FRAME_STATS_H__ */
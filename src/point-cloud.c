@@ -0,0 +1,359 @@
+/* GFreenect Utils : point-cloud.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "point-cloud.h"
+
+/* Depth samples are unprojected to points in meters, x to the right,
+   y down and z away from the camera. The ray through every pixel is
+   computed once per frame size, reduction and intrinsics and shared
+   by everyone asking for the same, so a point costs one multiply per
+   axis. Points are written in order, skipping the samples with no
+   depth or out of the thresholds as they go */
+
+/* Calibration of a typical Kinect depth camera */
+#define DEFAULT_FX 594.21
+#define DEFAULT_FY 591.04
+#define DEFAULT_CX 339.31
+#define DEFAULT_CY 242.74
+
+#define MILLIMETERS_PER_METER 1000.
+
+/* Points are written in chunks of this many when they have to be
+   byte swapped */
+#define WRITE_CHUNK 4096
+
+struct _PointCloudRays
+{
+  gint ref_count;
+  guint width;
+  guint height;
+  guint dimension_factor;
+  PointCloudIntrinsics intrinsics;
+
+  /* x and y of the ray through each sample, per millimeter of depth */
+  gfloat *rays;
+};
+
+static GMutex rays_cache_mutex;
+static GSList *rays_cache = NULL;
+
+void
+point_cloud_intrinsics_init_default (PointCloudIntrinsics *intrinsics)
+{
+  g_return_if_fail (intrinsics != NULL);
+
+  intrinsics->fx = DEFAULT_FX;
+  intrinsics->fy = DEFAULT_FY;
+  intrinsics->cx = DEFAULT_CX;
+  intrinsics->cy = DEFAULT_CY;
+}
+
+/* Moves the principal point to the origin of frames cropped at
+   x_offset, y_offset of the whole frame */
+void
+point_cloud_intrinsics_crop (PointCloudIntrinsics *intrinsics,
+                             guint                 x_offset,
+                             guint                 y_offset)
+{
+  g_return_if_fail (intrinsics != NULL);
+
+  intrinsics->cx -= x_offset;
+  intrinsics->cy -= y_offset;
+}
+
+/* Parses "FX,FY,CX,CY" */
+gboolean
+point_cloud_intrinsics_parse (const gchar          *str,
+                              PointCloudIntrinsics *intrinsics)
+{
+  gchar **fields;
+  gdouble values[4];
+  gboolean valid;
+  guint i;
+
+  g_return_val_if_fail (str != NULL, FALSE);
+  g_return_val_if_fail (intrinsics != NULL, FALSE);
+
+  fields = g_strsplit (str, ",", 4);
+  valid = g_strv_length (fields) == 4;
+  for (i = 0; valid && i < 4; i++)
+    {
+      gchar *end = NULL;
+
+      values[i] = g_ascii_strtod (fields[i], &end);
+      valid = *fields[i] != '\0' && *end == '\0';
+    }
+  g_strfreev (fields);
+
+  if (! valid || values[0] <= 0. || values[1] <= 0.)
+    return FALSE;
+
+  intrinsics->fx = values[0];
+  intrinsics->fy = values[1];
+  intrinsics->cx = values[2];
+  intrinsics->cy = values[3];
+
+  return TRUE;
+}
+
+gboolean
+point_cloud_format_from_string (const gchar *str, PointCloudFormat *format)
+{
+  g_return_val_if_fail (str != NULL, FALSE);
+  g_return_val_if_fail (format != NULL, FALSE);
+
+  if (g_ascii_strcasecmp (str, "ply") == 0)
+    *format = POINT_CLOUD_FORMAT_PLY;
+  else if (g_ascii_strcasecmp (str, "f32") == 0)
+    *format = POINT_CLOUD_FORMAT_F32;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+const gchar *
+point_cloud_format_get_extension (PointCloudFormat format)
+{
+  return format == POINT_CLOUD_FORMAT_PLY ? "ply" : "f32";
+}
+
+static PointCloudRays *
+point_cloud_rays_new (guint                       width,
+                      guint                       height,
+                      guint                       dimension_factor,
+                      const PointCloudIntrinsics *intrinsics)
+{
+  PointCloudRays *rays;
+  gfloat *ray;
+  guint i, j;
+
+  rays = g_slice_new0 (PointCloudRays);
+  rays->ref_count = 1;
+  rays->width = width;
+  rays->height = height;
+  rays->dimension_factor = dimension_factor;
+  rays->intrinsics = *intrinsics;
+  rays->rays = g_new (gfloat, (gsize) width * height * 2);
+
+  ray = rays->rays;
+  for (j = 0; j < height; j++)
+    {
+      gdouble y = ((gdouble) j * dimension_factor - intrinsics->cy) /
+        intrinsics->fy / MILLIMETERS_PER_METER;
+
+      for (i = 0; i < width; i++)
+        {
+          *ray++ = ((gdouble) i * dimension_factor - intrinsics->cx) /
+            intrinsics->fx / MILLIMETERS_PER_METER;
+          *ray++ = y;
+        }
+    }
+
+  return rays;
+}
+
+static gboolean
+rays_match (PointCloudRays             *rays,
+            guint                       width,
+            guint                       height,
+            guint                       dimension_factor,
+            const PointCloudIntrinsics *intrinsics)
+{
+  return rays->width == width &&
+    rays->height == height &&
+    rays->dimension_factor == dimension_factor &&
+    rays->intrinsics.fx == intrinsics->fx &&
+    rays->intrinsics.fy == intrinsics->fy &&
+    rays->intrinsics.cx == intrinsics->cx &&
+    rays->intrinsics.cy == intrinsics->cy;
+}
+
+/* Returns the rays of frames of width x height samples, taken every
+   dimension_factor pixels, made the first time they are asked for.
+   They are kept until the program exits, frame sizes are few */
+PointCloudRays *
+point_cloud_rays_get (guint                       width,
+                      guint                       height,
+                      guint                       dimension_factor,
+                      const PointCloudIntrinsics *intrinsics)
+{
+  PointCloudRays *rays = NULL;
+  GSList *l;
+
+  g_return_val_if_fail (dimension_factor > 0, NULL);
+  g_return_val_if_fail (intrinsics != NULL, NULL);
+
+  g_mutex_lock (&rays_cache_mutex);
+  for (l = rays_cache; l != NULL; l = l->next)
+    if (rays_match (l->data, width, height, dimension_factor, intrinsics))
+      {
+        rays = l->data;
+        break;
+      }
+
+  if (rays == NULL)
+    {
+      rays = point_cloud_rays_new (width, height, dimension_factor,
+                                   intrinsics);
+      rays_cache = g_slist_prepend (rays_cache, rays);
+    }
+  point_cloud_rays_ref (rays);
+  g_mutex_unlock (&rays_cache_mutex);
+
+  return rays;
+}
+
+PointCloudRays *
+point_cloud_rays_ref (PointCloudRays *rays)
+{
+  g_return_val_if_fail (rays != NULL, NULL);
+
+  g_atomic_int_inc (&rays->ref_count);
+
+  return rays;
+}
+
+void
+point_cloud_rays_unref (PointCloudRays *rays)
+{
+  g_return_if_fail (rays != NULL);
+
+  if (g_atomic_int_dec_and_test (&rays->ref_count))
+    {
+      g_free (rays->rays);
+      g_slice_free (PointCloudRays, rays);
+    }
+}
+
+/* Writes the points of the depth samples between threshold_begin
+   and threshold_end, or above threshold_begin if threshold_end is 0,
+   to points as x, y, z triplets. points must have room for a point
+   per sample. Returns the number of points */
+guint
+point_cloud_rays_unproject (PointCloudRays *rays,
+                            const guint16  *depth,
+                            guint           threshold_begin,
+                            guint           threshold_end,
+                            gfloat         *points)
+{
+  const gfloat *ray;
+  gsize i, n_samples;
+  guint n_points = 0;
+  guint begin, end;
+
+  g_return_val_if_fail (rays != NULL, 0);
+  g_return_val_if_fail (depth != NULL, 0);
+  g_return_val_if_fail (points != NULL, 0);
+
+  begin = MAX (threshold_begin, 1);
+  end = threshold_end != 0 ? threshold_end : G_MAXUINT16;
+
+  n_samples = (gsize) rays->width * rays->height;
+  ray = rays->rays;
+
+  /* Every point is written and the output only moves forward when it
+     is kept, so there is no branch to mispredict. The output is never
+     ahead of the input, so the extra write always has room */
+  for (i = 0; i < n_samples; i++)
+    {
+      guint value = depth[i];
+      gfloat z = (gfloat) value;
+      gfloat *point = points + (gsize) n_points * 3;
+
+      point[0] = z * ray[2 * i];
+      point[1] = z * ray[2 * i + 1];
+      point[2] = z * (gfloat) (1. / MILLIMETERS_PER_METER);
+      n_points += value >= begin && value <= end;
+    }
+
+  return n_points;
+}
+
+/* Writes points as a binary PLY file, or as x, y, z little endian
+   32 bit floats with no header */
+gboolean
+point_cloud_write (const gchar       *path,
+                   PointCloudFormat   format,
+                   const gfloat      *points,
+                   guint              n_points,
+                   GError           **error)
+{
+  FILE *file;
+  gsize n_values;
+  gboolean success = TRUE;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (points != NULL || n_points == 0, FALSE);
+
+  file = g_fopen (path, "wb");
+  if (file == NULL)
+    goto error;
+
+  if (format == POINT_CLOUD_FORMAT_PLY)
+    fprintf (file,
+             "ply\n"
+             "format binary_little_endian 1.0\n"
+             "element vertex %u\n"
+             "property float x\n"
+             "property float y\n"
+             "property float z\n"
+             "end_header\n", n_points);
+
+  n_values = (gsize) n_points * 3;
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  success = fwrite (points, sizeof (gfloat), n_values, file) == n_values;
+#else
+  {
+    guint32 chunk[WRITE_CHUNK];
+    gsize i, j;
+
+    for (i = 0; success && i < n_values; i += WRITE_CHUNK)
+      {
+        gsize n = MIN (WRITE_CHUNK, n_values - i);
+
+        memcpy (chunk, points + i, n * sizeof (gfloat));
+        for (j = 0; j < n; j++)
+          chunk[j] = GUINT32_TO_LE (chunk[j]);
+        success = fwrite (chunk, sizeof (guint32), n, file) == n;
+      }
+  }
+#endif
+
+  if (fclose (file) != 0)
+    success = FALSE;
+
+  if (success)
+    return TRUE;
+
+ error:
+  {
+    gint saved_errno = errno;
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Could not write %s: %s", path, g_strerror (saved_errno));
+  }
+  return FALSE;
+}
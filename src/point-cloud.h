@@ -0,0 +1,76 @@
+/* GFreenect Utils : point-cloud.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POINT_CLOUD_H__
+#define __POINT_CLOUD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  POINT_CLOUD_FORMAT_PLY,
+  POINT_CLOUD_FORMAT_F32
+} PointCloudFormat;
+
+/* Pinhole intrinsics of the depth camera, in pixels of the full
+   resolution frames */
+typedef struct
+{
+  gdouble fx;
+  gdouble fy;
+  gdouble cx;
+  gdouble cy;
+} PointCloudIntrinsics;
+
+typedef struct _PointCloudRays PointCloudRays;
+
+void            point_cloud_intrinsics_init_default (PointCloudIntrinsics *intrinsics);
+gboolean        point_cloud_intrinsics_parse        (const gchar          *str,
+                                                     PointCloudIntrinsics *intrinsics);
+void            point_cloud_intrinsics_crop         (PointCloudIntrinsics *intrinsics,
+                                                     guint                 x_offset,
+                                                     guint                 y_offset);
+
+gboolean        point_cloud_format_from_string      (const gchar      *str,
+                                                     PointCloudFormat *format);
+const gchar    *point_cloud_format_get_extension    (PointCloudFormat  format);
+
+PointCloudRays *point_cloud_rays_get                (guint                       width,
+                                                     guint                       height,
+                                                     guint                       dimension_factor,
+                                                     const PointCloudIntrinsics *intrinsics);
+PointCloudRays *point_cloud_rays_ref                (PointCloudRays *rays);
+void            point_cloud_rays_unref              (PointCloudRays *rays);
+
+guint           point_cloud_rays_unproject          (PointCloudRays *rays,
+                                                     const guint16  *depth,
+                                                     guint           threshold_begin,
+                                                     guint           threshold_end,
+                                                     gfloat         *points);
+
+gboolean        point_cloud_write                   (const gchar      *path,
+                                                     PointCloudFormat  format,
+                                                     const gfloat     *points,
+                                                     guint             n_points,
+                                                     GError          **error);
+
+G_END_DECLS
+
+#endif /* __POINT_CLOUD_H__ */
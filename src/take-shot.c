@@ -25,275 +25,1565 @@
 #include <clutter/clutter.h>
 #include <clutter/clutter-keysyms.h>
 
+#include "depth-processing.h"
+#include "frame-pool.h"
+#include "depth-recorder.h"
+#include "virtual-device.h"
+#include "frame-stats.h"
+#include "depth-texture.h"
+#include "depth-colormap.h"
+#include "depth-filter.h"
+#include "depth-tiles.h"
+#include "point-cloud.h"
+#include "depth-registration.h"
+#include "depth-image.h"
+#include "frame-ring.h"
+#include "depth-history.h"
+#include "depth-histogram.h"
+
 static GFreenectDevice *kinect = NULL;
+static VirtualDevice *virtual_device = NULL;
+static FramePool *frame_pool = NULL;
 static ClutterActor *info_text;
 static ClutterActor *depth_tex;
 static ClutterActor *video_tex;
+static ClutterActor *cutout_tex;
+static ClutterActor *roi_area;
+static ClutterActor *roi_outline;
+static ClutterActor *histogram_tex;
 
 static guint THRESHOLD_BEGIN = 500;
 /* Adjust this value to increase of decrease
    the threshold */
 static guint THRESHOLD_END   = 1500;
 
+/* Limits of the threshold band, by hand or automatic */
+#define MIN_THRESHOLD_BAND 300
+#define MAX_THRESHOLD 4000
+
 static guint shot_timeout_id = 0;
-static gboolean record_shot = FALSE;
+static gint record_shot = FALSE;
 static gint DEFAULT_SECONDS_TO_SHOOT = 2;
 static gint seconds_to_shoot = 2;
+static gint info_seconds = -1;
+
+/* Number of frames that may wait for the disk while recording,
+   about one second of depth stream */
+#define RECORDER_QUEUE_LENGTH 30
+
+/* Number of video frames that may wait for the processing thread to
+   match them, a power of two */
+#define FRAME_RING_LENGTH 4
+
+/* The Kinect streams depth at 30 frames per second */
+#define FRAME_INTERVAL (G_USEC_PER_SEC / 30)
+
+/* The depth histogram counts one out of every HISTOGRAM_STEP samples
+   in each direction, and is drawn a column per bin */
+#define HISTOGRAM_STEP 2
+#define HISTOGRAM_WIDTH DEPTH_HISTOGRAM_N_BINS
+#define HISTOGRAM_HEIGHT 64
+
+/* Automatic threshold ends within this many millimeters of the one
+   in use are ignored, so noise does not make the band flicker */
+#define AUTO_THRESHOLD_HYSTERESIS 50
+
+static DepthRecorder *recorder = NULL;
+static guint status_update_id = 0;
+static FrameStats *frame_stats = NULL;
+static gchar *stats_csv_path = NULL;
+static gboolean record_uncompressed = FALSE;
+static gint dimension_factor = 1;
+static gchar *replay_path = NULL;
+static gboolean synthetic = FALSE;
+static gdouble virtual_fps = 0.;
+static gint max_frames = 0;
+static gboolean record_at_start = FALSE;
+static gint n_frames = 0;
+static gchar *palette_name = NULL;
+static gint denoise_strength = 0;
+static gint change_tolerance = DEPTH_TILES_DEFAULT_TOLERANCE;
+static gchar *cloud_format_str = NULL;
+static gchar *intrinsics_str = NULL;
+static gboolean write_cloud = FALSE;
+static PointCloudFormat cloud_format;
+static PointCloudIntrinsics intrinsics;
+static gboolean register_video = FALSE;
+static gchar *video_intrinsics_str = NULL;
+static gchar *baseline_str = NULL;
+static DepthRegistrationCalibration calibration;
+static gint sync_tolerance = 15;
+static gboolean record_video = FALSE;
+static gdouble pre_trigger = 0.;
+static gdouble post_trigger = 1.;
+static gint pre_trigger_memory = 64;
+static gchar *roi_str = NULL;
+static gchar *auto_threshold_str = NULL;
+
+/* The end of the threshold band can follow the nearest object, found
+   in the depth histogram by the processing thread, which leaves it in
+   auto_threshold_end for the next frames */
+#define AUTO_THRESHOLD_OFF -1
+static gint auto_threshold = AUTO_THRESHOLD_OFF;
+static gint auto_threshold_end = 0;
+
+/* Only this rectangle of the frames, in full resolution pixels, is
+   processed, shown and saved. An empty one stands for the whole
+   frame. It is set in the main thread, before and while dragging on
+   the depth view */
+static guint roi_x = 0;
+static guint roi_y = 0;
+static guint roi_width = 0;
+static guint roi_height = 0;
+static gboolean roi_dragging = FALSE;
+static gfloat roi_drag_x = 0;
+static gfloat roi_drag_y = 0;
+
+/* Drags shorter than this, in pixels, go back to the whole frame */
+#define ROI_MIN_SIZE 8
+
+/* The depth view shows the threshold mask, or the depth colored with
+   a palette over the threshold range */
+#define VIEW_MASK -1
+static gint depth_view = VIEW_MASK;
+
+static GOptionEntry entries[] =
+{
+  { "uncompressed", 'u', 0, G_OPTION_ARG_NONE, &record_uncompressed,
+    "Store recorded frames without compressing them", NULL },
+  { "reduction", 'r', 0, G_OPTION_ARG_INT, &dimension_factor,
+    "Save shots and recordings at 1/N of the resolution (1, 2 or 4)", "N" },
+  { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_path,
+    "Replay a recording or directory of shots instead of using a Kinect",
+    "PATH" },
+  { "synthetic", 0, 0, G_OPTION_ARG_NONE, &synthetic,
+    "Generate frames instead of using a Kinect", NULL },
+  { "fps", 0, 0, G_OPTION_ARG_DOUBLE, &virtual_fps,
+    "Frame rate of replayed or generated frames, by default the recorded "
+    "rate or 30", "FPS" },
+  { "frames", 0, 0, G_OPTION_ARG_INT, &max_frames,
+    "Quit after N replayed or generated depth frames", "N" },
+  { "record", 0, 0, G_OPTION_ARG_NONE, &record_at_start,
+    "Start recording right away", NULL },
+  { "stats-csv", 0, 0, G_OPTION_ARG_FILENAME, &stats_csv_path,
+    "Write the latency of every processing stage to FILE on exit", "FILE" },
+  { "palette", 0, 0, G_OPTION_ARG_STRING, &palette_name,
+    "Show the depth colored with PALETTE (gray, turbo, jet or near-far) "
+    "instead of the threshold mask", "PALETTE" },
+  { "denoise", 0, 0, G_OPTION_ARG_INT, &denoise_strength,
+    "Smooth the depth over time before processing it, from 1 (least) "
+    "to 3 (most), or 0 not to", "N" },
+  { "change-tolerance", 0, 0, G_OPTION_ARG_INT, &change_tolerance,
+    "Only process and show again the parts of the depth view that changed "
+    "by more than MM millimeters, 10 by default", "MM" },
+  { "cloud", 0, 0, G_OPTION_ARG_STRING, &cloud_format_str,
+    "Also save shots as point clouds, in binary PLY (ply) or packed x, y, z "
+    "32 bit floats (f32)", "FORMAT" },
+  { "intrinsics", 0, 0, G_OPTION_ARG_STRING, &intrinsics_str,
+    "Depth camera intrinsics used for point clouds, in full resolution "
+    "pixels", "FX,FY,CX,CY" },
+  { "register", 0, 0, G_OPTION_ARG_NONE, &register_video,
+    "Cut the thresholded depth out of the video and show it over the mask",
+    NULL },
+  { "video-intrinsics", 0, 0, G_OPTION_ARG_STRING, &video_intrinsics_str,
+    "Video camera intrinsics used for the cutout", "FX,FY,CX,CY" },
+  { "baseline", 0, 0, G_OPTION_ARG_STRING, &baseline_str,
+    "Distance from the depth to the video camera used for the cutout, 20 "
+    "by default", "MM" },
+  { "sync-tolerance", 0, 0, G_OPTION_ARG_INT, &sync_tolerance,
+    "Largest time between a depth frame and the video frame saved with it, "
+    "15 by default", "MS" },
+  { "record-video", 0, 0, G_OPTION_ARG_NONE, &record_video,
+    "Also record the video frames matched to the recorded depth frames",
+    NULL },
+  { "pre-trigger", 0, 0, G_OPTION_ARG_DOUBLE, &pre_trigger,
+    "Keep the last SECONDS of depth, for T to save them with the frames "
+    "after it", "SECONDS" },
+  { "post-trigger", 0, 0, G_OPTION_ARG_DOUBLE, &post_trigger,
+    "Depth saved after T is pressed, 1 second by default", "SECONDS" },
+  { "pre-trigger-memory", 0, 0, G_OPTION_ARG_INT, &pre_trigger_memory,
+    "Memory used to keep the depth before T, 64 by default", "MB" },
+  { "roi", 0, 0, G_OPTION_ARG_STRING, &roi_str,
+    "Only process and save this region of the frames, in full resolution "
+    "pixels", "X,Y,WIDTH,HEIGHT" },
+  { "auto-threshold", 0, 0, G_OPTION_ARG_STRING, &auto_threshold_str,
+    "Move the end of the threshold to the nearest object, found in the "
+    "depth histogram with otsu or peak", "METHOD" },
+  { NULL }
+};
+
+/* Depth frames are processed in their own thread so slow steps never
+   delay input or painting. The main thread copies each frame into a
+   single slot mailbox, replacing the one there if the processing
+   thread has not taken it yet, so the processing thread always works
+   on the newest frame. A frame that is replaced before it is taken
+   is stale and dropped. The finished image is handed back the same
+   way for the main thread to upload.
+
+   Video frames are queued in a ring of their own, tagged with the
+   time they arrived like depth frames. After a depth frame is shown,
+   it is matched with the queued video frame nearest to it, if any is
+   within sync_tolerance, so shots and recordings store both. Video
+   frames left behind are never matched.
+
+   The view is only made again, and uploaded, in the tiles where the
+   depth changed, so frames of a still scene cost little and frames
+   that did not change at all are never handed back. A result carries
+   the tiles changed since the last result the main thread took, so
+   the tiles of stale results are not lost.
+
+   With a region of interest only that rectangle is copied into the
+   mailbox, so every later step works on the cropped frame, and x, y
+   tell where it was in the whole frame.
+
+   A histogram of the depth is counted for every frame, and handed
+   back drawn with the view. It also places the end of the threshold
+   band when that is automatic. It is a pass of its own, as the view
+   is only thresholded where tiles changed and the whole frame only
+   when it is saved, so no thresholding pass sees every sample of
+   every frame */
 
 typedef struct
 {
-  guint16 *reduced_buffer;
-  gint width;
-  gint height;
-  gint reduced_width;
-  gint reduced_height;
-} BufferInfo;
+  guint16 *depth;
+  guint x;
+  guint y;
+  guint width;
+  guint height;
+  gint64 start_time;
+  guint threshold_begin;
+  guint threshold_end;
+  gint view;
+  gint auto_threshold;
+} DepthJob;
+
+typedef struct
+{
+  guchar *image;
+  guint n_channels;
+  guint x;
+  guint y;
+  guint width;
+  guint height;
+  guint8 *dirty_tiles;
+  gboolean all_dirty;
+  guchar *histogram_image;
+  gint64 start_time;
+} DepthResult;
+
+static GThread *processing_thread = NULL;
+static GMutex processing_mutex;
+static GCond processing_cond;
+static gboolean processing_stopping = FALSE;
+static gpointer depth_mailbox = NULL;
+static FrameRing *video_ring = NULL;
+static gpointer result_mailbox = NULL;
+static gint results_taken = 0;
+
+/* Only used by the processing thread */
+static DepthColormap *view_colormap = NULL;
+static DepthFilter *depth_filter = NULL;
+static DepthTiles *depth_tiles = NULL;
+static guint8 *pending_tiles = NULL;
+static guint results_published = 0;
+static guint results_discarded = 0;
+static guint job_x = 0;
+static guint job_y = 0;
+static DepthHistogram depth_histogram;
+
+/* The depth view as last made, which only changes in dirty tiles */
+static guchar *view_image = NULL;
+static guint view_n_channels = 0;
+static gint view_image_view = VIEW_MASK;
+static guint view_image_begin = 0;
+static guint view_image_end = 0;
+
+/* Taken by the processing thread while it uses the recorder, so it is
+   not closed under it */
+static GMutex recorder_mutex;
+static DepthRecorder *video_recorder = NULL;
+
+/* The video is registered to the last depth frame in the main thread,
+   as video frames arrive. A shot taken by the processing thread asks
+   for the next cutout to be saved with the shot's timestamp */
+static DepthRegistration *registration = NULL;
+static guint16 *latest_depth = NULL;
+static guint latest_depth_width = 0;
+static guint latest_depth_height = 0;
+static guchar *cutout = NULL;
+static GMutex color_shot_mutex;
+static gint64 color_shot_timestamp = 0;
+
+/* With --pre-trigger the last frames are kept compressed in memory.
+   The main thread sets the time T was pressed, and the processing
+   thread saves the frames around it once it has the last of them */
+static DepthHistory *history = NULL;
+static GMutex trigger_mutex;
+static gint64 trigger_time = 0;
+
+/* Puts value in a mailbox and returns what was in it. Written as a
+   compare and exchange loop, as g_atomic_pointer_exchange() needs
+   GLib 2.74 */
+static gpointer
+mailbox_swap (gpointer *mailbox, gpointer value)
+{
+  gpointer old;
+
+  do
+    old = g_atomic_pointer_get (mailbox);
+  while (! g_atomic_pointer_compare_and_exchange (mailbox, old, value));
+
+  return old;
+}
 
 static void
-grayscale_buffer_set_value (guchar *buffer, gint index, guchar value)
+free_depth_result (DepthResult *result)
 {
-  buffer[index * 3] = value;
-  buffer[index * 3 + 1] = value;
-  buffer[index * 3 + 2] = value;
+  frame_pool_release (frame_pool, result->image);
+  frame_pool_release (frame_pool, result->dirty_tiles);
+  frame_pool_release (frame_pool, result->histogram_image);
+  g_slice_free (DepthResult, result);
 }
 
-static BufferInfo *
-process_buffer (guint16 *buffer,
-                guint width,
-                guint height,
-                guint dimension_factor,
-                guint threshold_begin,
-                guint threshold_end)
+static void
+upload_result_rect (guint    x,
+                    guint    y,
+                    guint    width,
+                    guint    height,
+                    gpointer user_data)
 {
-  BufferInfo *buffer_info;
-  gint i, j, reduced_width, reduced_height;
-  guint16 *reduced_buffer;
+  DepthResult *result = user_data;
+  GError *error = NULL;
+
+  if (! depth_texture_upload_rect (CLUTTER_TEXTURE (depth_tex),
+                                   result->image,
+                                   result->width, result->height,
+                                   result->n_channels,
+                                   x, y, width, height,
+                                   &error))
+    {
+      g_debug ("Error setting texture area: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static gboolean
+upload_depth_result (gpointer data)
+{
+  DepthResult *result;
+  GError *error = NULL;
+  gint64 stage_time, time;
 
-  g_return_val_if_fail (buffer != NULL, NULL);
+  result = mailbox_swap (&result_mailbox, NULL);
+  if (result == NULL)
+    return FALSE;
+  g_atomic_int_inc (&results_taken);
 
-  reduced_width = (width - width % dimension_factor) / dimension_factor;
-  reduced_height = (height - height % dimension_factor) / dimension_factor;
+  stage_time = g_get_monotonic_time ();
 
-  reduced_buffer = g_slice_alloc0 (reduced_width * reduced_height *
-                                   sizeof (guint16));
+  clutter_actor_set_position (depth_tex, result->x, result->y);
+  if (! result->all_dirty)
+    {
+      depth_tiles_foreach_rect (result->dirty_tiles,
+                                result->width, result->height,
+                                upload_result_rect, result);
+    }
+  else if (! depth_texture_upload (CLUTTER_TEXTURE (depth_tex),
+                                   result->image,
+                                   result->width, result->height,
+                                   result->n_channels,
+                                   &error))
+    {
+      g_debug ("Error setting texture area: %s", error->message);
+      g_clear_error (&error);
+    }
 
-  for (i = 0; i < reduced_width; i++)
+  if (! depth_texture_upload (CLUTTER_TEXTURE (histogram_tex),
+                              result->histogram_image,
+                              HISTOGRAM_WIDTH, HISTOGRAM_HEIGHT, 4,
+                              &error))
     {
-      for (j = 0; j < reduced_height; j++)
-        {
-          gint index;
-          guint16 value;
+      g_debug ("Error setting histogram: %s", error->message);
+      g_error_free (error);
+    }
 
-          index = j * width * dimension_factor + i * dimension_factor;
-          value = buffer[index];
+  time = g_get_monotonic_time ();
+  frame_stats_add (frame_stats, FRAME_STAGE_UPLOAD, time - stage_time);
+  frame_stats_add (frame_stats, FRAME_STAGE_TOTAL, time - result->start_time);
 
-          if (value < threshold_begin || value > threshold_end)
-            {
-              reduced_buffer[j * reduced_width + i] = 0;
-              continue;
-            }
+  free_depth_result (result);
+  return FALSE;
+}
 
-          reduced_buffer[j * reduced_width + i] = value;
-        }
-    }
+/* Returns the colormap of the view, made again when the palette or
+   the thresholds change */
+static DepthColormap *
+get_view_colormap (DepthJob *job)
+{
+  guint range_begin, range_end;
 
-  buffer_info = g_slice_new0 (BufferInfo);
-  buffer_info->reduced_buffer = reduced_buffer;
-  buffer_info->reduced_width = reduced_width;
-  buffer_info->reduced_height = reduced_height;
-  buffer_info->width = width;
-  buffer_info->height = height;
+  if (view_colormap != NULL)
+    {
+      depth_colormap_get_range (view_colormap, &range_begin, &range_end);
+      if (depth_colormap_get_palette (view_colormap) == job->view &&
+          range_begin == job->threshold_begin &&
+          range_end == job->threshold_end)
+        return view_colormap;
+
+      depth_colormap_unref (view_colormap);
+    }
 
-  return buffer_info;
+  view_colormap = depth_colormap_new (job->view,
+                                      job->threshold_begin,
+                                      job->threshold_end);
+  return view_colormap;
 }
 
-static guchar *
-create_grayscale_buffer (BufferInfo *buffer_info, gint dimension_reduction)
+/* Makes the tracked tiles and the view image match the size and
+   view of job, making every tile dirty when they change */
+static void
+prepare_view (DepthJob *job)
 {
-  gint i,j;
-  gint size;
-  guchar *grayscale_buffer;
-  guint16 *reduced_buffer;
+  guint n_channels = 1;
+
+  if (depth_tiles != NULL &&
+      (depth_tiles_get_width (depth_tiles) != job->width ||
+       depth_tiles_get_height (depth_tiles) != job->height))
+    {
+      depth_tiles_free (depth_tiles);
+      depth_tiles = NULL;
+    }
 
-  reduced_buffer = buffer_info->reduced_buffer;
+  if (depth_tiles == NULL)
+    {
+      depth_tiles = depth_tiles_new (job->width, job->height,
+                                     change_tolerance);
+      g_free (pending_tiles);
+      pending_tiles = g_new0 (guint8, depth_tiles_get_n_tiles (depth_tiles));
+      g_free (view_image);
+      view_image = NULL;
+    }
 
-  size = buffer_info->width * buffer_info->height * sizeof (guchar) * 3;
-  grayscale_buffer = g_slice_alloc (size);
-  /*Paint is white*/
-  memset (grayscale_buffer, 255, size);
+  if (job->view != VIEW_MASK)
+    n_channels = depth_colormap_get_n_channels (get_view_colormap (job));
 
-  for (i = 0; i < buffer_info->reduced_width; i++)
+  if (view_image == NULL ||
+      n_channels != view_n_channels ||
+      job->view != view_image_view ||
+      job->threshold_begin != view_image_begin ||
+      job->threshold_end != view_image_end)
     {
-      for (j = 0; j < buffer_info->reduced_height; j++)
-        {
-          if (reduced_buffer[j * buffer_info->reduced_width + i] != 0)
-            {
-              gint index = j * dimension_reduction * buffer_info->width +
-                i * dimension_reduction;
-              grayscale_buffer_set_value (grayscale_buffer, index, 0);
-            }
-        }
+      g_free (view_image);
+      view_image = g_malloc ((gsize) job->width * job->height * n_channels);
+      view_n_channels = n_channels;
+      view_image_view = job->view;
+      view_image_begin = job->threshold_begin;
+      view_image_end = job->threshold_end;
+      depth_tiles_invalidate (depth_tiles);
+    }
+}
+
+/* Makes a rectangle of the view image again from the depth of job */
+static void
+update_view_rect (guint    x,
+                  guint    y,
+                  guint    width,
+                  guint    height,
+                  gpointer user_data)
+{
+  DepthJob *job = user_data;
+  DepthColormap *colormap;
+  guint row;
+
+  if (job->view == VIEW_MASK)
+    {
+      depth_processing_threshold_mask_rect (job->depth,
+                                            job->width,
+                                            job->height,
+                                            dimension_factor,
+                                            job->threshold_begin,
+                                            job->threshold_end,
+                                            x, y, width, height,
+                                            view_image);
+      return;
     }
 
-  return grayscale_buffer;
+  colormap = get_view_colormap (job);
+  for (row = y; row < y + height; row++)
+    {
+      gsize offset = (gsize) row * job->width + x;
+
+      depth_colormap_apply (colormap, job->depth + offset, width,
+                            view_image + offset * view_n_channels);
+    }
+}
+
+/* Copies a rectangle of the view image to the image of a result */
+static void
+copy_view_rect (guint    x,
+                guint    y,
+                guint    width,
+                guint    height,
+                gpointer user_data)
+{
+  DepthResult *result = user_data;
+  guint row;
+
+  for (row = y; row < y + height; row++)
+    {
+      gsize offset = ((gsize) row * result->width + x) * view_n_channels;
+
+      memcpy (result->image + offset, view_image + offset,
+              width * view_n_channels);
+    }
 }
 
+/* Thresholds the depth of job for saving it. No mask is made, the
+   view is made from the dirty tiles only */
 static guint16 *
-read_file_to_buffer (gchar *name, gsize count, GError *e)
+reduce_depth_job (DepthJob *job, const DepthFrameHeader *header)
 {
+  guint16 *reduced_buffer;
+
+  reduced_buffer = frame_pool_acquire (frame_pool,
+                                       header->width, header->height,
+                                       sizeof (guint16));
+
+  depth_processing_threshold_reduce (job->depth,
+                                     job->width,
+                                     job->height,
+                                     dimension_factor,
+                                     job->threshold_begin,
+                                     job->threshold_end,
+                                     reduced_buffer);
+
+  return reduced_buffer;
+}
+
+/* Writes the thresholded depth of a shot as a point cloud */
+static void
+save_shot_cloud (const DepthFrameHeader *header, const guint16 *reduced_buffer)
+{
+  PointCloudIntrinsics cropped_intrinsics = intrinsics;
+  PointCloudRays *rays;
   GError *error = NULL;
-  guint16 *depth = NULL;
-  GFile *new_file = g_file_new_for_path (name);
-  GFileInputStream *input_stream = g_file_read (new_file,
-                                                NULL,
-                                                &error);
-  if (error != NULL)
+  gfloat *points;
+  guint n_points;
+  gchar *name;
+
+  point_cloud_intrinsics_crop (&cropped_intrinsics,
+                               header->x_offset, header->y_offset);
+  rays = point_cloud_rays_get (header->width, header->height,
+                               header->dimension_factor,
+                               &cropped_intrinsics);
+  points = g_new (gfloat, (gsize) header->width * header->height * 3);
+  n_points = point_cloud_rays_unproject (rays, reduced_buffer,
+                                         header->threshold_begin,
+                                         header->threshold_end,
+                                         points);
+  point_cloud_rays_unref (rays);
+
+  name = g_strdup_printf ("./depth-cloud-%" G_GINT64_FORMAT ".%s",
+                          header->timestamp,
+                          point_cloud_format_get_extension (cloud_format));
+  if (point_cloud_write (name, cloud_format, points, n_points, &error))
+    {
+      g_print ("Created file: %s\n", name);
+    }
+  else
     {
       g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (name);
+  g_free (points);
+}
+
+/* Hands the tiles of the view that changed to the main thread */
+static void
+publish_view (DepthJob *job)
+{
+  DepthResult *result, *stale;
+  guint n_tiles, i;
+
+  n_tiles = depth_tiles_get_n_tiles (depth_tiles);
+
+  /* Once the main thread took every result handed to it, the tiles
+     they carried are on the texture */
+  if (g_atomic_int_get (&results_taken) + results_discarded ==
+      results_published)
+    memset (pending_tiles, 0, n_tiles);
+
+  result = g_slice_new (DepthResult);
+  result->x = job->x;
+  result->y = job->y;
+  result->width = job->width;
+  result->height = job->height;
+  result->n_channels = view_n_channels;
+  result->start_time = job->start_time;
+  result->all_dirty = TRUE;
+  result->dirty_tiles = frame_pool_acquire (frame_pool, n_tiles, 1,
+                                            sizeof (guint8));
+  for (i = 0; i < n_tiles; i++)
+    {
+      pending_tiles[i] |= depth_tiles_get_dirty (depth_tiles)[i];
+      result->dirty_tiles[i] = pending_tiles[i];
+      result->all_dirty &= pending_tiles[i] != 0;
+    }
+
+  result->image = frame_pool_acquire (frame_pool, job->width, job->height,
+                                      view_n_channels);
+  depth_tiles_foreach_rect (result->dirty_tiles, job->width, job->height,
+                            copy_view_rect, result);
+
+  result->histogram_image = frame_pool_acquire (frame_pool,
+                                                HISTOGRAM_WIDTH,
+                                                HISTOGRAM_HEIGHT, 4);
+  depth_histogram_draw (&depth_histogram, result->histogram_image,
+                        HISTOGRAM_WIDTH, HISTOGRAM_HEIGHT,
+                        job->threshold_begin, job->threshold_end);
+
+  results_published++;
+  stale = mailbox_swap (&result_mailbox, result);
+  if (stale != NULL)
+    {
+      results_discarded++;
+      frame_stats_add_stale (frame_stats);
+      free_depth_result (stale);
     }
   else
     {
-      gsize bread = 0;
-      depth = g_slice_alloc (count);
-      g_input_stream_read_all ((GInputStream *) input_stream,
-                               depth,
-                               count,
-                               &bread,
-                               NULL,
-                               &error);
+      clutter_threads_add_idle (upload_depth_result, NULL);
+    }
+}
 
-      if (error != NULL)
-        {
-          g_debug ("ERROR: %s", error->message);
-        }
+/* Returns TRUE if a video frame that arrived at or after timestamp
+   is queued, so no better match for it can come */
+static gboolean
+has_later_video_frame (gint64 timestamp)
+{
+  guint n_queued = frame_ring_get_n_queued (video_ring);
+
+  return n_queued > 0 &&
+    frame_ring_peek (video_ring, n_queued - 1)->timestamp >= timestamp;
+}
+
+/* Returns the queued video frame nearest to the depth frame of job,
+   waiting up to sync_tolerance for it to arrive, or NULL if there is
+   none within sync_tolerance. The frames before it are dropped, and
+   the one returned stays queued until the caller pops it */
+static FrameRingSlot *
+match_video_frame (DepthJob *job)
+{
+  gint64 tolerance = (gint64) sync_tolerance * 1000;
+  gint64 best_skew = G_MAXINT64;
+  guint n_queued, best = 0, i;
+
+  g_mutex_lock (&processing_mutex);
+  while (! processing_stopping &&
+         ! has_later_video_frame (job->start_time) &&
+         g_cond_wait_until (&processing_cond, &processing_mutex,
+                            job->start_time + tolerance))
+    ;
+  g_mutex_unlock (&processing_mutex);
+
+  /* Video frames are queued in the order they arrived */
+  n_queued = frame_ring_get_n_queued (video_ring);
+  for (i = 0; i < n_queued; i++)
+    {
+      gint64 skew = frame_ring_peek (video_ring, i)->timestamp -
+        job->start_time;
+
+      if (ABS (skew) >= ABS (best_skew))
+        break;
+      best = i;
+      best_skew = skew;
+    }
+
+  if (ABS (best_skew) <= tolerance)
+    {
+      frame_ring_pop (video_ring, best);
+      frame_stats_add_unmatched (frame_stats, 0, best);
+      frame_stats_add_match (frame_stats, best_skew);
+      return frame_ring_peek (video_ring, 0);
     }
-  return depth;
+
+  /* Drop the frames too old for this or any later depth frame */
+  for (i = 0; i < n_queued; i++)
+    if (frame_ring_peek (video_ring, i)->timestamp >=
+        job->start_time - tolerance)
+      break;
+  frame_ring_pop (video_ring, i);
+  frame_stats_add_unmatched (frame_stats, 1, i);
+
+  return NULL;
 }
 
+/* Writes the video frame matched to a shot */
 static void
-on_depth_frame (GFreenectDevice *kinect, gpointer user_data)
+save_shot_video (const DepthFrameHeader *header, FrameRingSlot *video)
 {
-  gint width, height;
-  guchar *grayscale_buffer;
-  guint16 *depth;
-  gchar *contents;
-  BufferInfo *buffer_info;
-  gsize len;
   GError *error = NULL;
-  GFreenectFrameMode frame_mode;
+  gchar *name;
 
-  depth = (guint16 *) gfreenect_device_get_depth_frame_raw (kinect,
-                                                            &len,
-                                                            &frame_mode);
+  name = g_strdup_printf ("./depth-video-%" G_GINT64_FORMAT ".%s",
+                          header->timestamp,
+                          video->bytes_per_pixel == 4 ? "pam" : "ppm");
+  if (depth_image_write_pnm (name, video->data, video->width, video->height,
+                             video->bytes_per_pixel, &error))
+    {
+      g_print ("Created file: %s\n", name);
+    }
+  else
+    {
+      g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
+    }
+  g_free (name);
+}
+
+/* Queues the video frame matched to a recorded depth frame in the
+   video recording, with the timestamp of the depth frame */
+static void
+record_video_frame (const DepthFrameHeader *header, FrameRingSlot *video)
+{
+  DepthFrameHeader video_header;
+
+  /* Video recordings only hold RGB frames */
+  if (video->bytes_per_pixel != 3)
+    return;
+
+  memset (&video_header, 0, sizeof (video_header));
+  video_header.width = video->width;
+  video_header.height = video->height;
+  video_header.timestamp = header->timestamp;
+  video_header.dimension_factor = 1;
+  depth_recorder_push (video_recorder, &video_header, video->data);
+}
+
+static void
+on_history_saved (const gchar  *path,
+                  guint         n_frames,
+                  const GError *error,
+                  gpointer      user_data)
+{
   if (error != NULL)
+    g_debug ("ERROR: %s", error->message);
+  else
+    g_print ("Created file: %s (%u frames)\n", path, n_frames);
+}
+
+/* Saves the frames around the time T was pressed, in the background,
+   once the frame captured at time is past them */
+static void
+save_triggered_history (gint64 time)
+{
+  GError *error = NULL;
+  gint64 trigger, end;
+  gchar *name;
+
+  g_mutex_lock (&trigger_mutex);
+  trigger = trigger_time;
+  end = trigger + (gint64) (post_trigger * G_USEC_PER_SEC);
+  if (trigger != 0 && time > end)
+    trigger_time = 0;
+  else
+    trigger = 0;
+  g_mutex_unlock (&trigger_mutex);
+
+  if (trigger == 0)
+    return;
+
+  name = g_strdup_printf ("./depth-trigger-%" G_GINT64_FORMAT,
+                          trigger +
+                          (g_get_real_time () - g_get_monotonic_time ()));
+  if (! depth_history_save (history, name,
+                            trigger - (gint64) (pre_trigger * G_USEC_PER_SEC),
+                            end, on_history_saved, NULL, &error))
     {
-      g_debug ("ERROR Opening: %s", error->message);
+      g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
     }
+  g_free (name);
+}
 
+/* Moves the end of the threshold band of the next frames to the
+   nearest object in the histogram, once it moved by more than
+   AUTO_THRESHOLD_HYSTERESIS */
+static void
+update_auto_threshold (DepthJob *job)
+{
+  guint end;
+
+  if (! depth_histogram_find_threshold (&depth_histogram,
+                                        job->auto_threshold,
+                                        job->threshold_begin, &end))
+    return;
+
+  end = CLAMP (end, job->threshold_begin + MIN_THRESHOLD_BAND,
+               MAX_THRESHOLD);
+  if (ABS ((gint) end - (gint) job->threshold_end) >
+      AUTO_THRESHOLD_HYSTERESIS)
+    g_atomic_int_set (&auto_threshold_end, end);
+}
 
-  width = frame_mode.width;
-  height = frame_mode.height;
+/* Denoises a frame, makes the view again where it changed and saves
+   it with the video frame matched to it, in the processing thread */
+static void
+process_depth_job (DepthJob *job)
+{
+  guint16 *reduced_buffer = NULL;
+  DepthFrameHeader header;
+  gint64 stage_time, time;
+  FrameRingSlot *video;
+  gboolean shot, saving;
+  guint n_dirty;
+
+  stage_time = g_get_monotonic_time ();
+
+  /* Once the region of interest moved, the filtered and tracked
+     samples are not those of the frame anymore */
+  if (job->x != job_x || job->y != job_y)
+    {
+      if (depth_filter != NULL)
+        {
+          depth_filter_free (depth_filter);
+          depth_filter = NULL;
+        }
+      if (depth_tiles != NULL)
+        {
+          depth_tiles_free (depth_tiles);
+          depth_tiles = NULL;
+        }
+      job_x = job->x;
+      job_y = job->y;
+    }
 
-  buffer_info = process_buffer (depth,
-                                width,
-                                height,
-                                1,
-                                THRESHOLD_BEGIN,
-                                THRESHOLD_END);
+  if (denoise_strength > 0)
+    {
+      if (depth_filter != NULL &&
+          (depth_filter_get_width (depth_filter) != job->width ||
+           depth_filter_get_height (depth_filter) != job->height))
+        {
+          depth_filter_free (depth_filter);
+          depth_filter = NULL;
+        }
+      if (depth_filter == NULL)
+        depth_filter = depth_filter_new (job->width, job->height,
+                                         denoise_strength,
+                                         DEPTH_FILTER_DEFAULT_JUMP);
 
-  grayscale_buffer = create_grayscale_buffer (buffer_info,
-                                              1);
+      depth_filter_apply (depth_filter, job->depth);
+
+      time = g_get_monotonic_time ();
+      frame_stats_add (frame_stats, FRAME_STAGE_DENOISE, time - stage_time);
+      stage_time = time;
+    }
 
-  if (record_shot)
+  /* Not counted while thresholding, which only sees the dirty tiles */
+  depth_histogram_compute (&depth_histogram, job->depth,
+                          job->width, job->height, HISTOGRAM_STEP);
+  if (job->auto_threshold != AUTO_THRESHOLD_OFF)
+    update_auto_threshold (job);
+
+  memset (&header, 0, sizeof (header));
+  header.width = depth_processing_reduce_dimension (job->width,
+                                                    dimension_factor);
+  header.height = depth_processing_reduce_dimension (job->height,
+                                                     dimension_factor);
+  /* The time the frame arrived, as real time */
+  header.timestamp = job->start_time +
+    (g_get_real_time () - g_get_monotonic_time ());
+  header.dimension_factor = dimension_factor;
+  header.threshold_begin = job->threshold_begin;
+  header.threshold_end = job->threshold_end;
+  header.x_offset = job->x;
+  header.y_offset = job->y;
+
+  prepare_view (job);
+  n_dirty = depth_tiles_update (depth_tiles, job->depth);
+  frame_stats_add_tiles (frame_stats, n_dirty,
+                         depth_tiles_get_n_tiles (depth_tiles));
+  depth_tiles_foreach_rect (depth_tiles_get_dirty (depth_tiles),
+                            job->width, job->height,
+                            update_view_rect, job);
+
+  time = g_get_monotonic_time ();
+  frame_stats_add (frame_stats, FRAME_STAGE_THRESHOLD, time - stage_time);
+
+  /* Nothing to show if no tile changed */
+  if (n_dirty > 0)
+    publish_view (job);
+
+  video = match_video_frame (job);
+  stage_time = g_get_monotonic_time ();
+
+  shot = g_atomic_int_compare_and_exchange (&record_shot, TRUE, FALSE);
+  saving = shot;
+
+  if (shot)
     {
-      g_debug ("Taking shot...");
       GError *error = NULL;
-      gchar *name = g_strdup_printf ("./depth-data-%d", g_get_real_time ());
-      g_file_set_contents (name, (gchar *) buffer_info->reduced_buffer,
-                           width * height * sizeof (guint16), &error);
+      gchar *name;
+
+      g_debug ("Taking shot...");
+      name = g_strdup_printf ("./depth-data-%" G_GINT64_FORMAT,
+                              header.timestamp);
+      reduced_buffer = reduce_depth_job (job, &header);
+      depth_file_save_frame (name, &header, reduced_buffer, &error);
       if (error != NULL)
         {
           g_debug ("ERROR: %s", error->message);
+          g_error_free (error);
         }
       else
         {
           g_print ("Created file: %s\n", name);
         }
+      g_free (name);
+
+      if (write_cloud)
+        save_shot_cloud (&header, reduced_buffer);
+
+      if (video != NULL)
+        save_shot_video (&header, video);
+
+      if (register_video)
+        {
+          g_mutex_lock (&color_shot_mutex);
+          color_shot_timestamp = header.timestamp;
+          g_mutex_unlock (&color_shot_mutex);
+        }
+    }
+
+  g_mutex_lock (&recorder_mutex);
+  if (recorder != NULL)
+    {
+      if (reduced_buffer == NULL)
+        reduced_buffer = reduce_depth_job (job, &header);
+      depth_recorder_push (recorder, &header, reduced_buffer);
+      if (video_recorder != NULL && video != NULL)
+        record_video_frame (&header, video);
+      saving = TRUE;
+    }
+  g_mutex_unlock (&recorder_mutex);
+
+  if (history != NULL)
+    {
+      if (reduced_buffer == NULL)
+        reduced_buffer = reduce_depth_job (job, &header);
+      depth_history_push (history, &header, reduced_buffer, job->start_time);
+      save_triggered_history (job->start_time);
+      saving = TRUE;
+    }
+
+  if (video != NULL)
+    frame_ring_pop (video_ring, 1);
 
-      record_shot = FALSE;
+  time = g_get_monotonic_time ();
+  if (saving)
+    {
+      frame_stats_add (frame_stats, FRAME_STAGE_SAVE, time - stage_time);
+      frame_pool_release (frame_pool, reduced_buffer);
     }
+}
+
+static void
+free_depth_job (DepthJob *job)
+{
+  frame_pool_release (frame_pool, job->depth);
+  g_slice_free (DepthJob, job);
+}
 
-  if (! clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (depth_tex),
-                                           grayscale_buffer,
+static gpointer
+processing_thread_func (gpointer data)
+{
+  while (TRUE)
+    {
+      DepthJob *job;
+      gboolean stopping;
+
+      g_mutex_lock (&processing_mutex);
+      while (! processing_stopping &&
+             g_atomic_pointer_get (&depth_mailbox) == NULL)
+        g_cond_wait (&processing_cond, &processing_mutex);
+      stopping = processing_stopping;
+      g_mutex_unlock (&processing_mutex);
+
+      if (stopping)
+        break;
+
+      job = mailbox_swap (&depth_mailbox, NULL);
+      if (job == NULL)
+        continue;
+
+      process_depth_job (job);
+      free_depth_job (job);
+    }
+
+  return NULL;
+}
+
+static void
+start_processing (void)
+{
+  video_ring = frame_ring_new (FRAME_RING_LENGTH, 0);
+  processing_stopping = FALSE;
+  processing_thread = g_thread_new ("depth-processing",
+                                    processing_thread_func, NULL);
+}
+
+static void
+stop_processing (void)
+{
+  gpointer job, result;
+
+  if (processing_thread == NULL)
+    return;
+
+  g_mutex_lock (&processing_mutex);
+  processing_stopping = TRUE;
+  g_cond_signal (&processing_cond);
+  g_mutex_unlock (&processing_mutex);
+
+  g_thread_join (processing_thread);
+  processing_thread = NULL;
+
+  job = mailbox_swap (&depth_mailbox, NULL);
+  if (job != NULL)
+    free_depth_job (job);
+  frame_ring_free (video_ring);
+  video_ring = NULL;
+
+  result = mailbox_swap (&result_mailbox, NULL);
+  if (result != NULL)
+    free_depth_result (result);
+
+  if (view_colormap != NULL)
+    {
+      depth_colormap_unref (view_colormap);
+      view_colormap = NULL;
+    }
+
+  if (depth_filter != NULL)
+    {
+      depth_filter_free (depth_filter);
+      depth_filter = NULL;
+    }
+
+  if (depth_tiles != NULL)
+    {
+      depth_tiles_free (depth_tiles);
+      depth_tiles = NULL;
+    }
+  g_free (pending_tiles);
+  pending_tiles = NULL;
+  g_free (view_image);
+  view_image = NULL;
+  results_published = 0;
+  results_discarded = 0;
+  job_x = 0;
+  job_y = 0;
+  g_atomic_int_set (&results_taken, 0);
+}
+
+/* Gets the region of interest within frames of width x height, the
+   whole frame if there is none or it is off the frame. Its origin is
+   moved down to a multiple of the reduction, so the reduced samples
+   of the region are those of the whole frame */
+static void
+get_roi (guint  width,
+         guint  height,
+         guint *x,
+         guint *y,
+         guint *crop_width,
+         guint *crop_height)
+{
+  *x = 0;
+  *y = 0;
+  *crop_width = width;
+  *crop_height = height;
+
+  if (roi_width == 0 || roi_height == 0 ||
+      roi_x >= width || roi_y >= height)
+    return;
+
+  *x = roi_x - roi_x % dimension_factor;
+  *y = roi_y - roi_y % dimension_factor;
+  *crop_width = MIN (roi_x + roi_width, width) - *x;
+  *crop_height = MIN (roi_y + roi_height, height) - *y;
+}
+
+/* Hands a depth frame, whether it comes from a Kinect or from a
+   virtual device, to the processing thread. start_time is when the
+   frame arrived, in monotonic time */
+static void
+submit_depth_frame (const guint16 *depth,
+                    guint          width,
+                    guint          height,
+                    gint64         start_time)
+{
+  DepthJob *job, *stale;
+  guint x, y, crop_width, crop_height;
+
+  if (processing_thread == NULL)
+    return;
+
+  if (register_video)
+    {
+      if (width != latest_depth_width || height != latest_depth_height)
+        {
+          g_free (latest_depth);
+          latest_depth = g_new (guint16, (gsize) width * height);
+          latest_depth_width = width;
+          latest_depth_height = height;
+        }
+      memcpy (latest_depth, depth, (gsize) width * height * sizeof (guint16));
+    }
+
+  get_roi (width, height, &x, &y, &crop_width, &crop_height);
+  job = g_slice_new (DepthJob);
+  job->depth = frame_pool_acquire (frame_pool, crop_width, crop_height,
+                                   sizeof (guint16));
+  depth_processing_crop (depth, width, x, y, crop_width, crop_height,
+                         job->depth);
+  if (auto_threshold != AUTO_THRESHOLD_OFF)
+    THRESHOLD_END = g_atomic_int_get (&auto_threshold_end);
+
+  job->x = x;
+  job->y = y;
+  job->width = crop_width;
+  job->height = crop_height;
+  job->start_time = start_time;
+  job->auto_threshold = auto_threshold;
+  job->threshold_begin = THRESHOLD_BEGIN;
+  job->threshold_end = THRESHOLD_END;
+  job->view = depth_view;
+
+  stale = mailbox_swap (&depth_mailbox, job);
+  if (stale != NULL)
+    {
+      frame_stats_add_stale (frame_stats);
+      free_depth_job (stale);
+    }
+
+  g_mutex_lock (&processing_mutex);
+  g_cond_signal (&processing_cond);
+  g_mutex_unlock (&processing_mutex);
+}
+
+/* Cuts the thresholded last depth frame out of a video frame, and
+   saves it if a shot asked for it */
+static void
+register_video_frame (const guchar *buffer,
+                      guint         width,
+                      guint         height,
+                      guint         bytes_per_pixel)
+{
+  GError *error = NULL;
+  gint64 start_time, timestamp;
+
+  start_time = g_get_monotonic_time ();
+
+  if (registration != NULL &&
+      ! depth_registration_has_size (registration,
+                                     latest_depth_width, latest_depth_height,
+                                     width, height))
+    {
+      depth_registration_free (registration);
+      registration = NULL;
+    }
+
+  if (registration == NULL)
+    {
+      registration = depth_registration_new (latest_depth_width,
+                                             latest_depth_height,
+                                             width, height, &calibration);
+      g_free (cutout);
+      cutout = g_malloc ((gsize) latest_depth_width * latest_depth_height * 4);
+    }
+
+  depth_registration_cutout (registration, latest_depth,
+                             THRESHOLD_BEGIN, THRESHOLD_END,
+                             buffer, bytes_per_pixel, cutout);
+
+  if (! depth_texture_upload (CLUTTER_TEXTURE (cutout_tex), cutout,
+                              latest_depth_width, latest_depth_height, 4,
+                              &error))
+    {
+      g_debug ("Error setting texture area: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  frame_stats_add (frame_stats, FRAME_STAGE_REGISTER,
+                   g_get_monotonic_time () - start_time);
+
+  g_mutex_lock (&color_shot_mutex);
+  timestamp = color_shot_timestamp;
+  color_shot_timestamp = 0;
+  g_mutex_unlock (&color_shot_mutex);
+
+  if (timestamp != 0)
+    {
+      gchar *name = g_strdup_printf ("./depth-color-%" G_GINT64_FORMAT ".pam",
+                                     timestamp);
+
+      if (depth_image_write_pnm (name, cutout, latest_depth_width,
+                                 latest_depth_height, 4, &error))
+        {
+          g_print ("Created file: %s\n", name);
+        }
+      else
+        {
+          g_debug ("ERROR: %s", error->message);
+          g_error_free (error);
+        }
+      g_free (name);
+    }
+}
+
+/* Hands a video frame to the processing thread to be matched with a
+   depth frame. start_time is when the frame arrived, in monotonic
+   time */
+static void
+submit_video_frame (const guchar *buffer,
+                    guint         width,
+                    guint         height,
+                    guint         bytes_per_pixel,
+                    gint64        start_time)
+{
+  FrameRingSlot *slot;
+
+  if (processing_thread == NULL)
+    return;
+
+  slot = frame_ring_reserve (video_ring, width, height, bytes_per_pixel,
+                             start_time);
+  if (slot == NULL)
+    {
+      frame_stats_add_unmatched (frame_stats, 0, 1);
+      return;
+    }
+
+  memcpy (slot->data, buffer, (gsize) width * height * bytes_per_pixel);
+  frame_ring_commit (video_ring);
+
+  /* The processing thread may be waiting for it */
+  g_mutex_lock (&processing_mutex);
+  g_cond_signal (&processing_cond);
+  g_mutex_unlock (&processing_mutex);
+}
+
+static void
+process_video_frame (const guchar *buffer,
+                     guint         width,
+                     guint         height,
+                     guint         bytes_per_pixel)
+{
+  GError *error = NULL;
+
+  submit_video_frame (buffer, width, height, bytes_per_pixel,
+                      g_get_monotonic_time ());
+
+  if (! clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (video_tex),
+                                           buffer,
                                            FALSE,
                                            width, height,
                                            0,
-                                           3,
+                                           bytes_per_pixel,
                                            CLUTTER_TEXTURE_NONE,
                                            &error))
     {
       g_debug ("Error setting texture area: %s", error->message);
       g_error_free (error);
     }
-  g_slice_free1 (width * height * sizeof (guchar) * 3, grayscale_buffer);
+
+  if (register_video && latest_depth != NULL)
+    register_video_frame (buffer, width, height, bytes_per_pixel);
+}
+
+static void
+on_depth_frame (GFreenectDevice *kinect, gpointer user_data)
+{
+  guint16 *depth;
+  gsize len;
+  GFreenectFrameMode frame_mode;
+  gint64 start_time;
+
+  start_time = g_get_monotonic_time ();
+  frame_stats_add_frame (frame_stats, start_time);
+
+  depth = (guint16 *) gfreenect_device_get_depth_frame_raw (kinect,
+                                                            &len,
+                                                            &frame_mode);
+
+  submit_depth_frame (depth, frame_mode.width, frame_mode.height,
+                      start_time);
+
+  frame_stats_add (frame_stats, FRAME_STAGE_FETCH,
+                   g_get_monotonic_time () - start_time);
+}
+
+static void
+on_video_frame (GFreenectDevice *kinect, gpointer user_data)
+{
+  guchar *buffer;
+  GFreenectFrameMode frame_mode;
+
+  buffer = gfreenect_device_get_video_frame_rgb (kinect, NULL, &frame_mode);
+
+  process_video_frame (buffer, frame_mode.width, frame_mode.height,
+                       frame_mode.bits_per_pixel / 8);
+}
+
+static void
+on_virtual_depth_frame (VirtualDevice *device,
+                        const guint16 *depth,
+                        guint          width,
+                        guint          height,
+                        gpointer       user_data)
+{
+  gint64 start_time = g_get_monotonic_time ();
+
+  frame_stats_add_frame (frame_stats, start_time);
+  submit_depth_frame (depth, width, height, start_time);
+
+  n_frames++;
+  if (max_frames > 0 && n_frames >= max_frames)
+    {
+      virtual_device_stop (device);
+      clutter_main_quit ();
+    }
+}
+
+static void
+on_virtual_video_frame (VirtualDevice *device,
+                        const guchar  *rgb,
+                        guint          width,
+                        guint          height,
+                        gpointer       user_data)
+{
+  process_video_frame (rgb, width, height, 3);
+}
+
+static void
+set_info_text (gint seconds)
+{
+  gchar *title, *threshold, *stats;
+  gchar *record_status = NULL;
+  gchar *recording_status = NULL;
+  gchar *history_status = NULL;
+  gchar *roi = NULL;
+
+  info_seconds = seconds;
+  if (roi_width > 0 && roi_height > 0)
+    roi = g_strdup_printf (" <b>Region:</b> %ux%u at %u,%u",
+                           roi_width, roi_height, roi_x, roi_y);
+  threshold = g_strdup_printf ("<b>Threshold:</b> %d%s%s <b>View:</b> %s%s",
+                               THRESHOLD_END,
+                               auto_threshold != AUTO_THRESHOLD_OFF ?
+                               " auto " : "",
+                               auto_threshold != AUTO_THRESHOLD_OFF ?
+                               depth_histogram_method_get_name (
+                                 auto_threshold) : "",
+                               depth_view == VIEW_MASK ? "mask" :
+                               depth_colormap_palette_get_name (depth_view),
+                               roi != NULL ? roi : "");
+  if (seconds == 0)
+    {
+      record_status = g_strdup (" <b>SAVING DEPTH FILE!</b>");
+    }
+  else if (seconds > 0)
+    {
+      record_status = g_strdup_printf (" <b>Taking shot in:</b> %d seconds",
+                                       seconds);
+    }
+
+  if (recorder != NULL)
+    {
+      DepthRecorderStats stats;
+      depth_recorder_get_stats (recorder, &stats);
+      recording_status = g_strdup_printf ("\n<b>Recording:</b> %"
+                                          G_GUINT64_FORMAT " frames, %"
+                                          G_GUINT64_FORMAT " dropped",
+                                          stats.frames_written,
+                                          stats.frames_dropped);
+    }
+
+  if (history != NULL)
+    {
+      DepthHistoryStats stats;
+      gboolean triggered;
+
+      depth_history_get_stats (history, &stats);
+      g_mutex_lock (&trigger_mutex);
+      triggered = trigger_time != 0;
+      g_mutex_unlock (&trigger_mutex);
+
+      history_status = g_strdup_printf ("\n<b>Pre-trigger:</b> %.1f s kept, %"
+                                        G_GUINT64_FORMAT " dropped%s",
+                                        stats.duration /
+                                        (gdouble) G_USEC_PER_SEC,
+                                        stats.frames_dropped,
+                                        triggered || stats.saving ?
+                                        " <b>SAVING TRIGGER!</b>" : "");
+    }
+
+  stats = frame_stats_to_markup (frame_stats);
+
+  title = g_strconcat (threshold,
+                       record_status != NULL ? record_status : "",
+                       recording_status != NULL ? recording_status : "",
+                       history_status != NULL ? history_status : "",
+                       "\n",
+                       stats,
+                       NULL);
+  clutter_text_set_markup (CLUTTER_TEXT (info_text), title);
+  g_free (title);
+  g_free (threshold);
+  g_free (record_status);
+  g_free (recording_status);
+  g_free (history_status);
+  g_free (roi);
+  g_free (stats);
+}
+
+static gboolean
+update_status (gpointer data)
+{
+  set_info_text (info_seconds);
+  return TRUE;
+}
+
+static void
+close_recorder (DepthRecorder *closing)
+{
+  GError *error = NULL;
+  DepthRecorderStats stats;
+  gchar *name;
+
+  depth_recorder_get_stats (closing, &stats);
+  name = g_strdup (depth_recorder_get_path (closing));
+  if (! depth_recorder_close (closing, &error))
+    {
+      g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_print ("Created file: %s (%" G_GUINT64_FORMAT " frames, %"
+               G_GUINT64_FORMAT " dropped)\n",
+               name, stats.frames_written, stats.frames_dropped);
+    }
+  g_free (name);
 }
 
 static void
-on_video_frame (GFreenectDevice *kinect, gpointer user_data)
+stop_recording (void)
 {
-  guchar *buffer;
-  GError *error = NULL;
-  GFreenectFrameMode frame_mode;
+  DepthRecorder *closing, *closing_video;
 
-  buffer = gfreenect_device_get_video_frame_rgb (kinect, NULL, &frame_mode);
+  if (recorder == NULL)
+    return;
 
-  if (! clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (video_tex),
-                                           buffer,
-                                           FALSE,
-                                           frame_mode.width, frame_mode.height,
-                                           0,
-                                           frame_mode.bits_per_pixel / 8,
-                                           CLUTTER_TEXTURE_NONE,
-                                           &error))
-    {
-      g_debug ("Error setting texture area: %s", error->message);
-      g_error_free (error);
-    }
+  g_mutex_lock (&recorder_mutex);
+  closing = recorder;
+  closing_video = video_recorder;
+  recorder = NULL;
+  video_recorder = NULL;
+  g_mutex_unlock (&recorder_mutex);
+
+  close_recorder (closing);
+  if (closing_video != NULL)
+    close_recorder (closing_video);
 }
 
 static void
-set_info_text (gint seconds)
+toggle_recording (void)
 {
-  gchar *title, *threshold;
-  gchar *record_status = NULL;
-  threshold = g_strdup_printf ("<b>Threshold:</b> %d",
-                               THRESHOLD_END);
-  if (seconds == 0)
+  GError *error = NULL;
+  DepthRecorder *opened, *opened_video = NULL;
+  gchar *name, *video_name;
+
+  if (recorder != NULL)
     {
-      record_status = g_strdup (" <b>SAVING DEPTH FILE!</b>");
+      stop_recording ();
+      return;
     }
-  else if (seconds > 0)
+
+  name = g_strdup_printf ("./depth-recording-%" G_GINT64_FORMAT,
+                          g_get_real_time ());
+  opened = depth_recorder_new (name,
+                               record_uncompressed ?
+                               DEPTH_FRAME_FORMAT_RAW_16 :
+                               DEPTH_FRAME_FORMAT_DELTA_RLE,
+                               RECORDER_QUEUE_LENGTH,
+                               &error);
+  if (opened == NULL)
     {
-      record_status = g_strdup_printf (" <b>Taking shot in:</b> %d seconds",
-                                       seconds);
+      g_debug ("ERROR: %s", error->message);
+      g_error_free (error);
+      g_free (name);
+      return;
     }
 
-  title = g_strconcat (threshold, record_status, NULL);
-  clutter_text_set_markup (CLUTTER_TEXT (info_text), title);
-  g_free (title);
-  g_free (threshold);
-  g_free (record_status);
+  if (record_video)
+    {
+      video_name = g_strconcat (name, ".video", NULL);
+      opened_video = depth_recorder_new (video_name, DEPTH_FRAME_FORMAT_RGB_24,
+                                         RECORDER_QUEUE_LENGTH, &error);
+      if (opened_video == NULL)
+        {
+          g_debug ("ERROR: %s", error->message);
+          g_clear_error (&error);
+        }
+      g_free (video_name);
+    }
+
+  g_mutex_lock (&recorder_mutex);
+  recorder = opened;
+  video_recorder = opened_video;
+  g_mutex_unlock (&recorder_mutex);
+  g_free (name);
+}
+
+/* Asks for the frames around now to be saved. A trigger still waiting
+   for its last frames keeps its time */
+static void
+trigger_history (void)
+{
+  if (history == NULL)
+    return;
+
+  g_mutex_lock (&trigger_mutex);
+  if (trigger_time == 0)
+    trigger_time = g_get_monotonic_time ();
+  g_mutex_unlock (&trigger_mutex);
 }
 
+/* Setting the threshold by hand stops setting it automatically */
 static void
 set_threshold (gint difference)
 {
   gint new_threshold = THRESHOLD_END + difference;
-  if (new_threshold >= THRESHOLD_BEGIN + 300 &&
-      new_threshold <= 4000)
+
+  auto_threshold = AUTO_THRESHOLD_OFF;
+  if (new_threshold >= THRESHOLD_BEGIN + MIN_THRESHOLD_BAND &&
+      new_threshold <= MAX_THRESHOLD)
     THRESHOLD_END = new_threshold;
 }
 
+/* Cycles through setting the threshold by hand and every automatic
+   method */
+static void
+next_auto_threshold (void)
+{
+  auto_threshold = auto_threshold + 1 < DEPTH_HISTOGRAM_LAST ?
+    auto_threshold + 1 : AUTO_THRESHOLD_OFF;
+  g_atomic_int_set (&auto_threshold_end, THRESHOLD_END);
+}
+
 static void
 set_tilt_angle (GFreenectDevice *kinect, gdouble difference)
 {
@@ -326,7 +1616,7 @@ decrease_time_to_take_shot (gpointer data)
     }
   else if (seconds_to_shoot == 0)
     {
-      record_shot = TRUE;
+      g_atomic_int_set (&record_shot, TRUE);
     }
   seconds_to_shoot--;
   return call_again;
@@ -350,14 +1640,11 @@ on_key_release (ClutterActor *actor,
                 ClutterEvent *event,
                 gpointer data)
 {
-  GFreenectDevice *kinect;
   gint seconds = -1;
   gdouble angle;
   guint key;
   g_return_val_if_fail (event != NULL, FALSE);
 
-  kinect = GFREENECT_DEVICE (data);
-
   key = clutter_event_get_key_symbol (event);
   switch (key)
     {
@@ -372,74 +1659,308 @@ on_key_release (ClutterActor *actor,
       set_threshold (-100);
       break;
     case CLUTTER_KEY_Up:
-      set_tilt_angle (kinect, 5);
+      if (kinect != NULL)
+        set_tilt_angle (kinect, 5);
       break;
     case CLUTTER_KEY_Down:
-      set_tilt_angle (kinect, -5);
+      if (kinect != NULL)
+        set_tilt_angle (kinect, -5);
+      break;
+    case CLUTTER_KEY_r:
+      toggle_recording ();
+      break;
+    case CLUTTER_KEY_t:
+      trigger_history ();
+      break;
+    case CLUTTER_KEY_g:
+      if (register_video)
+        {
+          if (CLUTTER_ACTOR_IS_VISIBLE (cutout_tex))
+            clutter_actor_hide (cutout_tex);
+          else
+            clutter_actor_show (cutout_tex);
+        }
+      break;
+    case CLUTTER_KEY_a:
+      next_auto_threshold ();
+      break;
+    case CLUTTER_KEY_c:
+      /* Cycles through the mask and every palette */
+      depth_view = depth_view + 1 < DEPTH_COLORMAP_LAST ?
+        depth_view + 1 : VIEW_MASK;
       break;
     }
   set_info_text (seconds);
   return TRUE;
 }
 
+/* Parses a region of interest given as X,Y,WIDTH,HEIGHT */
+static gboolean
+parse_roi (const gchar *str)
+{
+  gchar **fields;
+  guint64 values[4];
+  gboolean valid;
+  guint i;
+
+  fields = g_strsplit (str, ",", 4);
+  valid = g_strv_length (fields) == 4;
+  for (i = 0; valid && i < 4; i++)
+    {
+      gchar *end = NULL;
+
+      values[i] = g_ascii_strtoull (fields[i], &end, 10);
+      valid = g_ascii_isdigit (*fields[i]) && *end == '\0' &&
+        values[i] <= G_MAXUINT16;
+    }
+  g_strfreev (fields);
+
+  if (! valid || values[2] == 0 || values[3] == 0)
+    return FALSE;
+
+  roi_x = values[0];
+  roi_y = values[1];
+  roi_width = values[2];
+  roi_height = values[3];
+
+  return TRUE;
+}
+
+/* Outlines a rectangle of the depth view, or hides the outline if it
+   is empty */
+static void
+show_roi_outline (gfloat x, gfloat y, gfloat width, gfloat height)
+{
+  if (width <= 0 || height <= 0)
+    {
+      clutter_actor_hide (roi_outline);
+      return;
+    }
+
+  clutter_actor_set_position (roi_outline, x, y);
+  clutter_actor_set_size (roi_outline, width, height);
+  clutter_actor_show (roi_outline);
+}
+
+/* Gets the rectangle dragged from where the drag started to where
+   event happened, within the depth view */
+static void
+get_dragged_rect (ClutterActor *actor,
+                  ClutterEvent *event,
+                  gfloat       *x,
+                  gfloat       *y,
+                  gfloat       *width,
+                  gfloat       *height)
+{
+  gfloat event_x, event_y, actor_width, actor_height;
+
+  clutter_event_get_coords (event, &event_x, &event_y);
+  clutter_actor_transform_stage_point (actor, event_x, event_y,
+                                       &event_x, &event_y);
+  clutter_actor_get_size (actor, &actor_width, &actor_height);
+  event_x = CLAMP (event_x, 0, actor_width);
+  event_y = CLAMP (event_y, 0, actor_height);
+
+  *x = MIN (event_x, roi_drag_x);
+  *y = MIN (event_y, roi_drag_y);
+  *width = ABS (event_x - roi_drag_x);
+  *height = ABS (event_y - roi_drag_y);
+}
+
+static gboolean
+on_roi_button_press (ClutterActor *actor,
+                     ClutterEvent *event,
+                     gpointer      data)
+{
+  gfloat x, y;
+
+  if (clutter_event_get_button (event) != 1)
+    return FALSE;
+
+  clutter_event_get_coords (event, &x, &y);
+  clutter_actor_transform_stage_point (actor, x, y, &roi_drag_x, &roi_drag_y);
+  roi_dragging = TRUE;
+  clutter_grab_pointer (actor);
+
+  return TRUE;
+}
+
+static gboolean
+on_roi_motion (ClutterActor *actor,
+               ClutterEvent *event,
+               gpointer      data)
+{
+  gfloat x, y, width, height;
+
+  if (! roi_dragging)
+    return FALSE;
+
+  get_dragged_rect (actor, event, &x, &y, &width, &height);
+  show_roi_outline (x, y, width, height);
+
+  return TRUE;
+}
+
+/* Frames are only cropped to the dragged region once the drag ends,
+   a click or a short drag goes back to the whole frame */
+static gboolean
+on_roi_button_release (ClutterActor *actor,
+                       ClutterEvent *event,
+                       gpointer      data)
+{
+  gfloat x, y, width, height;
+
+  if (! roi_dragging || clutter_event_get_button (event) != 1)
+    return FALSE;
+
+  roi_dragging = FALSE;
+  clutter_ungrab_pointer ();
+
+  get_dragged_rect (actor, event, &x, &y, &width, &height);
+  if (width < ROI_MIN_SIZE || height < ROI_MIN_SIZE)
+    {
+      roi_x = roi_y = roi_width = roi_height = 0;
+    }
+  else
+    {
+      roi_x = x;
+      roi_y = y;
+      roi_width = width;
+      roi_height = height;
+    }
+  show_roi_outline (roi_x, roi_y, roi_width, roi_height);
+  set_info_text (info_seconds);
+
+  return TRUE;
+}
+
 static ClutterActor *
 create_instructions (void)
 {
   ClutterActor *text;
+  GString *markup;
 
-  text = clutter_text_new ();
-  clutter_text_set_markup (CLUTTER_TEXT (text),
-                         "<b>Instructions:</b>\n"
+  markup = g_string_new ("<b>Instructions:</b>\n"
                          "\tTake shot and save:  \tSpace bar\n"
+                         "\tStart/stop recording:  \tR\n"
                          "\tSet tilt angle:  \t\t\t\tUp/Down Arrows\n"
-                         "\tIncrease threshold:  \t\t\t+/-");
+                         "\tIncrease threshold:  \t\t\t+/-\n"
+                         "\tAutomatic threshold:  \t\tA\n"
+                         "\tChange view:  \t\t\t\tC\n"
+                         "\tSet/clear region:  \t\tDrag/click on depth");
+  if (register_video)
+    g_string_append (markup, "\n\tShow/hide cutout:  \t\tG");
+  if (history != NULL)
+    g_string_append (markup, "\n\tSave last seconds:  \t\tT");
+
+  text = clutter_text_new ();
+  clutter_text_set_markup (CLUTTER_TEXT (text), markup->str);
+  g_string_free (markup, TRUE);
+
   return text;
 }
 
+static void
+shut_down (void)
+{
+  static gboolean shut = FALSE;
+
+  if (shut)
+    return;
+  shut = TRUE;
+
+  if (kinect != NULL)
+    {
+      gfreenect_device_stop_depth_stream (kinect, NULL);
+      gfreenect_device_stop_video_stream (kinect, NULL);
+    }
+
+  if (virtual_device != NULL)
+    virtual_device_stop (virtual_device);
+
+  stop_processing ();
+  stop_recording ();
+
+  if (history != NULL)
+    {
+      depth_history_free (history);
+      history = NULL;
+    }
+
+  if (registration != NULL)
+    {
+      depth_registration_free (registration);
+      registration = NULL;
+    }
+  g_free (cutout);
+  cutout = NULL;
+  g_free (latest_depth);
+  latest_depth = NULL;
+
+  if (frame_pool != NULL)
+    {
+      frame_pool_dump (frame_pool);
+      frame_pool_free (frame_pool);
+      frame_pool = NULL;
+    }
+}
+
 static void
 on_destroy (ClutterActor *actor, gpointer data)
 {
-  GFreenectDevice *device = GFREENECT_DEVICE (data);
-  gfreenect_device_stop_depth_stream (device, NULL);
-  gfreenect_device_stop_video_stream (device, NULL);
+  shut_down ();
   clutter_main_quit ();
 }
 
 static void
-on_new_kinect_device (GObject      *obj,
-                      GAsyncResult *res,
-                      gpointer      user_data)
+create_stage (void)
 {
   ClutterActor *stage, *instructions;
-  GError *error = NULL;
+  ClutterColor transparent = { 0, 0, 0, 0 };
+  ClutterColor roi_color = { 255, 0, 0, 255 };
   gint width = 640;
   gint height = 480;
 
-  kinect = gfreenect_device_new_finish (res, &error);
-  if (kinect == NULL)
-    {
-      g_debug ("Failed to created kinect device: %s", error->message);
-      g_error_free (error);
-      clutter_main_quit ();
-      return;
-    }
-
-  g_debug ("Kinect device created!");
+  frame_pool = frame_pool_new ();
+  start_processing ();
 
   stage = clutter_stage_get_default ();
   clutter_stage_set_title (CLUTTER_STAGE (stage), "Kinect Test");
-  clutter_actor_set_size (stage, width * 2, height + 200);
+  clutter_actor_set_size (stage, width * 2,
+                          height + (register_video ? 280 : 260));
   clutter_stage_set_user_resizable (CLUTTER_STAGE (stage), TRUE);
 
-  g_signal_connect (stage, "destroy", G_CALLBACK (on_destroy), kinect);
+  g_signal_connect (stage, "destroy", G_CALLBACK (on_destroy), NULL);
   g_signal_connect (stage,
                     "key-release-event",
                     G_CALLBACK (on_key_release),
-                    kinect);
+                    NULL);
 
-  depth_tex = clutter_cairo_texture_new (width, height);
+  depth_tex = clutter_texture_new ();
   clutter_container_add_actor (CLUTTER_CONTAINER (stage), depth_tex);
 
+  /* Over the mask, so the foreground shows in color */
+  cutout_tex = clutter_texture_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), cutout_tex);
+
+  /* Over the depth view, the region of interest is dragged on it */
+  roi_area = clutter_rectangle_new_with_color (&transparent);
+  clutter_actor_set_size (roi_area, width, height);
+  clutter_actor_set_reactive (roi_area, TRUE);
+  g_signal_connect (roi_area, "button-press-event",
+                    G_CALLBACK (on_roi_button_press), NULL);
+  g_signal_connect (roi_area, "motion-event",
+                    G_CALLBACK (on_roi_motion), NULL);
+  g_signal_connect (roi_area, "button-release-event",
+                    G_CALLBACK (on_roi_button_release), NULL);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), roi_area);
+
+  roi_outline = clutter_rectangle_new_with_color (&transparent);
+  clutter_rectangle_set_border_color (CLUTTER_RECTANGLE (roi_outline),
+                                      &roi_color);
+  clutter_rectangle_set_border_width (CLUTTER_RECTANGLE (roi_outline), 2);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), roi_outline);
+
   video_tex = clutter_cairo_texture_new (width, height);
   clutter_actor_set_position (video_tex, width, 0.0);
   clutter_container_add_actor (CLUTTER_CONTAINER (stage), video_tex);
@@ -449,11 +1970,45 @@ on_new_kinect_device (GObject      *obj,
   clutter_actor_set_position (info_text, 50, height + 20);
   clutter_container_add_actor (CLUTTER_CONTAINER (stage), info_text);
 
+  /* Next to the info, under the video */
+  histogram_tex = clutter_texture_new ();
+  clutter_actor_set_position (histogram_tex, width + 50, height + 20);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), histogram_tex);
+
   instructions = create_instructions ();
   clutter_actor_set_position (instructions, 50, height + 70);
   clutter_container_add_actor (CLUTTER_CONTAINER (stage), instructions);
 
   clutter_actor_show_all (stage);
+  if (! register_video)
+    clutter_actor_hide (cutout_tex);
+  show_roi_outline (roi_x, roi_y, roi_width, roi_height);
+
+  status_update_id = g_timeout_add_seconds (1, update_status, NULL);
+
+  if (record_at_start)
+    toggle_recording ();
+}
+
+static void
+on_new_kinect_device (GObject      *obj,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  GError *error = NULL;
+
+  kinect = gfreenect_device_new_finish (res, &error);
+  if (kinect == NULL)
+    {
+      g_debug ("Failed to created kinect device: %s", error->message);
+      g_error_free (error);
+      clutter_main_quit ();
+      return;
+    }
+
+  g_debug ("Kinect device created!");
+
+  create_stage ();
 
   g_signal_connect (kinect,
                     "depth-frame",
@@ -487,21 +2042,216 @@ quit (gint signale)
 int
 main (int argc, char *argv[])
 {
-  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
-    return -1;
+  GError *error = NULL;
+
+  if (clutter_init_with_args (&argc, &argv,
+                              "- record depth files from a Kinect",
+                              entries, NULL, &error) != CLUTTER_INIT_SUCCESS)
+    {
+      if (error != NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+        }
+      return -1;
+    }
+
+  if (dimension_factor != 1 && dimension_factor != 2 && dimension_factor != 4)
+    {
+      g_printerr ("Invalid reduction %d, it must be 1, 2 or 4\n",
+                  dimension_factor);
+      return -1;
+    }
+
+  if (palette_name != NULL)
+    {
+      DepthColormapPalette palette;
+
+      if (! depth_colormap_palette_from_string (palette_name, &palette))
+        {
+          g_printerr ("Unknown palette \"%s\"\n", palette_name);
+          return -1;
+        }
+      depth_view = palette;
+    }
 
-  gfreenect_device_new (0,
-                        GFREENECT_SUBDEVICE_CAMERA,
-                        NULL,
-                        on_new_kinect_device,
-                        NULL);
+  if (cloud_format_str != NULL)
+    {
+      if (! point_cloud_format_from_string (cloud_format_str, &cloud_format))
+        {
+          g_printerr ("Unknown point cloud format \"%s\", it must be ply or "
+                      "f32\n", cloud_format_str);
+          return -1;
+        }
+      write_cloud = TRUE;
+    }
+
+  point_cloud_intrinsics_init_default (&intrinsics);
+  if (intrinsics_str != NULL &&
+      ! point_cloud_intrinsics_parse (intrinsics_str, &intrinsics))
+    {
+      g_printerr ("Invalid intrinsics \"%s\", expected FX,FY,CX,CY\n",
+                  intrinsics_str);
+      return -1;
+    }
+
+  depth_registration_calibration_init_default (&calibration);
+  calibration.depth = intrinsics;
+  if (video_intrinsics_str != NULL &&
+      ! point_cloud_intrinsics_parse (video_intrinsics_str,
+                                      &calibration.video))
+    {
+      g_printerr ("Invalid video intrinsics \"%s\", expected FX,FY,CX,CY\n",
+                  video_intrinsics_str);
+      return -1;
+    }
+  if (baseline_str != NULL)
+    {
+      gchar *end = NULL;
+
+      calibration.baseline = g_ascii_strtod (baseline_str, &end);
+      if (*baseline_str == '\0' || *end != '\0')
+        {
+          g_printerr ("Invalid baseline \"%s\"\n", baseline_str);
+          return -1;
+        }
+    }
+
+  if (auto_threshold_str != NULL)
+    {
+      DepthHistogramMethod method;
+
+      if (! depth_histogram_method_from_string (auto_threshold_str, &method))
+        {
+          g_printerr ("Unknown automatic threshold \"%s\", it must be otsu "
+                      "or peak\n", auto_threshold_str);
+          return -1;
+        }
+      auto_threshold = method;
+      auto_threshold_end = THRESHOLD_END;
+    }
+
+  if (roi_str != NULL && ! parse_roi (roi_str))
+    {
+      g_printerr ("Invalid region \"%s\", expected X,Y,WIDTH,HEIGHT\n",
+                  roi_str);
+      return -1;
+    }
+
+  if (change_tolerance < 0)
+    {
+      g_printerr ("Invalid change tolerance %d, it must be 0 or more\n",
+                  change_tolerance);
+      return -1;
+    }
+
+  if (sync_tolerance < 0)
+    {
+      g_printerr ("Invalid sync tolerance %d, it must be 0 or more\n",
+                  sync_tolerance);
+      return -1;
+    }
+
+  if (denoise_strength < 0 || denoise_strength > DEPTH_FILTER_MAX_STRENGTH)
+    {
+      g_printerr ("Invalid denoise strength %d, it must be 0 to %d\n",
+                  denoise_strength, DEPTH_FILTER_MAX_STRENGTH);
+      return -1;
+    }
+
+  if (pre_trigger < 0. || post_trigger < 0.)
+    {
+      g_printerr ("Invalid trigger window, it must be 0 seconds or more\n");
+      return -1;
+    }
+
+  if (pre_trigger > 0.)
+    {
+      gdouble fps = virtual_fps > 0. ? virtual_fps :
+        (gdouble) G_USEC_PER_SEC / FRAME_INTERVAL;
+
+      if (pre_trigger_memory <= 0)
+        {
+          g_printerr ("Invalid pre-trigger memory %d, it must be more than "
+                      "0\n", pre_trigger_memory);
+          return -1;
+        }
+
+      /* Everything the history will ever use is allocated now */
+      history = depth_history_new (ceil ((pre_trigger + post_trigger) * fps) +
+                                   1, (gsize) pre_trigger_memory << 20);
+      g_print ("Keeping up to %.1f s of depth before a trigger in %.1f MiB\n",
+               pre_trigger,
+               depth_history_get_memory_size (history) / (1024. * 1024.));
+    }
+
+  if (replay_path != NULL)
+    {
+      virtual_device = virtual_device_new_replay (replay_path, virtual_fps,
+                                                  &error);
+      if (virtual_device == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+          return -1;
+        }
+    }
+  else if (synthetic)
+    {
+      virtual_device = virtual_device_new_synthetic (virtual_fps);
+    }
+
+  if (virtual_device != NULL)
+    {
+      gint64 frame_interval = FRAME_INTERVAL;
+
+      /* Frames replayed at their recorded rate are not evenly spaced,
+         so drops are not counted for them */
+      if (virtual_fps > 0.)
+        frame_interval = G_USEC_PER_SEC / virtual_fps;
+      else if (replay_path != NULL)
+        frame_interval = 0;
+
+      frame_stats = frame_stats_new (frame_interval);
+      create_stage ();
+      virtual_device_start (virtual_device,
+                            on_virtual_depth_frame,
+                            on_virtual_video_frame,
+                            NULL);
+    }
+  else
+    {
+      frame_stats = frame_stats_new (FRAME_INTERVAL);
+      gfreenect_device_new (0,
+                            GFREENECT_SUBDEVICE_CAMERA,
+                            NULL,
+                            on_new_kinect_device,
+                            NULL);
+    }
 
   signal (SIGINT, quit);
 
   clutter_main ();
 
-  if (kinect != NULL)
-    g_object_unref (kinect);
+  /* Quitting after --frames or on SIGINT does not destroy the stage.
+     The streams are stopped before the device goes away */
+  shut_down ();
+
+  g_clear_object (&kinect);
+
+  if (virtual_device != NULL)
+    virtual_device_free (virtual_device);
+
+  if (status_update_id != 0)
+    g_source_remove (status_update_id);
+
+  if (stats_csv_path != NULL &&
+      ! frame_stats_write_csv (frame_stats, stats_csv_path, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
+  frame_stats_free (frame_stats);
 
   return 0;
 }
@@ -0,0 +1,178 @@
+/* GFreenect Utils : test-depth-codec.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "depth-codec.h"
+
+/* Checks that the depth codec gives back every frame exactly, and
+   that it refuses streams that are cut short, too long or made for
+   another frame size */
+
+/* Prefixes of longer streams are only tried at this many lengths */
+#define N_PREFIXES 256
+
+typedef enum
+{
+  PATTERN_ZEROS,
+  PATTERN_NOISE,
+  PATTERN_EXTREMES,
+  PATTERN_SURFACE,
+  PATTERN_THRESHOLDED,
+  PATTERN_LAST
+} Pattern;
+
+static const gchar *pattern_names[] = {
+  "zeros", "noise", "extremes", "surface", "thresholded"
+};
+
+static const guint sizes[][2] = {
+  { 640, 480 },
+  { 33, 17 },
+  { 7, 3 },
+  { 1, 300 },
+  { 300, 1 },
+  { 1, 1 }
+};
+
+static guint16 *
+make_depth (guint width, guint height, Pattern pattern)
+{
+  guint16 *depth;
+  guint i, j;
+
+  depth = g_new (guint16, (gsize) width * height);
+  for (j = 0; j < height; j++)
+    for (i = 0; i < width; i++)
+      {
+        guint16 *sample = depth + (gsize) j * width + i;
+
+        switch (pattern)
+          {
+          case PATTERN_ZEROS:
+            *sample = 0;
+            break;
+          case PATTERN_NOISE:
+            *sample = g_test_rand_int_range (0, G_MAXUINT16 + 1);
+            break;
+          case PATTERN_EXTREMES:
+            /* The largest differences there can be */
+            *sample = (i + j) % 2 == 0 ? 0 : G_MAXUINT16;
+            break;
+          case PATTERN_SURFACE:
+            *sample = 800 + i / 3 + j * 2 + g_test_rand_int_range (0, 3);
+            break;
+          case PATTERN_THRESHOLDED:
+            /* Blobs of depth among long runs of nothing */
+            *sample = (i / 16 + j / 8) % 3 == 0 ?
+              500 + g_test_rand_int_range (0, 1000) : 0;
+            break;
+          default:
+            g_assert_not_reached ();
+          }
+      }
+
+  return depth;
+}
+
+static gboolean
+decodes (const guint8 *encoded, gsize size, guint width, guint height)
+{
+  guint16 *depth;
+  gboolean result;
+
+  depth = g_new (guint16, (gsize) width * height);
+  result = depth_codec_decode (encoded, size, width, height, depth);
+  g_free (depth);
+
+  return result;
+}
+
+static void
+check_frame (guint width, guint height, Pattern pattern)
+{
+  guint16 *depth, *decoded;
+  guint8 *encoded;
+  gsize size, max_size, n_pixels = (gsize) width * height;
+  gsize prefix, step;
+
+  depth = make_depth (width, height, pattern);
+  max_size = depth_codec_get_max_encoded_size (width, height);
+  encoded = g_malloc (max_size + 1);
+  decoded = g_new (guint16, n_pixels);
+
+  size = depth_codec_encode (depth, width, height, encoded);
+  g_test_message ("%ux%u %s: %" G_GSIZE_FORMAT " bytes",
+                  width, height, pattern_names[pattern], size);
+  g_assert_cmpuint (size, >, 0);
+  g_assert_cmpuint (size, <=, max_size);
+
+  g_assert (depth_codec_decode (encoded, size, width, height, decoded));
+  g_assert (memcmp (depth, decoded, n_pixels * sizeof (guint16)) == 0);
+
+  /* Every sample has to be in the stream, so no shorter one is whole */
+  step = MAX (size / N_PREFIXES, 1);
+  for (prefix = 0; prefix < size; prefix += step)
+    g_assert (! decodes (encoded, prefix, width, height));
+  g_assert (! decodes (encoded, size - 1, width, height));
+
+  /* Nor may anything follow it */
+  encoded[size] = 0;
+  g_assert (! decodes (encoded, size + 1, width, height));
+
+  /* A stream for another size runs out early or has samples left */
+  g_assert (! decodes (encoded, size, width, height + 1));
+  if (height > 1)
+    g_assert (! decodes (encoded, size, width, height - 1));
+
+  g_free (decoded);
+  g_free (encoded);
+  g_free (depth);
+}
+
+static void
+test_round_trip (void)
+{
+  guint i;
+  Pattern pattern;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    for (pattern = 0; pattern < PATTERN_LAST; pattern++)
+      check_frame (sizes[i][0], sizes[i][1], pattern);
+}
+
+/* Varints longer than any sample or run can need */
+static void
+test_overlong_varint (void)
+{
+  static const guint8 encoded[] = { 0x82, 0x80, 0x80, 0x80, 0x80, 0x00 };
+
+  g_assert (! decodes (encoded, sizeof (encoded), 1, 1));
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/depth-codec/round-trip", test_round_trip);
+  g_test_add_func ("/depth-codec/overlong-varint", test_overlong_varint);
+
+  return g_test_run ();
+}
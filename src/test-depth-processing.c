@@ -0,0 +1,366 @@
+/* GFreenect Utils : test-depth-processing.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "depth-processing.h"
+
+/* Checks that every thresholding implementation makes the same reduced
+   buffer and mask as the scalar code record-depth-file had before them.
+   Run without GFREENECT_UTILS_SIMD, it runs itself again once for each
+   instruction set, as the choice is made only once per process */
+
+#define SIMD_ENV "GFREENECT_UTILS_SIMD"
+
+static gchar *test_path = NULL;
+
+static const guint sizes[][2] = {
+  { 640, 480 },
+  { 641, 479 },
+  { 320, 240 },
+  { 33, 7 },
+  { 17, 31 },
+  { 3, 2 },
+  { 7, 1 },
+  { 1, 9 },
+  { 1, 1 }
+};
+
+static const guint thresholds[][2] = {
+  { 500, 1500 },
+  { 0, 4000 },
+  { 0, 0 },
+  { 1, 65535 },
+  { 0, G_MAXUINT },
+  { 65535, 65535 },
+  { 1500, 500 },
+  { 70000, 80000 }
+};
+
+/* process_buffer() and create_grayscale_buffer() as they were in
+   take-shot.c, except that the gray buffer is made of single bytes
+   instead of RGB triplets, as the mask is now */
+
+typedef struct
+{
+  guint16 *reduced_buffer;
+  gint width;
+  gint height;
+  gint reduced_width;
+  gint reduced_height;
+} BufferInfo;
+
+static BufferInfo *
+process_buffer (guint16 *buffer,
+                guint width,
+                guint height,
+                guint dimension_factor,
+                guint threshold_begin,
+                guint threshold_end)
+{
+  BufferInfo *buffer_info;
+  gint i, j, reduced_width, reduced_height;
+  guint16 *reduced_buffer;
+
+  g_return_val_if_fail (buffer != NULL, NULL);
+
+  reduced_width = (width - width % dimension_factor) / dimension_factor;
+  reduced_height = (height - height % dimension_factor) / dimension_factor;
+
+  reduced_buffer = g_malloc0 (reduced_width * reduced_height *
+                              sizeof (guint16));
+
+  for (i = 0; i < reduced_width; i++)
+    {
+      for (j = 0; j < reduced_height; j++)
+        {
+          gint index;
+          guint16 value;
+
+          index = j * width * dimension_factor + i * dimension_factor;
+          value = buffer[index];
+
+          if (value < threshold_begin || value > threshold_end)
+            {
+              reduced_buffer[j * reduced_width + i] = 0;
+              continue;
+            }
+
+          reduced_buffer[j * reduced_width + i] = value;
+        }
+    }
+
+  buffer_info = g_slice_new0 (BufferInfo);
+  buffer_info->reduced_buffer = reduced_buffer;
+  buffer_info->reduced_width = reduced_width;
+  buffer_info->reduced_height = reduced_height;
+  buffer_info->width = width;
+  buffer_info->height = height;
+
+  return buffer_info;
+}
+
+static guchar *
+create_grayscale_buffer (BufferInfo *buffer_info, gint dimension_reduction)
+{
+  gint i,j;
+  gint size;
+  guchar *grayscale_buffer;
+  guint16 *reduced_buffer;
+
+  reduced_buffer = buffer_info->reduced_buffer;
+
+  size = buffer_info->width * buffer_info->height * sizeof (guchar);
+  grayscale_buffer = g_malloc (size);
+  /*Paint is white*/
+  memset (grayscale_buffer, 255, size);
+
+  for (i = 0; i < buffer_info->reduced_width; i++)
+    {
+      for (j = 0; j < buffer_info->reduced_height; j++)
+        {
+          if (reduced_buffer[j * buffer_info->reduced_width + i] != 0)
+            {
+              gint index = j * dimension_reduction * buffer_info->width +
+                i * dimension_reduction;
+              grayscale_buffer[index] = 0;
+            }
+        }
+    }
+
+  return grayscale_buffer;
+}
+
+static void
+buffer_info_free (BufferInfo *buffer_info)
+{
+  g_free (buffer_info->reduced_buffer);
+  g_slice_free (BufferInfo, buffer_info);
+}
+
+/* Random depth with many samples right at and next to the threshold
+   ends, and at both ends of the range */
+static guint16 *
+make_depth (guint width, guint height, guint threshold_begin,
+            guint threshold_end)
+{
+  guint16 *depth;
+  gsize i, n_pixels = (gsize) width * height;
+
+  depth = g_new (guint16, n_pixels);
+  for (i = 0; i < n_pixels; i++)
+    {
+      switch (g_test_rand_int_range (0, 8))
+        {
+        case 0:
+          depth[i] = 0;
+          break;
+        case 1:
+          depth[i] = G_MAXUINT16;
+          break;
+        case 2:
+          depth[i] = MIN (threshold_begin, G_MAXUINT16);
+          break;
+        case 3:
+          depth[i] = MIN (threshold_end, G_MAXUINT16);
+          break;
+        case 4:
+          depth[i] = MIN (threshold_begin - 1, G_MAXUINT16);
+          break;
+        case 5:
+          depth[i] = MIN (threshold_end + 1, G_MAXUINT16);
+          break;
+        default:
+          depth[i] = g_test_rand_int_range (0, 5000);
+          break;
+        }
+    }
+
+  return depth;
+}
+
+static gboolean
+check_buffer (const gchar *what, const gchar *description,
+              gconstpointer buffer, gconstpointer expected,
+              gsize n_samples, gsize sample_size)
+{
+  const guint8 *a = buffer, *b = expected;
+  gsize i;
+
+  for (i = 0; i < n_samples; i++)
+    {
+      if (memcmp (a + i * sample_size, b + i * sample_size, sample_size) != 0)
+        {
+          g_printerr ("%s: %s differs at sample %" G_GSIZE_FORMAT "\n",
+                      description, what, i);
+          g_test_fail ();
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+check_case (guint width, guint height, guint dimension_factor,
+            guint threshold_begin, guint threshold_end)
+{
+  BufferInfo *buffer_info;
+  guchar *grayscale_buffer;
+  guint16 *depth, *reduced_buffer;
+  guchar *mask_buffer;
+  gsize n_reduced, n_pixels = (gsize) width * height;
+  gchar *description;
+
+  description = g_strdup_printf ("%ux%u, dimension factor %u, "
+                                 "threshold %u-%u",
+                                 width, height, dimension_factor,
+                                 threshold_begin, threshold_end);
+
+  depth = make_depth (width, height, threshold_begin, threshold_end);
+  buffer_info = process_buffer (depth, width, height, dimension_factor,
+                                threshold_begin, threshold_end);
+  grayscale_buffer = create_grayscale_buffer (buffer_info, dimension_factor);
+  n_reduced = (gsize) buffer_info->reduced_width * buffer_info->reduced_height;
+
+  g_assert_cmpuint (depth_processing_reduce_dimension (width,
+                                                       dimension_factor),
+                    ==, buffer_info->reduced_width);
+  g_assert_cmpuint (depth_processing_reduce_dimension (height,
+                                                       dimension_factor),
+                    ==, buffer_info->reduced_height);
+
+  /* One more sample than needed, to catch writes past the end */
+  reduced_buffer = g_new (guint16, n_reduced + 1);
+  mask_buffer = g_new (guchar, n_pixels + 1);
+
+  reduced_buffer[n_reduced] = 0xabcd;
+  mask_buffer[n_pixels] = 0x42;
+  depth_processing_threshold_mask (depth, width, height, dimension_factor,
+                                   threshold_begin, threshold_end,
+                                   reduced_buffer, mask_buffer);
+  check_buffer ("threshold_mask reduced buffer", description,
+                reduced_buffer, buffer_info->reduced_buffer,
+                n_reduced, sizeof (guint16));
+  check_buffer ("threshold_mask mask", description,
+                mask_buffer, grayscale_buffer, n_pixels, 1);
+  g_assert_cmpuint (reduced_buffer[n_reduced], ==, 0xabcd);
+  g_assert_cmpuint (mask_buffer[n_pixels], ==, 0x42);
+
+  memset (reduced_buffer, 0x55, n_reduced * sizeof (guint16));
+  depth_processing_threshold_reduce (depth, width, height, dimension_factor,
+                                     threshold_begin, threshold_end,
+                                     reduced_buffer);
+  check_buffer ("threshold_reduce reduced buffer", description,
+                reduced_buffer, buffer_info->reduced_buffer,
+                n_reduced, sizeof (guint16));
+  g_assert_cmpuint (reduced_buffer[n_reduced], ==, 0xabcd);
+
+  memset (mask_buffer, 0x55, n_pixels);
+  depth_processing_threshold_mask_rect (depth, width, height,
+                                        dimension_factor,
+                                        threshold_begin, threshold_end,
+                                        0, 0, width, height, mask_buffer);
+  check_buffer ("threshold_mask_rect mask", description,
+                mask_buffer, grayscale_buffer, n_pixels, 1);
+  g_assert_cmpuint (mask_buffer[n_pixels], ==, 0x42);
+
+  g_free (reduced_buffer);
+  g_free (mask_buffer);
+  g_free (grayscale_buffer);
+  buffer_info_free (buffer_info);
+  g_free (depth);
+  g_free (description);
+}
+
+static void
+test_threshold (void)
+{
+  guint i, j, dimension_factor;
+
+  g_test_message ("Implementation: %s",
+                  depth_processing_get_implementation ());
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    for (dimension_factor = 1; dimension_factor <= 4; dimension_factor++)
+      for (j = 0; j < G_N_ELEMENTS (thresholds); j++)
+        check_case (sizes[i][0], sizes[i][1], dimension_factor,
+                    thresholds[j][0], thresholds[j][1]);
+}
+
+static void
+test_simd (gconstpointer data)
+{
+  const gchar *simd_name = data;
+  gchar *argv[] = { test_path, NULL };
+  gchar **envp;
+  gint status;
+  GError *error = NULL;
+
+  envp = g_environ_setenv (g_get_environ (), SIMD_ENV, simd_name, TRUE);
+
+  if (! g_spawn_sync (NULL, argv, envp, 0, NULL, NULL,
+                      NULL, NULL, &status, &error))
+    {
+      g_printerr ("%s: %s\n", simd_name, error->message);
+      g_error_free (error);
+      g_test_fail ();
+    }
+  /* Checked by hand, as g_spawn_check_exit_status() is deprecated
+     since GLib 2.70 and its replacement is not in older ones */
+  else if (! WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      g_printerr ("%s: the checks failed\n", simd_name);
+      g_test_fail ();
+    }
+
+  g_strfreev (envp);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  test_path = argv[0];
+  g_test_init (&argc, &argv, NULL);
+
+  if (g_getenv (SIMD_ENV) != NULL)
+    {
+      g_test_add_func ("/depth-processing/threshold", test_threshold);
+    }
+  else
+    {
+      DepthProcessingSimd simd;
+
+      for (simd = DEPTH_PROCESSING_SIMD_SCALAR;
+           simd < DEPTH_PROCESSING_SIMD_LAST;
+           simd++)
+        {
+          const gchar *simd_name = depth_processing_simd_get_name (simd);
+          gchar *path;
+
+          path = g_strdup_printf ("/depth-processing/threshold/%s",
+                                  simd_name);
+          g_test_add_data_func (path, simd_name, test_simd);
+          g_free (path);
+        }
+    }
+
+  return g_test_run ();
+}
@@ -0,0 +1,304 @@
+/* GFreenect Utils : virtual-device.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "virtual-device.h"
+#include "depth-sequence.h"
+
+/* Stands in for a Kinect by emitting depth and video frames from the
+   main loop, either replayed from a depth recording or directory of
+   shots, looping at the end, or generated. Frames are emitted on a
+   fixed schedule so a slow consumer makes them late rather than
+   slowing the device down, like the real one */
+
+#define DEFAULT_FPS 30.
+
+/* The synthetic scene: a wall with a disc moving in front of it and
+   a band without depth along the left edge, like the Kinect shadow */
+#define WALL_DEPTH     2500
+#define DISC_DEPTH     1000
+#define DISC_RADIUS    100
+#define DISC_SPEED     8
+#define SHADOW_WIDTH   8
+
+struct _VirtualDevice
+{
+  DepthSequence *sequence;
+  gdouble fps;
+
+  VirtualDeviceDepthFunc depth_func;
+  VirtualDeviceVideoFunc video_func;
+  gpointer user_data;
+  guint source_id;
+  gboolean running;
+
+  guint64 n_frames;
+  gint64 start_time;
+  gint64 loop_offset;
+  guint frame;
+
+  guint16 *depth;
+  gsize depth_samples;
+  guchar *video;
+};
+
+VirtualDevice *
+virtual_device_new_synthetic (gdouble fps)
+{
+  VirtualDevice *device;
+
+  device = g_slice_new0 (VirtualDevice);
+  device->fps = fps > 0. ? fps : DEFAULT_FPS;
+  device->depth_samples = VIRTUAL_DEVICE_WIDTH * VIRTUAL_DEVICE_HEIGHT;
+  device->depth = g_new (guint16, device->depth_samples);
+  device->video = g_malloc (VIRTUAL_DEVICE_WIDTH * VIRTUAL_DEVICE_HEIGHT * 3);
+
+  return device;
+}
+
+/* Replays the frames of a recording or directory of shots, at fps or
+   at the rate they were captured if fps is 0 */
+VirtualDevice *
+virtual_device_new_replay (const gchar *path, gdouble fps, GError **error)
+{
+  VirtualDevice *device;
+  DepthSequence *sequence;
+
+  sequence = depth_sequence_open (path, error);
+  if (sequence == NULL)
+    return NULL;
+
+  device = virtual_device_new_synthetic (fps);
+  device->sequence = sequence;
+  device->fps = fps;
+
+  return device;
+}
+
+void
+virtual_device_free (VirtualDevice *device)
+{
+  g_return_if_fail (device != NULL);
+
+  virtual_device_stop (device);
+
+  if (device->sequence != NULL)
+    depth_sequence_free (device->sequence);
+  g_free (device->depth);
+  g_free (device->video);
+  g_slice_free (VirtualDevice, device);
+}
+
+static void
+generate_depth (VirtualDevice *device)
+{
+  gint width = VIRTUAL_DEVICE_WIDTH;
+  gint height = VIRTUAL_DEVICE_HEIGHT;
+  gint range = width + 2 * DISC_RADIUS;
+  gint center_x, center_y;
+  gint i, j;
+
+  center_x = (gint) ((device->n_frames * DISC_SPEED) % range) - DISC_RADIUS;
+  center_y = height / 2;
+
+  for (j = 0; j < height; j++)
+    {
+      guint16 *row = device->depth + (gsize) j * width;
+      gint dy = j - center_y;
+
+      for (i = 0; i < width; i++)
+        {
+          gint dx = i - center_x;
+
+          if (i < SHADOW_WIDTH)
+            row[i] = 0;
+          else if (dx * dx + dy * dy < DISC_RADIUS * DISC_RADIUS)
+            row[i] = DISC_DEPTH + (dx * dx + dy * dy) / DISC_RADIUS;
+          else
+            row[i] = WALL_DEPTH + j;
+        }
+    }
+}
+
+static void
+generate_video (VirtualDevice *device)
+{
+  guint i, j;
+  guchar shift = device->n_frames;
+
+  for (j = 0; j < VIRTUAL_DEVICE_HEIGHT; j++)
+    {
+      guchar *pixel = device->video + (gsize) j * VIRTUAL_DEVICE_WIDTH * 3;
+
+      for (i = 0; i < VIRTUAL_DEVICE_WIDTH; i++, pixel += 3)
+        {
+          pixel[0] = i + shift;
+          pixel[1] = j;
+          pixel[2] = shift;
+        }
+    }
+}
+
+static gboolean
+emit_replayed_depth (VirtualDevice *device)
+{
+  DepthFrameHeader header;
+  const guint16 *depth;
+  GError *error = NULL;
+
+  if (! depth_sequence_get_frame_header (device->sequence, device->frame,
+                                         &header, &error))
+    goto error;
+
+  if ((gsize) header.width * header.height > device->depth_samples)
+    {
+      device->depth_samples = (gsize) header.width * header.height;
+      g_free (device->depth);
+      device->depth = g_new (guint16, device->depth_samples);
+    }
+
+  depth = depth_sequence_get_depth (device->sequence, device->frame, &header,
+                                    device->depth, device->depth_samples,
+                                    &error);
+  if (depth == NULL)
+    goto error;
+
+  device->depth_func (device, depth, header.width, header.height,
+                      device->user_data);
+  depth_sequence_release_frame (device->sequence, device->frame);
+  return TRUE;
+
+ error:
+  g_debug ("ERROR: %s", error->message);
+  g_error_free (error);
+  return FALSE;
+}
+
+/* Returns when the next frame is due, in microseconds since start.
+   Called once per frame, as it accounts for the replay looping */
+static gint64
+get_next_time (VirtualDevice *device)
+{
+  guint n_frames;
+
+  if (device->sequence == NULL || device->fps > 0.)
+    return device->n_frames * G_USEC_PER_SEC / device->fps;
+
+  n_frames = depth_sequence_get_n_frames (device->sequence);
+  if (device->frame == 0 && device->n_frames > 0)
+    device->loop_offset += depth_sequence_get_time (device->sequence,
+                                                    n_frames - 1) +
+      DEPTH_SEQUENCE_DEFAULT_INTERVAL;
+
+  return device->loop_offset +
+    depth_sequence_get_time (device->sequence, device->frame);
+}
+
+static gboolean
+emit_frame (gpointer data);
+
+static void
+schedule_frame (VirtualDevice *device)
+{
+  gint64 delay;
+
+  delay = device->start_time + get_next_time (device) - g_get_monotonic_time ();
+  device->source_id = g_timeout_add (MAX (delay, 0) / 1000, emit_frame, device);
+}
+
+static gboolean
+emit_frame (gpointer data)
+{
+  VirtualDevice *device = data;
+
+  device->source_id = 0;
+
+  if (device->sequence != NULL)
+    {
+      emit_replayed_depth (device);
+      device->frame = (device->frame + 1) %
+        depth_sequence_get_n_frames (device->sequence);
+    }
+  else
+    {
+      generate_depth (device);
+      device->depth_func (device, device->depth,
+                          VIRTUAL_DEVICE_WIDTH, VIRTUAL_DEVICE_HEIGHT,
+                          device->user_data);
+    }
+
+  /* The callbacks may have stopped the device */
+  if (! device->running)
+    return FALSE;
+
+  if (device->video_func != NULL)
+    {
+      generate_video (device);
+      device->video_func (device, device->video,
+                          VIRTUAL_DEVICE_WIDTH, VIRTUAL_DEVICE_HEIGHT,
+                          device->user_data);
+    }
+
+  if (! device->running)
+    return FALSE;
+
+  device->n_frames++;
+  schedule_frame (device);
+
+  return FALSE;
+}
+
+/* Starts emitting frames from the main loop. Replayed depth frames
+   keep the size they were stored with; video frames are always
+   generated, as depth files have no video */
+void
+virtual_device_start (VirtualDevice          *device,
+                      VirtualDeviceDepthFunc  depth_func,
+                      VirtualDeviceVideoFunc  video_func,
+                      gpointer                user_data)
+{
+  g_return_if_fail (device != NULL);
+  g_return_if_fail (depth_func != NULL);
+
+  virtual_device_stop (device);
+
+  device->depth_func = depth_func;
+  device->video_func = video_func;
+  device->user_data = user_data;
+  device->n_frames = 0;
+  device->frame = 0;
+  device->loop_offset = 0;
+  device->start_time = g_get_monotonic_time ();
+  device->running = TRUE;
+
+  schedule_frame (device);
+}
+
+void
+virtual_device_stop (VirtualDevice *device)
+{
+  g_return_if_fail (device != NULL);
+
+  device->running = FALSE;
+  if (device->source_id != 0)
+    {
+      g_source_remove (device->source_id);
+      device->source_id = 0;
+    }
+}
@@ -0,0 +1,57 @@
+/* GFreenect Utils : virtual-device.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIRTUAL_DEVICE_H__
+#define __VIRTUAL_DEVICE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define VIRTUAL_DEVICE_WIDTH  640
+#define VIRTUAL_DEVICE_HEIGHT 480
+
+typedef struct _VirtualDevice VirtualDevice;
+
+/* Frames are only valid during the call */
+typedef void (*VirtualDeviceDepthFunc) (VirtualDevice *device,
+                                        const guint16 *depth,
+                                        guint          width,
+                                        guint          height,
+                                        gpointer       user_data);
+typedef void (*VirtualDeviceVideoFunc) (VirtualDevice *device,
+                                        const guchar  *rgb,
+                                        guint          width,
+                                        guint          height,
+                                        gpointer       user_data);
+
+VirtualDevice *virtual_device_new_replay    (const gchar  *path,
+                                             gdouble       fps,
+                                             GError      **error);
+VirtualDevice *virtual_device_new_synthetic (gdouble fps);
+void           virtual_device_free          (VirtualDevice *device);
+
+void           virtual_device_start         (VirtualDevice          *device,
+                                             VirtualDeviceDepthFunc  depth_func,
+                                             VirtualDeviceVideoFunc  video_func,
+                                             gpointer                user_data);
+void           virtual_device_stop          (VirtualDevice *device);
+
+G_END_DECLS
+
+#endif /* __VIRTUAL_DEVICE_H__ */
@@ -0,0 +1,207 @@
+/* GFreenect Utils : worker-pool.c
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "worker-pool.h"
+
+/* Name of the environment variable that sets the number of threads of
+   the default pool, e.g. 1 to process everything in the caller */
+#define THREADS_ENV "GFREENECT_UTILS_THREADS"
+
+/* Threads of the default pool, the caller's included, as set by the
+   program, or 0 for one per core */
+static guint default_n_threads = 0;
+
+/* The threads are created once and wait in a GThreadPool. A run wakes
+   as many of them as can help and they, together with the caller,
+   take bands from a shared counter until none is left, so the bands
+   are balanced between the threads without a queue entry per band.
+   Threads that only get to run after every band is taken leave right
+   away. Several threads may run work on the same pool at once */
+
+struct _WorkerPool
+{
+  GThreadPool *threads;
+  guint n_threads;
+
+  /* Protect the pending_helpers of every run, so a run never has to
+     tear down a lock a helper may still be releasing */
+  GMutex mutex;
+  GCond cond;
+};
+
+typedef struct
+{
+  WorkerPool *pool;
+  WorkerPoolFunc func;
+  gpointer user_data;
+  guint n_bands;
+  gint next_band;
+  guint pending_helpers;
+} WorkerRun;
+
+static void
+run_bands (WorkerRun *run)
+{
+  guint band;
+
+  while ((band = g_atomic_int_add (&run->next_band, 1)) < run->n_bands)
+    run->func (band, run->user_data);
+}
+
+static void
+helper_func (gpointer data, gpointer user_data)
+{
+  WorkerRun *run = data;
+  WorkerPool *pool = run->pool;
+
+  run_bands (run);
+
+  /* run belongs to the caller and may be gone once this is done */
+  g_mutex_lock (&pool->mutex);
+  if (--run->pending_helpers == 0)
+    g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&pool->mutex);
+}
+
+/* Creates a pool of n_threads threads, besides the ones calling
+   worker_pool_run(). A pool of 0 threads runs all the work in the
+   caller */
+WorkerPool *
+worker_pool_new (guint n_threads)
+{
+  WorkerPool *pool;
+  GError *error = NULL;
+
+  pool = g_slice_new0 (WorkerPool);
+  g_mutex_init (&pool->mutex);
+  g_cond_init (&pool->cond);
+
+  if (n_threads > 0)
+    {
+      pool->threads = g_thread_pool_new (helper_func, NULL, n_threads, TRUE,
+                                         &error);
+      if (pool->threads == NULL)
+        {
+          g_debug ("ERROR: %s", error->message);
+          g_error_free (error);
+          n_threads = 0;
+        }
+    }
+  pool->n_threads = n_threads;
+
+  return pool;
+}
+
+void
+worker_pool_free (WorkerPool *pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  if (pool->threads != NULL)
+    g_thread_pool_free (pool->threads, FALSE, TRUE);
+  g_mutex_clear (&pool->mutex);
+  g_cond_clear (&pool->cond);
+  g_slice_free (WorkerPool, pool);
+}
+
+/* Sets how many threads, the caller's included, the default pool
+   has, for programs that already keep every core busy with threads
+   of their own. THREADS_ENV still overrides it. Only has an effect
+   before the default pool is first used */
+void
+worker_pool_set_default_n_threads (guint n_threads)
+{
+  g_return_if_fail (n_threads > 0);
+
+  default_n_threads = n_threads;
+}
+
+/* Returns a pool shared by the whole program, with a thread for every
+   core but the one of the caller unless set otherwise */
+WorkerPool *
+worker_pool_get_default (void)
+{
+  static WorkerPool *pool = NULL;
+
+  if (g_once_init_enter (&pool))
+    {
+      const gchar *threads_str = g_getenv (THREADS_ENV);
+      gint n_threads = g_get_num_processors ();
+
+      if (default_n_threads > 0)
+        n_threads = default_n_threads;
+
+      if (threads_str != NULL && atoi (threads_str) > 0)
+        n_threads = atoi (threads_str);
+
+      g_once_init_leave (&pool, worker_pool_new (n_threads - 1));
+    }
+
+  return pool;
+}
+
+guint
+worker_pool_get_n_threads (WorkerPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, 0);
+
+  return pool->n_threads;
+}
+
+/* Calls func for every band from 0 to n_bands - 1, spread over the
+   caller and the pool threads, and returns when all are done */
+void
+worker_pool_run (WorkerPool     *pool,
+                 guint           n_bands,
+                 WorkerPoolFunc  func,
+                 gpointer        user_data)
+{
+  WorkerRun run;
+  guint i, n_helpers;
+
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (func != NULL);
+
+  run.pool = pool;
+  run.func = func;
+  run.user_data = user_data;
+  run.n_bands = n_bands;
+  run.next_band = 0;
+  n_helpers = MIN (pool->n_threads, n_bands > 0 ? n_bands - 1 : 0);
+  run.pending_helpers = n_helpers;
+
+  if (n_helpers == 0)
+    {
+      run_bands (&run);
+      return;
+    }
+
+  /* pending_helpers goes down as soon as the first helper is done */
+  for (i = 0; i < n_helpers; i++)
+    g_thread_pool_push (pool->threads, &run, NULL);
+
+  run_bands (&run);
+
+  /* The helpers use run until they are done with it */
+  g_mutex_lock (&pool->mutex);
+  while (run.pending_helpers > 0)
+    g_cond_wait (&pool->cond, &pool->mutex);
+  g_mutex_unlock (&pool->mutex);
+}
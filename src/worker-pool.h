@@ -0,0 +1,46 @@
+/* GFreenect Utils : worker-pool.h
+ *
+ * Copyright (c) 2012 Igalia, S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _WorkerPool WorkerPool;
+
+/* Processes one band of the work, called from any thread */
+typedef void (*WorkerPoolFunc) (guint    band,
+                                gpointer user_data);
+
+WorkerPool *worker_pool_new                   (guint n_threads);
+void        worker_pool_free                  (WorkerPool *pool);
+WorkerPool *worker_pool_get_default           (void);
+void        worker_pool_set_default_n_threads (guint n_threads);
+
+guint       worker_pool_get_n_threads         (WorkerPool *pool);
+
+void        worker_pool_run                   (WorkerPool     *pool,
+                                               guint           n_bands,
+                                               WorkerPoolFunc  func,
+                                               gpointer        user_data);
+
+G_END_DECLS
+
+#endif /* __WORKER_POOL_H__ */